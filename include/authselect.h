@@ -37,6 +37,12 @@ struct authselect_profile;
  */
 struct authselect_files;
 
+/**
+ * Library context that keeps profiles and configuration in memory between
+ * calls. See authselect_ctx_* functions to manipulate this structure.
+ */
+struct authselect_ctx;
+
 /**
  * Authselect profile types.
  */
@@ -60,6 +66,13 @@ enum authselect_profile_type {
  * If the selected profile supports optional features, these features
  * may be enabled by putting them into @features array.
  *
+ * If any configuration file can not be written, the previous content of
+ * all files is restored. The files are replaced one by one, therefore if
+ * the process is killed or the system crashes while they are replaced,
+ * some of them may already have the new content. Such configuration is
+ * reported as modified by @authselect_validate_configuration and it is
+ * fixed by activating the profile again with @force_override.
+ *
  * @param profile_id     Profile identifier.
  * @param features       NULL-terminated array of optional features to enable.
  * @param force_override If true, authselect will override local changes.
@@ -107,6 +120,20 @@ authselect_apply_changes(void);
 int
 authselect_backup(const char *name, char **_path);
 
+/**
+ * Backup all system configuration files into a single compressed archive.
+ * The archive is stored in the backup directory together with other backups
+ * and it can be listed, restored and removed the same way.
+ *
+ * @param name          Backup name. If not specified, current time with random
+ *                      suffix will be used.
+ * @param _path         Path to the backup archive.
+ *
+ * @return EOK on success, other errno code on failure.
+ */
+int
+authselect_backup_archive(const char *name, char **_path);
+
 /**
  * List available backups.
  *
@@ -129,6 +156,35 @@ authselect_backup_list(void);
 int
 authselect_backup_remove(const char *name);
 
+/**
+ * Remove backups that are not retained by the given policy.
+ *
+ * Backups are kept if they are one of @keep_last newest backups, or the
+ * newest backup of one of @keep_daily most recent days or @keep_weekly most
+ * recent weeks that have a backup. If all of these are zero, all backups
+ * are kept. Then, if @max_bytes is not zero, the oldest backups are
+ * removed until the remaining ones take at most @max_bytes of disk space.
+ * Files shared between backups are counted only once. The newest backup is
+ * never removed because of its size.
+ *
+ * @param keep_last     Number of newest backups to keep.
+ * @param keep_daily    Number of days to keep a backup for.
+ * @param keep_weekly   Number of weeks to keep a backup for.
+ * @param max_bytes     Maximum disk space used by backups, 0 for no limit.
+ * @param dry_run       If true, backups are not removed.
+ * @param _removed      NULL-terminated string array that holds names of
+ *                      removed backups, from the oldest.
+ *
+ * @return EOK on success, other errno code on failure.
+ */
+int
+authselect_backup_gc(unsigned int keep_last,
+                     unsigned int keep_daily,
+                     unsigned int keep_weekly,
+                     unsigned long long max_bytes,
+                     bool dry_run,
+                     char ***_removed);
+
 /**
  * Restore configuration from backup.
  *
@@ -238,6 +294,30 @@ int
 authselect_profile(const char *profile_id,
                    struct authselect_profile **_profile);
 
+/**
+ * Return summary information about a profile: its identifier, path, name,
+ * description, requirements and supported features.
+ *
+ * The information is served from the profile index if profile caching
+ * is enabled so the profile files are not read unless they were changed.
+ * Templates are not loaded, therefore @authselect_profile_nsswitch_maps
+ * can not be used with this profile.
+ *
+ * Free the structure with @authselect_profile_free().
+ *
+ * @param profile_id    Profile identifier.
+ * @param _profile      Authselect profile information.
+ *
+ * @return
+ * - 0 if the profile was found, profile information is returned
+ *   in @_profile output variable.
+ * - ENOENT if the profile was not found.
+ * - Other errno code on generic error.
+ */
+int
+authselect_profile_summary(const char *profile_id,
+                           struct authselect_profile **_profile);
+
 /**
  * Get profile identifier.
  *
@@ -348,6 +428,77 @@ authselect_files(const char *profile_id,
                  const char **features,
                  struct authselect_files **_files);
 
+/**
+ * Get nsswitch and PAM configuration from an already loaded profile.
+ *
+ * This is the same as @authselect_files() but the profile is not read
+ * again. The profile must be obtained by @authselect_profile.
+ *
+ * Free the files structure with @authselect_files_free().
+ *
+ * @param profile       Pointer to structure obtained by @authselect_profile.
+ * @param features      NULL-terminated array of optional features to enable.
+ * @param _files        Generated files content.
+ *
+ * @return
+ * - 0 on success, the generated content is returned in @_files output variable.
+ * - EINVAL if the profile does not contain templates.
+ * - Other errno code on generic error.
+ */
+int
+authselect_profile_files(const struct authselect_profile *profile,
+                         const char **features,
+                         struct authselect_files **_files);
+
+/**
+ * Get nsswitch and PAM configuration for multiple sets of features at once.
+ *
+ * This is the same as calling @authselect_files() for each set of features
+ * but the profile is read and parsed only once.
+ *
+ * Free the files array with @authselect_files_batch_free().
+ *
+ * @param profile_id    Profile identifier.
+ * @param features      NULL-terminated array of NULL-terminated arrays of
+ *                      optional features to enable.
+ * @param _files        NULL-terminated array of generated files content, one
+ *                      item for each set of features in the same order.
+ *
+ * @return
+ * - 0 on success, the generated content is returned in @_files output variable.
+ * - ENOENT if the profile was not found.
+ * - Other errno code on generic error.
+ */
+int
+authselect_files_batch(const char *profile_id,
+                       const char ***features,
+                       struct authselect_files ***_files);
+
+/**
+ * Write all distinct variants of files that can be generated by the profile.
+ *
+ * Instead of generating files for each combination of features, only
+ * features that really change the result of template operators are
+ * enumerated, including features implied by other features. Each distinct
+ * content is written once into @dirname under its SHA-256 hash. The file
+ * @dirname/matrix contains one line for each variant of each file with the
+ * file name, hash of the content and features that produce this content.
+ *
+ * nsswitch.conf content is written as it is generated from the profile,
+ * without merging it with user nsswitch configuration.
+ *
+ * @param profile_id    Profile identifier.
+ * @param dirname       Output directory, it is created if it does not exist.
+ *
+ * @return
+ * - 0 on success.
+ * - ENOENT if the profile was not found.
+ * - Other errno code on generic error.
+ */
+int
+authselect_profile_matrix(const char *profile_id,
+                          const char *dirname);
+
 /**
  * Get nsswitch.conf content.
  *
@@ -442,6 +593,20 @@ authselect_files_dconf_lock(const struct authselect_files *files);
 void
 authselect_files_free(struct authselect_files *files);
 
+/**
+ * Free array of authconfig_files structures obtained by
+ * @authselect_files_batch.
+ *
+ * @param files    Array obtained by @authselect_files_batch.
+ */
+void
+authselect_files_batch_free(struct authselect_files **files);
+
+/**
+ * Paths returned by the following functions are prefixed with the root
+ * directory set by @authselect_set_root. They are valid until it changes.
+ */
+
 /**
  * @return Path to system nsswitch.conf file.
  */
@@ -490,6 +655,12 @@ authselect_path_dconf_db();
 const char *
 authselect_path_dconf_lock();
 
+/**
+ * @return Path to directory that contains backups.
+ */
+const char *
+authselect_path_backups();
+
 /**
  * Empty value for initialization.
  */
@@ -563,6 +734,130 @@ authselect_profile_create(const char *name,
                           const char **symlinks,
                           char **_path);
 
+/**
+ * Create library context.
+ *
+ * The context caches profile list, profiles, current configuration and the
+ * result of its validation so repeated calls do not have to read the files
+ * again. Changes of profile and configuration directories are watched with
+ * inotify and only affected entries are read again when they are changed.
+ *
+ * The context must not be used by multiple threads at the same time,
+ * however different contexts can be used by different threads concurrently.
+ * Each context has its own caches and debug function.
+ *
+ * Free the context with @authselect_ctx_free().
+ *
+ * @param[out] _ctx    Library context.
+ *
+ * @return 0 on success, other errno code on generic error.
+ */
+int
+authselect_ctx_create(struct authselect_ctx **_ctx);
+
+/**
+ * Free library context.
+ *
+ * @param ctx          Library context.
+ */
+void
+authselect_ctx_free(struct authselect_ctx *ctx);
+
+/**
+ * Same as @authselect_list() but served from the context cache.
+ *
+ * @param ctx          Library context.
+ */
+char **
+authselect_ctx_list(struct authselect_ctx *ctx);
+
+/**
+ * Same as @authselect_profile() but served from the context cache.
+ *
+ * The returned profile is shared with the context. It must not be used
+ * after the context is freed, however it is not changed when the profile
+ * is read again. Free it with @authselect_profile_free().
+ *
+ * @param ctx          Library context.
+ */
+int
+authselect_ctx_profile(struct authselect_ctx *ctx,
+                       const char *profile_id,
+                       struct authselect_profile **_profile);
+
+/**
+ * Same as @authselect_current_configuration() but served from the context
+ * cache.
+ *
+ * @param ctx          Library context.
+ */
+int
+authselect_ctx_current_configuration(struct authselect_ctx *ctx,
+                                     char **_profile_id,
+                                     char ***_features);
+
+/**
+ * Same as @authselect_validate_configuration() but served from the context
+ * cache.
+ *
+ * @param ctx          Library context.
+ */
+int
+authselect_ctx_validate_configuration(struct authselect_ctx *ctx,
+                                      bool *_is_valid);
+
+/**
+ * Same as @authselect_files() but the profile is served from the context
+ * cache.
+ *
+ * @param ctx          Library context.
+ */
+int
+authselect_ctx_files(struct authselect_ctx *ctx,
+                     const char *profile_id,
+                     const char **features,
+                     struct authselect_files **_files);
+
+/**
+ * Same as @authselect_activate() but using the context cache and settings.
+ *
+ * @param ctx          Library context.
+ */
+int
+authselect_ctx_activate(struct authselect_ctx *ctx,
+                        const char *profile_id,
+                        const char **features,
+                        bool force_overwrite);
+
+/**
+ * Same as @authselect_apply_changes() but using the context cache and
+ * settings.
+ *
+ * @param ctx          Library context.
+ */
+int
+authselect_ctx_apply_changes(struct authselect_ctx *ctx);
+
+/**
+ * Same as @authselect_feature_enable() but using the context cache and
+ * settings.
+ *
+ * @param ctx          Library context.
+ */
+int
+authselect_ctx_feature_enable(struct authselect_ctx *ctx,
+                              const char *feature);
+
+/**
+ * Same as @authselect_feature_disable() but using the context cache and
+ * settings.
+ *
+ * @param ctx          Library context.
+ */
+int
+authselect_ctx_feature_disable(struct authselect_ctx *ctx,
+                               const char *feature);
+
 /**
  * Free NULL-terminated string array.
  */
@@ -600,4 +895,149 @@ typedef void (*authselect_debug_fn)(void *pvt,
  */
 void authselect_set_debug_fn(authselect_debug_fn fn, void *pvt);
 
+/* Set debug function used by calls made with library context.
+ *
+ * It overrides the function set by @authselect_set_debug_fn for calls
+ * made with @ctx, including threads started by these calls. Use NULL to
+ * disable debug messages for this context.
+ *
+ * @param ctx Library context.
+ * @param fn Function to be called on internal events.
+ * @param pvt Caller private data passed to the function.
+ */
+void authselect_ctx_set_debug_fn(struct authselect_ctx *ctx,
+                                 authselect_debug_fn fn,
+                                 void *pvt);
+
+/* Set number of threads used to generate configuration files.
+ *
+ * Configuration files are generated serially by default. If @threads is
+ * greater than one, independent files are generated concurrently by up to
+ * @threads threads. The generated content is the same in both cases.
+ *
+ * It applies to calls made without library context and to contexts that
+ * do not set their own number with @authselect_ctx_set_threads.
+ *
+ * @param threads Number of threads, 0 or 1 to generate files serially.
+ */
+void authselect_set_threads(unsigned int threads);
+
+/* Set number of threads used to generate configuration files by calls made
+ * with library context.
+ *
+ * It overrides the number set by @authselect_set_threads for calls made
+ * with @ctx. Worker threads are started by the first call that needs them
+ * and they are reused by the following calls until the context is freed.
+ *
+ * @param ctx Library context.
+ * @param threads Number of threads, 0 or 1 to generate files serially.
+ */
+void authselect_ctx_set_threads(struct authselect_ctx *ctx,
+                                unsigned int threads);
+
+/* Update dconf database in background.
+ *
+ * Dconf database is updated when the configuration files are written and
+ * the calling function waits until it is finished by default. If @async
+ * is true, the update is only started and the function returns as soon as
+ * all configuration files are written. Use @authselect_dconf_wait() to
+ * obtain the result of the update.
+ *
+ * It applies to calls made without library context and to contexts that
+ * do not set their own mode with @authselect_ctx_set_dconf_async. Updates
+ * started with a context are tracked by the context.
+ *
+ * @param async True to update dconf database in background.
+ */
+void authselect_set_dconf_async(bool async);
+
+/* Wait until dconf database update that runs in background is finished.
+ *
+ * If more updates were started since the last call, the error of the
+ * first one that failed is returned.
+ *
+ * @return
+ * - 0 if no update failed since the last call.
+ * - ETIMEDOUT if the update did not finish in time.
+ * - Other errno code if the update failed.
+ */
+int authselect_dconf_wait(void);
+
+/* Update dconf database in background for calls made with library context.
+ *
+ * It overrides the mode set by @authselect_set_dconf_async for calls made
+ * with @ctx. Result of updates started by these calls is obtained with
+ * @authselect_ctx_dconf_wait. Freeing the context waits until the update
+ * is finished.
+ *
+ * @param ctx Library context.
+ * @param async True to update dconf database in background.
+ */
+void authselect_ctx_set_dconf_async(struct authselect_ctx *ctx, bool async);
+
+/* Wait until dconf database update started in background by a call made
+ * with library context is finished.
+ *
+ * @see authselect_dconf_wait
+ *
+ * @param ctx Library context.
+ *
+ * @return Same as @authselect_dconf_wait.
+ */
+int authselect_ctx_dconf_wait(struct authselect_ctx *ctx);
+
+/* Serve queries by authselectd if it is running.
+ *
+ * If enabled, @authselect_list(), @authselect_profile_summary(),
+ * @authselect_current_configuration(), @authselect_validate_configuration()
+ * and @authselect_files() are answered by authselectd from its memory
+ * instead of reading the files. If the daemon is not running, the library
+ * reads the files itself. The daemon is not used by default.
+ *
+ * The daemon serves only root and the user it runs as, other users
+ * always read the files themselves. Calls made with library context are
+ * never answered by the daemon since the context has its own cache.
+ *
+ * @param use_daemon True to use authselectd.
+ */
+void authselect_set_daemon(bool use_daemon);
+
+/* Use alternate root directory.
+ *
+ * All configuration, state, PAM, nsswitch, dconf, backup and profile paths
+ * are prefixed with @root, so the configuration can be activated and
+ * validated within an unpacked system image without chroot. Symbolic links
+ * still point to paths within the root directory. Dconf database is not
+ * updated and authselectd is not used when the root directory is set.
+ *
+ * It applies to all calls that are not made with a context that has its
+ * own root directory and it should be called before any context is
+ * created. Use @authselect_ctx_set_root() to work with multiple root
+ * directories concurrently.
+ *
+ * @param root Path to the root directory or NULL to use the system root.
+ *
+ * @return
+ * - 0 on success.
+ * - ENOENT if the directory does not exist.
+ * - ENOTDIR if the path is not a directory.
+ * - Other errno code on generic error.
+ */
+int authselect_set_root(const char *root);
+
+/* Use alternate root directory for calls made with library context.
+ *
+ * It overrides the root directory set by @authselect_set_root for calls
+ * made with @ctx. Cached state of the context is dropped.
+ *
+ * @see authselect_set_root
+ *
+ * @param ctx Library context.
+ * @param root Path to the root directory or NULL to use the root directory
+ *             set by @authselect_set_root.
+ *
+ * @return 0 on success, other errno code on error.
+ */
+int authselect_ctx_set_root(struct authselect_ctx *ctx, const char *root);
+
 #endif /* _AUTHSELECT_H_ */
@@ -41,3 +41,29 @@ AC_DEFUN([REQUIRE_SELINUX],
   AC_SUBST(SELINUX_LIBS)
 ])
 
+
+AC_DEFUN([REQUIRE_PTHREAD],
+[
+  AC_CHECK_HEADERS(pthread.h,
+    [AC_CHECK_LIB(pthread, pthread_mutex_lock,
+      [PTHREAD_LIBS="-lpthread"],
+      [AC_MSG_ERROR([pthread library is missing])]
+    )],
+    [AC_MSG_ERROR([pthread headers are missing])]
+  )
+  AC_SUBST(PTHREAD_LIBS)
+])
+
+dnl Require zlib library and store ld and c flags in ZLIB_LIBS and ZLIB_CFLAGS.
+AC_DEFUN([REQUIRE_ZLIB], [
+    AC_SUBST(ZLIB_LIBS)
+    AC_SUBST(ZLIB_CFLAGS)
+
+    PKG_CHECK_MODULES([ZLIB], [zlib], [found_zlib=yes], [found_zlib=no])
+
+    AS_IF([test x"$found_zlib" != xyes], [AC_CHECK_HEADERS([zlib.h],
+        [AC_CHECK_LIB([z], [gzdopen], [ZLIB_LIBS="-lz"],
+            AC_MSG_ERROR([zlib library must support gzdopen]))],
+        [AC_MSG_ERROR([zlib header files are not installed])]
+    )])
+])
@@ -102,17 +102,21 @@ _authselect_completions()
         if [[ "${COMP_WORDS[$COMP_CWORD]}" =~ ^- ]] ; then
             case "$command" in
                 select)
-                    echo "--force --quiet --nobackup --backup="
+                    echo "--force --quiet --nobackup --backup= --archive"
                     ;;
                 apply-changes|disable-feature)
-                    echo "--backup="
+                    echo "--backup= --archive"
                     ;;
                 enable-feature)
-                    echo "--backup= --quiet"
+                    echo "--backup= --archive --quiet"
                     ;;
                 current|backup-list)
                     echo "--raw"
                     ;;
+                backup-gc)
+                    echo "--keep-last= --keep-daily= --keep-weekly=" \
+                         "--max-size= --dry-run --quiet"
+                    ;;
                 create-profile)
                     echo "--vendor --base-on= --base-on-default" \
                          "--symlink-meta --symlink-nsswitch --symlink-pam" \
@@ -121,7 +125,7 @@ _authselect_completions()
                 test)
                     echo "--all --nsswitch --system-auth --password-auth" \
                          "--smartcard-auth --fingerprint-auth --postlogin" \
-                         "--dconf-db --dconf-lock"
+                         "--dconf-db --dconf-lock --batch= --matrix="
                     ;;
             esac
         fi
@@ -191,7 +195,7 @@ _authselect_completions()
 
     COMMANDS=(select apply-changes list list-features show requirements current
               check test enable-feature disable-feature create-profile
-              backup-list backup-remove backup-restore)
+              backup-list backup-remove backup-restore backup-gc)
 
     possibleopts="$(get_option_params)"
     if [[ "$possibleopts" != "" ]]; then
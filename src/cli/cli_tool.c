@@ -76,6 +76,8 @@ static void cli_tool_print_common_opts(int min_len)
                     _("Print trace messages"));
     fprintf(stderr, "  %-*s\t %s\n", min_len, "--warn",
                     _("Print warning messages"));
+    fprintf(stderr, "  %-*s\t %s\n", min_len, "--root=DIR",
+                    _("Use alternate root directory"));
     fprintf(stderr, "\n");
     fprintf(stderr, _("Help options:\n"));
     fprintf(stderr, "  %-*s\t %s\n", min_len, "-?, --help",
@@ -90,17 +92,20 @@ static struct poptOption *cli_tool_common_opts_table(void)
         {"debug", '\0', POPT_ARG_NONE | POPT_ARGFLAG_STRIP, NULL, 'd', "Print more verbose debugging information", NULL },
         {"trace", '\0', POPT_ARG_NONE | POPT_ARGFLAG_STRIP, NULL, 't', "Print trace messages", NULL },
         {"warn", '\0', POPT_ARG_NONE | POPT_ARGFLAG_STRIP, NULL, 'w', "Print warning messages", NULL },
+        {"root", '\0', POPT_ARG_STRING | POPT_ARGFLAG_STRIP, NULL, 'r', "Use alternate root directory", "DIR" },
         POPT_TABLEEND
     };
 
     return options;
 }
 
-static void cli_tool_common_opts(int *argc, const char **argv)
+static errno_t cli_tool_common_opts(int *argc, const char **argv)
 {
     poptContext pc;
     struct poptOption *options;
     int orig_argc = *argc;
+    char *root = NULL;
+    errno_t ret;
     int opt;
 
     options = cli_tool_common_opts_table();
@@ -117,6 +122,10 @@ static void cli_tool_common_opts(int *argc, const char **argv)
         case 'w':
             enable_warning = true;
             break;
+        case 'r':
+            free(root);
+            root = poptGetOptArg(pc);
+            break;
         default:
             break;
         }
@@ -125,11 +134,23 @@ static void cli_tool_common_opts(int *argc, const char **argv)
     set_debug_fn(print_debug, NULL);
     authselect_set_debug_fn(print_debug, NULL);
 
+    ret = EOK;
+    if (root != NULL) {
+        ret = authselect_set_root(root);
+        if (ret != EOK) {
+            ERROR("Unable to use root directory [%s] [%d]: %s",
+                  root, ret, strerror(ret));
+        }
+        free(root);
+    }
+
     /* Strip common options from arguments. We will discard_const here,
      * since it is not worth the trouble to convert it back and forth. */
     *argc = poptStrippedArgv(pc, orig_argc, (char **)argv);
 
     poptFreeContext(pc);
+
+    return ret;
 }
 
 static bool cli_tool_is_delimiter(struct cli_route_cmd *command)
@@ -422,7 +443,10 @@ int cli_tool_main(int argc, const char **argv,
 {
     errno_t ret;
 
-    cli_tool_common_opts(&argc, argv);
+    ret = cli_tool_common_opts(&argc, argv);
+    if (ret != EOK) {
+        return 1;
+    }
 
     ret = cli_tool_route(argc, argv, commands);
 
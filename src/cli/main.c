@@ -20,6 +20,7 @@
 
 #include <time.h>
 #include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -84,8 +85,11 @@ parse_profile_options(struct cli_cmdline *cmdline,
     profile_skipped = false;
     for (i = 0, j = 0; i < cmdline->argc; i++) {
         /* Skip options. */
-        if (strcmp(cmdline->argv[i], "--backup") == 0) {
-            /* Skip also the next parameter which is the backup name. */
+        if (strcmp(cmdline->argv[i], "--backup") == 0
+                || strcmp(cmdline->argv[i], "--batch") == 0
+                || strcmp(cmdline->argv[i], "--matrix") == 0) {
+            /* Skip also the next parameter which is the backup, batch file
+             * or matrix directory name. */
             i++;
             continue;
         }
@@ -116,7 +120,8 @@ parse_profile_options(struct cli_cmdline *cmdline,
 static errno_t
 perform_backup(int quiet,
                int backup,
-               const char *backup_name)
+               const char *backup_name,
+               int archive)
 {
     char *backup_path;
     errno_t ret;
@@ -125,7 +130,12 @@ perform_backup(int quiet,
         return EOK;
     }
 
-    ret = authselect_backup(backup_name, &backup_path);
+    if (archive) {
+        ret = authselect_backup_archive(backup_name, &backup_path);
+    } else {
+        ret = authselect_backup(backup_name, &backup_path);
+    }
+
     if (ret != EOK) {
         CLI_ERROR("Unable to backup current configuration!\n");
         return ret;
@@ -147,6 +157,7 @@ static errno_t activate(struct cli_cmdline *cmdline)
     char **maps = NULL;
     int backup = 0;
     int nobackup = 0;
+    int archive = 0;
     int enforce = 0;
     int quiet = 0;
     errno_t ret;
@@ -156,6 +167,7 @@ static errno_t activate(struct cli_cmdline *cmdline)
         {"force", 'f', POPT_ARG_VAL, &enforce, 1, _("Enforce changes"), NULL },
         {NULL, 'b', POPT_ARG_VAL, &backup, 1, _("Backup system files before activating profile (generate unique name)"), NULL },
         {"backup", '\0', POPT_ARG_STRING | POPT_ARG_NONE, &backup_name, 0, _("Backup system files before activating profile"), _("NAME") },
+        {"archive", '\0', POPT_ARG_VAL, &archive, 1, _("Store the backup in a single compressed archive"), NULL },
         {"nobackup", '\0', POPT_ARG_VAL, &nobackup, 1, _("Do not backup system files when --force is set"), NULL },
         {"quiet", 'q', POPT_ARG_VAL, &quiet, 1, _("Do not print profile requirements"), NULL },
         POPT_TABLEEND
@@ -189,7 +201,7 @@ static errno_t activate(struct cli_cmdline *cmdline)
     }
 
     if (backup || backup_name != NULL || (enforce && !nobackup)) {
-        ret = perform_backup(quiet, backup, backup_name);
+        ret = perform_backup(quiet, backup, backup_name, archive);
         if (ret != EOK) {
             goto done;
         }
@@ -237,12 +249,14 @@ done:
 static errno_t apply_changes(struct cli_cmdline *cmdline)
 {
     char *backup_name = NULL;
+    int archive = 0;
     int backup = 0;
     errno_t ret;
 
     struct poptOption options[] = {
         {NULL, 'b', POPT_ARG_VAL, &backup, 1, _("Backup system files before activating profile (generate unique name)"), NULL },
         {"backup", '\0', POPT_ARG_STRING | POPT_ARG_NONE, &backup_name, 0, _("Backup system files before activating profile"), _("NAME") },
+        {"archive", '\0', POPT_ARG_VAL, &archive, 1, _("Store the backup in a single compressed archive"), NULL },
         POPT_TABLEEND
     };
 
@@ -252,7 +266,7 @@ static errno_t apply_changes(struct cli_cmdline *cmdline)
         return ret;
     }
 
-    ret = perform_backup(false, backup, backup_name);
+    ret = perform_backup(false, backup, backup_name, archive);
     if (ret != EOK) {
         return ret;
     }
@@ -397,7 +411,7 @@ static errno_t list(struct cli_cmdline *cmdline)
     maxlen = list_max_length(profiles);
 
     for (i = 0; profiles[i] != NULL; i++) {
-        ret = authselect_profile(profiles[i], &profile);
+        ret = authselect_profile_summary(profiles[i], &profile);
         if (ret != EOK) {
             ERROR("Unable to get profile information [%d]: %s",
                   ret, strerror(ret));
@@ -433,7 +447,7 @@ static errno_t list_features(struct cli_cmdline *cmdline)
         return ret;
     }
 
-    ret = authselect_profile(profile_id, &profile);
+    ret = authselect_profile_summary(profile_id, &profile);
     if (ret != EOK) {
         ERROR("Unable to get profile information [%d]: %s",
               ret, strerror(ret));
@@ -525,13 +539,204 @@ done:
     return ret;
 }
 
+struct test_file {
+    const char * (*content_fn)(const struct authselect_files *);
+    const char * (*path_fn)(void);
+    int *enabled;
+};
+
+static void
+test_print_files(struct test_file *generated,
+                 int print_all,
+                 const struct authselect_files *files)
+{
+    const char *content;
+    const char *path;
+    int i;
+
+    for (i = 0; generated[i].content_fn != NULL; i++) {
+        if (!print_all && *generated[i].enabled == 0) {
+            continue;
+        }
+
+        path = generated[i].path_fn();
+        content = generated[i].content_fn(files);
+
+        if (content == NULL) {
+            CLI_PRINT("File %s: Empty\n\n", path);
+        } else {
+            CLI_PRINT("File %s:\n%s\n\n", path, content);
+        }
+    }
+}
+
+struct test_batch {
+    /* Read lines, features point into them. */
+    char **lines;
+
+    /* NULL-terminated array of sets of features. */
+    const char ***sets;
+    size_t count;
+};
+
+static void
+test_batch_free(struct test_batch *batch)
+{
+    size_t i;
+
+    for (i = 0; i < batch->count; i++) {
+        free(batch->lines[i]);
+        free(batch->sets[i]);
+    }
+
+    free(batch->lines);
+    free(batch->sets);
+}
+
+static errno_t
+test_batch_add(struct test_batch *batch,
+               char *line)
+{
+    const char ***sets;
+    const char **set;
+    char **lines;
+    char *saveptr;
+    char *feature;
+    int i;
+
+    lines = realloc_array(batch->lines, char *, batch->count + 1);
+    if (lines == NULL) {
+        return ENOMEM;
+    }
+    batch->lines = lines;
+
+    sets = realloc_array(batch->sets, const char **, batch->count + 2);
+    if (sets == NULL) {
+        return ENOMEM;
+    }
+    batch->sets = sets;
+
+    /* There can not be more features than half of the line length. */
+    set = malloc_zero_array(const char *, strlen(line) / 2 + 2);
+    if (set == NULL) {
+        return ENOMEM;
+    }
+
+    i = 0;
+    for (feature = strtok_r(line, " \t\n", &saveptr);
+         feature != NULL;
+         feature = strtok_r(NULL, " \t\n", &saveptr)) {
+        set[i++] = feature;
+    }
+
+    batch->lines[batch->count] = line;
+    batch->sets[batch->count] = set;
+    batch->count++;
+    batch->sets[batch->count] = NULL;
+
+    return EOK;
+}
+
+/* Read sets of features from a file. Each line contains one set of
+ * features separated by white space, lines starting with # are ignored. */
+static errno_t
+test_batch_read(const char *path,
+                struct test_batch *batch)
+{
+    char *line = NULL;
+    size_t linesize = 0;
+    errno_t ret;
+    FILE *file;
+
+    file = fopen(path, "r");
+    if (file == NULL) {
+        ret = errno;
+        ERROR("Unable to open [%s] [%d]: %s", path, ret, strerror(ret));
+        return ret;
+    }
+
+    batch->sets = malloc_zero_array(const char **, 1);
+    if (batch->sets == NULL) {
+        ret = ENOMEM;
+        goto done;
+    }
+
+    while (getline(&line, &linesize, file) != -1) {
+        if (line[0] == '#') {
+            continue;
+        }
+
+        ret = test_batch_add(batch, line);
+        if (ret != EOK) {
+            goto done;
+        }
+
+        line = NULL;
+        linesize = 0;
+    }
+
+    if (ferror(file)) {
+        ERROR("Unable to read [%s]", path);
+        ret = EIO;
+        goto done;
+    }
+
+    ret = EOK;
+
+done:
+    free(line);
+    fclose(file);
+
+    return ret;
+}
+
+static errno_t test_batch(const char *profile_id,
+                          const char *batch_file,
+                          struct test_file *generated,
+                          int print_all)
+{
+    struct authselect_files **files = NULL;
+    struct test_batch batch = {0};
+    errno_t ret;
+    int i, j;
+
+    ret = test_batch_read(batch_file, &batch);
+    if (ret != EOK) {
+        goto done;
+    }
+
+    ret = authselect_files_batch(profile_id, batch.sets, &files);
+    if (ret != EOK) {
+        ERROR("Unable to get generated content [%d]: %s", ret, strerror(ret));
+        goto done;
+    }
+
+    for (i = 0; files[i] != NULL; i++) {
+        CLI_PRINT("Features:");
+        for (j = 0; batch.sets[i][j] != NULL; j++) {
+            printf(" %s", batch.sets[i][j]);
+        }
+        printf("\n\n");
+
+        test_print_files(generated, print_all, files[i]);
+    }
+
+    ret = EOK;
+
+done:
+    authselect_files_batch_free(files);
+    test_batch_free(&batch);
+
+    return ret;
+}
+
 static errno_t test(struct cli_cmdline *cmdline)
 {
     struct authselect_files *files;
     const char *profile_id;
     const char **features;
-    const char *content;
-    const char *path;
+    char *batch_file = NULL;
+    char *matrix_dir = NULL;
     int print_all = 1;
     int print_nsswitch = 0;
     int print_systemauth = 0;
@@ -554,14 +759,12 @@ static errno_t test(struct cli_cmdline *cmdline)
         {"postlogin", 'o', POPT_ARG_VAL, &print_postlogin, 1, _("Print postlogin content"), NULL },
         {"dconf-db", 'd', POPT_ARG_VAL, &print_dconfdb, 1, _("Print dconf database content"), NULL },
         {"dconf-lock", 'l', POPT_ARG_VAL, &print_dconflock, 1, _("Print dconf lock content"), NULL },
+        {"batch", '\0', POPT_ARG_STRING, &batch_file, 0, _("Read sets of features from file, one set per line"), _("FILE") },
+        {"matrix", '\0', POPT_ARG_STRING, &matrix_dir, 0, _("Write all distinct variants of generated files into directory"), _("DIR") },
         POPT_TABLEEND
         };
 
-    struct {
-        const char * (*content_fn)(const struct authselect_files *);
-        const char * (*path_fn)(void);
-        int *enabled;
-    } generated[] = {
+    struct test_file generated[] = {
         {authselect_files_nsswitch, authselect_path_nsswitch, &print_nsswitch},
         {authselect_files_systemauth, authselect_path_systemauth, &print_systemauth},
         {authselect_files_passwordauth, authselect_path_passwordauth, &print_passwordauth},
@@ -578,33 +781,44 @@ static errno_t test(struct cli_cmdline *cmdline)
         return ret;
     }
 
-    ret = authselect_files(profile_id, features, &files);
-    if (ret != EOK) {
-        ERROR("Unable to get generated content [%d]: %s", ret, strerror(ret));
-        return ret;
-    }
-
     for (i = 0; generated[i].content_fn != NULL; i++) {
         if (*generated[i].enabled == 1) {
             print_all = 0;
         }
     }
 
-    for (i = 0; generated[i].content_fn != NULL; i++) {
-        if (!print_all && *generated[i].enabled == 0) {
-            continue;
+    if (matrix_dir != NULL) {
+        if (features[0] != NULL || batch_file != NULL) {
+            ERROR("Features can not be combined with --matrix");
+            return EINVAL;
         }
 
-        path = generated[i].path_fn();
-        content = generated[i].content_fn(files);
+        ret = authselect_profile_matrix(profile_id, matrix_dir);
+        if (ret != EOK) {
+            ERROR("Unable to write variants [%d]: %s", ret, strerror(ret));
+            return ret;
+        }
 
-        if (content == NULL) {
-            CLI_PRINT("File %s: Empty\n\n", path);
-        } else {
-            CLI_PRINT("File %s:\n%s\n\n", path, content);
+        return EOK;
+    }
+
+    if (batch_file != NULL) {
+        if (features[0] != NULL) {
+            ERROR("Features can not be combined with --batch");
+            return EINVAL;
         }
+
+        return test_batch(profile_id, batch_file, generated, print_all);
+    }
+
+    ret = authselect_files(profile_id, features, &files);
+    if (ret != EOK) {
+        ERROR("Unable to get generated content [%d]: %s", ret, strerror(ret));
+        return ret;
     }
 
+    test_print_files(generated, print_all, files);
+
     return EOK;
 }
 
@@ -616,6 +830,7 @@ static errno_t enable(struct cli_cmdline *cmdline)
     char *profile_id = NULL;
     const char *feature;
     const char *features[2];
+    int archive = 0;
     int backup = 0;
     int quiet = 0;
     errno_t ret;
@@ -623,6 +838,7 @@ static errno_t enable(struct cli_cmdline *cmdline)
     struct poptOption options[] = {
         {NULL, 'b', POPT_ARG_VAL, &backup, 1, _("Backup system files before activating profile (generate unique name)"), NULL },
         {"backup", '\0', POPT_ARG_STRING | POPT_ARG_NONE, &backup_name, 0, _("Backup system files before activating profile"), _("NAME") },
+        {"archive", '\0', POPT_ARG_VAL, &archive, 1, _("Store the backup in a single compressed archive"), NULL },
         {"quiet", 'q', POPT_ARG_VAL, &quiet, 1, _("Do not print profile requirements"), NULL },
         POPT_TABLEEND
     };
@@ -663,7 +879,7 @@ static errno_t enable(struct cli_cmdline *cmdline)
         goto done;
     }
 
-    ret = perform_backup(quiet, backup, backup_name);
+    ret = perform_backup(quiet, backup, backup_name, archive);
     if (ret != EOK) {
         CLI_ERROR("Unable to backup current configuration [%d]: %s\n",
                   ret, strerror(ret));
@@ -692,6 +908,7 @@ done:
 
 static errno_t disable(struct cli_cmdline *cmdline)
 {
+    int archive = 0;
     int backup = 0;
     char *backup_name = NULL;
     const char *feature;
@@ -700,6 +917,7 @@ static errno_t disable(struct cli_cmdline *cmdline)
     struct poptOption options[] = {
         {NULL, 'b', POPT_ARG_VAL, &backup, 1, _("Backup system files before activating profile (generate unique name)"), NULL },
         {"backup", '\0', POPT_ARG_STRING | POPT_ARG_NONE, &backup_name, 0, _("Backup system files before activating profile"), _("NAME") },
+        {"archive", '\0', POPT_ARG_VAL, &archive, 1, _("Store the backup in a single compressed archive"), NULL },
         POPT_TABLEEND
     };
 
@@ -711,7 +929,7 @@ static errno_t disable(struct cli_cmdline *cmdline)
         return ret;
     }
 
-    ret = perform_backup(false, backup, backup_name);
+    ret = perform_backup(false, backup, backup_name, archive);
     if (ret != EOK) {
         return ret;
     }
@@ -813,7 +1031,7 @@ static errno_t backup_list(struct cli_cmdline *cmdline)
         }
 
         for (i = 0; names[i] != NULL; i++) {
-            path = format("%s/%s", AUTHSELECT_BACKUP_DIR, names[i]);
+            path = format("%s/%s", authselect_path_backups(), names[i]);
             if (path == NULL) {
                 ERROR("Out of memory!");
                 ret = ENOMEM;
@@ -869,6 +1087,125 @@ static errno_t backup_remove(struct cli_cmdline *cmdline)
     return EOK;
 }
 
+static errno_t
+parse_size(const char *str, unsigned long long *_size)
+{
+    unsigned long long multiplier;
+    unsigned long long size;
+    char *end;
+
+    errno = 0;
+    size = strtoull(str, &end, 10);
+    if (errno == ERANGE) {
+        return ERANGE;
+    } else if (errno != 0 || end == str || str[0] == '-') {
+        return EINVAL;
+    }
+
+    switch (*end) {
+    case '\0':
+        multiplier = 1;
+        break;
+    case 'K':
+        multiplier = 1024ULL;
+        end++;
+        break;
+    case 'M':
+        multiplier = 1024ULL * 1024;
+        end++;
+        break;
+    case 'G':
+        multiplier = 1024ULL * 1024 * 1024;
+        end++;
+        break;
+    default:
+        return EINVAL;
+    }
+
+    if (*end != '\0') {
+        return EINVAL;
+    }
+
+    /* Wrapped size would remove backups that were meant to be kept. */
+    if (size > ULLONG_MAX / multiplier) {
+        return ERANGE;
+    }
+
+    *_size = size * multiplier;
+
+    return EOK;
+}
+
+static errno_t backup_gc(struct cli_cmdline *cmdline)
+{
+    unsigned long long max_bytes = 0;
+    char *max_size = NULL;
+    char **removed = NULL;
+    int keep_weekly = 0;
+    int keep_daily = 0;
+    int keep_last = 0;
+    int dry_run = 0;
+    int quiet = 0;
+    errno_t ret;
+    int i;
+
+    struct poptOption options[] = {
+        {"keep-last", '\0', POPT_ARG_INT, &keep_last, 0, _("Keep N newest backups"), _("N") },
+        {"keep-daily", '\0', POPT_ARG_INT, &keep_daily, 0, _("Keep the newest backup of each of N most recent days"), _("N") },
+        {"keep-weekly", '\0', POPT_ARG_INT, &keep_weekly, 0, _("Keep the newest backup of each of N most recent weeks"), _("N") },
+        {"max-size", '\0', POPT_ARG_STRING, &max_size, 0, _("Remove the oldest backups until all take at most SIZE bytes (K, M and G suffixes are accepted)"), _("SIZE") },
+        {"dry-run", 'n', POPT_ARG_VAL, &dry_run, 1, _("Only print backups that would be removed"), NULL },
+        {"quiet", 'q', POPT_ARG_VAL, &quiet, 1, _("Do not print removed backups"), NULL },
+        POPT_TABLEEND
+    };
+
+    ret = cli_tool_popt(cmdline, options, CLI_TOOL_OPT_OPTIONAL, NULL, NULL);
+    if (ret != EOK) {
+        ERROR("Unable to parse command arguments");
+        return ret;
+    }
+
+    if (keep_last < 0 || keep_daily < 0 || keep_weekly < 0) {
+        CLI_ERROR("Number of backups to keep can not be negative!\n");
+        ret = EINVAL;
+        goto done;
+    }
+
+    if (max_size != NULL) {
+        ret = parse_size(max_size, &max_bytes);
+        if (ret == ERANGE) {
+            CLI_ERROR("Size [%s] is too large!\n", max_size);
+            goto done;
+        } else if (ret != EOK) {
+            CLI_ERROR("Invalid size [%s]!\n", max_size);
+            goto done;
+        }
+    }
+
+    ret = authselect_backup_gc(keep_last, keep_daily, keep_weekly,
+                               max_bytes, dry_run, &removed);
+    if (ret != EOK) {
+        CLI_ERROR("Unable to remove old backups [%d]: %s\n",
+                  ret, strerror(ret));
+        goto done;
+    }
+
+    for (i = 0; removed[i] != NULL; i++) {
+        if (dry_run) {
+            CLI_PRINT("Would remove backup %s\n", removed[i]);
+        } else {
+            CLI_MSG(quiet, "Removed backup %s\n", removed[i]);
+        }
+    }
+
+    ret = EOK;
+
+done:
+    authselect_array_free(removed);
+
+    return ret;
+}
+
 static errno_t backup_restore(struct cli_cmdline *cmdline)
 {
     const char *name;
@@ -936,6 +1273,7 @@ int main(int argc, const char **argv)
         CLI_TOOL_COMMAND("backup-list", "List available backups", CLI_CMD_NONE, backup_list),
         CLI_TOOL_COMMAND("backup-remove", "Remove backup", CLI_CMD_REQUIRE_ROOT, backup_remove),
         CLI_TOOL_COMMAND("backup-restore", "Restore from backup", CLI_CMD_REQUIRE_ROOT, backup_restore),
+        CLI_TOOL_COMMAND("backup-gc", "Remove backups according to retention policy", CLI_CMD_REQUIRE_ROOT, backup_gc),
         CLI_TOOL_LAST
     };
 
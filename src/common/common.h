@@ -25,6 +25,7 @@
 
 #include <stdlib.h>
 #include <stdarg.h>
+#include <stdbool.h>
 
 #include "errno_t.h"
 #include "gettext.h"
@@ -53,6 +54,10 @@
 
 void set_debug_fn(authselect_debug_fn fn, void *pvt);
 
+/* Override debug function in the calling thread. If @enabled is false,
+ * the function set by set_debug_fn() is used again. */
+void set_thread_debug_fn(bool enabled, authselect_debug_fn fn, void *pvt);
+
 void debug(enum authselect_debug level,
            const char *file,
            unsigned long line,
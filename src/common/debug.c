@@ -28,12 +28,23 @@
 authselect_debug_fn debug_fn;
 void *debug_fn_pvt;
 
+static __thread bool debug_fn_thread_enabled;
+static __thread authselect_debug_fn debug_fn_thread;
+static __thread void *debug_fn_thread_pvt;
+
 void set_debug_fn(authselect_debug_fn fn, void *pvt)
 {
     debug_fn = fn;
     debug_fn_pvt = pvt;
 }
 
+void set_thread_debug_fn(bool enabled, authselect_debug_fn fn, void *pvt)
+{
+    debug_fn_thread_enabled = enabled;
+    debug_fn_thread = fn;
+    debug_fn_thread_pvt = pvt;
+}
+
 void debug(enum authselect_debug level,
            const char *file,
            unsigned long line,
@@ -41,19 +52,31 @@ void debug(enum authselect_debug level,
            const char *fmt,
            ...)
 {
+    authselect_debug_fn fn = debug_fn;
+    void *pvt = debug_fn_pvt;
     va_list va;
     char *msg;
 
+    if (debug_fn_thread_enabled) {
+        fn = debug_fn_thread;
+        pvt = debug_fn_thread_pvt;
+    }
+
+    /* Debug messages are disabled. */
+    if (fn == NULL) {
+        return;
+    }
+
     va_start(va, fmt);
     msg = vaformat(fmt, va);
     va_end(va);
 
     if (msg == NULL) {
-        debug_fn(debug_fn_pvt, AUTHSELECT_ERROR, file, line, function,
-                 "debug: Unable to construct message!");
+        fn(pvt, AUTHSELECT_ERROR, file, line, function,
+           "debug: Unable to construct message!");
         return;
     }
 
-    debug_fn(debug_fn_pvt, level, file, line, function, msg);
+    fn(pvt, level, file, line, function, msg);
     free(msg);
 }
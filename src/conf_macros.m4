@@ -62,6 +62,10 @@ CONFIGURABLE_VALUE(state-dir, state_dir, AUTHSELECT_STATE_DIR, DIR,
                    [Directory where authselect state should be stored],
                    $localstatedir/lib/authselect)
 
+CONFIGURABLE_VALUE(run-dir, run_dir, AUTHSELECT_RUN_DIR, DIR,
+                   [Directory where authselectd creates its socket],
+                   /run/authselect)
+
 CONFIGURABLE_VALUE(pythonbin, pythonbin, PYTHON_BIN, PATH,
                    [Path to the python interpreter],
                    $bindir/python3)
@@ -84,3 +88,13 @@ AS_IF([test "x$enable_debug_template_regex" = "xyes"],
         [Debug template regular expressions]
     )
 )
+
+AC_ARG_ENABLE(
+    [daemon],
+    AS_HELP_STRING(
+        [--enable-daemon],
+        [Build authselectd daemon that serves queries over a local socket]
+    )
+)
+
+AM_CONDITIONAL([BUILD_DAEMON], [test "x$enable_daemon" = "xyes"])
@@ -0,0 +1,810 @@
+/*
+    Authors:
+        Pavel Březina <pbrezina@redhat.com>
+
+    Copyright (C) 2018 Red Hat
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+
+#include <poll.h>
+#include <time.h>
+#include <errno.h>
+#include <stdio.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <popt.h>
+
+#include "authselect.h"
+#include "common/common.h"
+#include "lib/constants.h"
+#include "lib/daemon/daemon.h"
+#include "lib/profiles/profiles.h"
+#include "lib/util/util.h"
+
+/* Maximum number of clients that are served at the same time. */
+#define AUTHSELECTD_MAX_CLIENTS 64
+
+/* Client must send its request and receive the reply within this time,
+ * otherwise it is disconnected. Requests are answered from memory so
+ * well-behaved clients need only a fraction of it. */
+#define AUTHSELECTD_CLIENT_TIMEOUT_MS 1000
+
+struct authselectd_client {
+    int fd;
+
+    /* Monotonic time in milliseconds when the client is disconnected. */
+    int64_t deadline;
+
+    /* Length of the request and number of its bytes that were received. */
+    uint64_t length;
+    size_t header;
+    char *request;
+    size_t received;
+
+    /* Reply prefixed with its length, NULL until the request is received. */
+    char *reply;
+    size_t reply_length;
+    size_t sent;
+};
+
+struct authselectd {
+    int sock;
+
+    /* Profiles and configuration are cached here. */
+    struct authselect_ctx *ctx;
+
+    struct authselectd_client clients[AUTHSELECTD_MAX_CLIENTS];
+    size_t num_clients;
+};
+
+static volatile sig_atomic_t authselectd_terminate = 0;
+
+static bool enable_trace;
+static bool enable_warning;
+static bool enable_debug;
+
+static void
+authselectd_print_debug(void *pvt,
+                        enum authselect_debug level,
+                        const char *file,
+                        unsigned long line,
+                        const char *function,
+                        const char *msg)
+{
+    const char *category = "unknown";
+
+    switch (level) {
+    case AUTHSELECT_INFO:
+        if (!enable_trace) {
+            return;
+        }
+        category = "info";
+        break;
+    case AUTHSELECT_WARNING:
+        if (!enable_warning) {
+            return;
+        }
+        category = "warn";
+        break;
+    case AUTHSELECT_ERROR:
+        category = "error";
+        break;
+    }
+
+    if (!enable_debug) {
+        fprintf(stderr, "[%s] %s\n", category, msg);
+        return;
+    }
+
+    fprintf(stderr, "[%s] [%s] %s\n", category, function, msg);
+}
+
+static void
+authselectd_signal(int signum)
+{
+    authselectd_terminate = 1;
+}
+
+static errno_t
+authselectd_list(struct authselectd *daemon,
+                 struct unpack *request,
+                 struct pack *reply)
+{
+    char **profiles;
+
+    profiles = authselect_ctx_list(daemon->ctx);
+    if (profiles == NULL) {
+        pack_uint64(reply, EIO);
+        return EOK;
+    }
+
+    pack_uint64(reply, EOK);
+    authselectd_pack_array(reply, (const char **)profiles);
+
+    authselect_array_free(profiles);
+
+    return EOK;
+}
+
+static errno_t
+authselectd_profile(struct authselectd *daemon,
+                    struct unpack *request,
+                    struct pack *reply)
+{
+    struct authselect_profile *profile;
+    const char *profile_id;
+    char **features;
+    errno_t ret;
+
+    profile_id = unpack_string(request);
+    if (profile_id == NULL || request->left != 0) {
+        return EINVAL;
+    }
+
+    ret = authselect_ctx_profile(daemon->ctx, profile_id, &profile);
+    if (ret != EOK) {
+        pack_uint64(reply, ret);
+        return EOK;
+    }
+
+    features = authselect_profile_features(profile);
+    if (features == NULL) {
+        authselect_profile_free(profile);
+        pack_uint64(reply, ENOMEM);
+        return EOK;
+    }
+
+    pack_uint64(reply, EOK);
+    pack_string(reply, profile->id);
+    pack_string(reply, profile->path);
+    pack_string(reply, profile->name);
+    pack_string(reply, profile->description);
+    pack_string(reply, profile->requirements);
+    authselectd_pack_array(reply, (const char **)features);
+
+    authselect_array_free(features);
+    authselect_profile_free(profile);
+
+    return EOK;
+}
+
+static errno_t
+authselectd_current(struct authselectd *daemon,
+                    struct unpack *request,
+                    struct pack *reply)
+{
+    char *profile_id;
+    char **features;
+    errno_t ret;
+
+    ret = authselect_ctx_current_configuration(daemon->ctx, &profile_id,
+                                               &features);
+    pack_uint64(reply, ret);
+    if (ret != EOK) {
+        return EOK;
+    }
+
+    pack_string(reply, profile_id);
+    authselectd_pack_array(reply, (const char **)features);
+
+    free(profile_id);
+    authselect_array_free(features);
+
+    return EOK;
+}
+
+static errno_t
+authselectd_validate(struct authselectd *daemon,
+                     struct unpack *request,
+                     struct pack *reply)
+{
+    bool is_valid = false;
+    errno_t ret;
+
+    ret = authselect_ctx_validate_configuration(daemon->ctx, &is_valid);
+
+    pack_uint64(reply, ret);
+    pack_uint64(reply, is_valid);
+
+    return EOK;
+}
+
+static errno_t
+authselectd_files(struct authselectd *daemon,
+                  struct unpack *request,
+                  struct pack *reply)
+{
+    struct authselect_profile *profile;
+    struct authselect_files *files;
+    const char *profile_id;
+    char **features;
+    errno_t ret;
+
+    profile_id = unpack_string(request);
+    features = authselectd_unpack_array(request);
+    if (profile_id == NULL || features == NULL || request->left != 0) {
+        string_array_free(features);
+        return EINVAL;
+    }
+
+    ret = authselect_ctx_profile(daemon->ctx, profile_id, &profile);
+    if (ret == EOK) {
+        ret = authselect_profile_files(profile, (const char **)features,
+                                       &files);
+        authselect_profile_free(profile);
+    }
+    string_array_free(features);
+
+    pack_uint64(reply, ret);
+    if (ret != EOK) {
+        return EOK;
+    }
+
+    pack_string(reply, authselect_files_systemauth(files));
+    pack_string(reply, authselect_files_passwordauth(files));
+    pack_string(reply, authselect_files_smartcardauth(files));
+    pack_string(reply, authselect_files_fingerprintauth(files));
+    pack_string(reply, authselect_files_postlogin(files));
+    pack_string(reply, authselect_files_nsswitch(files));
+    pack_string(reply, authselect_files_dconf_db(files));
+    pack_string(reply, authselect_files_dconf_lock(files));
+
+    authselect_files_free(files);
+
+    return EOK;
+}
+
+/**
+ * Process request and store the reply in @reply. If an error is returned,
+ * the connection is closed without reply.
+ */
+static errno_t
+authselectd_process(struct authselectd *daemon,
+                    const char *buffer,
+                    size_t length,
+                    struct pack *reply)
+{
+    struct unpack request;
+    uint64_t command;
+    errno_t ret;
+
+    struct {
+        enum authselectd_command command;
+        errno_t (*fn)(struct authselectd *, struct unpack *, struct pack *);
+    } commands[] = {
+        {AUTHSELECTD_LIST, authselectd_list},
+        {AUTHSELECTD_PROFILE, authselectd_profile},
+        {AUTHSELECTD_CURRENT, authselectd_current},
+        {AUTHSELECTD_VALIDATE, authselectd_validate},
+        {AUTHSELECTD_FILES, authselectd_files},
+        {AUTHSELECTD_SENTINEL, NULL}
+    };
+
+    request.data = buffer;
+    request.left = length;
+    request.error = EOK;
+
+    /* Unknown clients are disconnected without reply so they can do the
+     * work themselves. */
+    if (!unpack_string_equal(&request, AUTHSELECTD_MAGIC)
+            || unpack_uint64(&request) != AUTHSELECTD_VERSION) {
+        WARN("Unsupported client, closing connection");
+        return EPROTO;
+    }
+
+    command = unpack_uint64(&request);
+    if (request.error != EOK) {
+        WARN("Malformed request, closing connection");
+        return EPROTO;
+    }
+
+    ret = EINVAL;
+    for (int i = 0; commands[i].fn != NULL; i++) {
+        if (commands[i].command == command) {
+            ret = commands[i].fn(daemon, &request, reply);
+            break;
+        }
+    }
+
+    if (ret != EOK) {
+        WARN("Invalid request [%d]: %s", ret, strerror(ret));
+        return ret;
+    }
+
+    if (reply->error != EOK) {
+        WARN("Unable to create reply [%d]: %s",
+             reply->error, strerror(reply->error));
+        return reply->error;
+    }
+
+    if (reply->length > AUTHSELECTD_MESSAGE_LIMIT) {
+        WARN("Reply is too large, closing connection");
+        return ERANGE;
+    }
+
+    return EOK;
+}
+
+static int64_t
+authselectd_now(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/**
+ * Only clients with the same privileges as the daemon are served.
+ */
+static bool
+authselectd_peer_allowed(int fd)
+{
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    errno_t ret;
+
+    ret = getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len);
+    if (ret != 0) {
+        ret = errno;
+        WARN("Unable to get client credentials [%d]: %s",
+             ret, strerror(ret));
+        return false;
+    }
+
+    if (cred.uid != 0 && cred.uid != geteuid()) {
+        WARN("Client with uid %u is not allowed, closing connection",
+             (unsigned int)cred.uid);
+        return false;
+    }
+
+    return true;
+}
+
+static void
+authselectd_client_close(struct authselectd *daemon, size_t index)
+{
+    struct authselectd_client *client = &daemon->clients[index];
+
+    close(client->fd);
+    free(client->request);
+    free(client->reply);
+
+    /* Keep the array dense. */
+    daemon->num_clients--;
+    *client = daemon->clients[daemon->num_clients];
+}
+
+static void
+authselectd_accept(struct authselectd *daemon)
+{
+    struct authselectd_client *client;
+    errno_t ret;
+    int fd;
+
+    while (daemon->num_clients < AUTHSELECTD_MAX_CLIENTS) {
+        fd = accept4(daemon->sock, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+        if (fd == -1) {
+            ret = errno;
+            if (ret != EINTR && ret != EAGAIN && ret != EWOULDBLOCK
+                    && ret != ECONNABORTED) {
+                WARN("Unable to accept connection [%d]: %s",
+                     ret, strerror(ret));
+            }
+            return;
+        }
+
+        if (!authselectd_peer_allowed(fd)) {
+            close(fd);
+            continue;
+        }
+
+        client = &daemon->clients[daemon->num_clients++];
+        memset(client, 0, sizeof(struct authselectd_client));
+        client->fd = fd;
+        client->deadline = authselectd_now() + AUTHSELECTD_CLIENT_TIMEOUT_MS;
+    }
+}
+
+/**
+ * Receive as much of the request as is available.
+ *
+ * @return EOK if the whole request was received, EAGAIN if more data is
+ *         expected, other errno code on error.
+ */
+static errno_t
+authselectd_client_recv(struct authselectd_client *client)
+{
+    ssize_t bytes;
+
+    while (client->header < sizeof(uint64_t)) {
+        bytes = recv(client->fd, (char *)&client->length + client->header,
+                     sizeof(uint64_t) - client->header, 0);
+        if (bytes == -1) {
+            return errno == EINTR ? EAGAIN : errno;
+        } else if (bytes == 0) {
+            return EPIPE;
+        }
+
+        client->header += bytes;
+    }
+
+    if (client->request == NULL) {
+        if (client->length > AUTHSELECTD_MESSAGE_LIMIT) {
+            return ERANGE;
+        }
+
+        /* Allocate at least one byte so empty message is not NULL. */
+        client->request = malloc_zero_array(char, client->length + 1);
+        if (client->request == NULL) {
+            return ENOMEM;
+        }
+    }
+
+    while (client->received < client->length) {
+        bytes = recv(client->fd, client->request + client->received,
+                     client->length - client->received, 0);
+        if (bytes == -1) {
+            return errno == EINTR ? EAGAIN : errno;
+        } else if (bytes == 0) {
+            return EPIPE;
+        }
+
+        client->received += bytes;
+    }
+
+    return EOK;
+}
+
+/**
+ * Send as much of the reply as the socket accepts.
+ *
+ * @return EOK if the whole reply was sent, EAGAIN if the client must
+ *         read it first, other errno code on error.
+ */
+static errno_t
+authselectd_client_send(struct authselectd_client *client)
+{
+    ssize_t bytes;
+
+    while (client->sent < client->reply_length) {
+        bytes = send(client->fd, client->reply + client->sent,
+                     client->reply_length - client->sent, MSG_NOSIGNAL);
+        if (bytes == -1) {
+            return errno == EINTR ? EAGAIN : errno;
+        }
+
+        client->sent += bytes;
+    }
+
+    return EOK;
+}
+
+static errno_t
+authselectd_client_respond(struct authselectd *daemon,
+                           struct authselectd_client *client)
+{
+    struct pack reply = {0};
+    uint64_t length;
+    errno_t ret;
+
+    ret = authselectd_process(daemon, client->request, client->length,
+                              &reply);
+    if (ret != EOK) {
+        goto done;
+    }
+
+    client->reply_length = sizeof(uint64_t) + reply.length;
+    client->reply = malloc_zero_array(char, client->reply_length);
+    if (client->reply == NULL) {
+        ret = ENOMEM;
+        goto done;
+    }
+
+    length = reply.length;
+    memcpy(client->reply, &length, sizeof(uint64_t));
+    if (reply.length > 0) {
+        memcpy(client->reply + sizeof(uint64_t), reply.data, reply.length);
+    }
+
+    ret = EOK;
+
+done:
+    pack_free(&reply);
+
+    return ret;
+}
+
+/**
+ * Make progress with client according to events reported by poll().
+ *
+ * @return EOK if the client was served, EAGAIN if it waits for more
+ *         events, other errno code on error.
+ */
+static errno_t
+authselectd_client_handle(struct authselectd *daemon,
+                          struct authselectd_client *client,
+                          short revents)
+{
+    errno_t ret;
+
+    if (revents & (POLLERR | POLLNVAL)) {
+        return EPIPE;
+    }
+
+    if (client->reply == NULL) {
+        if (!(revents & (POLLIN | POLLHUP))) {
+            return EAGAIN;
+        }
+
+        ret = authselectd_client_recv(client);
+        if (ret != EOK) {
+            return ret;
+        }
+
+        ret = authselectd_client_respond(daemon, client);
+        if (ret != EOK) {
+            return ret;
+        }
+
+        /* The reply usually fits into the socket buffer right away. */
+        return authselectd_client_send(client);
+    }
+
+    if (!(revents & (POLLOUT | POLLHUP))) {
+        return EAGAIN;
+    }
+
+    return authselectd_client_send(client);
+}
+
+static errno_t
+authselectd_listen(struct authselectd *daemon)
+{
+    struct sockaddr_un addr = {0};
+    errno_t ret;
+    int fd;
+
+    addr.sun_family = AF_UNIX;
+    if (strlen(PATH_DAEMON_SOCKET) >= sizeof(addr.sun_path)) {
+        ERROR("Socket path [%s] is too long", PATH_DAEMON_SOCKET);
+        return ENAMETOOLONG;
+    }
+
+    strcpy(addr.sun_path, PATH_DAEMON_SOCKET);
+
+    ret = mkdir(AUTHSELECT_RUN_DIR, AUTHSELECT_DIR_MODE);
+    if (ret != 0 && errno != EEXIST) {
+        ret = errno;
+        ERROR("Unable to create [%s] [%d]: %s",
+              AUTHSELECT_RUN_DIR, ret, strerror(ret));
+        return ret;
+    }
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (fd == -1) {
+        ret = errno;
+        ERROR("Unable to create socket [%d]: %s", ret, strerror(ret));
+        return ret;
+    }
+
+    /* Remove stale socket unless another instance is running. */
+    ret = connect(fd, (struct sockaddr *)&addr, sizeof(addr));
+    if (ret == 0 || errno == EAGAIN) {
+        ERROR("authselectd is already running");
+        close(fd);
+        return EADDRINUSE;
+    }
+
+    unlink(PATH_DAEMON_SOCKET);
+
+    ret = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    if (ret != 0) {
+        ret = errno;
+        ERROR("Unable to bind to [%s] [%d]: %s",
+              PATH_DAEMON_SOCKET, ret, strerror(ret));
+        close(fd);
+        return ret;
+    }
+
+    /* Only privileged clients are served, others read the files
+     * themselves. Peer credentials are checked on accept as well. */
+    ret = chmod(PATH_DAEMON_SOCKET, 0600);
+    if (ret == 0) {
+        ret = listen(fd, SOMAXCONN);
+    }
+    if (ret != 0) {
+        ret = errno;
+        ERROR("Unable to listen on [%s] [%d]: %s",
+              PATH_DAEMON_SOCKET, ret, strerror(ret));
+        close(fd);
+        unlink(PATH_DAEMON_SOCKET);
+        return ret;
+    }
+
+    daemon->sock = fd;
+
+    return EOK;
+}
+
+static errno_t
+authselectd_run(struct authselectd *daemon)
+{
+    struct pollfd fds[1 + AUTHSELECTD_MAX_CLIENTS];
+    struct authselectd_client *client;
+    int64_t left;
+    int64_t now;
+    size_t count;
+    size_t i;
+    errno_t ret;
+    int timeout;
+
+    INFO("Listening on [%s]", PATH_DAEMON_SOCKET);
+
+    /* Changes are picked up by the context on each request. Signal
+     * interrupts poll() since SA_RESTART is not used. */
+    while (!authselectd_terminate) {
+        /* Stop accepting new clients when the table is full, they wait
+         * in the listen queue. */
+        fds[0].fd = daemon->sock;
+        fds[0].events = daemon->num_clients < AUTHSELECTD_MAX_CLIENTS
+                        ? POLLIN : 0;
+        fds[0].revents = 0;
+
+        timeout = -1;
+        now = authselectd_now();
+        count = daemon->num_clients;
+        for (i = 0; i < count; i++) {
+            client = &daemon->clients[i];
+            fds[1 + i].fd = client->fd;
+            fds[1 + i].events = client->reply == NULL ? POLLIN : POLLOUT;
+            fds[1 + i].revents = 0;
+
+            left = client->deadline > now ? client->deadline - now : 0;
+            if (timeout == -1 || left < timeout) {
+                timeout = left;
+            }
+        }
+
+        ret = poll(fds, 1 + count, timeout);
+        if (ret == -1) {
+            ret = errno;
+            if (ret != EINTR) {
+                WARN("Unable to wait for events [%d]: %s",
+                     ret, strerror(ret));
+            }
+            continue;
+        }
+
+        /* Go backwards since closed clients are replaced by the last one,
+         * which was already handled. */
+        now = authselectd_now();
+        for (i = count; i > 0; i--) {
+            client = &daemon->clients[i - 1];
+            ret = authselectd_client_handle(daemon, client,
+                                            fds[i].revents);
+            if (ret == EAGAIN && client->deadline <= now) {
+                WARN("Client did not finish in time, closing connection");
+            } else if (ret == EAGAIN) {
+                continue;
+            } else if (ret != EOK) {
+                WARN("Unable to serve client [%d]: %s", ret, strerror(ret));
+            }
+
+            authselectd_client_close(daemon, i - 1);
+        }
+
+        if (fds[0].revents & POLLIN) {
+            authselectd_accept(daemon);
+        }
+    }
+
+    INFO("Terminating");
+
+    return EOK;
+}
+
+static void
+authselectd_free(struct authselectd *daemon)
+{
+    while (daemon->num_clients > 0) {
+        authselectd_client_close(daemon, daemon->num_clients - 1);
+    }
+
+    if (daemon->sock != -1) {
+        close(daemon->sock);
+        unlink(PATH_DAEMON_SOCKET);
+    }
+
+    authselect_ctx_free(daemon->ctx);
+}
+
+int main(int argc, const char **argv)
+{
+    struct authselectd daemon = {0};
+    struct sigaction sa = {0};
+    poptContext pc;
+    errno_t ret;
+    int opt;
+
+    struct poptOption options[] = {
+        POPT_AUTOHELP
+        {"debug", '\0', POPT_ARG_NONE, NULL, 'd', "Print more verbose debugging information", NULL },
+        {"trace", '\0', POPT_ARG_NONE, NULL, 't', "Print trace messages", NULL },
+        {"warn", '\0', POPT_ARG_NONE, NULL, 'w', "Print warning messages", NULL },
+        POPT_TABLEEND
+    };
+
+    pc = poptGetContext(argv[0], argc, argv, options, 0);
+    while ((opt = poptGetNextOpt(pc)) > 0) {
+        switch (opt) {
+        case 'd':
+            enable_debug = true;
+            break;
+        case 't':
+            enable_trace = true;
+            break;
+        case 'w':
+            enable_warning = true;
+            break;
+        }
+    }
+
+    if (opt != -1) {
+        fprintf(stderr, "%s: %s\n", poptBadOption(pc, 0), poptStrerror(opt));
+        poptFreeContext(pc);
+        return 1;
+    }
+
+    poptFreeContext(pc);
+
+    set_debug_fn(authselectd_print_debug, NULL);
+    authselect_set_debug_fn(authselectd_print_debug, NULL);
+
+    sa.sa_handler = authselectd_signal;
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+
+    sa.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &sa, NULL);
+
+    daemon.sock = -1;
+    ret = authselect_ctx_create(&daemon.ctx);
+    if (ret != EOK) {
+        ERROR("Unable to create context [%d]: %s", ret, strerror(ret));
+        goto done;
+    }
+
+    ret = authselectd_listen(&daemon);
+    if (ret != EOK) {
+        goto done;
+    }
+
+    ret = authselectd_run(&daemon);
+
+done:
+    authselectd_free(&daemon);
+
+    return ret == EOK ? 0 : 1;
+}
@@ -19,6 +19,7 @@
 */
 
 #include <stddef.h>
+#include <string.h>
 #include <stdlib.h>
 #include <stdbool.h>
 
@@ -26,6 +27,8 @@
 
 #include "lib/constants.h"
 #include "lib/util/util.h"
+#include "lib/ctx/ctx.h"
+#include "lib/daemon/daemon.h"
 #include "lib/files/files.h"
 #include "lib/profiles/profiles.h"
 
@@ -74,24 +77,130 @@ authselect_set_debug_fn(authselect_debug_fn fn, void *pvt)
     set_debug_fn(fn, pvt);
 }
 
+_PUBLIC_ void
+authselect_set_threads(unsigned int threads)
+{
+    authselect_system_set_threads(threads);
+}
+
+_PUBLIC_ void
+authselect_set_dconf_async(bool async)
+{
+    authselect_profile_dconf_set_async(async);
+}
+
 _PUBLIC_ int
-authselect_activate(const char *profile_id,
-                    const char **features,
-                    bool force_overwrite)
+authselect_dconf_wait(void)
+{
+    return authselect_profile_dconf_wait();
+}
+
+_PUBLIC_ void
+authselect_set_daemon(bool use_daemon)
+{
+    authselect_daemon_set_enabled(use_daemon);
+}
+
+_PUBLIC_ int
+authselect_set_root(const char *root)
+{
+    struct authselect_root *newroot = NULL;
+    errno_t ret;
+
+    if (root != NULL) {
+        ret = authselect_root_create(root, &newroot);
+        if (ret != EOK) {
+            return ret;
+        }
+    }
+
+    authselect_root_set_global(newroot);
+
+    return EOK;
+}
+
+/**
+ * The following functions read the data from the context cache if the
+ * context is given, otherwise the data is read directly.
+ */
+
+static errno_t
+authselect_get_profile(struct authselect_ctx *ctx,
+                       const char *profile_id,
+                       struct authselect_profile **_profile)
+{
+    if (ctx != NULL) {
+        return authselect_ctx_cache_profile(ctx, profile_id, _profile);
+    }
+
+    return authselect_profile_read(profile_id, AUTHSELECT_PROFILE_ANY,
+                                   _profile);
+}
+
+static errno_t
+authselect_get_config(struct authselect_ctx *ctx,
+                      char **_profile_id,
+                      char ***_features)
+{
+    const char *profile_id;
+    char **features;
+    errno_t ret;
+
+    if (ctx == NULL) {
+        return authselect_config_read(_profile_id, _features);
+    }
+
+    ret = authselect_ctx_cache_config(ctx, &profile_id, &features);
+    if (ret != EOK) {
+        return ret;
+    }
+
+    *_profile_id = strdup(profile_id);
+    *_features = string_array_copy(features, false);
+    if (*_profile_id == NULL || *_features == NULL) {
+        free(*_profile_id);
+        string_array_free(*_features);
+        return ENOMEM;
+    }
+
+    return EOK;
+}
+
+static errno_t
+authselect_get_validation(struct authselect_ctx *ctx,
+                          bool *_is_valid)
+{
+    if (ctx != NULL) {
+        return authselect_ctx_cache_validation(ctx, _is_valid);
+    }
+
+    return authselect_validate_configuration(_is_valid);
+}
+
+static errno_t
+authselect_do_activate(struct authselect_ctx *ctx,
+                       const char *profile_id,
+                       const char **features,
+                       bool force_overwrite)
 {
     struct authselect_profile *profile;
+    struct authselect_dirs *dirs;
+    bool available;
     bool is_valid;
     errno_t ret;
 
     INFO("Trying to activate profile [%s]", profile_id);
 
-    ret = authselect_profile(profile_id, &profile);
+    ret = authselect_get_profile(ctx, profile_id, &profile);
     if (ret != EOK) {
         ERROR("Unable to find profile [%s] [%d]: %s",
               profile_id, ret, strerror(ret));
         return ret;
     }
 
+    /* All files written during activation are labeled with one session. */
+    selinux_labels_begin();
+
     if (!authselect_check_features(profile, features)) {
         ret = EINVAL;
         goto done;
@@ -104,7 +213,7 @@ authselect_activate(const char *profile_id,
     }
 
     /* First, check that current configuration is valid. */
-    ret = authselect_validate_configuration(&is_valid);
+    ret = authselect_get_validation(ctx, &is_valid);
     if (ret != EOK && ret != ENOENT) {
         ERROR("Unable to check configuration [%d]: %s", ret, strerror(ret));
         goto done;
@@ -120,7 +229,14 @@ authselect_activate(const char *profile_id,
 
     /* If no configuration is present, check for existing files. */
     if (ret == ENOENT) {
-        if (!authselect_symlinks_location_available()) {
+        ret = authselect_dirs_open(&dirs);
+        if (ret != EOK) {
+            goto done;
+        }
+
+        available = authselect_symlinks_location_available(dirs);
+        authselect_dirs_close(dirs);
+        if (!available) {
             ERROR("File that needs to be overwritten was found");
             ERROR("Refusing to activate profile unless this file is removed "
                   "or overwrite is requested.");
@@ -137,27 +253,28 @@ done:
               profile_id, ret, strerror(ret));
     }
 
+    selinux_labels_end();
     authselect_profile_free(profile);
 
     return ret;
 }
 
-_PUBLIC_ int
-authselect_apply_changes(void)
+static errno_t
+authselect_do_apply_changes(struct authselect_ctx *ctx)
 {
-    struct authselect_profile *profile;
+    struct authselect_profile *profile = NULL;
     char **supported = NULL;
     char *profile_id;
     char **features;
     errno_t ret;
     int i;
 
-    ret = authselect_current_configuration(&profile_id, &features);
+    ret = authselect_get_config(ctx, &profile_id, &features);
     if (ret != EOK) {
         return ret;
     }
 
-    ret = authselect_profile(profile_id, &profile);
+    ret = authselect_get_profile(ctx, profile_id, &profile);
     if (ret != EOK) {
         ERROR("Unable to find profile [%s] [%d]: %s",
               profile_id, ret, strerror(ret));
@@ -183,7 +300,8 @@ authselect_apply_changes(void)
         i--;
     }
 
-    ret = authselect_activate(profile_id, (const char **)features, false);
+    ret = authselect_do_activate(ctx, profile_id, (const char **)features,
+                                 false);
 
 done:
     authselect_profile_free(profile);
@@ -194,14 +312,15 @@ done:
     return ret;
 }
 
-_PUBLIC_ int
-authselect_feature_enable(const char *feature)
+static errno_t
+authselect_do_feature_enable(struct authselect_ctx *ctx,
+                             const char *feature)
 {
     char *profile_id;
     char **features;
     errno_t ret;
 
-    ret = authselect_current_configuration(&profile_id, &features);
+    ret = authselect_get_config(ctx, &profile_id, &features);
     if (ret != EOK) {
         return ret;
     }
@@ -212,7 +331,8 @@ authselect_feature_enable(const char *feature)
         goto done;
     }
 
-    ret = authselect_activate(profile_id, (const char **)features, false);
+    ret = authselect_do_activate(ctx, profile_id, (const char **)features,
+                                 false);
 
 done:
     string_array_free(features);
@@ -221,21 +341,23 @@ done:
     return ret;
 }
 
-_PUBLIC_ int
-authselect_feature_disable(const char *feature)
+static errno_t
+authselect_do_feature_disable(struct authselect_ctx *ctx,
+                              const char *feature)
 {
     char *profile_id;
     char **features;
     errno_t ret;
 
-    ret = authselect_config_read(&profile_id, &features);
+    ret = authselect_get_config(ctx, &profile_id, &features);
     if (ret != EOK) {
         return ret;
     }
 
     string_array_del_value(features, feature);
 
-    ret = authselect_activate(profile_id, (const char **)features, false);
+    ret = authselect_do_activate(ctx, profile_id, (const char **)features,
+                                 false);
 
     string_array_free(features);
     free(profile_id);
@@ -243,6 +365,94 @@ authselect_feature_disable(const char *feature)
     return ret;
 }
 
+_PUBLIC_ int
+authselect_activate(const char *profile_id,
+                    const char **features,
+                    bool force_overwrite)
+{
+    return authselect_do_activate(NULL, profile_id, features,
+                                  force_overwrite);
+}
+
+_PUBLIC_ int
+authselect_apply_changes(void)
+{
+    return authselect_do_apply_changes(NULL);
+}
+
+_PUBLIC_ int
+authselect_feature_enable(const char *feature)
+{
+    return authselect_do_feature_enable(NULL, feature);
+}
+
+_PUBLIC_ int
+authselect_feature_disable(const char *feature)
+{
+    return authselect_do_feature_disable(NULL, feature);
+}
+
+_PUBLIC_ int
+authselect_ctx_activate(struct authselect_ctx *ctx,
+                        const char *profile_id,
+                        const char **features,
+                        bool force_overwrite)
+{
+    struct authselect_ctx *prev;
+    errno_t ret;
+
+    prev = authselect_ctx_enter(ctx);
+    authselect_ctx_refresh(ctx);
+    ret = authselect_do_activate(ctx, profile_id, features, force_overwrite);
+    authselect_ctx_leave(prev);
+
+    return ret;
+}
+
+_PUBLIC_ int
+authselect_ctx_apply_changes(struct authselect_ctx *ctx)
+{
+    struct authselect_ctx *prev;
+    errno_t ret;
+
+    prev = authselect_ctx_enter(ctx);
+    authselect_ctx_refresh(ctx);
+    ret = authselect_do_apply_changes(ctx);
+    authselect_ctx_leave(prev);
+
+    return ret;
+}
+
+_PUBLIC_ int
+authselect_ctx_feature_enable(struct authselect_ctx *ctx,
+                              const char *feature)
+{
+    struct authselect_ctx *prev;
+    errno_t ret;
+
+    prev = authselect_ctx_enter(ctx);
+    authselect_ctx_refresh(ctx);
+    ret = authselect_do_feature_enable(ctx, feature);
+    authselect_ctx_leave(prev);
+
+    return ret;
+}
+
+_PUBLIC_ int
+authselect_ctx_feature_disable(struct authselect_ctx *ctx,
+                               const char *feature)
+{
+    struct authselect_ctx *prev;
+    errno_t ret;
+
+    prev = authselect_ctx_enter(ctx);
+    authselect_ctx_refresh(ctx);
+    ret = authselect_do_feature_disable(ctx, feature);
+    authselect_ctx_leave(prev);
+
+    return ret;
+}
+
 _PUBLIC_ int
 authselect_validate_configuration(bool *_is_valid)
 {
@@ -250,6 +460,11 @@ authselect_validate_configuration(bool *_is_valid)
     char **features;
     errno_t ret;
 
+    ret = authselect_daemon_validate(_is_valid);
+    if (ret != ENOTCONN) {
+        return ret;
+    }
+
     ret = authselect_config_read(&profile_id, &features);
     if (ret == ENOENT) {
         *_is_valid = authselect_config_validate_non_existing();
@@ -271,6 +486,13 @@ _PUBLIC_ int
 authselect_current_configuration(char **_profile_id,
                                  char ***_features)
 {
+    errno_t ret;
+
+    ret = authselect_daemon_current(_profile_id, _features);
+    if (ret != ENOTCONN) {
+        return ret;
+    }
+
     return authselect_config_read(_profile_id, _features);
 }
 
@@ -280,7 +502,11 @@ authselect_list()
     char **profiles;
     errno_t ret;
 
-    ret = authselect_profile_list(&profiles);
+    ret = authselect_daemon_list(&profiles);
+    if (ret == ENOTCONN) {
+        ret = authselect_profile_list(&profiles);
+    }
+
     if (ret != EOK) {
         return NULL;
     }
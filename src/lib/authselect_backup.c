@@ -20,8 +20,11 @@
 
 #include <time.h>
 #include <errno.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "authselect.h"
 #include "common/common.h"
@@ -32,21 +35,42 @@
 
 static errno_t
 authselect_backup_create_named(const char *name,
+                               bool archive,
                                char **_path)
 {
+    struct stat statbuf;
     char *path;
     errno_t ret;
 
-    path = format("%s/%s", AUTHSELECT_BACKUP_DIR, name);
+    if (strcmp(name, FILE_BACKUP_OBJECTS) == 0) {
+        ERROR("Backup name [%s] is reserved", name);
+        return EINVAL;
+    }
+
+    path = format("%s/%s", DIR_BACKUP, name);
     if (path == NULL) {
         return ENOMEM;
     }
 
-    ret = file_make_path(path, AUTHSELECT_DIR_MODE);
+    /* Existing archive is replaced when the new one is written. */
+    if (archive) {
+        ret = lstat(path, &statbuf);
+        if (ret == 0 && !S_ISREG(statbuf.st_mode)) {
+            ERROR("Backup [%s] already exists and it is not an archive",
+                  name);
+            free(path);
+            return EEXIST;
+        }
+
+        ret = file_make_path(DIR_BACKUP, AUTHSELECT_DIR_MODE);
+    } else {
+        ret = file_make_path(path, AUTHSELECT_DIR_MODE);
+    }
+
     if (ret != EOK) {
         free(path);
         ERROR("Unable to create backup directory [%s/%s] [%d]: %s",
-              AUTHSELECT_BACKUP_DIR, name, ret, strerror(ret));
+              DIR_BACKUP, name, ret, strerror(ret));
         return ret;
     }
 
@@ -56,7 +80,8 @@ authselect_backup_create_named(const char *name,
 }
 
 static errno_t
-authselect_backup_create_anonymous(char **_path)
+authselect_backup_create_anonymous(bool archive,
+                                   char **_path)
 {
     struct tm *tm;
     char date[255];
@@ -64,11 +89,12 @@ authselect_backup_create_anonymous(char **_path)
     time_t now;
     size_t n;
     errno_t ret;
+    int fd;
 
-    ret = file_make_path(AUTHSELECT_BACKUP_DIR, AUTHSELECT_DIR_MODE);
+    ret = file_make_path(DIR_BACKUP, AUTHSELECT_DIR_MODE);
     if (ret != EOK) {
         ERROR("Unable to create backup directory [%s] [%d]: %s",
-              AUTHSELECT_BACKUP_DIR, ret, strerror(ret));
+              DIR_BACKUP, ret, strerror(ret));
         return ret;
     }
 
@@ -83,16 +109,29 @@ authselect_backup_create_anonymous(char **_path)
         return EINVAL;
     }
 
-    path = format("%s/%s.XXXXXX", AUTHSELECT_BACKUP_DIR, date);
+    path = format("%s/%s.XXXXXX", DIR_BACKUP, date);
     if (path == NULL) {
         return ENOMEM;
     }
 
-    INFO("Creating temporary directory at [%s]", path);
-    if (mkdtemp(path) == NULL) {
-        ret = errno;
-        free(path);
-        return ret;
+    if (archive) {
+        /* Reserve the name, the archive is written over this file. */
+        INFO("Creating temporary file at [%s]", path);
+        fd = mkstemp(path);
+        if (fd == -1) {
+            ret = errno;
+            free(path);
+            return ret;
+        }
+
+        close(fd);
+    } else {
+        INFO("Creating temporary directory at [%s]", path);
+        if (mkdtemp(path) == NULL) {
+            ret = errno;
+            free(path);
+            return ret;
+        }
     }
 
     *_path = path;
@@ -101,20 +140,63 @@ authselect_backup_create_anonymous(char **_path)
 }
 
 static errno_t
-authselect_backup_create(const char *name, char **_path)
+authselect_backup_create(const char *name, bool archive, char **_path)
 {
     if (name != NULL && name[0] != '\0') {
-        return authselect_backup_create_named(name, _path);
+        return authselect_backup_create_named(name, archive, _path);
+    }
+
+    return authselect_backup_create_anonymous(archive, _path);
+}
+
+/**
+ * Backup that is being created. Files are either linked into the backup
+ * directory at @path and listed in @manifest, or added to @archive which is
+ * written to @path when all files are added.
+ */
+struct authselect_backup_target {
+    char *path;
+    char *manifest;
+    struct authselect_archive *archive;
+};
+
+static errno_t
+authselect_backup_copy(struct authselect_backup_target *target,
+                       const char *source,
+                       const char *filename)
+{
+    char digest[SHA256_HEX_SIZE];
+    char *manifest;
+    errno_t ret;
+
+    if (target->archive != NULL) {
+        INFO("Adding [%s] to archive [%s]", source, target->path);
+        return authselect_archive_add(target->archive, source, filename);
+    }
+
+    INFO("Copying [%s] to [%s/%s]", source, target->path, filename);
+    ret = authselect_objects_copy(source, target->path, filename, digest);
+    if (ret != EOK) {
+        return ret;
     }
 
-    return authselect_backup_create_anonymous(_path);
+    manifest = format("%s%s %s\n", target->manifest, digest, filename);
+    if (manifest == NULL) {
+        return ENOMEM;
+    }
+
+    free(target->manifest);
+    target->manifest = manifest;
+
+    return EOK;
 }
 
 static errno_t
-authselect_backup_system_configuration(const char *path)
+authselect_backup_system_configuration(struct authselect_backup_target *target)
 {
     struct authselect_symlink files[] = {SYMLINK_FILES};
     const char *filename;
+    char *source;
     errno_t ret;
     int i;
 
@@ -125,14 +207,21 @@ authselect_backup_system_configuration(const char *path)
             return EINVAL;
         }
 
-        INFO("Copying [%s] to [%s/%s]", files[i].name, path, filename);
-        ret = selinux_file_copy(files[i].name, path, filename,
-                                AUTHSELECT_DIR_MODE);
+        /* The link may point to an absolute path within the root. */
+        ret = authselect_path_follow(files[i].name, &source);
+        if (ret != EOK) {
+            ERROR("Unable to resolve [%s] [%d]: %s", files[i].name,
+                  ret, strerror(ret));
+            return ret;
+        }
+
+        ret = authselect_backup_copy(target, source, filename);
+        free(source);
         if (ret == ENOENT) {
             WARN("File [%s] does not exist", files[i].name);
         } else if (ret != EOK) {
             ERROR("Unable to copy [%s] to [%s/%s] [%d]: %s", files[i].name,
-                  path, filename, ret, strerror(ret));
+                  target->path, filename, ret, strerror(ret));
             return ret;
         }
     }
@@ -141,114 +230,251 @@ authselect_backup_system_configuration(const char *path)
 }
 
 static errno_t
-authselect_backup_authselect_configuration(const char *path)
+authselect_backup_authselect_configuration(
+    struct authselect_backup_target *target)
 {
     errno_t ret;
 
-    ret = selinux_file_copy(PATH_CONFIG_FILE, path, FILE_CONFIG,
-                            AUTHSELECT_DIR_MODE);
+    ret = authselect_backup_copy(target, PATH_CONFIG_FILE, FILE_CONFIG);
     if (ret != EOK) {
         ERROR("Unable to copy [%s] to [%s/%s] [%d]: %s", PATH_CONFIG_FILE,
-              path, FILE_CONFIG, ret, strerror(ret));
+              target->path, FILE_CONFIG, ret, strerror(ret));
         return ret;
     }
 
-    return authselect_backup_system_configuration(path);
+    return authselect_backup_system_configuration(target);
 }
 
-_PUBLIC_ int
-authselect_backup(const char *name, char **_path)
+static errno_t
+authselect_backup_write_manifest(const char *path,
+                                 const char *manifest)
 {
-    char *path = NULL;
+    char *filepath;
+    errno_t ret;
+
+    filepath = format("%s/%s", path, FILE_BACKUP_MANIFEST);
+    if (filepath == NULL) {
+        return ENOMEM;
+    }
+
+    ret = textfile_write(filepath, manifest, AUTHSELECT_FILE_MODE);
+    if (ret != EOK) {
+        ERROR("Unable to write [%s] [%d]: %s", filepath, ret, strerror(ret));
+    }
+
+    free(filepath);
+
+    return ret;
+}
+
+static errno_t
+authselect_backup_perform(const char *name,
+                          bool archive,
+                          char **_path)
+{
+    struct authselect_backup_target target = {NULL, NULL, NULL};
     bool is_valid;
     errno_t ret;
 
-    ret = authselect_backup_create(name, &path);
+    selinux_labels_begin();
+
+    ret = authselect_backup_create(name, archive, &target.path);
     if (ret != EOK) {
         goto done;
     }
 
+    if (archive) {
+        ret = authselect_archive_new(&target.archive);
+        if (ret != EOK) {
+            goto done;
+        }
+    } else {
+        target.manifest = strdup("");
+        if (target.manifest == NULL) {
+            ret = ENOMEM;
+            goto done;
+        }
+    }
+
     ret = authselect_validate_configuration(&is_valid);
     if (ret == EOK && is_valid) {
         /* Valid authselect configuration. */
-        INFO("Trying to backup authselect configuration to [%s]", path);
-        ret = authselect_backup_authselect_configuration(path);
+        INFO("Trying to backup authselect configuration to [%s]",
+             target.path);
+        ret = authselect_backup_authselect_configuration(&target);
+    } else {
+        INFO("Trying to backup system configuration to [%s]", target.path);
+        ret = authselect_backup_system_configuration(&target);
+    }
+
+    if (ret != EOK) {
         goto done;
     }
 
-    INFO("Trying to backup system configuration to [%s]", path);
-    ret = authselect_backup_system_configuration(path);
+    if (archive) {
+        ret = authselect_archive_write(target.archive, target.path);
+    } else {
+        ret = authselect_backup_write_manifest(target.path, target.manifest);
+    }
 
 done:
+    selinux_labels_end();
+    authselect_archive_free(target.archive);
+    free(target.manifest);
+
     if (ret == EOK) {
-        INFO("Backup was successfuly created at [%s]", path);
-        *_path = path;
+        INFO("Backup was successfuly created at [%s]", target.path);
+        *_path = target.path;
         ret = EOK;
     } else if (ret != EOK) {
         ERROR("Unable to create backup [%d]: %s", ret, strerror(ret));
-        free(path);
+
+        /* Do not leave the reserved name of an anonymous archive behind. */
+        if (archive && target.path != NULL
+                && (name == NULL || name[0] == '\0')) {
+            unlink(target.path);
+        }
+
+        free(target.path);
     }
 
     return ret;
 }
 
+_PUBLIC_ int
+authselect_backup(const char *name, char **_path)
+{
+    return authselect_backup_perform(name, false, _path);
+}
+
+_PUBLIC_ int
+authselect_backup_archive(const char *name, char **_path)
+{
+    return authselect_backup_perform(name, true, _path);
+}
+
+/**
+ * Tell if @name is an archive backup. Only manifest of the archive is read.
+ */
+static bool
+authselect_backup_is_archive(const char *name)
+{
+    struct authselect_archive *archive;
+    char *path;
+    errno_t ret;
+
+    path = format("%s/%s", DIR_BACKUP, name);
+    if (path == NULL) {
+        return false;
+    }
+
+    ret = authselect_archive_open(path, &archive);
+    free(path);
+    if (ret != EOK) {
+        return false;
+    }
+
+    authselect_archive_free(archive);
+
+    return true;
+}
+
 _PUBLIC_ char **
 authselect_backup_list(void)
 {
+    struct dir_item *items;
     char **names;
+    size_t count;
     errno_t ret;
+    size_t i;
 
-    ret = dir_list(AUTHSELECT_BACKUP_DIR,
-                   DIR_LIST_DIRS | DIR_LIST_SORT_BY_CTIME,
-                   &names, NULL);
+    ret = dir_list_stat(DIR_BACKUP,
+                        DIR_LIST_DIRS | DIR_LIST_FILES | DIR_LIST_SORT_BY_CTIME,
+                        &items, &count, NULL);
     if (ret != EOK) {
         ERROR("Unable to list directory [%s] [%d]: %s",
-              AUTHSELECT_BACKUP_DIR, ret, strerror(ret));
+              DIR_BACKUP, ret, strerror(ret));
         return NULL;
     }
 
+    names = string_array_create(count);
+    if (names == NULL) {
+        goto done;
+    }
+
+    for (i = 0; i < count; i++) {
+        /* Files of all backups are stored here, it is not a backup. */
+        if (strcmp(items[i].name, FILE_BACKUP_OBJECTS) == 0) {
+            continue;
+        }
+
+        if (S_ISREG(items[i].statbuf.st_mode)
+                && !authselect_backup_is_archive(items[i].name)) {
+            continue;
+        }
+
+        names = string_array_add_value(names, items[i].name, false);
+        if (names == NULL) {
+            goto done;
+        }
+    }
+
+done:
+    dir_items_free(items, count);
+
     return names;
 }
 
 _PUBLIC_ int
 authselect_backup_remove(const char *name)
 {
+    struct stat statbuf;
     char *path;
     errno_t ret;
 
     INFO("Removing backup [%s]", name);
 
-    path = format("%s/%s", AUTHSELECT_BACKUP_DIR, name);
+    path = format("%s/%s", DIR_BACKUP, name);
     if (path == NULL) {
         return ENOMEM;
     }
 
-    ret = dir_remove(path);
+    if (lstat(path, &statbuf) == 0 && S_ISREG(statbuf.st_mode)) {
+        ret = unlink(path) == 0 ? EOK : errno;
+    } else {
+        ret = dir_remove(path);
+    }
+
     if (ret != EOK) {
-        ERROR("Unable to delete directory [%s] [%d]: %s",
+        ERROR("Unable to delete backup [%s] [%d]: %s",
               path, ret, strerror(ret));
+        free(path);
+        return ret;
     }
 
-    return ret;
+    free(path);
+
+    /* Objects that were used only by this backup are not needed anymore. */
+    authselect_objects_prune();
+
+    return EOK;
 }
 
+/**
+ * Restore files from backup directory @path or from @archive if it is set.
+ */
 static errno_t
-authselect_restore_system_configuration(const char *path)
+authselect_restore_files(const char *path,
+                         struct authselect_archive *archive,
+                         struct selinux_safe_copy *table)
 {
-    struct selinux_safe_copy table[] = {
-        {FILE_SYSTEM,      PATH_SYMLINK_SYSTEM},
-        {FILE_PASSWORD,    PATH_SYMLINK_PASSWORD},
-        {FILE_FINGERPRINT, PATH_SYMLINK_FINGERPRINT},
-        {FILE_SMARTCARD,   PATH_SYMLINK_SMARTCARD},
-        {FILE_POSTLOGIN,   PATH_SYMLINK_POSTLOGIN},
-        {FILE_NSSWITCH,    PATH_SYMLINK_NSSWITCH},
-        {FILE_DCONF_DB,    PATH_SYMLINK_DCONF_DB},
-        {FILE_DCONF_LOCK,  PATH_SYMLINK_DCONF_LOCK},
-        {NULL, NULL},
-    };
     errno_t ret;
     int i;
 
+    if (archive != NULL) {
+        return authselect_archive_extract(archive, table, AUTHSELECT_DIR_MODE);
+    }
+
     for (i = 0; table[i].source != NULL; i++) {
         table[i].source = format("%s/%s", path, table[i].source);
         if (table[i].source == NULL) {
@@ -270,7 +496,27 @@ done:
 }
 
 static errno_t
-authselect_restore_authselect_configuration(const char *path)
+authselect_restore_system_configuration(const char *path,
+                                        struct authselect_archive *archive)
+{
+    struct selinux_safe_copy table[] = {
+        {FILE_SYSTEM,      PATH_SYMLINK_SYSTEM},
+        {FILE_PASSWORD,    PATH_SYMLINK_PASSWORD},
+        {FILE_FINGERPRINT, PATH_SYMLINK_FINGERPRINT},
+        {FILE_SMARTCARD,   PATH_SYMLINK_SMARTCARD},
+        {FILE_POSTLOGIN,   PATH_SYMLINK_POSTLOGIN},
+        {FILE_NSSWITCH,    PATH_SYMLINK_NSSWITCH},
+        {FILE_DCONF_DB,    PATH_SYMLINK_DCONF_DB},
+        {FILE_DCONF_LOCK,  PATH_SYMLINK_DCONF_LOCK},
+        {NULL, NULL},
+    };
+
+    return authselect_restore_files(path, archive, table);
+}
+
+static errno_t
+authselect_restore_authselect_configuration(const char *path,
+                                            struct authselect_archive *archive)
 {
     struct selinux_safe_copy table[] = {
         {FILE_CONFIG,      PATH_CONFIG_FILE},
@@ -284,24 +530,21 @@ authselect_restore_authselect_configuration(const char *path)
         {FILE_DCONF_LOCK,  PATH_DCONF_LOCK},
         {NULL, NULL},
     };
+    struct authselect_dirs *dirs = NULL;
     errno_t ret;
-    int i;
 
-    for (i = 0; table[i].source != NULL; i++) {
-        table[i].source = format("%s/%s", path, table[i].source);
-        if (table[i].source == NULL) {
-            ret = ENOMEM;
-            goto done;
-        }
+    ret = authselect_restore_files(path, archive, table);
+    if (ret != EOK) {
+        ERROR("Unable to copy files [%d]: %s", ret, strerror(ret));
+        goto done;
     }
 
-    ret = selinux_copy_files_safely(table, AUTHSELECT_DIR_MODE);
+    ret = authselect_dirs_open(&dirs);
     if (ret != EOK) {
-        ERROR("Unable to copy files [%d]: %s", ret, strerror(ret));
         goto done;
     }
 
-    ret = authselect_symlinks_write();
+    ret = authselect_symlinks_write(dirs);
     if (ret != EOK) {
         ERROR("Unable to create symbolic links [%d]: %s", ret, strerror(ret));
         goto done;
@@ -318,11 +561,7 @@ authselect_restore_authselect_configuration(const char *path)
     ret = EOK;
 
 done:
-    /* In case of an error in formatting the source file, it will be NULL
-     * and the iteration will stop before we free the static data. */
-    for (i = 0; table[i].source != NULL; i++) {
-        free((char*)table[i].source);
-    }
+    authselect_dirs_close(dirs);
 
     return ret;
 }
@@ -330,40 +569,419 @@ done:
 _PUBLIC_ int
 authselect_backup_restore(const char *name)
 {
+    struct authselect_archive *archive = NULL;
+    struct stat statbuf;
     char *confpath = NULL;
     char *path = NULL;
     errno_t ret;
 
     INFO("Restoring configuration from backup [%s]", name);
 
-    path = format("%s/%s", AUTHSELECT_BACKUP_DIR, name);
+    selinux_labels_begin();
+
+    path = format("%s/%s", DIR_BACKUP, name);
     if (path == NULL) {
         ret = ENOMEM;
         goto done;
     }
 
-    confpath = format("%s/%s", path, FILE_CONFIG);
-    if (confpath == NULL) {
-        ret = ENOMEM;
+    ret = lstat(path, &statbuf);
+    if (ret != 0) {
+        ret = errno;
         goto done;
     }
 
-    ret = file_exists(confpath);
+    if (S_ISREG(statbuf.st_mode)) {
+        ret = authselect_archive_open(path, &archive);
+        if (ret != EOK) {
+            goto done;
+        }
+
+        ret = authselect_archive_contains(archive, FILE_CONFIG) ? EOK : ENOENT;
+    } else {
+        confpath = format("%s/%s", path, FILE_CONFIG);
+        if (confpath == NULL) {
+            ret = ENOMEM;
+            goto done;
+        }
+
+        ret = file_exists(confpath);
+    }
+
     if (ret == EOK) {
         INFO("Backup [%s] contains authselect configuration", name);
-        ret = authselect_restore_authselect_configuration(path);
+        ret = authselect_restore_authselect_configuration(path, archive);
     } else if (ret == ENOENT) {
         INFO("Backup [%s] contains non-authselect configuration", name);
-        ret = authselect_restore_system_configuration(path);
+        ret = authselect_restore_system_configuration(path, archive);
     }
 
 done:
+    selinux_labels_end();
+
     if (ret != EOK) {
         ERROR("Unable to restore [%s] [%d]: %s", name, ret, strerror(ret));
     }
 
+    authselect_archive_free(archive);
     free(confpath);
     free(path);
 
     return ret;
 }
+
+/**
+ * File or directory that takes space in the backup directory. Files are
+ * shared between backups, therefore each inode is counted only once.
+ */
+struct authselect_backup_inode {
+    dev_t dev;
+    ino_t ino;
+    uint64_t bytes;
+    unsigned int refs;
+};
+
+struct authselect_backup_usage {
+    struct authselect_backup_inode *inodes;
+    size_t count;
+    size_t capacity;
+};
+
+struct authselect_backup_entry {
+    struct dir_item *item;
+
+    /* Indexes of inodes that are used by this backup. */
+    size_t *inodes;
+    size_t num_inodes;
+
+    bool keep;
+    bool remove;
+};
+
+static errno_t
+authselect_backup_usage_add(struct authselect_backup_usage *usage,
+                            struct authselect_backup_entry *entry,
+                            const struct stat *statbuf)
+{
+    struct authselect_backup_inode *inodes;
+    size_t *indexes;
+    size_t i;
+
+    for (i = 0; i < usage->count; i++) {
+        if (usage->inodes[i].dev == statbuf->st_dev
+                && usage->inodes[i].ino == statbuf->st_ino) {
+            break;
+        }
+    }
+
+    if (i == usage->count) {
+        if (usage->count == usage->capacity) {
+            usage->capacity = usage->capacity == 0 ? 64 : usage->capacity * 2;
+            inodes = realloc(usage->inodes, sizeof(*inodes) * usage->capacity);
+            if (inodes == NULL) {
+                return ENOMEM;
+            }
+
+            usage->inodes = inodes;
+        }
+
+        usage->inodes[i].dev = statbuf->st_dev;
+        usage->inodes[i].ino = statbuf->st_ino;
+        usage->inodes[i].bytes = (uint64_t)statbuf->st_blocks * 512;
+        usage->inodes[i].refs = 0;
+        usage->count++;
+    }
+
+    indexes = realloc(entry->inodes, sizeof(size_t) * (entry->num_inodes + 1));
+    if (indexes == NULL) {
+        return ENOMEM;
+    }
+
+    usage->inodes[i].refs++;
+    indexes[entry->num_inodes] = i;
+    entry->inodes = indexes;
+    entry->num_inodes++;
+
+    return EOK;
+}
+
+static errno_t
+authselect_backup_usage_scan(struct authselect_backup_usage *usage,
+                             struct authselect_backup_entry *entry)
+{
+    struct dir_item *files;
+    size_t count;
+    char *path;
+    errno_t ret;
+    size_t i;
+
+    ret = authselect_backup_usage_add(usage, entry, &entry->item->statbuf);
+    if (ret != EOK || S_ISREG(entry->item->statbuf.st_mode)) {
+        return ret;
+    }
+
+    path = format("%s/%s", DIR_BACKUP, entry->item->name);
+    if (path == NULL) {
+        return ENOMEM;
+    }
+
+    ret = dir_list_stat(path, DIR_LIST_FILES, &files, &count, NULL);
+    free(path);
+    if (ret != EOK) {
+        return ret;
+    }
+
+    for (i = 0; i < count; i++) {
+        ret = authselect_backup_usage_add(usage, entry, &files[i].statbuf);
+        if (ret != EOK) {
+            break;
+        }
+    }
+
+    dir_items_free(files, count);
+
+    return ret;
+}
+
+static uint64_t
+authselect_backup_usage_total(struct authselect_backup_usage *usage)
+{
+    uint64_t total = 0;
+    size_t i;
+
+    for (i = 0; i < usage->count; i++) {
+        if (usage->inodes[i].refs > 0) {
+            total += usage->inodes[i].bytes;
+        }
+    }
+
+    return total;
+}
+
+/**
+ * Drop references of a removed backup and return the number of bytes that
+ * are freed by removing it.
+ */
+static uint64_t
+authselect_backup_usage_release(struct authselect_backup_usage *usage,
+                                struct authselect_backup_entry *entry)
+{
+    struct authselect_backup_inode *inode;
+    uint64_t freed = 0;
+    size_t i;
+
+    for (i = 0; i < entry->num_inodes; i++) {
+        inode = &usage->inodes[entry->inodes[i]];
+        inode->refs--;
+        if (inode->refs == 0) {
+            freed += inode->bytes;
+        }
+    }
+
+    return freed;
+}
+
+/**
+ * Keep the newest backup of each of the @num most recent periods. Period of
+ * a backup is given by formatting its creation time with @period_format.
+ * Entries are sorted from the oldest to the newest.
+ */
+static void
+authselect_backup_keep_periods(struct authselect_backup_entry *entries,
+                               size_t count,
+                               const char *period_format,
+                               unsigned int num)
+{
+    char period[64] = {'\0'};
+    char last[64] = {'\0'};
+    unsigned int kept = 0;
+    struct tm tm;
+    size_t i;
+
+    for (i = count; i > 0 && kept < num; i--) {
+        if (localtime_r(&entries[i - 1].item->statbuf.st_ctim.tv_sec,
+                        &tm) == NULL) {
+            continue;
+        }
+
+        if (strftime(period, sizeof(period), period_format, &tm) == 0) {
+            continue;
+        }
+
+        if (strcmp(period, last) == 0) {
+            continue;
+        }
+
+        entries[i - 1].keep = true;
+        strcpy(last, period);
+        kept++;
+    }
+}
+
+_PUBLIC_ int
+authselect_backup_gc(unsigned int keep_last,
+                     unsigned int keep_daily,
+                     unsigned int keep_weekly,
+                     unsigned long long max_bytes,
+                     bool dry_run,
+                     char ***_removed)
+{
+    struct authselect_backup_usage usage = {NULL, 0, 0};
+    struct authselect_backup_entry *entries = NULL;
+    struct dir_item *items = NULL;
+    char **removed = NULL;
+    size_t num_entries = 0;
+    size_t num_removed = 0;
+    size_t count = 0;
+    uint64_t total;
+    int dirfd = -1;
+    errno_t ret;
+    size_t i;
+
+    removed = string_array_create(0);
+    if (removed == NULL) {
+        return ENOMEM;
+    }
+
+    ret = dir_list_stat(DIR_BACKUP,
+                        DIR_LIST_DIRS | DIR_LIST_FILES | DIR_LIST_SORT_BY_CTIME,
+                        &items, &count, &dirfd);
+    if (ret == ENOENT) {
+        INFO("There are no backups");
+        *_removed = removed;
+        return EOK;
+    } else if (ret != EOK) {
+        ERROR("Unable to list directory [%s] [%d]: %s",
+              DIR_BACKUP, ret, strerror(ret));
+        goto done;
+    }
+
+    entries = malloc_zero_array(struct authselect_backup_entry, count);
+    if (entries == NULL) {
+        ret = ENOMEM;
+        goto done;
+    }
+
+    for (i = 0; i < count; i++) {
+        if (strcmp(items[i].name, FILE_BACKUP_OBJECTS) == 0) {
+            continue;
+        }
+
+        if (S_ISREG(items[i].statbuf.st_mode)
+                && !authselect_backup_is_archive(items[i].name)) {
+            continue;
+        }
+
+        entries[num_entries].item = &items[i];
+        num_entries++;
+    }
+
+    /* Without any rule, all backups are kept unless they take too much
+     * space. */
+    if (keep_last == 0 && keep_daily == 0 && keep_weekly == 0) {
+        for (i = 0; i < num_entries; i++) {
+            entries[i].keep = true;
+        }
+    }
+
+    for (i = num_entries; i > 0 && num_entries - i < keep_last; i--) {
+        entries[i - 1].keep = true;
+    }
+
+    authselect_backup_keep_periods(entries, num_entries, "%Y-%m-%d",
+                                   keep_daily);
+    authselect_backup_keep_periods(entries, num_entries, "%G-%V",
+                                   keep_weekly);
+
+    if (max_bytes > 0) {
+        for (i = 0; i < num_entries; i++) {
+            ret = authselect_backup_usage_scan(&usage, &entries[i]);
+            if (ret != EOK) {
+                ERROR("Unable to compute size of backup [%s] [%d]: %s",
+                      entries[i].item->name, ret, strerror(ret));
+                goto done;
+            }
+        }
+    }
+
+    for (i = 0; i < num_entries; i++) {
+        if (!entries[i].keep) {
+            entries[i].remove = true;
+            authselect_backup_usage_release(&usage, &entries[i]);
+        }
+    }
+
+    /* Remove the oldest backups until they fit, the newest is always
+     * kept. */
+    if (max_bytes > 0) {
+        total = authselect_backup_usage_total(&usage);
+        for (i = 0; i + 1 < num_entries && total > max_bytes; i++) {
+            if (entries[i].remove) {
+                continue;
+            }
+
+            entries[i].remove = true;
+            total -= authselect_backup_usage_release(&usage, &entries[i]);
+        }
+
+        INFO("Backups will take %llu bytes", (unsigned long long)total);
+    }
+
+    for (i = 0; i < num_entries; i++) {
+        if (!entries[i].remove) {
+            continue;
+        }
+
+        if (!dry_run) {
+            INFO("Removing backup [%s]", entries[i].item->name);
+            if (S_ISREG(entries[i].item->statbuf.st_mode)) {
+                ret = unlinkat(dirfd, entries[i].item->name, 0) == 0
+                      ? EOK : errno;
+            } else {
+                ret = dir_remove_at(dirfd, entries[i].item->name);
+            }
+
+            if (ret != EOK && ret != ENOENT) {
+                ERROR("Unable to remove backup [%s] [%d]: %s",
+                      entries[i].item->name, ret, strerror(ret));
+                goto done;
+            }
+        }
+
+        removed = string_array_add_value(removed, entries[i].item->name,
+                                         false);
+        if (removed == NULL) {
+            ret = ENOMEM;
+            goto done;
+        }
+
+        num_removed++;
+    }
+
+    *_removed = removed;
+    removed = NULL;
+
+    ret = EOK;
+
+done:
+    /* Objects of backups that were removed before an error are not needed
+     * either. */
+    if (!dry_run && num_removed > 0) {
+        authselect_objects_prune();
+    }
+
+    for (i = 0; i < num_entries; i++) {
+        free(entries[i].inodes);
+    }
+
+    string_array_free(removed);
+    dir_items_free(items, count);
+    free(usage.inodes);
+    free(entries);
+
+    if (dirfd != -1) {
+        close(dirfd);
+    }
+
+    return ret;
+}
@@ -0,0 +1,242 @@
+/*
+    Authors:
+        Pavel Březina <pbrezina@redhat.com>
+
+    Copyright (C) 2018 Red Hat
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "authselect.h"
+#include "common/common.h"
+#include "lib/constants.h"
+#include "lib/ctx/ctx.h"
+#include "lib/profiles/profiles.h"
+#include "lib/util/util.h"
+
+_PUBLIC_ int
+authselect_ctx_create(struct authselect_ctx **_ctx)
+{
+    struct authselect_ctx *prev;
+    struct authselect_ctx *ctx;
+    errno_t ret;
+
+    ctx = malloc_zero(struct authselect_ctx);
+    if (ctx == NULL) {
+        return ENOMEM;
+    }
+
+    prev = authselect_ctx_enter(ctx);
+    ret = authselect_ctx_init(ctx);
+    authselect_ctx_leave(prev);
+    if (ret != EOK) {
+        free(ctx);
+        return ret;
+    }
+
+    *_ctx = ctx;
+
+    return EOK;
+}
+
+_PUBLIC_ void
+authselect_ctx_free(struct authselect_ctx *ctx)
+{
+    if (ctx == NULL) {
+        return;
+    }
+
+    authselect_ctx_destroy(ctx);
+    free(ctx);
+}
+
+_PUBLIC_ void
+authselect_ctx_set_debug_fn(struct authselect_ctx *ctx,
+                            authselect_debug_fn fn,
+                            void *pvt)
+{
+    ctx->has_debug_fn = true;
+    ctx->debug_fn = fn;
+    ctx->debug_pvt = pvt;
+}
+
+_PUBLIC_ void
+authselect_ctx_set_threads(struct authselect_ctx *ctx,
+                           unsigned int threads)
+{
+    ctx->has_threads = true;
+    ctx->threads = threads == 0 ? 1 : threads;
+}
+
+_PUBLIC_ void
+authselect_ctx_set_dconf_async(struct authselect_ctx *ctx,
+                               bool async)
+{
+    ctx->has_dconf_async = true;
+    ctx->dconf_async = async;
+}
+
+_PUBLIC_ int
+authselect_ctx_dconf_wait(struct authselect_ctx *ctx)
+{
+    struct authselect_ctx *prev;
+    errno_t ret;
+
+    prev = authselect_ctx_enter(ctx);
+    ret = authselect_profile_dconf_wait();
+    authselect_ctx_leave(prev);
+
+    return ret;
+}
+
+_PUBLIC_ int
+authselect_ctx_set_root(struct authselect_ctx *ctx,
+                        const char *root)
+{
+    struct authselect_root *newroot = NULL;
+    struct authselect_ctx *prev;
+    errno_t ret;
+
+    if (root != NULL) {
+        prev = authselect_ctx_enter(ctx);
+        ret = authselect_root_create(root, &newroot);
+        authselect_ctx_leave(prev);
+        if (ret != EOK) {
+            return ret;
+        }
+    }
+
+    return authselect_ctx_change_root(ctx, newroot);
+}
+
+_PUBLIC_ char **
+authselect_ctx_list(struct authselect_ctx *ctx)
+{
+    struct authselect_ctx *prev;
+    char **profiles;
+    errno_t ret;
+
+    prev = authselect_ctx_enter(ctx);
+    authselect_ctx_refresh(ctx);
+
+    ret = authselect_ctx_cache_list(ctx, &profiles);
+    profiles = ret == EOK ? string_array_copy(profiles, false) : NULL;
+
+    authselect_ctx_leave(prev);
+
+    return profiles;
+}
+
+_PUBLIC_ int
+authselect_ctx_profile(struct authselect_ctx *ctx,
+                       const char *profile_id,
+                       struct authselect_profile **_profile)
+{
+    struct authselect_ctx *prev;
+    errno_t ret;
+
+    prev = authselect_ctx_enter(ctx);
+    authselect_ctx_refresh(ctx);
+    ret = authselect_ctx_cache_profile(ctx, profile_id, _profile);
+    authselect_ctx_leave(prev);
+
+    return ret;
+}
+
+_PUBLIC_ int
+authselect_ctx_files(struct authselect_ctx *ctx,
+                     const char *profile_id,
+                     const char **features,
+                     struct authselect_files **_files)
+{
+    struct authselect_profile *profile;
+    struct authselect_ctx *prev;
+    errno_t ret;
+
+    prev = authselect_ctx_enter(ctx);
+    authselect_ctx_refresh(ctx);
+
+    ret = authselect_ctx_cache_profile(ctx, profile_id, &profile);
+    if (ret == EOK) {
+        ret = authselect_profile_files(profile, features, _files);
+        authselect_profile_free(profile);
+    }
+
+    authselect_ctx_leave(prev);
+
+    return ret;
+}
+
+_PUBLIC_ int
+authselect_ctx_current_configuration(struct authselect_ctx *ctx,
+                                     char **_profile_id,
+                                     char ***_features)
+{
+    struct authselect_ctx *prev;
+    const char *profile_id;
+    char **features;
+    char *id = NULL;
+    errno_t ret;
+
+    prev = authselect_ctx_enter(ctx);
+    authselect_ctx_refresh(ctx);
+
+    ret = authselect_ctx_cache_config(ctx, &profile_id, &features);
+    if (ret != EOK) {
+        goto done;
+    }
+
+    id = strdup(profile_id);
+    if (id == NULL) {
+        ret = ENOMEM;
+        goto done;
+    }
+
+    if (_features != NULL) {
+        *_features = string_array_copy(features, false);
+        if (*_features == NULL) {
+            ret = ENOMEM;
+            goto done;
+        }
+    }
+
+    *_profile_id = id;
+    id = NULL;
+
+    ret = EOK;
+
+done:
+    free(id);
+    authselect_ctx_leave(prev);
+
+    return ret;
+}
+
+_PUBLIC_ int
+authselect_ctx_validate_configuration(struct authselect_ctx *ctx,
+                                      bool *_is_valid)
+{
+    struct authselect_ctx *prev;
+    errno_t ret;
+
+    prev = authselect_ctx_enter(ctx);
+    authselect_ctx_refresh(ctx);
+    ret = authselect_ctx_cache_validation(ctx, _is_valid);
+    authselect_ctx_leave(prev);
+
+    return ret;
+}
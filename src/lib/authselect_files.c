@@ -23,32 +23,103 @@
 
 #include "authselect.h"
 #include "lib/constants.h"
+#include "lib/util/util.h"
+#include "lib/daemon/daemon.h"
 #include "lib/files/files.h"
 #include "lib/profiles/profiles.h"
 
+_PUBLIC_ int
+authselect_profile_files(const struct authselect_profile *profile,
+                         const char **features,
+                         struct authselect_files **_files)
+{
+    if (profile == NULL) {
+        return EINVAL;
+    }
+
+    if (profile->templates == NULL) {
+        ERROR("Profile [%s] was loaded without templates", profile->id);
+        return EINVAL;
+    }
+
+    return authselect_system_generate(features, profile->templates, _files);
+}
+
 _PUBLIC_ int
 authselect_files(const char *profile_id,
                  const char **features,
                  struct authselect_files **_files)
 {
     struct authselect_profile *profile;
-    struct authselect_files *files;
     errno_t ret;
 
+    ret = authselect_daemon_files(profile_id, features, _files);
+    if (ret != ENOTCONN) {
+        return ret;
+    }
+
     ret = authselect_profile(profile_id, &profile);
     if (ret != EOK) {
         return ret;
     }
 
-    ret = authselect_system_generate(features, profile->files, &files);
+    ret = authselect_profile_files(profile, features, _files);
     authselect_profile_free(profile);
+
+    return ret;
+}
+
+_PUBLIC_ int
+authselect_files_batch(const char *profile_id,
+                       const char ***features,
+                       struct authselect_files ***_files)
+{
+    struct authselect_profile *profile;
+    struct authselect_files **files;
+    errno_t ret;
+    size_t count;
+    size_t i;
+
+    if (features == NULL) {
+        return EINVAL;
+    }
+
+    count = 0;
+    while (features[count] != NULL) {
+        count++;
+    }
+
+    ret = authselect_profile(profile_id, &profile);
     if (ret != EOK) {
         return ret;
     }
 
+    files = malloc_zero_array(struct authselect_files *, count + 1);
+    if (files == NULL) {
+        ret = ENOMEM;
+        goto done;
+    }
+
+    for (i = 0; i < count; i++) {
+        ret = authselect_system_generate(features[i], profile->templates,
+                                         &files[i]);
+        if (ret != EOK) {
+            goto done;
+        }
+    }
+
     *_files = files;
 
-    return EOK;
+    ret = EOK;
+
+done:
+    if (ret != EOK) {
+        authselect_files_batch_free(files);
+    }
+
+    authselect_profile_free(profile);
+
+    return ret;
 }
 
 _PUBLIC_ const char *
@@ -134,10 +205,21 @@ authselect_files_dconf_lock(const struct authselect_files *files)
 _PUBLIC_ void
 authselect_files_free(struct authselect_files *files)
 {
+    size_t i;
+
     if (files == NULL) {
         return;
     }
 
+    if (files->views != NULL) {
+        for (i = 0; files->views[i] != NULL; i++) {
+            textfile_unmap(files->views[i]);
+        }
+
+        free(files->views);
+        goto done;
+    }
+
     if (files->systemauth != NULL) {
         free(files->systemauth);
     }
@@ -170,7 +252,24 @@ authselect_files_free(struct authselect_files *files)
         free(files->dconflock);
     }
 
+done:
     memset(files, 0, sizeof(struct authselect_files));
 
     free(files);
 }
+
+_PUBLIC_ void
+authselect_files_batch_free(struct authselect_files **files)
+{
+    size_t i;
+
+    if (files == NULL) {
+        return;
+    }
+
+    for (i = 0; files[i] != NULL; i++) {
+        authselect_files_free(files[i]);
+    }
+
+    free(files);
+}
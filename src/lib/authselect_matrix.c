@@ -0,0 +1,239 @@
+/*
+    Authors:
+        Pavel Březina <pbrezina@redhat.com>
+
+    Copyright (C) 2018 Red Hat
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "authselect.h"
+#include "lib/constants.h"
+#include "lib/paths.h"
+#include "lib/util/util.h"
+#include "lib/files/files.h"
+#include "lib/profiles/profiles.h"
+
+struct authselect_matrix {
+    const char *dirname;
+    const char *filename;
+
+    /* Hashes of content already written for the current file. */
+    char **hashes;
+
+    /* Content of the mapping table. */
+    char *table;
+    size_t length;
+};
+
+static errno_t
+authselect_matrix_add_row(struct authselect_matrix *matrix,
+                          const char *hash,
+                          const struct feature_table *table,
+                          const struct feature_set *features)
+{
+    const char *name;
+    size_t len;
+    char *row;
+    char *tmp;
+    unsigned int id;
+
+    row = format("%s %s", matrix->filename, hash);
+    if (row == NULL) {
+        return ENOMEM;
+    }
+
+    for (id = 0; id < feature_table_count(table); id++) {
+        if (!feature_set_has(features, id)) {
+            continue;
+        }
+
+        name = feature_table_name(table, id);
+        tmp = format("%s %s", row, name);
+        free(row);
+        if (tmp == NULL) {
+            return ENOMEM;
+        }
+        row = tmp;
+    }
+
+    len = strlen(row);
+    tmp = realloc_array(matrix->table, char, matrix->length + len + 2);
+    if (tmp == NULL) {
+        free(row);
+        return ENOMEM;
+    }
+
+    memcpy(tmp + matrix->length, row, len);
+    matrix->length += len;
+    tmp[matrix->length++] = '\n';
+    tmp[matrix->length] = '\0';
+    matrix->table = tmp;
+    free(row);
+
+    return EOK;
+}
+
+static errno_t
+authselect_matrix_write_variant(const struct template *template,
+                                const struct feature_set *features,
+                                void *pvt)
+{
+    struct authselect_matrix *matrix = pvt;
+    char hash[SHA256_HEX_SIZE];
+    char *content;
+    char *path = NULL;
+    char **hashes;
+    errno_t ret;
+
+    content = template_render_set(template, features);
+    if (content == NULL) {
+        return ENOMEM;
+    }
+
+    sha256_hex(content, strlen(content), hash);
+
+    /* Different sets of features may produce the same content. */
+    if (string_array_has_value(matrix->hashes, hash)) {
+        ret = EOK;
+        goto done;
+    }
+
+    hashes = string_array_add_value(matrix->hashes, hash, false);
+    if (hashes == NULL) {
+        ret = ENOMEM;
+        goto done;
+    }
+    matrix->hashes = hashes;
+
+    path = format("%s/%s", matrix->dirname, hash);
+    if (path == NULL) {
+        ret = ENOMEM;
+        goto done;
+    }
+
+    /* The same content may be shared by more files. */
+    ret = file_exists(path);
+    if (ret == ENOENT) {
+        ret = textfile_write(path, content, AUTHSELECT_FILE_MODE);
+    }
+    if (ret != EOK) {
+        ERROR("Unable to write [%s] [%d]: %s", path, ret, strerror(ret));
+        goto done;
+    }
+
+    ret = authselect_matrix_add_row(matrix, hash,
+                                    template_get_feature_table(template),
+                                    features);
+
+done:
+    free(content);
+    free(path);
+
+    return ret;
+}
+
+_PUBLIC_ int
+authselect_profile_matrix(const char *profile_id,
+                          const char *dirname)
+{
+    struct authselect_matrix matrix = {0};
+    struct authselect_profile *profile;
+    struct authselect_templates *templates;
+    char *path = NULL;
+    errno_t ret;
+    int i;
+
+    ret = authselect_profile(profile_id, &profile);
+    if (ret != EOK) {
+        return ret;
+    }
+
+    templates = profile->templates;
+    struct {
+        const char *filename;
+        const struct template *template;
+    } files[] = {
+        {FILE_SYSTEM,      templates->systemauth},
+        {FILE_PASSWORD,    templates->passwordauth},
+        {FILE_SMARTCARD,   templates->smartcardauth},
+        {FILE_FINGERPRINT, templates->fingerprintauth},
+        {FILE_POSTLOGIN,   templates->postlogin},
+        {FILE_NSSWITCH,    templates->nsswitch},
+        {FILE_DCONF_DB,    templates->dconfdb},
+        {FILE_DCONF_LOCK,  templates->dconflock},
+        {NULL, NULL}
+    };
+
+    path = format("%s/%s", dirname, "matrix");
+    if (path == NULL) {
+        ret = ENOMEM;
+        goto done;
+    }
+
+    ret = file_make_path(dirname, AUTHSELECT_DIR_MODE);
+    if (ret != EOK) {
+        ERROR("Unable to create [%s] [%d]: %s", dirname, ret, strerror(ret));
+        goto done;
+    }
+
+    matrix.dirname = dirname;
+    for (i = 0; files[i].filename != NULL; i++) {
+        if (files[i].template == NULL) {
+            continue;
+        }
+
+        matrix.filename = files[i].filename;
+        matrix.hashes = string_array_create(10);
+        if (matrix.hashes == NULL) {
+            ret = ENOMEM;
+            goto done;
+        }
+
+        ret = template_walk(files[i].template,
+                            authselect_matrix_write_variant, &matrix);
+        if (ret != EOK) {
+            ERROR("Unable to generate variants of [%s] [%d]: %s",
+                  files[i].filename, ret, strerror(ret));
+            goto done;
+        }
+
+        INFO("Found %d variants of [%s]", string_array_count(matrix.hashes),
+             files[i].filename);
+
+        string_array_free(matrix.hashes);
+        matrix.hashes = NULL;
+    }
+
+    ret = textfile_write(path, matrix.table == NULL ? "" : matrix.table,
+                         AUTHSELECT_FILE_MODE);
+    if (ret != EOK) {
+        ERROR("Unable to write [%s] [%d]: %s", path, ret, strerror(ret));
+        goto done;
+    }
+
+    ret = EOK;
+
+done:
+    string_array_free(matrix.hashes);
+    free(matrix.table);
+    free(path);
+    authselect_profile_free(profile);
+
+    return ret;
+}
@@ -67,3 +67,9 @@ authselect_path_dconf_lock()
 {
     return PATH_SYMLINK_DCONF_LOCK;
 }
+
+_PUBLIC_ const char *
+authselect_path_backups()
+{
+    return DIR_BACKUP;
+}
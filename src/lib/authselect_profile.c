@@ -26,6 +26,7 @@
 #include "common/common.h"
 #include "lib/constants.h"
 #include "lib/util/util.h"
+#include "lib/daemon/daemon.h"
 #include "lib/profiles/profiles.h"
 
 _PUBLIC_ int
@@ -36,6 +37,20 @@ authselect_profile(const char *profile_id,
                                    _profile);
 }
 
+_PUBLIC_ int
+authselect_profile_summary(const char *profile_id,
+                           struct authselect_profile **_profile)
+{
+    errno_t ret;
+
+    ret = authselect_daemon_profile(profile_id, _profile);
+    if (ret != ENOTCONN) {
+        return ret;
+    }
+
+    return authselect_profile_index_read(profile_id, _profile);
+}
+
 _PUBLIC_ const char *
 authselect_profile_id(const struct authselect_profile *profile)
 {
@@ -99,7 +114,13 @@ authselect_profile_nsswitch_maps(const struct authselect_profile *profile,
         return NULL;
     }
 
-    template = template_generate(profile->files->nsswitch, features);
+    if (profile->templates == NULL) {
+        ERROR("Profile [%s] was loaded without templates", profile->id);
+        return NULL;
+    }
+
+    template = profile->templates->nsswitch == NULL ? strdup("")
+               : template_render(profile->templates->nsswitch, features);
     if (template == NULL) {
         ERROR("Unable to generate nsswitch.conf");
         return NULL;
@@ -119,33 +140,47 @@ _PUBLIC_ char **
 authselect_profile_features(const struct authselect_profile *profile)
 {
     char **features;
-    char **array;
     errno_t ret;
-    int i;
+    size_t i;
 
     if (profile == NULL) {
         return NULL;
     }
 
+    /* Profile was loaded from the profile index. */
+    if (profile->templates == NULL) {
+        features = string_array_copy(profile->features, false);
+        if (features == NULL) {
+            ERROR("Unable to obtain feature list (out of memory)");
+        }
+
+        return features;
+    }
+
     features = string_array_create(10);
     if (features == NULL) {
         ERROR("Unable to create array (out of memory)");
         return NULL;
     }
 
-    struct authselect_generated files[] = PROFILE_FILES(profile->files);
+    const struct template *templates[] = {
+        profile->templates->systemauth,
+        profile->templates->passwordauth,
+        profile->templates->fingerprintauth,
+        profile->templates->smartcardauth,
+        profile->templates->postlogin,
+        profile->templates->nsswitch,
+        profile->templates->dconfdb,
+        profile->templates->dconflock
+    };
 
-    for (i = 0; files[i].path != NULL; i++) {
-        array = template_list_features(files[i].content);
-        if (array == NULL) {
-            ERROR("Unable to obtain feature list (out of memory)");
-            ret = ENOMEM;
-            goto done;
+    for (i = 0; i < sizeof(templates) / sizeof(templates[0]); i++) {
+        if (templates[i] == NULL) {
+            continue;
         }
 
-        features = string_array_concat(features, array, true);
-        string_array_free(array);
-
+        features = string_array_concat(features,
+                       (char **)template_get_features(templates[i]), true);
         if (features == NULL) {
             ERROR("Unable to obtain feature list (out of memory)");
             ret = ENOMEM;
@@ -166,6 +201,14 @@ done:
     return features;
 }
 
+struct authselect_profile *
+authselect_profile_ref(struct authselect_profile *profile)
+{
+    __atomic_add_fetch(&profile->refs, 1, __ATOMIC_RELAXED);
+
+    return profile;
+}
+
 _PUBLIC_ void
 authselect_profile_free(struct authselect_profile *profile)
 {
@@ -173,6 +216,11 @@ authselect_profile_free(struct authselect_profile *profile)
         return;
     }
 
+    /* Someone else still holds a reference. */
+    if (__atomic_fetch_sub(&profile->refs, 1, __ATOMIC_ACQ_REL) != 0) {
+        return;
+    }
+
     if (profile->id != NULL) {
         free(profile->id);
     }
@@ -193,6 +241,8 @@ authselect_profile_free(struct authselect_profile *profile)
         free(profile->requirements);
     }
 
+    string_array_free(profile->features);
+    authselect_system_templates_free(profile->templates);
     authselect_files_free(profile->files);
 
     memset(profile, 0, sizeof(struct authselect_profile));
@@ -29,6 +29,8 @@
 #define AUTHSELECT_DIR_MODE        0755
 #define AUTHSELECT_FILE_MODE       0644
 #define AUTHSELECT_FILE_SIZE_LIMIT 4096
+#define AUTHSELECT_CACHE_SIZE_LIMIT (AUTHSELECT_FILE_SIZE_LIMIT * 32)
 #define AUTHSELECT_CUSTOM_PREFIX   "custom/"
+#define AUTHSELECT_DCONF_TIMEOUT   60
 
 #endif /* _AUTHSELECT_PRIVATE_H_ */
@@ -0,0 +1,685 @@
+/*
+    Authors:
+        Pavel Březina <pbrezina@redhat.com>
+
+    Copyright (C) 2018 Red Hat
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+#include "authselect.h"
+#include "common/common.h"
+#include "lib/constants.h"
+#include "lib/ctx/ctx.h"
+#include "lib/files/files.h"
+#include "lib/profiles/profiles.h"
+#include "lib/util/util.h"
+
+#define AUTHSELECT_CTX_WATCH_MASK                                             \
+    (IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE           \
+     | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF            \
+     | IN_ONLYDIR)
+
+enum authselect_ctx_watch_type {
+    /* Directory that contains profiles. */
+    AUTHSELECT_CTX_WATCH_PROFILES,
+
+    /* Directory of a cached profile. */
+    AUTHSELECT_CTX_WATCH_PROFILE,
+
+    /* Directory with authselect configuration file. */
+    AUTHSELECT_CTX_WATCH_CONFIG,
+
+    /* Other directory that is checked during configuration validation. */
+    AUTHSELECT_CTX_WATCH_SYSTEM
+};
+
+struct authselect_ctx_watch {
+    int wd;
+    enum authselect_ctx_watch_type type;
+
+    /* Profile id prefix for profile directory, profile id for profile. */
+    char *id;
+
+    /* If set, only changes of these files are of interest. */
+    char **names;
+};
+
+struct authselect_ctx_profile {
+    struct authselect_profile *profile;
+    struct authselect_ctx_profile *next;
+};
+
+static __thread struct authselect_ctx *authselect_ctx_thread = NULL;
+
+static void
+authselect_ctx_set_thread(struct authselect_ctx *ctx)
+{
+    authselect_ctx_thread = ctx;
+
+    if (ctx == NULL || !ctx->has_debug_fn) {
+        set_thread_debug_fn(false, NULL, NULL);
+        return;
+    }
+
+    set_thread_debug_fn(true, ctx->debug_fn, ctx->debug_pvt);
+}
+
+struct authselect_ctx *
+authselect_ctx_enter(struct authselect_ctx *ctx)
+{
+    struct authselect_ctx *prev = authselect_ctx_thread;
+
+    authselect_ctx_set_thread(ctx);
+
+    return prev;
+}
+
+void
+authselect_ctx_leave(struct authselect_ctx *prev)
+{
+    authselect_ctx_set_thread(prev);
+}
+
+struct authselect_ctx *
+authselect_ctx_current(void)
+{
+    return authselect_ctx_thread;
+}
+
+static void
+authselect_ctx_watch_free(struct authselect_ctx_watch *watch)
+{
+    free(watch->id);
+    string_array_free(watch->names);
+}
+
+/**
+ * Watch directory. Ownership of @id and @names is transferred to the
+ * context even on error.
+ */
+static errno_t
+authselect_ctx_watch(struct authselect_ctx *ctx,
+                     const char *path,
+                     enum authselect_ctx_watch_type type,
+                     char *id,
+                     char **names)
+{
+    struct authselect_ctx_watch *watches;
+    struct authselect_ctx_watch watch;
+    errno_t ret;
+    size_t i;
+
+    watch.wd = -1;
+    watch.type = type;
+    watch.id = id;
+    watch.names = names;
+
+    if ((type == AUTHSELECT_CTX_WATCH_PROFILES
+            || type == AUTHSELECT_CTX_WATCH_PROFILE) && id == NULL) {
+        ret = ENOMEM;
+        goto done;
+    }
+
+    watch.wd = inotify_add_watch(ctx->inotify, path,
+                                 AUTHSELECT_CTX_WATCH_MASK);
+    if (watch.wd == -1) {
+        ret = errno;
+        INFO("Unable to watch [%s] [%d]: %s", path, ret, strerror(ret));
+        goto done;
+    }
+
+    /* The same directory returns the same watch descriptor. */
+    for (i = 0; i < ctx->num_watches; i++) {
+        if (ctx->watches[i].wd == watch.wd) {
+            ret = EOK;
+            goto done;
+        }
+    }
+
+    watches = realloc_array(ctx->watches, struct authselect_ctx_watch,
+                            ctx->num_watches + 1);
+    if (watches == NULL) {
+        inotify_rm_watch(ctx->inotify, watch.wd);
+        ret = ENOMEM;
+        goto done;
+    }
+
+    watches[ctx->num_watches] = watch;
+    ctx->watches = watches;
+    ctx->num_watches++;
+
+    return EOK;
+
+done:
+    authselect_ctx_watch_free(&watch);
+    return ret;
+}
+
+static void
+authselect_ctx_watch_dirs(struct authselect_ctx *ctx)
+{
+    const char *nsswitch_link;
+    const char *nsswitch;
+    char *nsswitch_dir;
+    char **names;
+    errno_t ret;
+    int i;
+
+    const char *system_dirs[] = {
+        DIR_STATE,
+        DIR_DCONF,
+        DIR_DCONF_LOCKS,
+        NULL
+    };
+
+    ctx->profiles_unwatched = false;
+    ctx->config_unwatched = false;
+    ctx->system_unwatched = false;
+
+    ret = authselect_ctx_watch(ctx, DIR_DEFAULT_PROFILES,
+                               AUTHSELECT_CTX_WATCH_PROFILES,
+                               strdup(""), NULL);
+    ctx->profiles_unwatched |= (ret != EOK);
+
+    ret = authselect_ctx_watch(ctx, DIR_VENDOR_PROFILES,
+                               AUTHSELECT_CTX_WATCH_PROFILES,
+                               strdup(""), NULL);
+    ctx->profiles_unwatched |= (ret != EOK);
+
+    ret = authselect_ctx_watch(ctx, DIR_CUSTOM_PROFILES,
+                               AUTHSELECT_CTX_WATCH_PROFILES,
+                               strdup(AUTHSELECT_CUSTOM_PREFIX), NULL);
+    ctx->profiles_unwatched |= (ret != EOK);
+
+    ret = authselect_ctx_watch(ctx, DIR_CONFIG,
+                               AUTHSELECT_CTX_WATCH_CONFIG, NULL, NULL);
+    ctx->config_unwatched |= (ret != EOK);
+
+    for (i = 0; system_dirs[i] != NULL; i++) {
+        ret = authselect_ctx_watch(ctx, system_dirs[i],
+                                   AUTHSELECT_CTX_WATCH_SYSTEM, NULL, NULL);
+        ctx->system_unwatched |= (ret != EOK);
+    }
+
+    /* PAM directory contains many other files, watch only our symlinks. */
+    names = string_array_create(5);
+    if (names != NULL) {
+        names[0] = strdup(FILE_SYSTEM);
+        names[1] = strdup(FILE_PASSWORD);
+        names[2] = strdup(FILE_FINGERPRINT);
+        names[3] = strdup(FILE_SMARTCARD);
+        names[4] = strdup(FILE_POSTLOGIN);
+        if (string_array_count(names) != 5) {
+            string_array_free(names);
+            names = NULL;
+        }
+    }
+
+    if (names == NULL) {
+        ctx->system_unwatched = true;
+    } else {
+        ret = authselect_ctx_watch(ctx, DIR_PAM,
+                                   AUTHSELECT_CTX_WATCH_SYSTEM, NULL, names);
+        ctx->system_unwatched |= (ret != EOK);
+    }
+
+    nsswitch_link = PATH_SYMLINK_NSSWITCH;
+    nsswitch = strrchr(nsswitch_link, '/');
+    nsswitch_dir = strndup(nsswitch_link, nsswitch - nsswitch_link);
+    names = string_array_create(1);
+    if (names != NULL) {
+        names[0] = strdup(nsswitch + 1);
+    }
+
+    if (nsswitch_dir == NULL || names == NULL || names[0] == NULL) {
+        string_array_free(names);
+        ctx->system_unwatched = true;
+    } else {
+        ret = authselect_ctx_watch(ctx, nsswitch_dir,
+                                   AUTHSELECT_CTX_WATCH_SYSTEM, NULL, names);
+        ctx->system_unwatched |= (ret != EOK);
+    }
+
+    free(nsswitch_dir);
+}
+
+static void
+authselect_ctx_drop_validation(struct authselect_ctx *ctx)
+{
+    ctx->has_validation = false;
+}
+
+static void
+authselect_ctx_drop_config(struct authselect_ctx *ctx)
+{
+    free(ctx->profile_id);
+    string_array_free(ctx->features);
+
+    ctx->profile_id = NULL;
+    ctx->features = NULL;
+    ctx->has_config = false;
+
+    authselect_ctx_drop_validation(ctx);
+}
+
+static void
+authselect_ctx_drop_profile(struct authselect_ctx *ctx,
+                            const char *profile_id)
+{
+    struct authselect_ctx_profile **item;
+    struct authselect_ctx_profile *next;
+
+    for (item = &ctx->profiles; *item != NULL; item = &(*item)->next) {
+        if (strcmp((*item)->profile->id, profile_id) == 0) {
+            INFO("Profile [%s] was changed", profile_id);
+            next = (*item)->next;
+            authselect_profile_free((*item)->profile);
+            free(*item);
+            *item = next;
+            break;
+        }
+    }
+
+    /* Validation result depends on the selected profile. */
+    if (ctx->has_config && ctx->config_ret == EOK
+            && strcmp(ctx->profile_id, profile_id) == 0) {
+        authselect_ctx_drop_validation(ctx);
+    }
+}
+
+static void
+authselect_ctx_drop_profiles(struct authselect_ctx *ctx)
+{
+    struct authselect_ctx_profile *item;
+    struct authselect_ctx_profile *next;
+
+    string_array_free(ctx->list);
+    ctx->list = NULL;
+
+    for (item = ctx->profiles; item != NULL; item = next) {
+        next = item->next;
+        authselect_profile_free(item->profile);
+        free(item);
+    }
+
+    ctx->profiles = NULL;
+
+    authselect_ctx_drop_validation(ctx);
+}
+
+static void
+authselect_ctx_process_event(struct authselect_ctx *ctx,
+                             const struct inotify_event *event)
+{
+    struct authselect_ctx_watch *watch = NULL;
+    bool is_config;
+    char *id;
+    size_t i;
+
+    for (i = 0; i < ctx->num_watches; i++) {
+        if (ctx->watches[i].wd == event->wd) {
+            watch = &ctx->watches[i];
+            break;
+        }
+    }
+
+    if (watch == NULL) {
+        return;
+    }
+
+    switch (watch->type) {
+    case AUTHSELECT_CTX_WATCH_PROFILES:
+        string_array_free(ctx->list);
+        ctx->list = NULL;
+
+        if (event->len == 0) {
+            /* The directory itself was removed or moved. */
+            authselect_ctx_drop_profiles(ctx);
+            break;
+        }
+
+        /* Profile with this name may now be found elsewhere. */
+        id = format("%s%s", watch->id, event->name);
+        if (id == NULL) {
+            authselect_ctx_drop_profiles(ctx);
+            break;
+        }
+
+        authselect_ctx_drop_profile(ctx, id);
+        free(id);
+        break;
+    case AUTHSELECT_CTX_WATCH_PROFILE:
+        authselect_ctx_drop_profile(ctx, watch->id);
+        break;
+    case AUTHSELECT_CTX_WATCH_CONFIG:
+        is_config = event->len == 0 || strcmp(event->name, FILE_CONFIG) == 0;
+        if (is_config) {
+            authselect_ctx_drop_config(ctx);
+        } else {
+            authselect_ctx_drop_validation(ctx);
+        }
+        break;
+    case AUTHSELECT_CTX_WATCH_SYSTEM:
+        if (watch->names == NULL || event->len == 0
+                || string_array_has_value(watch->names, event->name)) {
+            authselect_ctx_drop_validation(ctx);
+        }
+        break;
+    }
+
+    if (!(event->mask & IN_IGNORED)) {
+        return;
+    }
+
+    /* The directory is not watched anymore. */
+    switch (watch->type) {
+    case AUTHSELECT_CTX_WATCH_PROFILES:
+        ctx->profiles_unwatched = true;
+        break;
+    case AUTHSELECT_CTX_WATCH_PROFILE:
+        break;
+    case AUTHSELECT_CTX_WATCH_CONFIG:
+        ctx->config_unwatched = true;
+        break;
+    case AUTHSELECT_CTX_WATCH_SYSTEM:
+        ctx->system_unwatched = true;
+        break;
+    }
+
+    authselect_ctx_watch_free(watch);
+    *watch = ctx->watches[--ctx->num_watches];
+}
+
+void
+authselect_ctx_refresh(struct authselect_ctx *ctx)
+{
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    const struct inotify_event *event;
+    ssize_t length;
+    ssize_t offset;
+
+    while (true) {
+        length = read(ctx->inotify, buffer, sizeof(buffer));
+        if (length == -1 && errno == EINTR) {
+            continue;
+        }
+
+        if (length <= 0) {
+            break;
+        }
+
+        for (offset = 0; offset < length;
+                offset += sizeof(struct inotify_event) + event->len) {
+            event = (const struct inotify_event *)(buffer + offset);
+
+            /* Some events were lost, we do not know what has changed. */
+            if (event->mask & IN_Q_OVERFLOW) {
+                INFO("Too many changes, dropping all cached data");
+                authselect_ctx_drop_profiles(ctx);
+                authselect_ctx_drop_config(ctx);
+                continue;
+            }
+
+            authselect_ctx_process_event(ctx, event);
+        }
+    }
+
+    /* Nothing is cached for directories that are not watched, try again
+     * since they might have been created. */
+    if (ctx->profiles_unwatched || ctx->config_unwatched
+            || ctx->system_unwatched) {
+        authselect_ctx_watch_dirs(ctx);
+    }
+}
+
+errno_t
+authselect_ctx_init(struct authselect_ctx *ctx)
+{
+    errno_t ret;
+
+    ctx->inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (ctx->inotify == -1) {
+        ret = errno;
+        ERROR("Unable to initialize inotify [%d]: %s", ret, strerror(ret));
+        return ret;
+    }
+
+    authselect_ctx_watch_dirs(ctx);
+
+    return EOK;
+}
+
+static void
+authselect_ctx_unwatch_dirs(struct authselect_ctx *ctx)
+{
+    size_t i;
+
+    for (i = 0; i < ctx->num_watches; i++) {
+        authselect_ctx_watch_free(&ctx->watches[i]);
+    }
+
+    free(ctx->watches);
+    ctx->watches = NULL;
+    ctx->num_watches = 0;
+
+    if (ctx->inotify != -1) {
+        close(ctx->inotify);
+        ctx->inotify = -1;
+    }
+}
+
+void
+authselect_ctx_destroy(struct authselect_ctx *ctx)
+{
+    authselect_profile_dconf_free(ctx->dconf);
+    authselect_ctx_drop_profiles(ctx);
+    authselect_ctx_drop_config(ctx);
+    authselect_ctx_unwatch_dirs(ctx);
+    authselect_root_free(ctx->root);
+    authselect_system_pool_free(ctx->pool);
+}
+
+errno_t
+authselect_ctx_change_root(struct authselect_ctx *ctx,
+                           struct authselect_root *root)
+{
+    struct authselect_ctx *prev;
+    errno_t ret;
+
+    authselect_ctx_drop_profiles(ctx);
+    authselect_ctx_drop_config(ctx);
+    authselect_ctx_unwatch_dirs(ctx);
+
+    authselect_root_free(ctx->root);
+    ctx->root = root;
+
+    /* Directories are watched within the new root. */
+    prev = authselect_ctx_enter(ctx);
+    ret = authselect_ctx_init(ctx);
+    authselect_ctx_leave(prev);
+
+    return ret;
+}
+
+errno_t
+authselect_ctx_cache_list(struct authselect_ctx *ctx,
+                          char ***_profiles)
+{
+    char **profiles;
+    errno_t ret;
+
+    if (ctx->list == NULL || ctx->profiles_unwatched) {
+        ret = authselect_profile_list(&profiles);
+        if (ret != EOK) {
+            return ret;
+        }
+
+        string_array_free(ctx->list);
+        ctx->list = profiles;
+    }
+
+    *_profiles = ctx->list;
+
+    return EOK;
+}
+
+errno_t
+authselect_ctx_cache_profile(struct authselect_ctx *ctx,
+                             const char *profile_id,
+                             struct authselect_profile **_profile)
+{
+    struct authselect_profile *profile;
+    struct authselect_ctx_profile *item;
+    errno_t ret;
+
+    for (item = ctx->profiles; item != NULL; item = item->next) {
+        if (strcmp(item->profile->id, profile_id) == 0) {
+            *_profile = authselect_profile_ref(item->profile);
+            return EOK;
+        }
+    }
+
+    ret = authselect_profile_read(profile_id, AUTHSELECT_PROFILE_ANY,
+                                  &profile);
+    if (ret != EOK) {
+        return ret;
+    }
+
+    *_profile = profile;
+
+    /* It is not possible to detect changes. */
+    if (ctx->profiles_unwatched) {
+        return EOK;
+    }
+
+    ret = authselect_ctx_watch(ctx, profile->path,
+                               AUTHSELECT_CTX_WATCH_PROFILE,
+                               strdup(profile_id), NULL);
+    if (ret != EOK) {
+        return EOK;
+    }
+
+    item = malloc_zero(struct authselect_ctx_profile);
+    if (item == NULL) {
+        return EOK;
+    }
+
+    item->profile = authselect_profile_ref(profile);
+    item->next = ctx->profiles;
+    ctx->profiles = item;
+
+    return EOK;
+}
+
+errno_t
+authselect_ctx_cache_config(struct authselect_ctx *ctx,
+                            const char **_profile_id,
+                            char ***_features)
+{
+    if (!ctx->has_config || ctx->config_unwatched) {
+        authselect_ctx_drop_config(ctx);
+        ctx->config_ret = authselect_config_read(&ctx->profile_id,
+                                                 &ctx->features);
+        ctx->has_config = true;
+    }
+
+    if (ctx->config_ret != EOK) {
+        return ctx->config_ret;
+    }
+
+    *_profile_id = ctx->profile_id;
+    *_features = ctx->features;
+
+    return EOK;
+}
+
+static bool
+authselect_ctx_validate_existing(struct authselect_ctx *ctx,
+                                 const char *profile_id,
+                                 const char **features,
+                                 bool *_cacheable)
+{
+    struct authselect_profile *profile;
+    struct authselect_ctx_profile *item;
+    struct authselect_files *files;
+    bool result;
+    errno_t ret;
+
+    ret = authselect_ctx_cache_profile(ctx, profile_id, &profile);
+    if (ret == EOK) {
+        ret = authselect_profile_files(profile, features, &files);
+    }
+    if (ret != EOK) {
+        ERROR("Unable to load profile [%s] [%d]: %s",
+              profile_id, ret, strerror(ret));
+        *_cacheable = !ctx->profiles_unwatched;
+        return false;
+    }
+
+    result = authselect_config_validate_files(files);
+
+    /* The result can be cached only if the profile changes are watched. */
+    *_cacheable = false;
+    for (item = ctx->profiles; item != NULL; item = item->next) {
+        if (item->profile == profile) {
+            *_cacheable = true;
+            break;
+        }
+    }
+
+    authselect_files_free(files);
+    authselect_profile_free(profile);
+
+    return result;
+}
+
+errno_t
+authselect_ctx_cache_validation(struct authselect_ctx *ctx,
+                                bool *_is_valid)
+{
+    const char *profile_id;
+    bool cacheable = true;
+    char **features;
+    errno_t ret;
+
+    if (ctx->has_validation && !ctx->config_unwatched
+            && !ctx->system_unwatched) {
+        *_is_valid = ctx->is_valid;
+        return ctx->validation_ret;
+    }
+
+    ret = authselect_ctx_cache_config(ctx, &profile_id, &features);
+    if (ret == ENOENT) {
+        ctx->is_valid = authselect_config_validate_non_existing();
+    } else if (ret == EOK) {
+        ctx->is_valid = authselect_ctx_validate_existing(ctx, profile_id,
+                            (const char **)features, &cacheable);
+    } else {
+        return ret;
+    }
+
+    ctx->validation_ret = ret;
+    ctx->has_validation = cacheable;
+
+    *_is_valid = ctx->is_valid;
+
+    return ret;
+}
@@ -0,0 +1,248 @@
+/*
+    Authors:
+        Pavel Březina <pbrezina@redhat.com>
+
+    Copyright (C) 2018 Red Hat
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _CTX_H_
+#define _CTX_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "authselect.h"
+#include "common/errno_t.h"
+
+struct authselect_root;
+struct authselect_profile;
+struct authselect_ctx_watch;
+struct authselect_ctx_profile;
+struct authselect_system_pool;
+struct authselect_profile_dconf;
+
+/**
+ * Library context. It holds state that is kept in memory between calls and
+ * invalidated when the underlying files change.
+ */
+struct authselect_ctx {
+    /**
+     * Debug function used by calls made with this context. If not set,
+     * the function set by authselect_set_debug_fn() is used.
+     */
+    bool has_debug_fn;
+    authselect_debug_fn debug_fn;
+    void *debug_pvt;
+
+    /**
+     * Root directory prefixed to all paths used by calls made with this
+     * context. If not set, the root set by authselect_set_root() is used.
+     */
+    struct authselect_root *root;
+
+    /**
+     * Number of threads used to generate files by calls made with this
+     * context. If not set, the number set by authselect_set_threads() is
+     * used. Worker threads are kept in @pool between calls.
+     */
+    bool has_threads;
+    unsigned int threads;
+    struct authselect_system_pool *pool;
+
+    /**
+     * Update dconf database in background. If not set, the mode set by
+     * authselect_set_dconf_async() is used. Updates started with this
+     * context are tracked in @dconf.
+     */
+    bool has_dconf_async;
+    bool dconf_async;
+    struct authselect_profile_dconf *dconf;
+
+    /**
+     * Inotify file descriptor used to detect changes.
+     */
+    int inotify;
+
+    /**
+     * Watched directories.
+     */
+    struct authselect_ctx_watch *watches;
+    size_t num_watches;
+
+    /**
+     * Some directory could not be watched, therefore the state that depends
+     * on it is not cached.
+     */
+    bool profiles_unwatched;
+    bool config_unwatched;
+    bool system_unwatched;
+
+    /**
+     * Cached profile list.
+     */
+    char **list;
+
+    /**
+     * Cached profiles.
+     */
+    struct authselect_ctx_profile *profiles;
+
+    /**
+     * Cached content of the authselect configuration file.
+     */
+    bool has_config;
+    errno_t config_ret;
+    char *profile_id;
+    char **features;
+
+    /**
+     * Cached result of configuration validation.
+     */
+    bool has_validation;
+    errno_t validation_ret;
+    bool is_valid;
+};
+
+/**
+ * Make @ctx the context of the calling thread. Library functions called
+ * until authselect_ctx_leave() use its settings.
+ *
+ * @param ctx           Context, may be NULL to use global settings.
+ *
+ * @return Previous context of the calling thread.
+ */
+struct authselect_ctx *
+authselect_ctx_enter(struct authselect_ctx *ctx);
+
+/**
+ * Restore previous context of the calling thread.
+ *
+ * @param prev          Context returned by authselect_ctx_enter().
+ */
+void
+authselect_ctx_leave(struct authselect_ctx *prev);
+
+/**
+ * Return context of the calling thread.
+ *
+ * New threads must enter the context of their creator to use the same
+ * settings.
+ *
+ * @return Context or NULL if global settings are used.
+ */
+struct authselect_ctx *
+authselect_ctx_current(void);
+
+/**
+ * Initialize context caches and start watching relevant directories.
+ *
+ * @param ctx           Zeroed context.
+ *
+ * @return EOK on success, other errno code on error.
+ */
+errno_t
+authselect_ctx_init(struct authselect_ctx *ctx);
+
+/**
+ * Release all resources held by the context but not the context itself.
+ *
+ * @param ctx           Context.
+ */
+void
+authselect_ctx_destroy(struct authselect_ctx *ctx);
+
+/**
+ * Use different root directory for all paths. Cached state is dropped and
+ * directories in the new root are watched.
+ *
+ * @param ctx           Context.
+ * @param root          New root directory, ownership is transferred to the
+ *                      context. NULL to use root set by authselect_set_root().
+ *
+ * @return EOK on success, other errno code on error.
+ */
+errno_t
+authselect_ctx_change_root(struct authselect_ctx *ctx,
+                           struct authselect_root *root);
+
+/**
+ * Process pending file system events and drop cached state that was
+ * affected by them. It also tries to watch directories that did not exist
+ * before.
+ *
+ * @param ctx           Context.
+ */
+void
+authselect_ctx_refresh(struct authselect_ctx *ctx);
+
+/**
+ * Return cached profile list or read it.
+ *
+ * @param ctx           Context.
+ * @param _profiles     Cached NULL-terminated profile list, it is owned by
+ *                      the context and valid until the next refresh.
+ *
+ * @return EOK on success, other errno code on error.
+ */
+errno_t
+authselect_ctx_cache_list(struct authselect_ctx *ctx,
+                          char ***_profiles);
+
+/**
+ * Return cached profile or read it.
+ *
+ * @param ctx           Context.
+ * @param profile_id    Profile identifier.
+ * @param _profile      New reference to the profile, it must be released
+ *                      with authselect_profile_free().
+ *
+ * @return EOK on success, ENOENT if the profile does not exist, other errno
+ *         code on error.
+ */
+errno_t
+authselect_ctx_cache_profile(struct authselect_ctx *ctx,
+                             const char *profile_id,
+                             struct authselect_profile **_profile);
+
+/**
+ * Return cached content of authselect configuration or read it.
+ *
+ * @param ctx           Context.
+ * @param _profile_id   Profile identifier, owned by the context.
+ * @param _features     Enabled features, owned by the context.
+ *
+ * @return EOK on success, ENOENT if there is no configuration, other errno
+ *         code on error.
+ */
+errno_t
+authselect_ctx_cache_config(struct authselect_ctx *ctx,
+                            const char **_profile_id,
+                            char ***_features);
+
+/**
+ * Return cached result of configuration validation or validate it.
+ *
+ * @param ctx           Context.
+ * @param _is_valid     True if the configuration is valid.
+ *
+ * @return EOK if the configuration exists, ENOENT if there is no
+ *         configuration, other errno code on error.
+ */
+errno_t
+authselect_ctx_cache_validation(struct authselect_ctx *ctx,
+                                bool *_is_valid);
+
+#endif /* _CTX_H_ */
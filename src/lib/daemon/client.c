@@ -0,0 +1,407 @@
+/*
+    Authors:
+        Pavel Březina <pbrezina@redhat.com>
+
+    Copyright (C) 2018 Red Hat
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+
+#include "common/common.h"
+#include "lib/constants.h"
+#include "lib/ctx/ctx.h"
+#include "lib/daemon/daemon.h"
+#include "lib/files/files.h"
+#include "lib/profiles/profiles.h"
+#include "lib/util/util.h"
+
+static bool authselect_daemon_enabled = false;
+
+void
+authselect_daemon_set_enabled(bool enabled)
+{
+    authselect_daemon_enabled = enabled;
+}
+
+static errno_t
+authselect_daemon_connect(int *_fd)
+{
+    struct sockaddr_un addr = {0};
+    struct timeval timeout = {0};
+    errno_t ret;
+    int fd;
+
+    addr.sun_family = AF_UNIX;
+    if (strlen(PATH_DAEMON_SOCKET) >= sizeof(addr.sun_path)) {
+        return ENAMETOOLONG;
+    }
+
+    strcpy(addr.sun_path, PATH_DAEMON_SOCKET);
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        return errno;
+    }
+
+    timeout.tv_sec = AUTHSELECTD_TIMEOUT;
+    ret = setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (ret == 0) {
+        ret = setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout,
+                         sizeof(timeout));
+    }
+    if (ret != 0) {
+        ret = errno;
+        close(fd);
+        return ret;
+    }
+
+    ret = connect(fd, (struct sockaddr *)&addr, sizeof(addr));
+    if (ret != 0) {
+        ret = errno;
+        close(fd);
+        return ret;
+    }
+
+    *_fd = fd;
+
+    return EOK;
+}
+
+static void
+authselect_daemon_request(struct pack *request,
+                          enum authselectd_command command)
+{
+    pack_string(request, AUTHSELECTD_MAGIC);
+    pack_uint64(request, AUTHSELECTD_VERSION);
+    pack_uint64(request, command);
+}
+
+/**
+ * Send request to the daemon and receive its reply. The reply is stored
+ * in @_buffer, which must be freed by the caller, and @_reply is set to
+ * the operation result.
+ *
+ * @return EOK if the operation succeeded, ENOTCONN if the daemon can
+ *         not be used, other errno code returned by the operation.
+ */
+static errno_t
+authselect_daemon_call(struct pack *request,
+                       char **_buffer,
+                       struct unpack *_reply)
+{
+    size_t length;
+    char *buffer;
+    errno_t ret;
+    int fd = -1;
+
+    /* The daemon serves only configuration of this system. Calls made with
+     * a context are answered from its own cache. */
+    if (!authselect_daemon_enabled || authselect_root_dir() != NULL
+            || authselect_ctx_current() != NULL) {
+        return ENOTCONN;
+    }
+
+    ret = authselect_daemon_connect(&fd);
+    if (ret != EOK) {
+        INFO("authselectd is not available [%d]: %s", ret, strerror(ret));
+        return ENOTCONN;
+    }
+
+    ret = authselectd_send(fd, request);
+    if (ret == EOK) {
+        ret = authselectd_recv(fd, &buffer, &length);
+    }
+    close(fd);
+    if (ret != EOK) {
+        WARN("Unable to communicate with authselectd [%d]: %s",
+             ret, strerror(ret));
+        return ENOTCONN;
+    }
+
+    _reply->data = buffer;
+    _reply->left = length;
+    _reply->error = EOK;
+
+    ret = unpack_uint64_max(_reply, INT32_MAX);
+    if (_reply->error != EOK) {
+        WARN("authselectd sent malformed reply");
+        free(buffer);
+        return ENOTCONN;
+    }
+
+    *_buffer = buffer;
+
+    return ret;
+}
+
+errno_t
+authselect_daemon_list(char ***_profiles)
+{
+    struct pack request = {0};
+    struct unpack reply;
+    char *buffer = NULL;
+    char **profiles;
+    errno_t ret;
+
+    authselect_daemon_request(&request, AUTHSELECTD_LIST);
+    ret = authselect_daemon_call(&request, &buffer, &reply);
+    pack_free(&request);
+    if (ret != EOK) {
+        goto done;
+    }
+
+    profiles = authselectd_unpack_array(&reply);
+    if (profiles == NULL) {
+        ret = reply.error == ENOMEM ? ENOMEM : EINVAL;
+        goto done;
+    }
+
+    *_profiles = profiles;
+
+    ret = EOK;
+
+done:
+    free(buffer);
+    return ret;
+}
+
+errno_t
+authselect_daemon_profile(const char *profile_id,
+                          struct authselect_profile **_profile)
+{
+    struct authselect_profile *profile = NULL;
+    struct pack request = {0};
+    const char *requirements;
+    const char *description;
+    const char *name;
+    const char *path;
+    const char *id;
+    struct unpack reply;
+    char *buffer = NULL;
+    errno_t ret;
+
+    authselect_daemon_request(&request, AUTHSELECTD_PROFILE);
+    pack_string(&request, profile_id);
+    ret = authselect_daemon_call(&request, &buffer, &reply);
+    pack_free(&request);
+    if (ret != EOK) {
+        goto done;
+    }
+
+    profile = malloc_zero(struct authselect_profile);
+    if (profile == NULL) {
+        ret = ENOMEM;
+        goto done;
+    }
+
+    id = unpack_string(&reply);
+    path = unpack_string(&reply);
+    name = unpack_string(&reply);
+    description = unpack_string(&reply);
+    requirements = unpack_string(&reply);
+    profile->features = authselectd_unpack_array(&reply);
+    if (reply.error != EOK || id == NULL || path == NULL || name == NULL
+            || description == NULL) {
+        ret = reply.error == ENOMEM ? ENOMEM : EINVAL;
+        goto done;
+    }
+
+    profile->id = strdup(id);
+    profile->path = strdup(path);
+    profile->name = strdup(name);
+    profile->description = strdup(description);
+    if (profile->id == NULL || profile->path == NULL || profile->name == NULL
+            || profile->description == NULL) {
+        ret = ENOMEM;
+        goto done;
+    }
+
+    if (requirements != NULL) {
+        profile->requirements = strdup(requirements);
+        if (profile->requirements == NULL) {
+            ret = ENOMEM;
+            goto done;
+        }
+    }
+
+    *_profile = profile;
+
+    ret = EOK;
+
+done:
+    if (ret != EOK) {
+        authselect_profile_free(profile);
+    }
+
+    free(buffer);
+    return ret;
+}
+
+errno_t
+authselect_daemon_current(char **_profile_id,
+                          char ***_features)
+{
+    struct pack request = {0};
+    const char *profile_id;
+    char *id = NULL;
+    char **features = NULL;
+    struct unpack reply;
+    char *buffer = NULL;
+    errno_t ret;
+
+    authselect_daemon_request(&request, AUTHSELECTD_CURRENT);
+    ret = authselect_daemon_call(&request, &buffer, &reply);
+    pack_free(&request);
+    if (ret != EOK) {
+        goto done;
+    }
+
+    profile_id = unpack_string(&reply);
+    features = authselectd_unpack_array(&reply);
+    if (reply.error != EOK || profile_id == NULL) {
+        ret = reply.error == ENOMEM ? ENOMEM : EINVAL;
+        goto done;
+    }
+
+    id = strdup(profile_id);
+    if (id == NULL) {
+        ret = ENOMEM;
+        goto done;
+    }
+
+    *_profile_id = id;
+
+    if (_features != NULL) {
+        *_features = features;
+        features = NULL;
+    }
+
+    ret = EOK;
+
+done:
+    string_array_free(features);
+    free(buffer);
+    return ret;
+}
+
+errno_t
+authselect_daemon_validate(bool *_is_valid)
+{
+    struct pack request = {0};
+    struct unpack reply;
+    char *buffer = NULL;
+    errno_t ret;
+    bool is_valid;
+
+    authselect_daemon_request(&request, AUTHSELECTD_VALIDATE);
+    ret = authselect_daemon_call(&request, &buffer, &reply);
+    pack_free(&request);
+
+    /* ENOENT means that there is no configuration, the validation result
+     * is sent as well. */
+    if (ret != EOK && ret != ENOENT) {
+        goto done;
+    }
+
+    is_valid = unpack_uint64_max(&reply, 1);
+    if (reply.error != EOK) {
+        ret = EINVAL;
+        goto done;
+    }
+
+    *_is_valid = is_valid;
+
+done:
+    free(buffer);
+    return ret;
+}
+
+errno_t
+authselect_daemon_files(const char *profile_id,
+                        const char **features,
+                        struct authselect_files **_files)
+{
+    struct authselect_files *files = NULL;
+    struct pack request = {0};
+    struct unpack reply;
+    const char *value;
+    char *buffer = NULL;
+    errno_t ret;
+    int i;
+
+    authselect_daemon_request(&request, AUTHSELECTD_FILES);
+    pack_string(&request, profile_id);
+    authselectd_pack_array(&request, features);
+    ret = authselect_daemon_call(&request, &buffer, &reply);
+    pack_free(&request);
+    if (ret != EOK) {
+        goto done;
+    }
+
+    files = malloc_zero(struct authselect_files);
+    if (files == NULL) {
+        ret = ENOMEM;
+        goto done;
+    }
+
+    char **content[] = {
+        &files->systemauth,
+        &files->passwordauth,
+        &files->smartcardauth,
+        &files->fingerprintauth,
+        &files->postlogin,
+        &files->nsswitch,
+        &files->dconfdb,
+        &files->dconflock,
+        NULL
+    };
+
+    for (i = 0; content[i] != NULL; i++) {
+        value = unpack_string(&reply);
+        if (reply.error != EOK) {
+            ret = EINVAL;
+            goto done;
+        }
+
+        if (value == NULL) {
+            continue;
+        }
+
+        *content[i] = strdup(value);
+        if (*content[i] == NULL) {
+            ret = ENOMEM;
+            goto done;
+        }
+    }
+
+    *_files = files;
+
+    ret = EOK;
+
+done:
+    if (ret != EOK) {
+        authselect_files_free(files);
+    }
+
+    free(buffer);
+    return ret;
+}
@@ -0,0 +1,149 @@
+/*
+    Authors:
+        Pavel Březina <pbrezina@redhat.com>
+
+    Copyright (C) 2018 Red Hat
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _DAEMON_H_
+#define _DAEMON_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "common/errno_t.h"
+
+struct authselect_profile;
+struct authselect_files;
+struct pack;
+struct unpack;
+
+/* Bump this if the protocol changes. */
+#define AUTHSELECTD_MAGIC    "authselectd"
+#define AUTHSELECTD_VERSION  1
+
+/* Maximum size of a single message. */
+#define AUTHSELECTD_MESSAGE_LIMIT (16 * 1024 * 1024)
+
+/* Client gives up if the daemon does not reply within this time. */
+#define AUTHSELECTD_TIMEOUT 10
+
+/**
+ * Operations served by authselectd.
+ *
+ * Each request consists of AUTHSELECTD_MAGIC, AUTHSELECTD_VERSION, command
+ * and its arguments. Each reply consists of errno code of the operation
+ * and its result.
+ */
+enum authselectd_command {
+    /* No arguments, reply: profile list. */
+    AUTHSELECTD_LIST = 1,
+
+    /* Arguments: profile id, reply: id, path, name, description,
+     * requirements and features. */
+    AUTHSELECTD_PROFILE,
+
+    /* No arguments, reply: profile id and features. */
+    AUTHSELECTD_CURRENT,
+
+    /* No arguments, reply: true if the configuration is valid. */
+    AUTHSELECTD_VALIDATE,
+
+    /* Arguments: profile id and features, reply: generated files. */
+    AUTHSELECTD_FILES,
+
+    AUTHSELECTD_SENTINEL
+};
+
+/**
+ * Send message prefixed with its length to the socket.
+ *
+ * @param fd        Connected socket.
+ * @param message   Message to send.
+ *
+ * @return EOK on success, other errno code on error.
+ */
+errno_t
+authselectd_send(int fd, const struct pack *message);
+
+/**
+ * Receive message sent with authselectd_send().
+ *
+ * @param fd        Connected socket.
+ * @param _data     Received message, it must be freed by the caller.
+ * @param _length   Length of the message.
+ *
+ * @return EOK on success, EPIPE if the connection was closed before the
+ *         whole message was received, other errno code on error.
+ */
+errno_t
+authselectd_recv(int fd, char **_data, size_t *_length);
+
+/**
+ * Pack NULL-terminated string array.
+ *
+ * @param pack      Serialization buffer.
+ * @param array     NULL-terminated string array, may be NULL.
+ */
+void
+authselectd_pack_array(struct pack *pack, const char **array);
+
+/**
+ * Unpack string array packed with authselectd_pack_array().
+ *
+ * @param unpack    Serialized data.
+ *
+ * @return Newly allocated NULL-terminated string array or NULL on error.
+ */
+char **
+authselectd_unpack_array(struct unpack *unpack);
+
+/**
+ * Serve queries by authselectd if it is running.
+ *
+ * @param enabled   True to use the daemon.
+ */
+void
+authselect_daemon_set_enabled(bool enabled);
+
+/**
+ * The following functions ask authselectd to perform the operation. They
+ * return ENOTCONN if the daemon is not used or it can not be reached, in
+ * which case the caller is expected to perform the operation itself. Other
+ * error codes are returned by the operation.
+ */
+
+errno_t
+authselect_daemon_list(char ***_profiles);
+
+errno_t
+authselect_daemon_profile(const char *profile_id,
+                          struct authselect_profile **_profile);
+
+errno_t
+authselect_daemon_current(char **_profile_id,
+                          char ***_features);
+
+errno_t
+authselect_daemon_validate(bool *_is_valid);
+
+errno_t
+authselect_daemon_files(const char *profile_id,
+                        const char **features,
+                        struct authselect_files **_files);
+
+#endif /* _DAEMON_H_ */
@@ -0,0 +1,191 @@
+/*
+    Authors:
+        Pavel Březina <pbrezina@redhat.com>
+
+    Copyright (C) 2018 Red Hat
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "common/common.h"
+#include "lib/daemon/daemon.h"
+#include "lib/util/util.h"
+
+static errno_t
+authselectd_send_data(int fd, const void *data, size_t length)
+{
+    const char *buffer = data;
+    ssize_t bytes;
+    size_t sent;
+
+    for (sent = 0; sent < length; sent += bytes) {
+        /* Do not raise SIGPIPE in the library consumer if the other side
+         * closes the connection. */
+        bytes = send(fd, buffer + sent, length - sent, MSG_NOSIGNAL);
+        if (bytes == -1) {
+            if (errno == EINTR) {
+                bytes = 0;
+                continue;
+            }
+
+            return errno;
+        }
+    }
+
+    return EOK;
+}
+
+static errno_t
+authselectd_recv_data(int fd, void *data, size_t length)
+{
+    char *buffer = data;
+    ssize_t bytes;
+    size_t received;
+
+    for (received = 0; received < length; received += bytes) {
+        bytes = recv(fd, buffer + received, length - received, 0);
+        if (bytes == -1) {
+            if (errno == EINTR) {
+                bytes = 0;
+                continue;
+            }
+
+            return errno;
+        }
+
+        if (bytes == 0) {
+            return EPIPE;
+        }
+    }
+
+    return EOK;
+}
+
+errno_t
+authselectd_send(int fd, const struct pack *message)
+{
+    uint64_t length;
+    errno_t ret;
+
+    if (message->error != EOK) {
+        return message->error;
+    }
+
+    if (message->length > AUTHSELECTD_MESSAGE_LIMIT) {
+        return ERANGE;
+    }
+
+    length = message->length;
+    ret = authselectd_send_data(fd, &length, sizeof(uint64_t));
+    if (ret != EOK) {
+        return ret;
+    }
+
+    return authselectd_send_data(fd, message->data, message->length);
+}
+
+errno_t
+authselectd_recv(int fd, char **_data, size_t *_length)
+{
+    uint64_t length;
+    char *data;
+    errno_t ret;
+
+    ret = authselectd_recv_data(fd, &length, sizeof(uint64_t));
+    if (ret != EOK) {
+        return ret;
+    }
+
+    if (length > AUTHSELECTD_MESSAGE_LIMIT) {
+        return ERANGE;
+    }
+
+    /* Allocate at least one byte so empty message is not NULL. */
+    data = malloc_zero_array(char, length + 1);
+    if (data == NULL) {
+        return ENOMEM;
+    }
+
+    ret = authselectd_recv_data(fd, data, length);
+    if (ret != EOK) {
+        free(data);
+        return ret;
+    }
+
+    *_data = data;
+    *_length = length;
+
+    return EOK;
+}
+
+void
+authselectd_pack_array(struct pack *pack, const char **array)
+{
+    size_t count;
+    size_t i;
+
+    for (count = 0; array != NULL && array[count] != NULL; count++) {
+        /* Just count the items. */
+    }
+
+    pack_uint64(pack, count);
+    for (i = 0; i < count; i++) {
+        pack_string(pack, array[i]);
+    }
+}
+
+char **
+authselectd_unpack_array(struct unpack *unpack)
+{
+    const char *value;
+    uint64_t count;
+    uint64_t i;
+    char **array;
+
+    /* Each item takes at least its length. */
+    count = unpack_uint64_max(unpack, unpack->left / sizeof(uint64_t));
+    if (unpack->error != EOK) {
+        return NULL;
+    }
+
+    array = string_array_create(count);
+    if (array == NULL) {
+        unpack->error = ENOMEM;
+        return NULL;
+    }
+
+    for (i = 0; i < count; i++) {
+        value = unpack_string(unpack);
+        if (value == NULL) {
+            unpack->error = unpack->error == EOK ? EINVAL : unpack->error;
+            string_array_free(array);
+            return NULL;
+        }
+
+        array[i] = strdup(value);
+        if (array[i] == NULL) {
+            unpack->error = ENOMEM;
+            string_array_free(array);
+            return NULL;
+        }
+    }
+
+    return array;
+}
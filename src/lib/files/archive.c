@@ -0,0 +1,730 @@
+/*
+    Authors:
+        Pavel Březina <pbrezina@redhat.com>
+
+    Copyright (C) 2018 Red Hat
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <selinux/selinux.h>
+#include <sys/stat.h>
+
+#include "common/common.h"
+#include "lib/constants.h"
+#include "lib/util/util.h"
+#include "lib/files/files.h"
+
+/**
+ * The archive is a single gzip stream. It starts with a manifest:
+ *
+ *   authselect-archive 1
+ *   SIZE MODE UID GID CONTEXT NAME
+ *   ...
+ *   <empty line>
+ *
+ * CONTEXT is "-" if the file has no selinux context. The manifest is
+ * followed by content of the files in the same order.
+ */
+#define ARCHIVE_MAGIC "authselect-archive 1"
+
+#define ARCHIVE_LINE_MAX 4096
+#define ARCHIVE_MAX_FILES 64
+#define ARCHIVE_BUFFER_SIZE 4096
+
+struct authselect_archive_file {
+    char *name;
+    char *context;
+    uint64_t size;
+    mode_t mode;
+    uid_t uid;
+    gid_t gid;
+
+    /* Source file, only set when the archive is being created. */
+    int fd;
+};
+
+struct authselect_archive {
+    struct authselect_archive_file *files;
+    size_t count;
+
+    /* Opened archive and index of file whose content is read next. */
+    gzFile gz;
+    size_t next;
+};
+
+struct authselect_archive_extraction {
+    struct authselect_archive *archive;
+
+    /* Index of archived file for each extracted file. */
+    size_t *indexes;
+    size_t count;
+};
+
+static void
+authselect_archive_file_free(struct authselect_archive_file *file)
+{
+    if (file->fd != -1) {
+        close(file->fd);
+    }
+
+    free(file->name);
+    free(file->context);
+}
+
+static errno_t
+authselect_archive_error(gzFile gz)
+{
+    const char *msg;
+    int errnum;
+
+    msg = gzerror(gz, &errnum);
+    if (errnum == Z_ERRNO) {
+        return errno != 0 ? errno : EIO;
+    }
+
+    ERROR("Archive error [%d]: %s", errnum, msg);
+
+    return errnum == Z_MEM_ERROR ? ENOMEM : EIO;
+}
+
+static errno_t
+authselect_archive_append(struct authselect_archive *archive,
+                          struct authselect_archive_file *file)
+{
+    struct authselect_archive_file *files;
+
+    files = realloc(archive->files, sizeof(*files) * (archive->count + 1));
+    if (files == NULL) {
+        return ENOMEM;
+    }
+
+    files[archive->count] = *file;
+    archive->files = files;
+    archive->count++;
+
+    return EOK;
+}
+
+errno_t
+authselect_archive_new(struct authselect_archive **_archive)
+{
+    struct authselect_archive *archive;
+
+    archive = malloc_zero(struct authselect_archive);
+    if (archive == NULL) {
+        return ENOMEM;
+    }
+
+    *_archive = archive;
+
+    return EOK;
+}
+
+errno_t
+authselect_archive_add(struct authselect_archive *archive,
+                       const char *source,
+                       const char *name)
+{
+    struct authselect_archive_file file = {NULL, NULL, 0, 0, 0, 0, -1};
+    struct stat statbuf;
+    char *context;
+    errno_t ret;
+
+    if (strpbrk(name, " \n/") != NULL) {
+        ERROR("Invalid archived file name [%s]", name);
+        return EINVAL;
+    }
+
+    file.fd = open(source, O_RDONLY | O_CLOEXEC);
+    if (file.fd == -1) {
+        return errno;
+    }
+
+    ret = fstat(file.fd, &statbuf);
+    if (ret != 0) {
+        ret = errno;
+        goto done;
+    }
+
+    if (!S_ISREG(statbuf.st_mode)) {
+        ERROR("[%s] is not a regular file", source);
+        ret = EINVAL;
+        goto done;
+    }
+
+    if (is_selinux_enabled() == 1) {
+        ret = fgetfilecon(file.fd, &context);
+        if (ret < 0) {
+            ret = errno;
+            ERROR("Unable to obtain selinux context for [%s] [%d]: %s",
+                  source, ret, strerror(ret));
+            goto done;
+        }
+
+        if (context != NULL) {
+            file.context = strdup(context);
+            freecon(context);
+            if (file.context == NULL) {
+                ret = ENOMEM;
+                goto done;
+            }
+
+            if (strpbrk(file.context, " \n") != NULL) {
+                ERROR("Invalid selinux context of [%s]", source);
+                ret = EINVAL;
+                goto done;
+            }
+        }
+    }
+
+    file.name = strdup(name);
+    if (file.name == NULL) {
+        ret = ENOMEM;
+        goto done;
+    }
+
+    file.size = statbuf.st_size;
+    file.mode = statbuf.st_mode & ALLPERMS;
+    file.uid = statbuf.st_uid;
+    file.gid = statbuf.st_gid;
+
+    ret = authselect_archive_append(archive, &file);
+
+done:
+    if (ret != EOK) {
+        authselect_archive_file_free(&file);
+    }
+
+    return ret;
+}
+
+static errno_t
+authselect_archive_write_file(gzFile gz,
+                              struct authselect_archive_file *file)
+{
+    char buf[ARCHIVE_BUFFER_SIZE];
+    uint64_t left;
+    ssize_t len;
+    errno_t ret;
+
+    /* Exactly the number of bytes from the manifest is written. */
+    for (left = file->size; left > 0; left -= len) {
+        len = read(file->fd, buf, left < sizeof(buf) ? left : sizeof(buf));
+        if (len == -1 && errno == EINTR) {
+            len = 0;
+            continue;
+        } else if (len == -1) {
+            ret = errno;
+            ERROR("Unable to read [%s] [%d]: %s",
+                  file->name, ret, strerror(ret));
+            return ret;
+        } else if (len == 0) {
+            ERROR("File [%s] was truncated while it was archived",
+                  file->name);
+            return EIO;
+        }
+
+        if (gzwrite(gz, buf, len) != len) {
+            return authselect_archive_error(gz);
+        }
+    }
+
+    return EOK;
+}
+
+errno_t
+authselect_archive_write(struct authselect_archive *archive,
+                         const char *path)
+{
+    struct authselect_archive_file *file;
+    char *tmpfile = NULL;
+    gzFile gz = NULL;
+    errno_t ret;
+    size_t i;
+    int fd;
+
+    /* Archived files may not be readable by everyone. */
+    ret = selinux_mkstemp_fd(AT_FDCWD, path, S_IRUSR | S_IWUSR,
+                             &tmpfile, &fd);
+    if (ret != EOK) {
+        ERROR("Unable to create temporary file for [%s] [%d]: %s",
+              path, ret, strerror(ret));
+        return ret;
+    }
+
+    gz = gzdopen(fd, "wb");
+    if (gz == NULL) {
+        close(fd);
+        ret = ENOMEM;
+        goto done;
+    }
+
+    if (gzprintf(gz, "%s\n", ARCHIVE_MAGIC) <= 0) {
+        ret = authselect_archive_error(gz);
+        goto done;
+    }
+
+    for (i = 0; i < archive->count; i++) {
+        file = &archive->files[i];
+        if (gzprintf(gz, "%llu %04o %u %u %s %s\n",
+                     (unsigned long long)file->size, (unsigned int)file->mode,
+                     (unsigned int)file->uid, (unsigned int)file->gid,
+                     file->context == NULL ? "-" : file->context,
+                     file->name) <= 0) {
+            ret = authselect_archive_error(gz);
+            goto done;
+        }
+    }
+
+    if (gzputs(gz, "\n") <= 0) {
+        ret = authselect_archive_error(gz);
+        goto done;
+    }
+
+    for (i = 0; i < archive->count; i++) {
+        INFO("Archiving [%s] into [%s]", archive->files[i].name, path);
+        ret = authselect_archive_write_file(gz, &archive->files[i]);
+        if (ret != EOK) {
+            goto done;
+        }
+    }
+
+    ret = gzclose(gz);
+    gz = NULL;
+    if (ret != Z_OK) {
+        ERROR("Unable to write archive [%s] [%d]", tmpfile, ret);
+        ret = EIO;
+        goto done;
+    }
+
+    ret = rename(tmpfile, path);
+    if (ret != 0) {
+        ret = errno;
+        ERROR("Unable to rename [%s] to [%s] [%d]: %s",
+              tmpfile, path, ret, strerror(ret));
+        goto done;
+    }
+
+    ret = EOK;
+
+done:
+    if (gz != NULL) {
+        gzclose(gz);
+    }
+
+    if (ret != EOK) {
+        unlink(tmpfile);
+    }
+
+    free(tmpfile);
+
+    return ret;
+}
+
+static errno_t
+authselect_archive_read_line(gzFile gz,
+                             char *line,
+                             size_t size)
+{
+    size_t len;
+    int errnum;
+
+    if (gzgets(gz, line, size) == NULL) {
+        /* Small archives are decompressed and verified at once. */
+        gzerror(gz, &errnum);
+        if (errnum != Z_OK) {
+            return authselect_archive_error(gz);
+        }
+
+        return EINVAL;
+    }
+
+    len = strlen(line);
+    if (len == 0 || line[len - 1] != '\n') {
+        return EINVAL;
+    }
+
+    line[len - 1] = '\0';
+
+    return EOK;
+}
+
+static errno_t
+authselect_archive_parse_file(char *line,
+                              struct authselect_archive_file *file)
+{
+    unsigned long long size;
+    unsigned int mode;
+    unsigned int uid;
+    unsigned int gid;
+    char *context;
+    char *name;
+    char *sep;
+    int offset = 0;
+    int ret;
+
+    ret = sscanf(line, "%llu %o %u %u %n", &size, &mode, &uid, &gid, &offset);
+    if (ret != 4 || offset == 0) {
+        return EINVAL;
+    }
+
+    context = line + offset;
+    sep = strchr(context, ' ');
+    if (sep == NULL) {
+        return EINVAL;
+    }
+
+    *sep = '\0';
+    name = sep + 1;
+    if (name[0] == '\0' || strpbrk(name, " /") != NULL) {
+        return EINVAL;
+    }
+
+    file->name = strdup(name);
+    if (file->name == NULL) {
+        return ENOMEM;
+    }
+
+    if (strcmp(context, "-") != 0) {
+        file->context = strdup(context);
+        if (file->context == NULL) {
+            return ENOMEM;
+        }
+    }
+
+    file->size = size;
+    file->mode = mode & ALLPERMS;
+    file->uid = uid;
+    file->gid = gid;
+
+    return EOK;
+}
+
+errno_t
+authselect_archive_open(const char *path,
+                        struct authselect_archive **_archive)
+{
+    struct authselect_archive_file file;
+    struct authselect_archive *archive;
+    char line[ARCHIVE_LINE_MAX];
+    errno_t ret;
+    int fd;
+
+    archive = malloc_zero(struct authselect_archive);
+    if (archive == NULL) {
+        return ENOMEM;
+    }
+
+    fd = open(path, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    if (fd == -1) {
+        ret = errno;
+        goto done;
+    }
+
+    archive->gz = gzdopen(fd, "rb");
+    if (archive->gz == NULL) {
+        close(fd);
+        ret = ENOMEM;
+        goto done;
+    }
+
+    /* Only the manifest is decompressed here. */
+    ret = authselect_archive_read_line(archive->gz, line, sizeof(line));
+    if (ret != EOK && ret != EINVAL) {
+        ERROR("Unable to read archive [%s] [%d]: %s",
+              path, ret, strerror(ret));
+        goto done;
+    } else if (ret != EOK || strcmp(line, ARCHIVE_MAGIC) != 0) {
+        INFO("[%s] is not an authselect archive", path);
+        ret = EINVAL;
+        goto done;
+    }
+
+    while (true) {
+        ret = authselect_archive_read_line(archive->gz, line, sizeof(line));
+        if (ret != EOK) {
+            ERROR("Archive [%s] has truncated manifest", path);
+            goto done;
+        }
+
+        if (line[0] == '\0') {
+            break;
+        }
+
+        if (archive->count == ARCHIVE_MAX_FILES) {
+            ERROR("Archive [%s] contains too many files", path);
+            ret = EINVAL;
+            goto done;
+        }
+
+        memset(&file, 0, sizeof(file));
+        file.fd = -1;
+
+        ret = authselect_archive_parse_file(line, &file);
+        if (ret == EOK && authselect_archive_contains(archive, file.name)) {
+            ret = EINVAL;
+        }
+
+        if (ret == EOK) {
+            ret = authselect_archive_append(archive, &file);
+        }
+
+        if (ret != EOK) {
+            ERROR("Archive [%s] has invalid manifest", path);
+            authselect_archive_file_free(&file);
+            goto done;
+        }
+    }
+
+    *_archive = archive;
+
+    ret = EOK;
+
+done:
+    if (ret != EOK) {
+        authselect_archive_free(archive);
+    }
+
+    return ret;
+}
+
+bool
+authselect_archive_contains(struct authselect_archive *archive,
+                            const char *name)
+{
+    size_t i;
+
+    for (i = 0; i < archive->count; i++) {
+        if (strcmp(archive->files[i].name, name) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Read content of the next archived file and write it into @fd, or skip
+ * it if @fd is -1.
+ */
+static errno_t
+authselect_archive_read_file(struct authselect_archive *archive,
+                             int fd)
+{
+    struct authselect_archive_file *file;
+    char buf[ARCHIVE_BUFFER_SIZE];
+    ssize_t written;
+    uint64_t left;
+    ssize_t pos;
+    int len;
+
+    file = &archive->files[archive->next];
+
+    for (left = file->size; left > 0; left -= len) {
+        len = gzread(archive->gz, buf,
+                     left < sizeof(buf) ? left : sizeof(buf));
+        if (len < 0) {
+            return authselect_archive_error(archive->gz);
+        } else if (len == 0) {
+            ERROR("Archive is truncated in [%s]", file->name);
+            return EIO;
+        }
+
+        if (fd == -1) {
+            continue;
+        }
+
+        for (pos = 0; pos < len; pos += written) {
+            written = write(fd, buf + pos, len - pos);
+            if (written == -1 && errno == EINTR) {
+                written = 0;
+            } else if (written == -1) {
+                return errno;
+            }
+        }
+    }
+
+    archive->next++;
+
+    return EOK;
+}
+
+/**
+ * Skip the remaining files and make sure the archive ends here. The gzip
+ * trailer is checked only when the end of the stream is reached, so the
+ * checksum of the content is verified only by reading past it.
+ */
+static errno_t
+authselect_archive_read_end(struct authselect_archive *archive)
+{
+    errno_t ret;
+    char byte;
+    int errnum;
+    int len;
+
+    while (archive->next < archive->count) {
+        ret = authselect_archive_read_file(archive, -1);
+        if (ret != EOK) {
+            return ret;
+        }
+    }
+
+    len = gzread(archive->gz, &byte, sizeof(byte));
+    if (len < 0) {
+        return authselect_archive_error(archive->gz);
+    } else if (len > 0) {
+        ERROR("Archive contains unexpected data");
+        return EINVAL;
+    }
+
+    gzerror(archive->gz, &errnum);
+    if (errnum != Z_OK) {
+        return authselect_archive_error(archive->gz);
+    }
+
+    return EOK;
+}
+
+static errno_t
+authselect_archive_extract_file(size_t index,
+                                int fd,
+                                void *pvt)
+{
+    struct authselect_archive_extraction *extraction = pvt;
+    struct authselect_archive *archive = extraction->archive;
+    size_t target = extraction->indexes[index];
+    errno_t ret;
+
+    if (target < archive->next) {
+        ERROR("File [%s] was already read from the archive",
+              archive->files[target].name);
+        return EINVAL;
+    }
+
+    /* Skip content of files that are not extracted. */
+    while (archive->next < target) {
+        ret = authselect_archive_read_file(archive, -1);
+        if (ret != EOK) {
+            return ret;
+        }
+    }
+
+    INFO("Extracting [%s]", archive->files[target].name);
+
+    ret = authselect_archive_read_file(archive, fd);
+    if (ret != EOK) {
+        return ret;
+    }
+
+    /* Nothing may be renamed before the whole archive is verified. */
+    if (index + 1 == extraction->count) {
+        return authselect_archive_read_end(archive);
+    }
+
+    return EOK;
+}
+
+errno_t
+authselect_archive_extract(struct authselect_archive *archive,
+                           struct selinux_safe_copy *table,
+                           mode_t dir_mode)
+{
+    struct authselect_archive_extraction extraction = {archive, NULL, 0};
+    struct authselect_archive_file *file;
+    struct selinux_safe_write *files;
+    size_t count;
+    size_t num;
+    size_t i;
+    size_t j;
+    errno_t ret;
+
+    for (count = 0; table[count].source != NULL; count++) {
+        if (!authselect_archive_contains(archive, table[count].source)) {
+            ERROR("File [%s] is not in the archive", table[count].source);
+            return ENOENT;
+        }
+    }
+
+    files = malloc_zero_array(struct selinux_safe_write, count + 1);
+    extraction.indexes = malloc_zero_array(size_t, count + 1);
+    if (files == NULL || extraction.indexes == NULL) {
+        ret = ENOMEM;
+        goto done;
+    }
+
+    /* Files are written in the order in which they are archived so their
+     * content can be streamed. */
+    for (j = 0, num = 0; j < archive->count; j++) {
+        file = &archive->files[j];
+        for (i = 0; i < count; i++) {
+            if (strcmp(table[i].source, file->name) == 0) {
+                break;
+            }
+        }
+
+        if (i == count) {
+            continue;
+        }
+
+        files[num].destination = table[i].destination;
+        files[num].context = file->context;
+        files[num].mode = file->mode;
+        files[num].uid = file->uid;
+        files[num].gid = file->gid;
+        extraction.indexes[num] = j;
+        num++;
+    }
+
+    extraction.count = num;
+
+    ret = selinux_write_files_safely(files, dir_mode,
+                                     authselect_archive_extract_file,
+                                     &extraction);
+
+done:
+    free(extraction.indexes);
+    free(files);
+
+    return ret;
+}
+
+void
+authselect_archive_free(struct authselect_archive *archive)
+{
+    size_t i;
+
+    if (archive == NULL) {
+        return;
+    }
+
+    for (i = 0; i < archive->count; i++) {
+        authselect_archive_file_free(&archive->files[i]);
+    }
+
+    if (archive->gz != NULL) {
+        gzclose(archive->gz);
+    }
+
+    free(archive->files);
+    free(archive);
+}
@@ -20,8 +20,10 @@
 
 #include <fcntl.h>
 #include <errno.h>
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 #include "common/common.h"
 #include "lib/constants.h"
@@ -113,12 +115,17 @@ done:
 }
 
 errno_t
-authselect_config_write(const char *profile_id,
+authselect_config_write(struct authselect_dirs *dirs,
+                        const char *profile_id,
                         const char **features)
 {
+    const char *paths[] = {PATH_CONFIG_FILE};
+    char *tmpfile = NULL;
     char *implode;
     char *output;
     errno_t ret;
+    int dirfd;
+    int fd = -1;
 
     implode = string_implode(features, '\n');
     if (implode == NULL) {
@@ -131,7 +138,52 @@ authselect_config_write(const char *profile_id,
         return ENOMEM;
     }
 
-    ret = textfile_write(PATH_CONFIG_FILE, output, AUTHSELECT_FILE_MODE);
+    /* Replace the file atomically so it is never seen half-written. */
+    dirfd = authselect_dirs_fd(dirs, PATH_CONFIG_FILE);
+    ret = selinux_mkstemp_fd(dirfd, PATH_CONFIG_FILE, S_IRUSR | S_IWUSR,
+                             &tmpfile, &fd);
+    if (ret != EOK) {
+        ERROR("Unable to create temporary file for [%s] [%d]: %s",
+              PATH_CONFIG_FILE, ret, strerror(ret));
+        goto done;
+    }
+
+    ret = textfile_write_fd(fd, tmpfile, output, AUTHSELECT_FILE_MODE);
+    if (ret != EOK) {
+        goto done;
+    }
+
+    ret = fdatasync(fd);
+    if (ret != 0) {
+        ret = errno;
+        ERROR("Unable to sync [%s] [%d]: %s", tmpfile, ret, strerror(ret));
+        goto done;
+    }
+
+    ret = renameat(dirfd, file_at(dirfd, tmpfile),
+                   dirfd, file_at(dirfd, PATH_CONFIG_FILE));
+    if (ret != 0) {
+        ret = errno;
+        ERROR("Unable to rename [%s] to [%s] [%d]: %s",
+              tmpfile, PATH_CONFIG_FILE, ret, strerror(ret));
+        goto done;
+    }
+
+    free(tmpfile);
+    tmpfile = NULL;
+
+    ret = authselect_dirs_sync(dirs, paths, 1);
+
+done:
+    if (fd != -1) {
+        close(fd);
+    }
+
+    if (tmpfile != NULL) {
+        unlinkat(dirfd, file_at(dirfd, tmpfile), 0);
+        free(tmpfile);
+    }
+
     free(output);
 
     return ret;
@@ -188,7 +240,7 @@ authselect_config_validate_existing(const char *profile_id,
                                     const char **features)
 {
     struct authselect_files *files;
-    bool result = true;
+    bool result;
     errno_t ret;
 
     ret = authselect_files(profile_id, features, &files);
@@ -198,13 +250,32 @@ authselect_config_validate_existing(const char *profile_id,
         return false;
     }
 
+    result = authselect_config_validate_files(files);
+
+    authselect_files_free(files);
+
+    return result;
+}
+
+bool
+authselect_config_validate_files(struct authselect_files *files)
+{
+    struct authselect_dirs *dirs;
+    bool result = true;
+    errno_t ret;
+
+    ret = authselect_dirs_open(&dirs);
+    if (ret != EOK) {
+        return false;
+    }
+
     /* Check that generated files exist and have proper content. */
-    result &= authselect_system_validate(files);
+    result &= authselect_system_validate(dirs, files);
 
     /* Check that symlinks exist and point to generated files. */
-    result &= authselect_symlinks_validate();
+    result &= authselect_symlinks_validate(dirs);
 
-    authselect_files_free(files);
+    authselect_dirs_close(dirs);
 
     return result;
 }
@@ -212,10 +283,19 @@ authselect_config_validate_existing(const char *profile_id,
 bool
 authselect_config_validate_non_existing()
 {
+    struct authselect_dirs *dirs;
     bool result = true;
+    errno_t ret;
+
+    ret = authselect_dirs_open(&dirs);
+    if (ret != EOK) {
+        return false;
+    }
+
+    result &= authselect_system_validate_missing(dirs);
+    result &= authselect_symlinks_validate_missing(dirs);
 
-    result &= authselect_system_validate_missing();
-    result &= authselect_symlinks_validate_missing();
+    authselect_dirs_close(dirs);
 
     return result;
 }
@@ -0,0 +1,218 @@
+/*
+    Authors:
+        Pavel Březina <pbrezina@redhat.com>
+
+    Copyright (C) 2018 Red Hat
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "common/common.h"
+#include "lib/constants.h"
+#include "lib/util/util.h"
+#include "lib/files/files.h"
+
+#define AUTHSELECT_DIRS_MAX 8
+
+struct authselect_dirs_entry {
+    char *path;
+    size_t length;
+    int fd;
+};
+
+struct authselect_dirs {
+    struct authselect_dirs_entry entries[AUTHSELECT_DIRS_MAX];
+    size_t count;
+};
+
+static errno_t
+authselect_dirs_add(struct authselect_dirs *dirs,
+                    const char *path)
+{
+    struct authselect_dirs_entry *entry;
+    errno_t ret;
+    size_t i;
+    int fd;
+
+    for (i = 0; i < dirs->count; i++) {
+        if (strcmp(dirs->entries[i].path, path) == 0) {
+            return EOK;
+        }
+    }
+
+    if (dirs->count == AUTHSELECT_DIRS_MAX) {
+        ERROR("Internal error: too many directories!");
+        return ERANGE;
+    }
+
+    fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) {
+        ret = errno;
+        if (ret == ENOENT) {
+            /* Files within are accessed by full path and fail as expected. */
+            INFO("Directory [%s] does not exist", path);
+            return EOK;
+        }
+
+        ERROR("Unable to open directory [%s] [%d]: %s",
+              path, ret, strerror(ret));
+        return ret;
+    }
+
+    entry = &dirs->entries[dirs->count];
+    entry->path = strdup(path);
+    if (entry->path == NULL) {
+        close(fd);
+        return ENOMEM;
+    }
+
+    entry->length = strlen(path);
+    entry->fd = fd;
+    dirs->count++;
+
+    return EOK;
+}
+
+errno_t
+authselect_dirs_open(struct authselect_dirs **_dirs)
+{
+    const char *paths[] = {
+        DIR_CONFIG,
+        DIR_STATE,
+        DIR_PAM,
+        DIR_DCONF,
+        DIR_DCONF_LOCKS,
+        NULL
+    };
+    struct authselect_dirs *dirs;
+    char *nsswitch_dir = NULL;
+    errno_t ret;
+    int i;
+
+    dirs = malloc_zero(struct authselect_dirs);
+    if (dirs == NULL) {
+        return ENOMEM;
+    }
+
+    for (i = 0; paths[i] != NULL; i++) {
+        ret = authselect_dirs_add(dirs, paths[i]);
+        if (ret != EOK) {
+            goto done;
+        }
+    }
+
+    nsswitch_dir = file_get_parent_directory(PATH_SYMLINK_NSSWITCH);
+    if (nsswitch_dir == NULL) {
+        ret = ENOMEM;
+        goto done;
+    }
+
+    ret = authselect_dirs_add(dirs, nsswitch_dir);
+    if (ret != EOK) {
+        goto done;
+    }
+
+    *_dirs = dirs;
+
+    ret = EOK;
+
+done:
+    free(nsswitch_dir);
+
+    if (ret != EOK) {
+        authselect_dirs_close(dirs);
+    }
+
+    return ret;
+}
+
+void
+authselect_dirs_close(struct authselect_dirs *dirs)
+{
+    size_t i;
+
+    if (dirs == NULL) {
+        return;
+    }
+
+    for (i = 0; i < dirs->count; i++) {
+        close(dirs->entries[i].fd);
+        free(dirs->entries[i].path);
+    }
+
+    free(dirs);
+}
+
+int
+authselect_dirs_fd(struct authselect_dirs *dirs,
+                   const char *path)
+{
+    struct authselect_dirs_entry *entry;
+    size_t i;
+
+    for (i = 0; i < dirs->count; i++) {
+        entry = &dirs->entries[i];
+        if (strncmp(path, entry->path, entry->length) == 0
+                && path[entry->length] == '/'
+                && path[entry->length + 1] != '\0'
+                && strchr(path + entry->length + 1, '/') == NULL) {
+            return entry->fd;
+        }
+    }
+
+    return AT_FDCWD;
+}
+
+errno_t
+authselect_dirs_sync(struct authselect_dirs *dirs,
+                     const char **paths,
+                     size_t count)
+{
+    errno_t result = EOK;
+    errno_t ret;
+    size_t i;
+    size_t j;
+    int fd;
+
+    for (i = 0; i < dirs->count; i++) {
+        fd = dirs->entries[i].fd;
+        for (j = 0; j < count; j++) {
+            if (paths[j] != NULL && authselect_dirs_fd(dirs, paths[j]) == fd) {
+                break;
+            }
+        }
+
+        if (j == count) {
+            continue;
+        }
+
+        ret = fsync(fd);
+        if (ret != 0) {
+            ret = errno;
+            ERROR("Unable to sync directory [%s] [%d]: %s",
+                  dirs->entries[i].path, ret, strerror(ret));
+            if (result == EOK) {
+                result = ret;
+            }
+        }
+    }
+
+    return result;
+}
@@ -22,8 +22,15 @@
 #define _FILES_H_
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
 
 #include "common/errno_t.h"
+#include "lib/util/sha256.h"
+
+struct textfile_view;
+struct selinux_safe_copy;
+struct authselect_archive;
 
 struct authselect_files {
     char *systemauth;
@@ -34,8 +41,88 @@ struct authselect_files {
     char *nsswitch;
     char *dconfdb;
     char *dconflock;
+
+    /* If set, the content points into these NULL-terminated read-only file
+     * views and it is released together with them instead of being freed. */
+    struct textfile_view **views;
 };
 
+struct template;
+struct feature_table;
+struct pack;
+struct unpack;
+
+/**
+ * Compiled system file templates.
+ */
+struct authselect_templates {
+    /* Features used in all templates. */
+    struct feature_table *features;
+
+    struct template *systemauth;
+    struct template *passwordauth;
+    struct template *smartcardauth;
+    struct template *fingerprintauth;
+    struct template *postlogin;
+    struct template *nsswitch;
+    struct template *dconfdb;
+    struct template *dconflock;
+};
+
+/**
+ * Directories that contain generated files, their copies, configuration
+ * and symbolic links. They are opened once per operation and the files
+ * are accessed relatively to them.
+ */
+struct authselect_dirs;
+
+/**
+ * Open all directories that authselect writes to. Directories that do not
+ * exist are skipped and files within them are accessed by their full path.
+ *
+ * @param _dirs       Opened directories.
+ *
+ * @return EOK on success, other errno code on error.
+ */
+errno_t
+authselect_dirs_open(struct authselect_dirs **_dirs);
+
+/**
+ * Close directories opened by authselect_dirs_open().
+ *
+ * @param dirs        Opened directories.
+ */
+void
+authselect_dirs_close(struct authselect_dirs *dirs);
+
+/**
+ * Return descriptor of @path parent directory that can be used with
+ * functions that accept it together with the path.
+ *
+ * @param dirs        Opened directories.
+ * @param path        Path to the file.
+ *
+ * @return Directory descriptor or AT_FDCWD if the directory is not opened.
+ */
+int
+authselect_dirs_fd(struct authselect_dirs *dirs,
+                   const char *path);
+
+/**
+ * Flush parent directories of given files to the disk so renamed and
+ * created files are persistent. Each directory is synced only once.
+ *
+ * @param dirs        Opened directories.
+ * @param paths       Array of file paths, NULL items are skipped.
+ * @param count       Number of items in @paths.
+ *
+ * @return EOK on success, other errno code on error.
+ */
+errno_t
+authselect_dirs_sync(struct authselect_dirs *dirs,
+                     const char **paths,
+                     size_t count);
+
 /**
  * Read information from configuration file.
  *
@@ -53,13 +140,15 @@ authselect_config_read(char **_profile_id,
 /**
  * Write information into configuration file.
  *
+ * @param dirs       Opened directories.
  * @param profile_id Profile ID.
  * @param features   NULL-terminated string array of enabled features.
  *
  * @return EOK on success, other errno code on error.
  */
 errno_t
-authselect_config_write(const char *profile_id,
+authselect_config_write(struct authselect_dirs *dirs,
+                        const char *profile_id,
                         const char **features);
 
 /**
@@ -82,6 +171,17 @@ bool
 authselect_config_validate_existing(const char *profile_id,
                                     const char **features);
 
+/**
+ * Validate existing configuration against files generated from the
+ * selected profile.
+ *
+ * @see authselect_config_validate_existing
+ *
+ * @return True if the configuration is valid, false otherwise.
+ */
+bool
+authselect_config_validate_files(struct authselect_files *files);
+
 /**
  * Validate non-existing configuration.
  *
@@ -108,6 +208,59 @@ authselect_system_read_templates(const char *dirname,
                                  int dirfd,
                                  struct authselect_files **_templates);
 
+/**
+ * Compile system files templates so they can be used to generate content
+ * repeatedly without parsing them again.
+ *
+ * Compiled templates references the content of @files, therefore @files
+ * must not be freed before the compiled templates.
+ *
+ * @param files      System files templates.
+ * @param _templates Compiled templates, missing templates are set to NULL.
+ *
+ * @return EOK on success, other errno code on error.
+ */
+errno_t
+authselect_system_compile_templates(struct authselect_files *files,
+                                    struct authselect_templates **_templates);
+
+/**
+ * Serialize compiled system files templates.
+ *
+ * @param templates  Compiled templates.
+ * @param pack       Serialization buffer.
+ */
+void
+authselect_system_pack_templates(const struct authselect_templates *templates,
+                                 struct pack *pack);
+
+/**
+ * Load compiled system files templates serialized with
+ * authselect_system_pack_templates().
+ *
+ * Compiled templates references the content of @files, therefore @files
+ * must not be freed before the compiled templates. The content must be
+ * the same as when the templates were serialized.
+ *
+ * @param files      System files templates.
+ * @param unpack     Serialized data.
+ * @param _templates Compiled templates, missing templates are set to NULL.
+ *
+ * @return EOK on success, other errno code on error.
+ */
+errno_t
+authselect_system_unpack_templates(struct authselect_files *files,
+                                   struct unpack *unpack,
+                                   struct authselect_templates **_templates);
+
+/**
+ * Free compiled system files templates.
+ *
+ * @param templates Compiled templates.
+ */
+void
+authselect_system_templates_free(struct authselect_templates *templates);
+
 /**
  * Find nsswitch maps in generated content.
  *
@@ -120,41 +273,95 @@ errno_t
 authselect_system_nsswitch_find_maps(char *content,
                                      char ***_maps);
 
+/**
+ * Set number of threads that are used to generate system files when the
+ * calling thread has no context or the context does not set it.
+ *
+ * @param threads     Number of threads, 0 or 1 disables parallel generation.
+ */
+void
+authselect_system_set_threads(unsigned int threads);
+
+struct authselect_system_pool;
+
+/**
+ * Start worker threads used to generate system files. The calling thread
+ * is counted as one of them.
+ *
+ * @param threads     Number of threads.
+ * @param _pool       Worker pool.
+ *
+ * @return EOK on success, other errno code on failure.
+ */
+errno_t
+authselect_system_pool_create(unsigned int threads,
+                              struct authselect_system_pool **_pool);
+
+/**
+ * Stop worker threads and free the pool.
+ *
+ * @param pool        Worker pool, may be NULL.
+ */
+void
+authselect_system_pool_free(struct authselect_system_pool *pool);
+
 /**
  * Generate content of system files based on provided templates.
  *
+ * Independent templates are rendered concurrently if more threads are
+ * set for the current context or with authselect_system_set_threads().
+ * Worker threads of a context are reused by subsequent calls. The result
+ * is always the same as if the files were generated serially.
+ *
  * @param features    Optional features that should be enabled.
- * @param templates   System file templates.
+ * @param templates   Compiled system file templates.
  * @param _files      Generated system files content.
  *
  * @return EOK on success, other errno code on failure.
  */
 errno_t
 authselect_system_generate(const char **features,
-                           struct authselect_files *templates,
+                           struct authselect_templates *templates,
                            struct authselect_files **_files);
 
 /**
- * Write system files.
+ * Write system files. Files that already have the expected content
+ * are not written again.
  *
+ * Each file is replaced atomically and if any file can not be committed,
+ * all files that were already committed are restored. The whole set is
+ * not replaced in a single step though: it takes one rename or exchange
+ * per written file (at most two per generated file, its copy included),
+ * so a crash during the commit may leave some files with the new content.
+ * The manifest is removed before the commit, therefore such configuration
+ * is reported as modified by validation and writing the files again
+ * fixes it.
+ *
+ * @param dirs        Opened directories.
  * @param features    Optional features that should be enabled.
- * @param templates   System file templates.
- * @param _files      Generated system files content.
+ * @param templates   Compiled system file templates.
+ * @param _changed    NULL-terminated list of paths to files that were written.
  *
  * @return EOK on success, other errno code on failure.
  */
 errno_t
-authselect_system_write(const char **features,
-                        struct authselect_files *templates);
+authselect_system_write(struct authselect_dirs *dirs,
+                        const char **features,
+                        struct authselect_templates *templates,
+                        char ***_changed);
 
 /**
  * Validate content of system files that we generate.
  *
+ * @param dirs        Opened directories.
+ * @param files       Expected content of the files.
+ *
  * @return True if the files are readable and have expected content, return
  *         false otherwise.
  */
 bool
-authselect_system_validate(struct authselect_files *files);
+authselect_system_validate(struct authselect_dirs *dirs,
+                           struct authselect_files *files);
 
 /**
  * Validate generated files for non-existing configuration.
@@ -162,27 +369,101 @@ authselect_system_validate(struct authselect_files *files);
  * It checks that there are not left overs from previous authselect
  * configuration, i.e. that all generated files do not exist.
  *
+ * @param dirs        Opened directories.
+ *
  * @return True if all generated files do not exist, false otherwise.
  */
 bool
-authselect_system_validate_missing(void);
+authselect_system_validate_missing(struct authselect_dirs *dirs);
+
+struct authselect_generated;
+struct authselect_manifest;
+
+enum authselect_manifest_result {
+    /* The file has the same content as when it was written. */
+    AUTHSELECT_MANIFEST_VALID,
+
+    /* The file content was modified. */
+    AUTHSELECT_MANIFEST_MODIFIED,
+
+    /* The manifest can not tell, file content must be compared. */
+    AUTHSELECT_MANIFEST_UNKNOWN
+};
+
+/**
+ * Record stat signature and digest of generated files and their copies
+ * that were just written.
+ *
+ * @param generated   Generated files.
+ *
+ * @return EOK on success, other errno code on failure.
+ */
+errno_t
+authselect_manifest_write(const struct authselect_generated *generated);
+
+/**
+ * Remove manifest of generated files.
+ */
+void
+authselect_manifest_delete(void);
+
+/**
+ * Read manifest of generated files.
+ *
+ * @param _manifest   Manifest.
+ *
+ * @return EOK on success, ENOENT if there is no manifest, other errno code
+ *         on failure.
+ */
+errno_t
+authselect_manifest_read(struct authselect_manifest **_manifest);
+
+/**
+ * Free manifest.
+ *
+ * @param manifest    Manifest.
+ */
+void
+authselect_manifest_free(struct authselect_manifest *manifest);
+
+/**
+ * Check whether the generated file at @path has the same content as it
+ * had when it was written together with its copy at @copy_path.
+ *
+ * Only the file stat signature is checked if the file was not touched,
+ * the file content is hashed otherwise.
+ *
+ * @param manifest    Manifest, may be NULL.
+ * @param path        Path to the generated file.
+ * @param copy_path   Path to the copy of the generated file.
+ *
+ * @return Result of the check, see enum authselect_manifest_result.
+ */
+enum authselect_manifest_result
+authselect_manifest_check(struct authselect_manifest *manifest,
+                          const char *path,
+                          const char *copy_path);
 
 /**
  * Write symbolic links to system configuration files.
  *
+ * @param dirs        Opened directories.
+ *
  * @return EOK on success, other errno code on failure.
  */
 errno_t
-authselect_symlinks_write(void);
+authselect_symlinks_write(struct authselect_dirs *dirs);
 
 /**
  * Validate symbolic links that we create.
  *
+ * @param dirs        Opened directories.
+ *
  * @return True if all symbolic links points to their expected destination,
  *         false otherwise.
  */
 bool
-authselect_symlinks_validate(void);
+authselect_symlinks_validate(struct authselect_dirs *dirs);
 
 /**
  * Validate symbolic links for non-existing configuration.
@@ -191,20 +472,149 @@ authselect_symlinks_validate(void);
  * to different destination that we create for authselect or they do not
  * exist at all.
  *
+ * @param dirs        Opened directories.
+ *
  * @return True if there are not left over symbolic links, false otherwise.
  */
 bool
-authselect_symlinks_validate_missing(void);
+authselect_symlinks_validate_missing(struct authselect_dirs *dirs);
 
 /**
  * Check if all locations where our symbolic links will be stored
  * are available. Returns false if any file already exist on these
  * locations.
  *
+ * @param dirs        Opened directories.
+ *
  * @return True if all locations are empty, false otherwise.
  */
 bool
-authselect_symlinks_location_available(void);
+authselect_symlinks_location_available(struct authselect_dirs *dirs);
+
+/**
+ * Copy file into a backup. The file is stored once in the backup object
+ * store, named by digest of its content and attributes, and the object is
+ * hard linked as @destdir/@destname. If hard links can not be used, the
+ * file is copied instead. Owner, permissions and selinux context of the
+ * source file are kept in both cases.
+ *
+ * @param source       Source file name.
+ * @param destdir      Backup directory.
+ * @param destname     File name within the backup.
+ * @param digest       Output object name.
+ *
+ * @return EOK on success, ENOENT if the source does not exist, other errno
+ *         code on error.
+ */
+errno_t
+authselect_objects_copy(const char *source,
+                        const char *destdir,
+                        const char *destname,
+                        char digest[SHA256_HEX_SIZE]);
+
+/**
+ * Remove objects that are not used by any backup.
+ */
+void
+authselect_objects_prune(void);
+
+/**
+ * Create new empty archive that files can be added to.
+ *
+ * @param _archive     Created archive.
+ *
+ * @return EOK on success, other errno code on error.
+ */
+errno_t
+authselect_archive_new(struct authselect_archive **_archive);
+
+/**
+ * Add file to the archive. The file is opened and its owner, permissions
+ * and selinux context are read, its content is read only when the archive
+ * is written.
+ *
+ * @param archive      Archive created with authselect_archive_new().
+ * @param source       Source file name.
+ * @param name         File name within the archive.
+ *
+ * @return EOK on success, ENOENT if the source does not exist, other errno
+ *         code on error.
+ */
+errno_t
+authselect_archive_add(struct authselect_archive *archive,
+                       const char *source,
+                       const char *name);
+
+/**
+ * Write the archive into @path. The compressed manifest of added files is
+ * written first and then the content of the files is streamed into the
+ * archive one after another. The archive is first written into a temporary
+ * file which is then renamed to @path.
+ *
+ * @param archive      Archive created with authselect_archive_new().
+ * @param path         Archive file name.
+ *
+ * @return EOK on success, other errno code on error.
+ */
+errno_t
+authselect_archive_write(struct authselect_archive *archive,
+                         const char *path);
+
+/**
+ * Open archive and read its manifest. The content of the files is not
+ * read until it is extracted.
+ *
+ * @param path         Archive file name.
+ * @param _archive     Opened archive.
+ *
+ * @return EOK on success, EINVAL if the file is not an archive, other errno
+ *         code on error.
+ */
+errno_t
+authselect_archive_open(const char *path,
+                        struct authselect_archive **_archive);
+
+/**
+ * Check whether the archive contains a file.
+ *
+ * @param archive      Archive opened with authselect_archive_open().
+ * @param name         File name within the archive.
+ *
+ * @return True if the file is in the archive, false otherwise.
+ */
+bool
+authselect_archive_contains(struct authselect_archive *archive,
+                            const char *name);
+
+/**
+ * Extract files from the archive with selinux_write_files_safely(), the
+ * content is streamed from the archive directly into the temporary files
+ * that are renamed to their destination. Owner, permissions and selinux
+ * context stored in the archive are set. The archive is read to its end and
+ * its checksum is verified before any file is renamed.
+ *
+ * Files can be extracted only once from an opened archive.
+ *
+ * @param archive      Archive opened with authselect_archive_open().
+ * @param table        Files to extract, the source is file name within the
+ *                     archive.
+ * @param dir_mode     Access mode of destination directory if it is created.
+ *
+ * @return EOK on success, ENOENT if a file is not in the archive, other
+ *         errno code on error.
+ */
+errno_t
+authselect_archive_extract(struct authselect_archive *archive,
+                           struct selinux_safe_copy *table,
+                           mode_t dir_mode);
+
+/**
+ * Close the archive and free its resources.
+ *
+ * @param archive      Archive, may be NULL.
+ */
+void
+authselect_archive_free(struct authselect_archive *archive);
 
 /**
  * List all profile directories in a sorted NULL-terminated string array.
@@ -0,0 +1,367 @@
+/*
+    Authors:
+        Pavel Březina <pbrezina@redhat.com>
+
+    Copyright (C) 2018 Red Hat
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+
+#include "common/common.h"
+#include "lib/constants.h"
+#include "lib/util/util.h"
+#include "lib/files/files.h"
+
+/* Each line of the manifest describes one file that was written:
+ * <sha256> <size> <dev> <ino> <mtime> <ctime> <path> */
+#define MANIFEST_LINE_FORMAT \
+    "%s %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRId64 ".%09ld %" PRId64 ".%09ld %s\n"
+
+#define MANIFEST_SCAN_FORMAT \
+    "%64s %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNd64 ".%ld %" SCNd64 ".%ld %n"
+
+struct authselect_manifest_entry {
+    char digest[SHA256_HEX_SIZE];
+    uint64_t size;
+    uint64_t dev;
+    uint64_t ino;
+    int64_t mtime;
+    long mtime_nsec;
+    int64_t ctime;
+    long ctime_nsec;
+    char *path;
+};
+
+struct authselect_manifest {
+    struct authselect_manifest_entry *entries;
+    size_t count;
+};
+
+static errno_t
+authselect_manifest_digest(const char *path,
+                           char digest[SHA256_HEX_SIZE])
+{
+    struct textfile_view *view;
+    errno_t ret;
+
+    ret = textfile_map(path, AUTHSELECT_FILE_SIZE_LIMIT, &view);
+    if (ret != EOK) {
+        return ret;
+    }
+
+    sha256_hex(view->data, view->length, digest);
+    textfile_unmap(view);
+
+    return EOK;
+}
+
+static void
+authselect_manifest_entry_set_stat(struct authselect_manifest_entry *entry,
+                                   const struct stat *st)
+{
+    entry->size = st->st_size;
+    entry->dev = st->st_dev;
+    entry->ino = st->st_ino;
+    entry->mtime = st->st_mtim.tv_sec;
+    entry->mtime_nsec = st->st_mtim.tv_nsec;
+    entry->ctime = st->st_ctim.tv_sec;
+    entry->ctime_nsec = st->st_ctim.tv_nsec;
+}
+
+static bool
+authselect_manifest_entry_match_stat(const struct authselect_manifest_entry *entry,
+                                     const struct stat *st)
+{
+    struct authselect_manifest_entry current;
+
+    authselect_manifest_entry_set_stat(&current, st);
+
+    return entry->size == current.size
+        && entry->dev == current.dev
+        && entry->ino == current.ino
+        && entry->mtime == current.mtime
+        && entry->mtime_nsec == current.mtime_nsec
+        && entry->ctime == current.ctime
+        && entry->ctime_nsec == current.ctime_nsec;
+}
+
+static char *
+authselect_manifest_line(const char *path)
+{
+    struct authselect_manifest_entry entry;
+    struct stat st;
+    errno_t ret;
+
+    ret = stat(path, &st);
+    if (ret != 0) {
+        return NULL;
+    }
+
+    ret = authselect_manifest_digest(path, entry.digest);
+    if (ret != EOK) {
+        return NULL;
+    }
+
+    authselect_manifest_entry_set_stat(&entry, &st);
+
+    return format(MANIFEST_LINE_FORMAT, entry.digest, entry.size, entry.dev,
+                  entry.ino, entry.mtime, entry.mtime_nsec, entry.ctime,
+                  entry.ctime_nsec, path);
+}
+
+static errno_t
+authselect_manifest_append(char **output,
+                           const char *path)
+{
+    char *line;
+    char *tmp;
+
+    line = authselect_manifest_line(path);
+    if (line == NULL) {
+        return EIO;
+    }
+
+    tmp = format("%s%s", *output, line);
+    free(line);
+    if (tmp == NULL) {
+        return ENOMEM;
+    }
+
+    free(*output);
+    *output = tmp;
+
+    return EOK;
+}
+
+errno_t
+authselect_manifest_write(const struct authselect_generated *generated)
+{
+    char *output;
+    errno_t ret;
+    int i;
+
+    INFO("Writing manifest of generated files [%s]", PATH_MANIFEST);
+
+    output = strdup("");
+    if (output == NULL) {
+        ret = ENOMEM;
+        goto done;
+    }
+
+    for (i = 0; generated[i].path != NULL; i++) {
+        ret = authselect_manifest_append(&output, generated[i].copy_path);
+        if (ret != EOK) {
+            goto done;
+        }
+
+        ret = authselect_manifest_append(&output, generated[i].path);
+        if (ret != EOK) {
+            goto done;
+        }
+    }
+
+    ret = textfile_write(PATH_MANIFEST, output, AUTHSELECT_FILE_MODE);
+
+done:
+    if (ret != EOK) {
+        WARN("Unable to write manifest [%s] [%d]: %s",
+             PATH_MANIFEST, ret, strerror(ret));
+        authselect_manifest_delete();
+    }
+
+    free(output);
+
+    return ret;
+}
+
+void
+authselect_manifest_delete(void)
+{
+    errno_t ret;
+
+    ret = unlink(PATH_MANIFEST);
+    if (ret != 0 && errno != ENOENT) {
+        ret = errno;
+        WARN("Unable to remove manifest [%s] [%d]: %s",
+             PATH_MANIFEST, ret, strerror(ret));
+    }
+}
+
+errno_t
+authselect_manifest_read(struct authselect_manifest **_manifest)
+{
+    struct authselect_manifest_entry *entry;
+    struct authselect_manifest *manifest;
+    char *content;
+    char **lines;
+    errno_t ret;
+    int pos;
+    int n;
+    int i;
+
+    ret = textfile_read(PATH_MANIFEST, AUTHSELECT_FILE_SIZE_LIMIT, &content);
+    if (ret != EOK) {
+        return ret;
+    }
+
+    lines = string_explode(content, '\n', STRING_EXPLODE_SKIP_EMPTY);
+    free(content);
+    if (lines == NULL) {
+        return ENOMEM;
+    }
+
+    manifest = malloc_zero(struct authselect_manifest);
+    if (manifest == NULL) {
+        ret = ENOMEM;
+        goto done;
+    }
+
+    manifest->entries = malloc_zero_array(struct authselect_manifest_entry,
+                                          string_array_count(lines));
+    if (manifest->entries == NULL) {
+        ret = ENOMEM;
+        goto done;
+    }
+
+    for (i = 0; lines[i] != NULL; i++) {
+        entry = &manifest->entries[manifest->count];
+        pos = -1;
+        n = sscanf(lines[i], MANIFEST_SCAN_FORMAT, entry->digest, &entry->size,
+                   &entry->dev, &entry->ino, &entry->mtime, &entry->mtime_nsec,
+                   &entry->ctime, &entry->ctime_nsec, &pos);
+        if (n != 8 || pos == -1 || lines[i][pos] == '\0') {
+            INFO("Malformed manifest line [%s]", lines[i]);
+            ret = EINVAL;
+            goto done;
+        }
+
+        entry->path = strdup(lines[i] + pos);
+        if (entry->path == NULL) {
+            ret = ENOMEM;
+            goto done;
+        }
+
+        manifest->count++;
+    }
+
+    *_manifest = manifest;
+
+    ret = EOK;
+
+done:
+    string_array_free(lines);
+
+    if (ret != EOK) {
+        authselect_manifest_free(manifest);
+    }
+
+    return ret;
+}
+
+void
+authselect_manifest_free(struct authselect_manifest *manifest)
+{
+    size_t i;
+
+    if (manifest == NULL) {
+        return;
+    }
+
+    for (i = 0; i < manifest->count; i++) {
+        free(manifest->entries[i].path);
+    }
+
+    free(manifest->entries);
+    free(manifest);
+}
+
+static const struct authselect_manifest_entry *
+authselect_manifest_find(struct authselect_manifest *manifest,
+                         const char *path)
+{
+    size_t i;
+
+    for (i = 0; i < manifest->count; i++) {
+        if (strcmp(manifest->entries[i].path, path) == 0) {
+            return &manifest->entries[i];
+        }
+    }
+
+    return NULL;
+}
+
+enum authselect_manifest_result
+authselect_manifest_check(struct authselect_manifest *manifest,
+                          const char *path,
+                          const char *copy_path)
+{
+    const struct authselect_manifest_entry *entry;
+    const struct authselect_manifest_entry *copy;
+    char digest[SHA256_HEX_SIZE];
+    struct stat st;
+    errno_t ret;
+
+    if (manifest == NULL) {
+        return AUTHSELECT_MANIFEST_UNKNOWN;
+    }
+
+    entry = authselect_manifest_find(manifest, path);
+    copy = authselect_manifest_find(manifest, copy_path);
+    if (entry == NULL || copy == NULL || strcmp(entry->digest, copy->digest) != 0) {
+        return AUTHSELECT_MANIFEST_UNKNOWN;
+    }
+
+    /* The file is compared against its copy so the copy must be the one
+     * that was written together with the file. */
+    ret = stat(copy_path, &st);
+    if (ret != 0 || !authselect_manifest_entry_match_stat(copy, &st)) {
+        return AUTHSELECT_MANIFEST_UNKNOWN;
+    }
+
+    ret = stat(path, &st);
+    if (ret != 0) {
+        return AUTHSELECT_MANIFEST_UNKNOWN;
+    }
+
+    if (authselect_manifest_entry_match_stat(entry, &st)) {
+        INFO("File [%s] was not touched since it was written", path);
+        return AUTHSELECT_MANIFEST_VALID;
+    }
+
+    /* The file was touched, check if its content still matches. */
+    if ((uint64_t)st.st_size != entry->size) {
+        return AUTHSELECT_MANIFEST_MODIFIED;
+    }
+
+    ret = authselect_manifest_digest(path, digest);
+    if (ret != EOK) {
+        return AUTHSELECT_MANIFEST_UNKNOWN;
+    }
+
+    if (strcmp(digest, entry->digest) != 0) {
+        return AUTHSELECT_MANIFEST_MODIFIED;
+    }
+
+    INFO("File [%s] has the same content as when it was written", path);
+
+    return AUTHSELECT_MANIFEST_VALID;
+}
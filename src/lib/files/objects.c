@@ -0,0 +1,229 @@
+/*
+    Authors:
+        Pavel Březina <pbrezina@redhat.com>
+
+    Copyright (C) 2018 Red Hat
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <selinux/selinux.h>
+#include <sys/stat.h>
+
+#include "common/common.h"
+#include "lib/constants.h"
+#include "lib/util/util.h"
+#include "lib/files/files.h"
+
+/* An object may be pruned by another process before we link it. */
+#define OBJECTS_LINK_ATTEMPTS 3
+
+/**
+ * Objects are named by digest of the file content together with its mode,
+ * owner and security context, so the object can be linked as is into any
+ * backup of a file with the same content and attributes.
+ */
+static errno_t
+authselect_objects_digest(const char *path,
+                          char digest[SHA256_HEX_SIZE])
+{
+    uint8_t raw[SHA256_DIGEST_SIZE];
+    struct textfile_view *view;
+    struct sha256_ctx sha;
+    char *context = NULL;
+    struct stat statbuf;
+    char *attrs;
+    errno_t ret;
+    int i;
+
+    ret = textfile_map(path, AUTHSELECT_FILE_SIZE_LIMIT, &view);
+    if (ret != EOK) {
+        return ret;
+    }
+
+    ret = stat(path, &statbuf);
+    if (ret != 0) {
+        ret = errno;
+        goto done;
+    }
+
+    if (is_selinux_enabled() == 1) {
+        ret = selinux_get_context(path, &context);
+        if (ret != EOK) {
+            goto done;
+        }
+    }
+
+    attrs = format("\n%o %u %u %s", statbuf.st_mode & ALLPERMS,
+                   statbuf.st_uid, statbuf.st_gid,
+                   context == NULL ? "" : context);
+    if (attrs == NULL) {
+        ret = ENOMEM;
+        goto done;
+    }
+
+    sha256_init(&sha);
+    sha256_update(&sha, view->data, view->length);
+    sha256_update(&sha, attrs, strlen(attrs));
+    sha256_final(&sha, raw);
+    free(attrs);
+
+    for (i = 0; i < SHA256_DIGEST_SIZE; i++) {
+        sprintf(&digest[i * 2], "%02x", raw[i]);
+    }
+
+    ret = EOK;
+
+done:
+    if (context != NULL) {
+        freecon(context);
+    }
+
+    textfile_unmap(view);
+
+    return ret;
+}
+
+errno_t
+authselect_objects_copy(const char *source,
+                        const char *destdir,
+                        const char *destname,
+                        char digest[SHA256_HEX_SIZE])
+{
+    char *tmpfile = NULL;
+    char *objpath = NULL;
+    char *destpath = NULL;
+    errno_t ret;
+    int i;
+
+    /* The source may change while it is being backed up. Take a private
+     * copy first so the object name always matches the stored content. */
+    ret = selinux_mkstemp_copy(source, DIR_BACKUP_OBJECTS, "object",
+                               AUTHSELECT_DIR_MODE, &tmpfile);
+    if (ret != EOK) {
+        return ret;
+    }
+
+    ret = authselect_objects_digest(tmpfile, digest);
+    if (ret != EOK) {
+        goto done;
+    }
+
+    objpath = format("%s/%s", DIR_BACKUP_OBJECTS, digest);
+    destpath = format("%s/%s", destdir, destname);
+    if (objpath == NULL || destpath == NULL) {
+        ret = ENOMEM;
+        goto done;
+    }
+
+    ret = file_make_path(destdir, AUTHSELECT_DIR_MODE);
+    if (ret != EOK) {
+        goto done;
+    }
+
+    /* The backup may be overwritten. Its files must not be written to since
+     * they are shared with other backups. */
+    ret = unlink(destpath);
+    if (ret != 0 && errno != ENOENT) {
+        ret = errno;
+        goto done;
+    }
+
+    for (i = 0; i < OBJECTS_LINK_ATTEMPTS; i++) {
+        ret = link(objpath, destpath);
+        if (ret == 0) {
+            INFO("Linked object [%s] to [%s]", digest, destpath);
+            ret = EOK;
+            goto done;
+        }
+
+        ret = errno;
+        if (ret != ENOENT) {
+            break;
+        }
+
+        /* Never replace an existing object, it is already linked to other
+         * backups. If it was stored meanwhile, it has the same content. */
+        INFO("Storing [%s] as object [%s]", source, digest);
+        ret = link(tmpfile, objpath);
+        if (ret != 0 && errno != EEXIST) {
+            ret = errno;
+            break;
+        }
+    }
+
+    /* Hard links may not be permitted here, keep a private copy. */
+    INFO("Unable to link object [%s] to [%s] [%d]: %s, copying it instead",
+         digest, destpath, ret, strerror(ret));
+
+    ret = selinux_file_copy(tmpfile, destdir, destname, AUTHSELECT_DIR_MODE);
+
+done:
+    if (tmpfile != NULL) {
+        unlink(tmpfile);
+    }
+
+    free(tmpfile);
+    free(objpath);
+    free(destpath);
+
+    return ret;
+}
+
+void
+authselect_objects_prune(void)
+{
+    struct stat statbuf;
+    char **objects;
+    errno_t ret;
+    int dirfd;
+    int i;
+
+    ret = dir_list(DIR_BACKUP_OBJECTS, DIR_LIST_FILES, &objects, &dirfd);
+    if (ret != EOK) {
+        if (ret != ENOENT) {
+            WARN("Unable to list objects [%d]: %s", ret, strerror(ret));
+        }
+        return;
+    }
+
+    for (i = 0; objects[i] != NULL; i++) {
+        /* Temporary files of objects that are being stored are skipped. */
+        if (strlen(objects[i]) != SHA256_HEX_SIZE - 1) {
+            continue;
+        }
+
+        ret = fstatat(dirfd, objects[i], &statbuf, AT_SYMLINK_NOFOLLOW);
+        if (ret != 0 || statbuf.st_nlink > 1) {
+            continue;
+        }
+
+        INFO("Removing unused object [%s]", objects[i]);
+        ret = unlinkat(dirfd, objects[i], 0);
+        if (ret != 0) {
+            ret = errno;
+            WARN("Unable to remove object [%s] [%d]: %s",
+                 objects[i], ret, strerror(ret));
+        }
+    }
+
+    close(dirfd);
+    string_array_free(objects);
+}
@@ -0,0 +1,560 @@
+/*
+    Authors:
+        Pavel Březina <pbrezina@redhat.com>
+
+    Copyright (C) 2018 Red Hat
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#ifdef HAVE_LINUX_OPENAT2_H
+#include <linux/openat2.h>
+#endif
+
+#include "common/common.h"
+#include "lib/constants.h"
+#include "lib/ctx/ctx.h"
+#include "lib/util/util.h"
+
+/* Maximum number of symbolic links followed when a path is resolved. */
+#define AUTHSELECT_PATH_FOLLOW_MAX 40
+
+/* Directories are listed first in enum authselect_path_id. */
+#define AUTHSELECT_PATH_IS_DIR(id) ((id) <= AUTHSELECT_PATH_BACKUP_OBJECTS)
+
+struct authselect_root {
+    char *dir;
+    size_t length;
+    int fd;
+    char *paths[AUTHSELECT_PATH_SENTINEL];
+};
+
+static const char *authselect_paths[AUTHSELECT_PATH_SENTINEL] = {
+    [AUTHSELECT_PATH_CONFIG_DIR] = AUTHSELECT_CONFIG_DIR,
+    [AUTHSELECT_PATH_STATE_DIR] = AUTHSELECT_STATE_DIR,
+    [AUTHSELECT_PATH_PAM_DIR] = AUTHSELECT_PAM_DIR,
+    [AUTHSELECT_PATH_DCONF_DIR] = AUTHSELECT_DCONF_DIR,
+    [AUTHSELECT_PATH_DCONF_LOCKS_DIR] = AUTHSELECT_DCONF_DIR "/locks",
+    [AUTHSELECT_PATH_BACKUP_DIR] = AUTHSELECT_BACKUP_DIR,
+    [AUTHSELECT_PATH_DEFAULT_PROFILES] = AUTHSELECT_PROFILE_DIR,
+    [AUTHSELECT_PATH_VENDOR_PROFILES] = AUTHSELECT_VENDOR_DIR,
+    [AUTHSELECT_PATH_CUSTOM_PROFILES] = AUTHSELECT_CUSTOM_DIR,
+    [AUTHSELECT_PATH_PROFILE_CACHE] = AUTHSELECT_STATE_DIR "/profile-cache",
+    [AUTHSELECT_PATH_BACKUP_OBJECTS] =
+        AUTHSELECT_BACKUP_DIR "/" FILE_BACKUP_OBJECTS,
+
+    [AUTHSELECT_PATH_CONFIG_FILE] = AUTHSELECT_CONFIG_DIR "/" FILE_CONFIG,
+
+    [AUTHSELECT_PATH_SYSTEM] = AUTHSELECT_CONFIG_DIR "/" FILE_SYSTEM,
+    [AUTHSELECT_PATH_PASSWORD] = AUTHSELECT_CONFIG_DIR "/" FILE_PASSWORD,
+    [AUTHSELECT_PATH_FINGERPRINT] = AUTHSELECT_CONFIG_DIR "/" FILE_FINGERPRINT,
+    [AUTHSELECT_PATH_SMARTCARD] = AUTHSELECT_CONFIG_DIR "/" FILE_SMARTCARD,
+    [AUTHSELECT_PATH_POSTLOGIN] = AUTHSELECT_CONFIG_DIR "/" FILE_POSTLOGIN,
+    [AUTHSELECT_PATH_NSSWITCH] = AUTHSELECT_CONFIG_DIR "/" FILE_NSSWITCH,
+    [AUTHSELECT_PATH_DCONF_DB] = AUTHSELECT_CONFIG_DIR "/" FILE_DCONF_DB,
+    [AUTHSELECT_PATH_DCONF_LOCK] = AUTHSELECT_CONFIG_DIR "/" FILE_DCONF_LOCK,
+    [AUTHSELECT_PATH_USER_NSSWITCH] =
+        AUTHSELECT_CONFIG_DIR "/" FILE_USER_NSSWITCH,
+
+    [AUTHSELECT_PATH_COPY_SYSTEM] = AUTHSELECT_STATE_DIR "/" FILE_SYSTEM,
+    [AUTHSELECT_PATH_COPY_PASSWORD] = AUTHSELECT_STATE_DIR "/" FILE_PASSWORD,
+    [AUTHSELECT_PATH_COPY_FINGERPRINT] =
+        AUTHSELECT_STATE_DIR "/" FILE_FINGERPRINT,
+    [AUTHSELECT_PATH_COPY_SMARTCARD] = AUTHSELECT_STATE_DIR "/" FILE_SMARTCARD,
+    [AUTHSELECT_PATH_COPY_POSTLOGIN] = AUTHSELECT_STATE_DIR "/" FILE_POSTLOGIN,
+    [AUTHSELECT_PATH_COPY_NSSWITCH] = AUTHSELECT_STATE_DIR "/" FILE_NSSWITCH,
+    [AUTHSELECT_PATH_COPY_DCONF_DB] = AUTHSELECT_STATE_DIR "/" FILE_DCONF_DB,
+    [AUTHSELECT_PATH_COPY_DCONF_LOCK] =
+        AUTHSELECT_STATE_DIR "/" FILE_DCONF_LOCK,
+    [AUTHSELECT_PATH_MANIFEST] = AUTHSELECT_STATE_DIR "/manifest",
+
+    [AUTHSELECT_PATH_SYMLINK_SYSTEM] = AUTHSELECT_PAM_DIR "/" FILE_SYSTEM,
+    [AUTHSELECT_PATH_SYMLINK_PASSWORD] = AUTHSELECT_PAM_DIR "/" FILE_PASSWORD,
+    [AUTHSELECT_PATH_SYMLINK_FINGERPRINT] =
+        AUTHSELECT_PAM_DIR "/" FILE_FINGERPRINT,
+    [AUTHSELECT_PATH_SYMLINK_SMARTCARD] = AUTHSELECT_PAM_DIR "/" FILE_SMARTCARD,
+    [AUTHSELECT_PATH_SYMLINK_POSTLOGIN] = AUTHSELECT_PAM_DIR "/" FILE_POSTLOGIN,
+    [AUTHSELECT_PATH_SYMLINK_NSSWITCH] = AUTHSELECT_NSSWITCH_CONF,
+    [AUTHSELECT_PATH_SYMLINK_DCONF_DB] =
+        AUTHSELECT_DCONF_DIR "/" AUTHSELECT_DCONF_FILE,
+    [AUTHSELECT_PATH_SYMLINK_DCONF_LOCK] =
+        AUTHSELECT_DCONF_DIR "/locks/" AUTHSELECT_DCONF_FILE,
+
+    [AUTHSELECT_PATH_PROFILE_INDEX] =
+        AUTHSELECT_STATE_DIR "/profile-cache/index",
+};
+
+#if defined(HAVE_LINUX_OPENAT2_H) && defined(SYS_openat2)
+/**
+ * Resolve @path with the kernel as if the root directory was the system
+ * root directory.
+ *
+ * @return EOK on success, ENOTSUP if it can not be used, ENOENT if some
+ *         component of @path does not exist, other errno code on error.
+ */
+static errno_t
+authselect_root_resolve_kernel(struct authselect_root *root,
+                               const char *path,
+                               bool follow,
+                               char **_resolved)
+{
+    struct open_how how = {0};
+    char procpath[64];
+    char target[PATH_MAX];
+    char *resolved;
+    ssize_t len;
+    errno_t ret;
+    int fd;
+
+    how.flags = O_PATH | O_CLOEXEC | (follow ? 0 : O_NOFOLLOW);
+    how.resolve = RESOLVE_IN_ROOT | RESOLVE_NO_MAGICLINKS;
+
+    fd = syscall(SYS_openat2, root->fd, path, &how, sizeof(how));
+    if (fd == -1) {
+        ret = errno;
+        if (ret == ENOSYS || ret == EPERM || ret == E2BIG || ret == EINVAL) {
+            return ENOTSUP;
+        }
+
+        return ret;
+    }
+
+    snprintf(procpath, sizeof(procpath), "/proc/self/fd/%d", fd);
+    len = readlink(procpath, target, sizeof(target) - 1);
+    if (len == -1) {
+        ret = errno;
+        close(fd);
+        /* /proc is not available. */
+        return ret == ENOENT ? ENOTSUP : ret;
+    }
+
+    close(fd);
+
+    target[len] = '\0';
+
+    /* The root directory path is canonical so it must be a prefix. */
+    if (strncmp(target, root->dir, root->length) != 0
+            || (target[root->length] != '/'
+                && target[root->length] != '\0')) {
+        ERROR("Path [%s] was resolved outside of root directory [%s]",
+              path, target);
+        return EXDEV;
+    }
+
+    resolved = strdup(target);
+    if (resolved == NULL) {
+        return ENOMEM;
+    }
+
+    *_resolved = resolved;
+
+    return EOK;
+}
+#else
+static errno_t
+authselect_root_resolve_kernel(struct authselect_root *root,
+                               const char *path,
+                               bool follow,
+                               char **_resolved)
+{
+    return ENOTSUP;
+}
+#endif
+
+/**
+ * Resolve @path component by component as if the root directory was the
+ * system root directory. Components that do not exist are kept as they
+ * are.
+ */
+static errno_t
+authselect_root_resolve_walk(struct authselect_root *root,
+                             const char *path,
+                             bool follow,
+                             char **_resolved)
+{
+    char target[PATH_MAX];
+    char resolved[PATH_MAX];
+    char pending[PATH_MAX];
+    char *component;
+    char *hostpath;
+    char *slash;
+    char *rest;
+    ssize_t len;
+    int links = 0;
+    int written;
+
+    /* Resolved part of the path as seen from within the root directory
+     * and components that are yet to be resolved. */
+    resolved[0] = '\0';
+    if (strlen(path) >= sizeof(pending)) {
+        return ENAMETOOLONG;
+    }
+    strcpy(pending, path);
+    rest = pending;
+
+    while (*rest != '\0') {
+        component = rest;
+        rest = strchr(component, '/');
+        if (rest == NULL) {
+            rest = component + strlen(component);
+        } else {
+            *rest = '\0';
+            rest++;
+        }
+
+        if (component[0] == '\0' || strcmp(component, ".") == 0) {
+            continue;
+        }
+
+        if (strcmp(component, "..") == 0) {
+            /* It never leaves the root directory. */
+            slash = strrchr(resolved, '/');
+            if (slash != NULL) {
+                *slash = '\0';
+            }
+            continue;
+        }
+
+        written = snprintf(resolved + strlen(resolved),
+                           sizeof(resolved) - strlen(resolved),
+                           "/%s", component);
+        if (written < 0 || (size_t)written >= sizeof(resolved)) {
+            return ENAMETOOLONG;
+        }
+
+        if (*rest == '\0' && !follow) {
+            break;
+        }
+
+        hostpath = format("%s%s", root->dir, resolved);
+        if (hostpath == NULL) {
+            return ENOMEM;
+        }
+
+        len = readlink(hostpath, target, sizeof(target) - 1);
+        free(hostpath);
+        if (len == -1) {
+            if (errno == EINVAL || errno == ENOENT || errno == ENOTDIR) {
+                /* Not a symbolic link or it does not exist. */
+                continue;
+            }
+
+            return errno;
+        }
+
+        if (++links > AUTHSELECT_PATH_FOLLOW_MAX) {
+            return ELOOP;
+        }
+
+        target[len] = '\0';
+
+        /* Continue with the destination of the link. */
+        if (strlen(target) + strlen(rest) + 2 > sizeof(pending)) {
+            return ENAMETOOLONG;
+        }
+        memmove(pending + len + 1, rest, strlen(rest) + 1);
+        memcpy(pending, target, len);
+        pending[len] = '/';
+        rest = pending;
+
+        /* Absolute destination starts from the root directory, relative
+         * destination from the directory that contains the link. */
+        if (target[0] == '/') {
+            resolved[0] = '\0';
+        } else {
+            *strrchr(resolved, '/') = '\0';
+        }
+    }
+
+    *_resolved = format("%s%s", root->dir, resolved);
+    if (*_resolved == NULL) {
+        return ENOMEM;
+    }
+
+    return EOK;
+}
+
+/**
+ * Resolve @path within the root directory so it does not lead outside
+ * of it, the same way as if chroot was used.
+ *
+ * @param root      Root directory.
+ * @param path      Path as seen from within the root directory.
+ * @param follow    Follow symbolic link in the last component.
+ * @param _resolved Path to the file on this system.
+ *
+ * @return EOK on success, other errno code on error.
+ */
+static errno_t
+authselect_root_resolve(struct authselect_root *root,
+                        const char *path,
+                        bool follow,
+                        char **_resolved)
+{
+    errno_t ret;
+
+    ret = authselect_root_resolve_kernel(root, path, follow, _resolved);
+    if (ret == ENOTSUP || ret == ENOENT || ret == ENOTDIR) {
+        /* Missing components are resolved in user space. */
+        ret = authselect_root_resolve_walk(root, path, follow, _resolved);
+    }
+
+    return ret;
+}
+
+/**
+ * Resolve path of a directory fully and path of a file up to its parent
+ * directory, the file itself may be a symbolic link that authselect
+ * manages.
+ */
+static errno_t
+authselect_root_resolve_id(struct authselect_root *root,
+                           enum authselect_path_id id,
+                           char **_resolved)
+{
+    const char *name;
+    char *parent;
+    char *resolved;
+    errno_t ret;
+
+    if (AUTHSELECT_PATH_IS_DIR(id)) {
+        return authselect_root_resolve(root, authselect_paths[id], true,
+                                       _resolved);
+    }
+
+    parent = file_get_parent_directory(authselect_paths[id]);
+    if (parent == NULL) {
+        return ENOMEM;
+    }
+
+    ret = authselect_root_resolve(root, parent, true, &resolved);
+    free(parent);
+    if (ret != EOK) {
+        return ret;
+    }
+
+    name = strrchr(authselect_paths[id], '/') + 1;
+    *_resolved = format("%s/%s", resolved, name);
+    free(resolved);
+    if (*_resolved == NULL) {
+        return ENOMEM;
+    }
+
+    return EOK;
+}
+
+static struct authselect_root *authselect_root_global = NULL;
+
+errno_t
+authselect_root_create(const char *dir,
+                       struct authselect_root **_root)
+{
+    struct authselect_root *root;
+    struct stat statbuf;
+    char *realdir;
+    errno_t ret;
+    int i;
+
+    realdir = realpath(dir, NULL);
+    if (realdir == NULL) {
+        ret = errno;
+        ERROR("Unable to resolve root directory [%s] [%d]: %s",
+              dir, ret, strerror(ret));
+        return ret;
+    }
+
+    ret = stat(realdir, &statbuf);
+    if (ret != 0) {
+        ret = errno;
+        ERROR("Unable to stat root directory [%s] [%d]: %s",
+              realdir, ret, strerror(ret));
+        free(realdir);
+        return ret;
+    }
+
+    if (!S_ISDIR(statbuf.st_mode)) {
+        ERROR("Root [%s] is not a directory", realdir);
+        free(realdir);
+        return ENOTDIR;
+    }
+
+    /* Nothing needs to be prefixed. */
+    if (strcmp(realdir, "/") == 0) {
+        free(realdir);
+        *_root = NULL;
+        return EOK;
+    }
+
+    root = malloc_zero(struct authselect_root);
+    if (root == NULL) {
+        free(realdir);
+        return ENOMEM;
+    }
+    root->fd = -1;
+
+    root->dir = realdir;
+    root->length = strlen(realdir);
+
+    root->fd = open(realdir, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (root->fd == -1) {
+        ret = errno;
+        ERROR("Unable to open root directory [%s] [%d]: %s",
+              realdir, ret, strerror(ret));
+        authselect_root_free(root);
+        return ret;
+    }
+
+    /* Symbolic links within the root directory may point to absolute paths
+     * that are meant to be resolved within it. */
+    for (i = 0; i < AUTHSELECT_PATH_SENTINEL; i++) {
+        ret = authselect_root_resolve_id(root, i, &root->paths[i]);
+        if (ret != EOK) {
+            ERROR("Unable to resolve [%s] within root directory [%s] "
+                  "[%d]: %s", authselect_paths[i], realdir,
+                  ret, strerror(ret));
+            authselect_root_free(root);
+            return ret;
+        }
+    }
+
+    /* Files within the root directory are labeled as if it was the system
+     * root directory. */
+    selinux_set_lookup_path_fn(authselect_path_strip_root);
+
+    INFO("Using root directory [%s]", realdir);
+
+    *_root = root;
+
+    return EOK;
+}
+
+void
+authselect_root_free(struct authselect_root *root)
+{
+    int i;
+
+    if (root == NULL) {
+        return;
+    }
+
+    for (i = 0; i < AUTHSELECT_PATH_SENTINEL; i++) {
+        free(root->paths[i]);
+    }
+
+    if (root->fd != -1) {
+        close(root->fd);
+    }
+
+    free(root->dir);
+    free(root);
+}
+
+void
+authselect_root_set_global(struct authselect_root *root)
+{
+    authselect_root_free(authselect_root_global);
+    authselect_root_global = root;
+}
+
+static struct authselect_root *
+authselect_root_current(void)
+{
+    struct authselect_ctx *ctx;
+
+    ctx = authselect_ctx_current();
+    if (ctx != NULL && ctx->root != NULL) {
+        return ctx->root;
+    }
+
+    return authselect_root_global;
+}
+
+const char *
+authselect_root_dir(void)
+{
+    struct authselect_root *root;
+
+    root = authselect_root_current();
+
+    return root == NULL ? NULL : root->dir;
+}
+
+const char *
+authselect_path(enum authselect_path_id id)
+{
+    struct authselect_root *root;
+
+    root = authselect_root_current();
+    if (root == NULL) {
+        return authselect_paths[id];
+    }
+
+    return root->paths[id];
+}
+
+const char *
+authselect_path_in_root(enum authselect_path_id id)
+{
+    return authselect_paths[id];
+}
+
+const char *
+authselect_path_strip_root(const char *path)
+{
+    struct authselect_root *root;
+
+    root = authselect_root_current();
+    if (root == NULL || strncmp(path, root->dir, root->length) != 0
+            || path[root->length] != '/') {
+        return path;
+    }
+
+    return path + root->length;
+}
+
+errno_t
+authselect_path_follow(const char *path,
+                       char **_resolved)
+{
+    struct authselect_root *root;
+    const char *inroot;
+    char *resolved;
+
+    /* Symbolic links can be followed by the kernel. */
+    root = authselect_root_current();
+    inroot = authselect_path_strip_root(path);
+    if (root == NULL || inroot == path) {
+        resolved = strdup(path);
+        if (resolved == NULL) {
+            return ENOMEM;
+        }
+
+        *_resolved = resolved;
+        return EOK;
+    }
+
+    return authselect_root_resolve(root, inroot, true, _resolved);
+}
@@ -18,6 +18,7 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <fcntl.h>
 #include <errno.h>
 #include <unistd.h>
 #include <sys/stat.h>
@@ -28,20 +29,20 @@
 #include "lib/files/files.h"
 
 errno_t
-authselect_symlinks_write()
+authselect_symlinks_write(struct authselect_dirs *dirs)
 {
     struct authselect_symlink symlinks[] = {SYMLINK_FILES};
-    mode_t oldmask;
     errno_t ret;
+    int dirfd;
     int i;
 
-    oldmask = umask(AUTHSELECT_FILE_MODE);
-
     for (i = 0; symlinks[i].name != NULL; i++) {
         INFO("Creating symbolic link [%s] to [%s]",
              symlinks[i].name, symlinks[i].dest);
 
-        ret = unlink(symlinks[i].name);
+        dirfd = authselect_dirs_fd(dirs, symlinks[i].name);
+
+        ret = unlinkat(dirfd, file_at(dirfd, symlinks[i].name), 0);
         if (ret != 0 && errno != ENOENT) {
             ret = errno;
             ERROR("Unable to overwrite file [%s] [%d]: %s",
@@ -49,7 +50,8 @@ authselect_symlinks_write()
             goto done;
         }
 
-        ret = symlink(symlinks[i].dest, symlinks[i].name);
+        ret = symlinkat(symlinks[i].dest, dirfd,
+                        file_at(dirfd, symlinks[i].name));
         if (ret != 0) {
             ret = errno;
             ERROR("Unable to create symbolic link [%s] [%d]: %s",
@@ -61,13 +63,11 @@ authselect_symlinks_write()
     ret = EOK;
 
 done:
-    umask(oldmask);
-
     return ret;
 }
 
 bool
-authselect_symlinks_validate()
+authselect_symlinks_validate(struct authselect_dirs *dirs)
 {
     struct authselect_symlink symlinks[] = {SYMLINK_FILES};
     bool result = true;
@@ -78,7 +78,8 @@ authselect_symlinks_validate()
     for (i = 0; symlinks[i].name != NULL; i++) {
         INFO("Validating link [%s]", symlinks[i].name);
 
-        ret = file_links_to(symlinks[i].name, symlinks[i].dest, &is_valid);
+        ret = file_links_to_at(authselect_dirs_fd(dirs, symlinks[i].name),
+                               symlinks[i].name, symlinks[i].dest, &is_valid);
         if (ret != EOK) {
             ERROR("Unable to validate link [%s] [%d]: %s",
                   symlinks[i].name, ret, strerror(ret));
@@ -96,16 +97,19 @@ authselect_symlinks_validate()
 }
 
 bool
-authselect_symlinks_validate_missing()
+authselect_symlinks_validate_missing(struct authselect_dirs *dirs)
 {
     struct authselect_symlink symlinks[] = {SYMLINK_FILES};
     bool result = true;
     bool valid;
     errno_t ret;
+    int dirfd;
     int i;
 
     for (i = 0; symlinks[i].name != NULL; i++) {
-        ret = file_exists(symlinks[i].name);
+        dirfd = authselect_dirs_fd(dirs, symlinks[i].name);
+
+        ret = file_exists_at(dirfd, symlinks[i].name);
         if (ret == ENOENT) {
             continue;
         } else if (ret != EOK) {
@@ -115,7 +119,8 @@ authselect_symlinks_validate_missing()
             continue;
         }
 
-        ret = file_does_not_link_to(symlinks[i].name, symlinks[i].dest, &valid);
+        ret = file_does_not_link_to_at(dirfd, symlinks[i].name,
+                                       symlinks[i].dest, &valid);
         if (ret != EOK) {
             ERROR("Unable to check file [%s] [%d]: %s",
                   symlinks[i].name, ret, strerror(ret));
@@ -135,7 +140,7 @@ authselect_symlinks_validate_missing()
 }
 
 bool
-authselect_symlinks_location_available()
+authselect_symlinks_location_available(struct authselect_dirs *dirs)
 {
     struct authselect_symlink symlinks[] = {SYMLINK_FILES};
     bool result = true;
@@ -143,7 +148,8 @@ authselect_symlinks_location_available()
     int i;
 
     for (i = 0; symlinks[i].name != NULL; i++) {
-        ret = file_exists(symlinks[i].name);
+        ret = file_exists_at(authselect_dirs_fd(dirs, symlinks[i].name),
+                             symlinks[i].name);
         if (ret == EOK) {
             ERROR("File [%s] exists but it needs to be overwritten!",
                   symlinks[i].name);
@@ -19,15 +19,19 @@
 */
 
 #include <time.h>
+#include <fcntl.h>
 #include <errno.h>
 #include <stdio.h>
 #include <regex.h>
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
 
 #include "common/common.h"
 #include "lib/constants.h"
+#include "lib/ctx/ctx.h"
 #include "lib/util/util.h"
 #include "lib/files/files.h"
 
@@ -39,9 +43,9 @@ struct authselect_system_paths {
     char **content;
 };
 
-struct authselect_system_templates {
-    const char *template;
-    char **generated;
+struct authselect_system_compiled {
+    const char *content;
+    struct template **template;
 };
 
 errno_t
@@ -50,8 +54,10 @@ authselect_system_read_templates(const char *dirname,
                                  struct authselect_files **_templates)
 {
     struct authselect_files *templates;
+    struct textfile_view *view;
     errno_t ret;
     int i;
+    int n;
 
     templates = malloc_zero(struct authselect_files);
     if (templates == NULL) {
@@ -70,20 +76,90 @@ authselect_system_read_templates(const char *dirname,
         {NULL, NULL},
     };
 
-    for (i = 0; paths[i].path != NULL; i++) {
+    templates->views = malloc_zero_array(struct textfile_view *,
+                                         sizeof(paths) / sizeof(paths[0]));
+    if (templates->views == NULL) {
+        free(templates);
+        return ENOMEM;
+    }
+
+    /* Compiled templates point into the file content and profiles may be
+     * cached for a long time, therefore the content is read and not mapped
+     * so it does not change under them. */
+    for (i = 0, n = 0; paths[i].path != NULL; i++) {
         INFO("Reading file [%s/%s]", dirname, paths[i].path);
 
-        ret = textfile_read_dirfd(dirfd, dirname, paths[i].path,
-                                  AUTHSELECT_FILE_SIZE_LIMIT,
-                                  paths[i].content);
+        ret = textfile_load_dirfd(dirfd, dirname, paths[i].path,
+                                  AUTHSELECT_FILE_SIZE_LIMIT, &view);
         if (ret == ENOENT) {
             *paths[i].content = NULL;
+            continue;
         } else if (ret != EOK) {
             ERROR("Unable to read file [%s/%s] [%d]: %s",
                   dirname, paths[i].path, ret, strerror(ret));
             authselect_files_free(templates);
             return ret;
         }
+
+        templates->views[n++] = view;
+        *paths[i].content = (char *)view->data;
+    }
+
+    *_templates = templates;
+
+    return EOK;
+}
+
+static errno_t
+authselect_system_load_templates(struct authselect_files *files,
+                                 struct unpack *unpack,
+                                 struct authselect_templates **_templates)
+{
+    struct authselect_templates *templates;
+    errno_t ret;
+    int i;
+
+    templates = malloc_zero(struct authselect_templates);
+    if (templates == NULL) {
+        return ENOMEM;
+    }
+
+    templates->features = feature_table_create();
+    if (templates->features == NULL) {
+        free(templates);
+        return ENOMEM;
+    }
+
+    struct authselect_system_compiled compiled[] = {
+        {files->systemauth,      &templates->systemauth},
+        {files->passwordauth,    &templates->passwordauth},
+        {files->smartcardauth,   &templates->smartcardauth},
+        {files->fingerprintauth, &templates->fingerprintauth},
+        {files->postlogin,       &templates->postlogin},
+        {files->nsswitch,        &templates->nsswitch},
+        {files->dconfdb,         &templates->dconfdb},
+        {files->dconflock,       &templates->dconflock},
+        {NULL, NULL},
+    };
+
+    for (i = 0; compiled[i].template != NULL; i++) {
+        if (compiled[i].content == NULL) {
+            *compiled[i].template = NULL;
+            continue;
+        }
+
+        if (unpack != NULL) {
+            ret = template_unpack(compiled[i].content, templates->features,
+                                  unpack, compiled[i].template);
+        } else {
+            ret = template_compile(compiled[i].content, templates->features,
+                                   compiled[i].template);
+        }
+        if (ret != EOK) {
+            ERROR("Unable to compile template [%d]: %s", ret, strerror(ret));
+            authselect_system_templates_free(templates);
+            return ret;
+        }
     }
 
     *_templates = templates;
@@ -91,6 +167,65 @@ authselect_system_read_templates(const char *dirname,
     return EOK;
 }
 
+errno_t
+authselect_system_compile_templates(struct authselect_files *files,
+                                    struct authselect_templates **_templates)
+{
+    return authselect_system_load_templates(files, NULL, _templates);
+}
+
+void
+authselect_system_pack_templates(const struct authselect_templates *templates,
+                                 struct pack *pack)
+{
+    size_t i;
+
+    const struct template *compiled[] = {
+        templates->systemauth,
+        templates->passwordauth,
+        templates->smartcardauth,
+        templates->fingerprintauth,
+        templates->postlogin,
+        templates->nsswitch,
+        templates->dconfdb,
+        templates->dconflock
+    };
+
+    for (i = 0; i < sizeof(compiled) / sizeof(compiled[0]); i++) {
+        if (compiled[i] != NULL) {
+            template_pack(compiled[i], pack);
+        }
+    }
+}
+
+errno_t
+authselect_system_unpack_templates(struct authselect_files *files,
+                                   struct unpack *unpack,
+                                   struct authselect_templates **_templates)
+{
+    return authselect_system_load_templates(files, unpack, _templates);
+}
+
+void
+authselect_system_templates_free(struct authselect_templates *templates)
+{
+    if (templates == NULL) {
+        return;
+    }
+
+    template_free(templates->systemauth);
+    template_free(templates->passwordauth);
+    template_free(templates->smartcardauth);
+    template_free(templates->fingerprintauth);
+    template_free(templates->postlogin);
+    template_free(templates->nsswitch);
+    template_free(templates->dconfdb);
+    template_free(templates->dconflock);
+    feature_table_free(templates->features);
+
+    free(templates);
+}
+
 errno_t
 authselect_system_nsswitch_find_maps(char *content,
                                      char ***_maps)
@@ -208,13 +343,14 @@ done:
 }
 
 static errno_t
-authselect_system_generate_nsswitch(const char *template,
-                                    const char **features,
-                                    char **_content)
+authselect_system_merge_nsswitch(const char *generated,
+                                 char *user_content,
+                                 char **_content)
 {
     static const char *preambule = \
     "# If you want to make changes to nsswitch.conf please modify\n"
-    "# " PATH_USER_NSSWITCH " and run 'authselect apply-changes'.\n"
+    "# " AUTHSELECT_CONFIG_DIR "/" FILE_USER_NSSWITCH
+    " and run 'authselect apply-changes'.\n"
     "#\n"
     "# Note that your changes may not be applied as they may be\n"
     "# overwritten by selected profile. Maps set in the authselect\n"
@@ -224,29 +360,20 @@ authselect_system_generate_nsswitch(const char *template,
     "#\n"
     "# For example, if the profile sets:\n"
     "#     passwd: sss files\n"
-    "# and " PATH_USER_NSSWITCH " contains:\n"
+    "# and " AUTHSELECT_CONFIG_DIR "/" FILE_USER_NSSWITCH " contains:\n"
     "#     passwd: files\n"
     "#     hosts: files dns\n"
     "# the resulting generated nsswitch.conf will be:\n"
     "#     passwd: sss files # from profile\n"
     "#     hosts: files dns  # from user file\n\n";
-    char *user_content = NULL;
-    char *generated = NULL;
     char *content = NULL;
     char **maps = NULL;
     errno_t ret;
 
-    generated = template_generate(template, features);
-    if (generated == NULL) {
-        ret = ENOMEM;
-        goto done;
-    }
-
-    ret = textfile_read(PATH_USER_NSSWITCH, AUTHSELECT_FILE_SIZE_LIMIT,
-                        &user_content);
-    switch (ret) {
-    case EOK:
-        ret = authselect_system_nsswitch_find_maps(generated, &maps);
+    if (user_content == NULL) {
+        content = format("%s%s", preambule, generated);
+    } else {
+        ret = authselect_system_nsswitch_find_maps((char *)generated, &maps);
         if (ret != EOK) {
             goto done;
         }
@@ -258,20 +385,11 @@ authselect_system_generate_nsswitch(const char *template,
 
         if (string_is_empty(user_content)) {
             content = format("%s%s", preambule, generated);
-            break;
+        } else {
+            content = format("%s%s\n# Included from "
+                             AUTHSELECT_CONFIG_DIR "/" FILE_USER_NSSWITCH
+                             "\n\n%s", preambule, generated, user_content);
         }
-
-        content = format("%s%s\n# Included from %s\n\n%s",
-                         preambule, generated, PATH_USER_NSSWITCH,
-                         user_content);
-        break;
-    case ENOENT:
-        content = format("%s%s", preambule, generated);
-        break;
-    default:
-        ERROR("Unable to read [%s] [%d]: %s", PATH_USER_NSSWITCH,
-              ret, strerror(ret));
-        goto done;
     }
 
     if (content == NULL) {
@@ -288,59 +406,419 @@ done:
         ERROR("Unable to generate nsswitch.conf [%d]: %s", ret, strerror(ret));
     }
 
-    free(user_content);
-    free(generated);
     string_array_free(maps);
 
     return ret;
 }
 
+struct authselect_system_job;
+
+typedef errno_t
+(*authselect_system_job_fn)(struct authselect_system_job *job);
+
+/**
+ * Independent part of files generation that can run in parallel.
+ */
+struct authselect_system_job {
+    authselect_system_job_fn fn;
+    const struct template *template;
+    const struct feature_set *features;
+    char **output;
+    errno_t ret;
+};
+
+/**
+ * Worker threads that are kept between generate calls.
+ */
+struct authselect_system_pool {
+    pthread_mutex_t lock;
+
+    /* Signalled when new jobs are posted or the pool is stopped. */
+    pthread_cond_t work;
+
+    /* Signalled when the last worker finished its part of the jobs. */
+    pthread_cond_t done;
+
+    pthread_t *workers;
+    unsigned int num_workers;
+    unsigned int threads;
+    bool stop;
+
+    /* Jobs that are currently processed. */
+    unsigned long generation;
+    struct authselect_system_job *jobs;
+    size_t count;
+    size_t next;
+    unsigned int active;
+
+    /* Context of the thread that posted the jobs. */
+    struct authselect_ctx *ctx;
+};
+
+static unsigned int authselect_system_threads = 1;
+
+void
+authselect_system_set_threads(unsigned int threads)
+{
+    authselect_system_threads = threads == 0 ? 1 : threads;
+}
+
+static errno_t
+authselect_system_job_render(struct authselect_system_job *job)
+{
+    if (job->template == NULL) {
+        *job->output = NULL;
+        return EOK;
+    }
+
+    *job->output = template_render_set(job->template, job->features);
+    if (*job->output == NULL) {
+        return ENOMEM;
+    }
+
+    return EOK;
+}
+
+static errno_t
+authselect_system_job_render_nsswitch(struct authselect_system_job *job)
+{
+    *job->output = job->template == NULL
+                   ? strdup("")
+                   : template_render_set(job->template, job->features);
+    if (*job->output == NULL) {
+        ERROR("Unable to generate nsswitch.conf [%d]: %s",
+              ENOMEM, strerror(ENOMEM));
+        return ENOMEM;
+    }
+
+    return EOK;
+}
+
+static errno_t
+authselect_system_job_read_user_nsswitch(struct authselect_system_job *job)
+{
+    errno_t ret;
+
+    ret = textfile_read(PATH_USER_NSSWITCH, AUTHSELECT_FILE_SIZE_LIMIT,
+                        job->output);
+    switch (ret) {
+    case EOK:
+        return EOK;
+    case ENOENT:
+        *job->output = NULL;
+        return EOK;
+    default:
+        ERROR("Unable to read [%s] [%d]: %s", PATH_USER_NSSWITCH,
+              ret, strerror(ret));
+        return ret;
+    }
+}
+
+static struct authselect_system_job *
+authselect_system_pool_take(struct authselect_system_pool *pool)
+{
+    struct authselect_system_job *job;
+
+    pthread_mutex_lock(&pool->lock);
+    job = pool->next < pool->count ? &pool->jobs[pool->next++] : NULL;
+    pthread_mutex_unlock(&pool->lock);
+
+    return job;
+}
+
+static void
+authselect_system_pool_process(struct authselect_system_pool *pool)
+{
+    struct authselect_system_job *job;
+
+    while ((job = authselect_system_pool_take(pool)) != NULL) {
+        job->ret = job->fn(job);
+    }
+}
+
+static void *
+authselect_system_worker(void *data)
+{
+    struct authselect_system_pool *pool = data;
+    struct authselect_ctx *prev;
+    unsigned long seen = 0;
+    struct authselect_ctx *ctx;
+
+    pthread_mutex_lock(&pool->lock);
+    while (true) {
+        while (!pool->stop && pool->generation == seen) {
+            pthread_cond_wait(&pool->work, &pool->lock);
+        }
+
+        if (pool->stop) {
+            break;
+        }
+
+        seen = pool->generation;
+        ctx = pool->ctx;
+        pthread_mutex_unlock(&pool->lock);
+
+        prev = authselect_ctx_enter(ctx);
+        authselect_system_pool_process(pool);
+        authselect_ctx_leave(prev);
+
+        pthread_mutex_lock(&pool->lock);
+        pool->active--;
+        if (pool->active == 0) {
+            pthread_cond_signal(&pool->done);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+errno_t
+authselect_system_pool_create(unsigned int threads,
+                              struct authselect_system_pool **_pool)
+{
+    struct authselect_system_pool *pool;
+    unsigned int i;
+    int ret;
+
+    pool = malloc_zero(struct authselect_system_pool);
+    if (pool == NULL) {
+        return ENOMEM;
+    }
+
+    pool->threads = threads;
+
+    /* The calling thread works as well. */
+    pool->workers = malloc_zero_array(pthread_t, threads);
+    if (pool->workers == NULL) {
+        free(pool);
+        return ENOMEM;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    /* If we can not create a thread, the jobs are processed by those that
+     * are already running. */
+    for (i = 0; i + 1 < threads; i++) {
+        ret = pthread_create(&pool->workers[i], NULL,
+                             authselect_system_worker, pool);
+        if (ret != 0) {
+            WARN("Unable to create thread [%d]: %s", ret, strerror(ret));
+            break;
+        }
+
+        pool->num_workers++;
+    }
+
+    *_pool = pool;
+
+    return EOK;
+}
+
+void
+authselect_system_pool_free(struct authselect_system_pool *pool)
+{
+    unsigned int i;
+
+    if (pool == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (i = 0; i < pool->num_workers; i++) {
+        pthread_join(pool->workers[i], NULL);
+    }
+
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->work);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->workers);
+    free(pool);
+}
+
+static void
+authselect_system_pool_run(struct authselect_system_pool *pool,
+                           struct authselect_system_job *jobs,
+                           size_t count)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->jobs = jobs;
+    pool->count = count;
+    pool->next = 0;
+    pool->active = pool->num_workers;
+    pool->ctx = authselect_ctx_current();
+    pool->generation++;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+
+    authselect_system_pool_process(pool);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->active > 0) {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+
+    pool->jobs = NULL;
+    pool->count = 0;
+    pool->ctx = NULL;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * Return worker pool of the current context, it is created when it is
+ * first needed and kept until the context is freed. Calls without context
+ * get a new pool that must be freed by the caller.
+ */
+static errno_t
+authselect_system_pool_get(unsigned int threads,
+                           struct authselect_system_pool **_pool,
+                           bool *_owned)
+{
+    struct authselect_ctx *ctx = authselect_ctx_current();
+    errno_t ret;
+
+    if (ctx == NULL) {
+        *_owned = true;
+        return authselect_system_pool_create(threads, _pool);
+    }
+
+    if (ctx->pool == NULL || ctx->pool->threads != threads) {
+        authselect_system_pool_free(ctx->pool);
+        ctx->pool = NULL;
+
+        ret = authselect_system_pool_create(threads, &ctx->pool);
+        if (ret != EOK) {
+            return ret;
+        }
+    }
+
+    *_owned = false;
+    *_pool = ctx->pool;
+
+    return EOK;
+}
+
+static unsigned int
+authselect_system_get_threads(void)
+{
+    struct authselect_ctx *ctx = authselect_ctx_current();
+
+    if (ctx != NULL && ctx->has_threads) {
+        return ctx->threads;
+    }
+
+    return authselect_system_threads;
+}
+
+static errno_t
+authselect_system_run_jobs(struct authselect_system_job *jobs,
+                           size_t count)
+{
+    struct authselect_system_pool *pool;
+    unsigned int threads;
+    bool owned;
+    size_t i;
+    errno_t ret;
+
+    threads = authselect_system_get_threads();
+    if (threads > count) {
+        threads = count;
+    }
+
+    if (threads <= 1) {
+        for (i = 0; i < count; i++) {
+            jobs[i].ret = jobs[i].fn(&jobs[i]);
+            if (jobs[i].ret != EOK) {
+                return jobs[i].ret;
+            }
+        }
+
+        return EOK;
+    }
+
+    ret = authselect_system_pool_get(threads, &pool, &owned);
+    if (ret != EOK) {
+        return ret;
+    }
+
+    authselect_system_pool_run(pool, jobs, count);
+
+    if (owned) {
+        authselect_system_pool_free(pool);
+    }
+
+    /* Report the same error as the serial path would. */
+    for (i = 0; i < count; i++) {
+        if (jobs[i].ret != EOK) {
+            return jobs[i].ret;
+        }
+    }
+
+    return EOK;
+}
+
 errno_t
 authselect_system_generate(const char **features,
-                           struct authselect_files *templates,
+                           struct authselect_templates *templates,
                            struct authselect_files **_files)
 {
     struct authselect_files *files;
+    struct feature_set set;
+    char *nsswitch = NULL;
+    char *user_nsswitch = NULL;
     errno_t ret;
-    int i;
 
     if (templates == NULL) {
         return EINVAL;
     }
 
+    ret = feature_set_init(&set, templates->features, features);
+    if (ret != EOK) {
+        return ret;
+    }
+
     files = malloc_zero(struct authselect_files);
     if (files == NULL) {
+        feature_set_destroy(&set);
         return ENOMEM;
     }
 
-    struct authselect_system_templates tpls[] = {
-        {templates->systemauth,      &files->systemauth},
-        {templates->passwordauth,    &files->passwordauth},
-        {templates->smartcardauth,   &files->smartcardauth},
-        {templates->fingerprintauth, &files->fingerprintauth},
-        {templates->postlogin,       &files->postlogin},
-        {templates->dconfdb,         &files->dconfdb},
-        {templates->dconflock,       &files->dconflock},
-        {NULL, NULL},
+    struct authselect_system_job jobs[] = {
+        {authselect_system_job_render, templates->systemauth, &set,
+         &files->systemauth, EOK},
+        {authselect_system_job_render, templates->passwordauth, &set,
+         &files->passwordauth, EOK},
+        {authselect_system_job_render, templates->smartcardauth, &set,
+         &files->smartcardauth, EOK},
+        {authselect_system_job_render, templates->fingerprintauth, &set,
+         &files->fingerprintauth, EOK},
+        {authselect_system_job_render, templates->postlogin, &set,
+         &files->postlogin, EOK},
+        {authselect_system_job_render, templates->dconfdb, &set,
+         &files->dconfdb, EOK},
+        {authselect_system_job_render, templates->dconflock, &set,
+         &files->dconflock, EOK},
+        /* nsswitch.conf is special as it can be merged with
+         * user-editable file */
+        {authselect_system_job_render_nsswitch, templates->nsswitch, &set,
+         &nsswitch, EOK},
+        {authselect_system_job_read_user_nsswitch, NULL, NULL,
+         &user_nsswitch, EOK},
     };
 
-    /* Template may be NULL so we must compare against destination. */
-    for (i = 0; tpls[i].generated != NULL; i++) {
-        if (tpls[i].template == NULL) {
-            *tpls[i].generated = NULL;
-            continue;
-        }
-
-        *tpls[i].generated = template_generate(tpls[i].template, features);
-        if (tpls[i].generated == NULL) {
-            ret = ENOMEM;
-            goto done;
-        }
+    ret = authselect_system_run_jobs(jobs, sizeof(jobs) / sizeof(jobs[0]));
+    if (ret != EOK) {
+        goto done;
     }
 
-    /* nsswitch.conf is special as it can be merged with user-editable file */
-    ret = authselect_system_generate_nsswitch(templates->nsswitch, features,
-                                              &files->nsswitch);
+    ret = authselect_system_merge_nsswitch(nsswitch, user_nsswitch,
+                                           &files->nsswitch);
     if (ret != EOK) {
         goto done;
     }
@@ -350,6 +828,10 @@ authselect_system_generate(const char **features,
     ret = EOK;
 
 done:
+    feature_set_destroy(&set);
+    free(nsswitch);
+    free(user_nsswitch);
+
     if (ret != EOK) {
         ERROR("Unable to generate files [%d]: %s", ret, strerror(ret));
         authselect_files_free(files);
@@ -359,16 +841,19 @@ done:
 }
 
 static errno_t
-authselect_system_write_temp(const char *path,
+authselect_system_write_temp(int dirfd,
+                             const char *path,
                              const char *content,
                              time_t timestamp,
-                             char **_tmp_file)
+                             char **_tmp_file,
+                             int *_fd)
 {
     errno_t ret;
 
     INFO("Writing temporary file for [%s]", path);
-    ret = template_write_temporary(path, content, AUTHSELECT_FILE_MODE, timestamp,
-                                   _tmp_file);
+    ret = template_write_temporary_at(dirfd, path, content,
+                                      AUTHSELECT_FILE_MODE, timestamp,
+                                      _tmp_file, _fd);
     if (ret != EOK) {
         ERROR("Unable to write temporary file [%s] [%d]: %s",
               path, ret, strerror(ret));
@@ -380,35 +865,234 @@ authselect_system_write_temp(const char *path,
     return EOK;
 }
 
+/**
+ * Generated file that is being committed.
+ */
+struct authselect_system_commit {
+    /* Final path of the file. */
+    const char *path;
+
+    /* Descriptor of the parent directory. */
+    int dirfd;
+
+    /* Descriptor of the staged file until it is synced. */
+    int fd;
+
+    /* Staged temporary file. It holds the previous content of @path
+     * once the files were exchanged. */
+    char *staged;
+
+    /* Hard link to the previous content of @path if the files can not be
+     * exchanged atomically. */
+    char *saved;
+
+    enum {
+        COMMIT_STAGED,
+        COMMIT_EXCHANGED,
+        COMMIT_REPLACED,
+        COMMIT_CREATED
+    } state;
+};
+
 static errno_t
-authselect_system_rename_temp(char **tmp_path,
-                              const char *final_path)
+authselect_system_commit_file(struct authselect_system_commit *commit)
 {
     errno_t ret;
 
-    INFO("Renaming [%s] to [%s]", *tmp_path, final_path);
+    INFO("Committing [%s] to [%s]", commit->staged, commit->path);
 
-    ret = rename(*tmp_path, final_path);
+    ret = file_exchange(commit->dirfd, commit->staged, commit->path);
+    if (ret == EOK) {
+        commit->state = COMMIT_EXCHANGED;
+        return EOK;
+    } else if (ret == ENOTSUP) {
+        /* Keep the previous content reachable so it can be restored. */
+        commit->saved = format("%s.old", commit->staged);
+        if (commit->saved == NULL) {
+            return ENOMEM;
+        }
+
+        ret = linkat(commit->dirfd, file_at(commit->dirfd, commit->path),
+                     commit->dirfd, file_at(commit->dirfd, commit->saved), 0);
+        if (ret != 0) {
+            ret = errno;
+            free(commit->saved);
+            commit->saved = NULL;
+        }
+    }
+
+    /* ENOENT means that the file does not exist yet. */
+    if (ret != EOK && ret != ENOENT) {
+        ERROR("Unable to commit [%s] to [%s] [%d]: %s",
+              commit->staged, commit->path, ret, strerror(ret));
+        return ret;
+    }
+
+    ret = renameat(commit->dirfd, file_at(commit->dirfd, commit->staged),
+                   commit->dirfd, file_at(commit->dirfd, commit->path));
     if (ret != 0) {
         ret = errno;
         ERROR("Unable to rename [%s] to [%s] [%d]: %s",
-              *tmp_path, final_path, ret, strerror(ret));
+              commit->staged, commit->path, ret, strerror(ret));
+        return ret;
     }
 
-    free(*tmp_path);
-    *tmp_path = NULL;
+    commit->state = commit->saved != NULL ? COMMIT_REPLACED : COMMIT_CREATED;
 
-    return ret;
+    return EOK;
+}
+
+static void
+authselect_system_rollback_file(struct authselect_system_commit *commit)
+{
+    errno_t ret = EOK;
+
+    switch (commit->state) {
+    case COMMIT_STAGED:
+        return;
+    case COMMIT_EXCHANGED:
+        ret = file_exchange(commit->dirfd, commit->staged, commit->path);
+        break;
+    case COMMIT_REPLACED:
+        ret = renameat(commit->dirfd, file_at(commit->dirfd, commit->saved),
+                       commit->dirfd, file_at(commit->dirfd, commit->path));
+        ret = ret == 0 ? EOK : errno;
+        break;
+    case COMMIT_CREATED:
+        ret = unlinkat(commit->dirfd, file_at(commit->dirfd, commit->path), 0);
+        ret = ret == 0 ? EOK : errno;
+        break;
+    }
+
+    if (ret != EOK) {
+        ERROR("Unable to restore previous content of [%s] [%d]: %s",
+              commit->path, ret, strerror(ret));
+        return;
+    }
+
+    INFO("Previous content of [%s] was restored", commit->path);
+
+    if (commit->state == COMMIT_REPLACED) {
+        free(commit->saved);
+        commit->saved = NULL;
+    }
+
+    commit->state = COMMIT_STAGED;
+}
+
+static void
+authselect_system_commit_unlink(struct authselect_system_commit *commit,
+                                const char *path)
+{
+    if (path != NULL) {
+        unlinkat(commit->dirfd, file_at(commit->dirfd, path), 0);
+    }
+}
+
+static void
+authselect_system_commit_free(struct authselect_system_commit *commit,
+                              bool committed)
+{
+    if (commit->state == COMMIT_STAGED) {
+        authselect_system_commit_unlink(commit, commit->staged);
+        authselect_system_commit_unlink(commit, commit->saved);
+    } else if (committed) {
+        /* Remove the previous content. */
+        if (commit->state == COMMIT_EXCHANGED) {
+            authselect_system_commit_unlink(commit, commit->staged);
+        } else if (commit->state == COMMIT_REPLACED) {
+            authselect_system_commit_unlink(commit, commit->saved);
+        }
+    }
+
+    /* Files of a failed rollback are kept so the administrator can restore
+     * them manually. */
+
+    if (commit->fd != -1) {
+        close(commit->fd);
+        commit->fd = -1;
+    }
+
+    free(commit->staged);
+    free(commit->saved);
+    commit->staged = NULL;
+    commit->saved = NULL;
+}
+
+static bool
+authselect_system_is_unchanged(struct authselect_dirs *dirs,
+                               struct authselect_manifest *manifest,
+                               const struct authselect_generated *generated)
+{
+    struct textfile_view *content = NULL;
+    struct textfile_view *copy = NULL;
+    struct stat statbuf;
+    errno_t ret;
+    bool bret = false;
+    int copy_dirfd;
+    int dirfd;
+
+    copy_dirfd = authselect_dirs_fd(dirs, generated->copy_path);
+    dirfd = authselect_dirs_fd(dirs, generated->path);
+
+    ret = textfile_map_dirfd(copy_dirfd, NULL,
+                             file_at(copy_dirfd, generated->copy_path),
+                             AUTHSELECT_FILE_SIZE_LIMIT, &copy);
+    if (ret != EOK) {
+        goto done;
+    }
+
+    if (!template_is_written_content(copy->data, generated->content)) {
+        goto done;
+    }
+
+    /* The file itself must be the same as its copy. */
+    switch (authselect_manifest_check(manifest, generated->path,
+                                      generated->copy_path)) {
+    case AUTHSELECT_MANIFEST_VALID:
+        break;
+    case AUTHSELECT_MANIFEST_MODIFIED:
+        goto done;
+    case AUTHSELECT_MANIFEST_UNKNOWN:
+        ret = textfile_map_dirfd(dirfd, NULL, file_at(dirfd, generated->path),
+                                 AUTHSELECT_FILE_SIZE_LIMIT, &content);
+        if (ret != EOK || strcmp(content->data, copy->data) != 0) {
+            goto done;
+        }
+        break;
+    }
+
+    /* Quietly check the file mode, mismatch is fixed by writing the file. */
+    ret = fstatat(dirfd, file_at(dirfd, generated->path), &statbuf,
+                  AT_SYMLINK_NOFOLLOW);
+    if (ret != 0 || !S_ISREG(statbuf.st_mode)
+            || (statbuf.st_mode & ALLPERMS) != AUTHSELECT_FILE_MODE) {
+        goto done;
+    }
+
+    bret = true;
+
+done:
+    textfile_unmap(content);
+    textfile_unmap(copy);
+
+    return bret;
 }
 
 errno_t
-authselect_system_write(const char **features,
-                        struct authselect_files *templates)
+authselect_system_write(struct authselect_dirs *dirs,
+                        const char **features,
+                        struct authselect_templates *templates,
+                        char ***_changed)
 {
+    struct authselect_manifest *manifest = NULL;
     struct authselect_files *files;
+    struct timespec start;
+    struct timespec end;
+    char **changed = NULL;
     errno_t ret;
     time_t now;
-    int i;
+    size_t i;
 
     ret = authselect_system_generate(features, templates, &files);
     if (ret != EOK) {
@@ -416,87 +1100,188 @@ authselect_system_write(const char **features,
     }
 
     struct authselect_generated generated[] = GENERATED_FILES(files);
-    char *tmp_files[sizeof(generated)/sizeof(struct authselect_generated)] = {NULL};
-    char *tmp_copies[sizeof(generated)/sizeof(struct authselect_generated)] = {NULL};
+    struct authselect_system_commit commits[2 * sizeof(generated)/sizeof(struct authselect_generated)] = {{NULL}};
+    bool skip[sizeof(generated)/sizeof(struct authselect_generated)] = {false};
+    const char *written[2 * sizeof(generated)/sizeof(struct authselect_generated)];
+    size_t count = sizeof(generated)/sizeof(struct authselect_generated) - 1;
+    bool committed = false;
+
+    for (i = 0; i < 2 * count; i++) {
+        commits[i].path = i < count ? generated[i].copy_path
+                                    : generated[i - count].path;
+        commits[i].dirfd = authselect_dirs_fd(dirs, commits[i].path);
+        commits[i].fd = -1;
+    }
+
+    changed = string_array_create(10);
+    if (changed == NULL) {
+        ret = ENOMEM;
+        goto done;
+    }
+
+    /* Files whose content would not change are not written at all. */
+    ret = authselect_manifest_read(&manifest);
+    if (ret != EOK) {
+        manifest = NULL;
+    }
 
-    /* First, write content into temporary files, so we can safely fail
-     * on error. */
-    now = time(NULL);
     for (i = 0; generated[i].path != NULL; i++) {
-        ret = authselect_system_write_temp(generated[i].copy_path,
-                                           generated[i].content,
-                                           now, &tmp_copies[i]);
-        if (ret != EOK) {
+        skip[i] = authselect_system_is_unchanged(dirs, manifest, &generated[i]);
+        if (skip[i]) {
+            INFO("File [%s] is not changed", generated[i].path);
+            continue;
+        }
+
+        changed = string_array_add_value(changed, generated[i].path, false);
+        if (changed == NULL) {
+            ret = ENOMEM;
             goto done;
         }
+    }
+
+    /* The manifest will not be valid anymore. If we crash during the
+     * commit, the configuration is compared in full and the partially
+     * written files are reported as modified. */
+    authselect_manifest_delete();
+
+    /* First phase: stage the content in temporary files, so we can safely
+     * fail on error. Copies are staged first to keep them in sync with
+     * the configuration if anything goes wrong. */
+    now = time(NULL);
+    for (i = 0; i < 2 * count; i++) {
+        if (skip[i % count]) {
+            continue;
+        }
 
-        ret = authselect_system_write_temp(generated[i].path,
-                                           generated[i].content,
-                                           now, &tmp_files[i]);
+        ret = authselect_system_write_temp(commits[i].dirfd, commits[i].path,
+                                           generated[i % count].content,
+                                           now, &commits[i].staged,
+                                           &commits[i].fd);
         if (ret != EOK) {
             goto done;
         }
     }
 
-    /* Now rename the files.
-     *
-     * We now know that the system is writable, so rename call shall not
-     * fail and it will overwrite any existing file. The only reason it
-     * can fail is EIO which we can not do anything about and we can not
-     * even recover from it.
-     */
-    for (i = 0; generated[i].copy_path != NULL; i++) {
-        ret = authselect_system_rename_temp(&tmp_copies[i],
-                                            generated[i].copy_path);
-        if (ret != EOK) {
+    /* Make sure that the content is on the disk before the files are
+     * committed, otherwise we may end up with empty files after a crash. */
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < 2 * count; i++) {
+        if (commits[i].fd == -1) {
+            continue;
+        }
+
+        ret = fdatasync(commits[i].fd);
+        if (ret != 0) {
+            ret = errno;
+            ERROR("Unable to sync temporary file [%s] [%d]: %s",
+                  commits[i].staged, ret, strerror(ret));
             goto done;
         }
+
+        close(commits[i].fd);
+        commits[i].fd = -1;
     }
 
-    for (i = 0; generated[i].path != NULL; i++) {
-        ret = authselect_system_rename_temp(&tmp_files[i], generated[i].path);
+    /* Second phase: put the staged files in place. Existing files are
+     * atomically exchanged with the staged ones so the previous content is
+     * still available and the whole set is restored if any of the files
+     * can not be committed.
+     *
+     * This protects against errors, not against a crash: there is one
+     * exchange per file and the files are referenced by fixed paths, so
+     * they can not be switched all at once. A crash leaves a mixed set
+     * which is detected by validation since the manifest is gone. */
+    for (i = 0; i < 2 * count; i++) {
+        if (commits[i].staged == NULL) {
+            continue;
+        }
+
+        ret = authselect_system_commit_file(&commits[i]);
         if (ret != EOK) {
             goto done;
         }
     }
 
-    ret = EOK;
+    committed = true;
 
-done:
+    /* Persist the renames. */
+    for (i = 0; i < 2 * count; i++) {
+        written[i] = commits[i].staged == NULL ? NULL : commits[i].path;
+    }
+
+    ret = authselect_dirs_sync(dirs, written, 2 * count);
     if (ret != EOK) {
-        for (i = 0; generated[i].path != NULL; i++) {
-            if (tmp_copies[i] != NULL) {
-                unlink(tmp_copies[i]);
-                free(tmp_copies[i]);
-                tmp_copies[i] = NULL;
-            }
+        goto done;
+    }
 
-            if (tmp_files[i] != NULL) {
-                unlink(tmp_files[i]);
-                free(tmp_files[i]);
-                tmp_files[i] = NULL;
-            }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    INFO("Files were synced to disk in %ld ms",
+         (long)((end.tv_sec - start.tv_sec) * 1000
+                + (end.tv_nsec - start.tv_nsec) / 1000000));
+
+    /* Failure is not fatal, files will be compared in full without it. */
+    authselect_manifest_write(generated);
+
+    for (i = 0; changed[i] != NULL; i++) {
+        INFO("File [%s] was updated", changed[i]);
+    }
+
+    *_changed = changed;
+
+    ret = EOK;
+
+done:
+    if (ret != EOK && !committed) {
+        for (i = 2 * count; i > 0; i--) {
+            authselect_system_rollback_file(&commits[i - 1]);
         }
     }
+
+    for (i = 0; i < 2 * count; i++) {
+        authselect_system_commit_free(&commits[i], committed);
+    }
+
+    if (ret != EOK) {
+        string_array_free(changed);
+    }
+    authselect_manifest_free(manifest);
     authselect_files_free(files);
 
     return ret;
 }
 
 static bool
-authselect_system_validate_file(const char *path,
+authselect_system_validate_file(struct authselect_dirs *dirs,
+                                struct authselect_manifest *manifest,
+                                const char *path,
                                 const char *copy_path,
                                 const char *expected)
 {
-    char *content;
-    char *copy_content;
+    struct textfile_view *content;
+    struct textfile_view *copy_content;
     errno_t ret;
     bool bret;
+    int copy_dirfd;
+    int dirfd;
+
+    copy_dirfd = authselect_dirs_fd(dirs, copy_path);
+    dirfd = authselect_dirs_fd(dirs, path);
 
     INFO("Validating file [%s]", path);
     expected = expected == NULL ? "" : expected;
 
-    ret = textfile_read(path, AUTHSELECT_FILE_SIZE_LIMIT, &content);
+    switch (authselect_manifest_check(manifest, path, copy_path)) {
+    case AUTHSELECT_MANIFEST_VALID:
+        goto check_mode;
+    case AUTHSELECT_MANIFEST_MODIFIED:
+        ERROR("[%s] has unexpected content!", path);
+        return false;
+    case AUTHSELECT_MANIFEST_UNKNOWN:
+        break;
+    }
+
+    ret = textfile_map_dirfd(dirfd, NULL, file_at(dirfd, path),
+                             AUTHSELECT_FILE_SIZE_LIMIT, &content);
     if (ret == ENOENT) {
         ERROR("[%s] does not exist!", path);
         return false;
@@ -508,25 +1293,27 @@ authselect_system_validate_file(const char *path,
         return false;
     }
 
-    ret = textfile_read(copy_path, AUTHSELECT_FILE_SIZE_LIMIT, &copy_content);
+    ret = textfile_map_dirfd(copy_dirfd, NULL, file_at(copy_dirfd, copy_path),
+                             AUTHSELECT_FILE_SIZE_LIMIT, &copy_content);
     if (ret == EOK) {
         /* Compare against copy of the originally generated files. */
         INFO("Comparing content against [%s]", copy_path);
-        bret = strcmp(content, copy_content) == 0;
-        free(copy_content);
+        bret = strcmp(content->data, copy_content->data) == 0;
+        textfile_unmap(copy_content);
     } else {
         INFO("Comparing content against current profile");
-        bret = template_validate_written_content(content, expected);
+        bret = template_validate_written_content(content->data, expected);
     }
 
-    free(content);
+    textfile_unmap(content);
     if (!bret) {
         ERROR("[%s] has unexpected content!", path);
         return false;
     }
 
-    ret = file_is_regular(path, AUTHSELECT_UID, AUTHSELECT_GID,
-                          S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH, &bret);
+check_mode:
+    ret = file_is_regular_at(dirfd, path, AUTHSELECT_UID, AUTHSELECT_GID,
+                             S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH, &bret);
     if (ret != EOK) {
         ERROR("Unable to check file mode of [%s] [%d]: %s",
               path, ret, strerror(ret));
@@ -537,15 +1324,25 @@ authselect_system_validate_file(const char *path,
 }
 
 bool
-authselect_system_validate(struct authselect_files *files)
+authselect_system_validate(struct authselect_dirs *dirs,
+                           struct authselect_files *files)
 {
     struct authselect_generated generated[] = GENERATED_FILES(files);
+    struct authselect_manifest *manifest = NULL;
     bool result = true;
+    errno_t ret;
     bool bret;
     int i;
 
+    ret = authselect_manifest_read(&manifest);
+    if (ret != EOK && ret != ENOENT) {
+        WARN("Unable to read manifest [%s] [%d]: %s",
+             PATH_MANIFEST, ret, strerror(ret));
+    }
+
     for (i = 0; generated[i].path != NULL; i++) {
-        bret = authselect_system_validate_file(generated[i].path,
+        bret = authselect_system_validate_file(dirs, manifest,
+                                               generated[i].path,
                                                generated[i].copy_path,
                                                generated[i].content);
         result &= bret;
@@ -555,11 +1352,13 @@ authselect_system_validate(struct authselect_files *files)
         }
     }
 
+    authselect_manifest_free(manifest);
+
     return result;
 }
 
 bool
-authselect_system_validate_missing()
+authselect_system_validate_missing(struct authselect_dirs *dirs)
 {
     struct authselect_generated generated[] = GENERATED_FILES_PATHS;
     bool result = true;
@@ -567,7 +1366,8 @@ authselect_system_validate_missing()
     int i;
 
     for (i = 0; generated[i].path != NULL; i++) {
-        ret = file_exists(generated[i].path);
+        ret = file_exists_at(authselect_dirs_fd(dirs, generated[i].path),
+                             generated[i].path);
         if (ret == EOK) {
             ERROR("File [%s] is still present", generated[i].path);
             result = false;
@@ -22,10 +22,12 @@
 #define _AUTHSELECT_PATHS_H_
 
 #include <stdbool.h>
+#include <stddef.h>
+
+#include "common/errno_t.h"
 
 /* Authselect configuration file. */
 #define FILE_CONFIG      "authselect.conf"
-#define PATH_CONFIG_FILE AUTHSELECT_CONFIG_DIR "/" FILE_CONFIG
 
 /* UID and GID of files owned by authselect. -1 means do not check. */
 #define AUTHSELECT_UID -1
@@ -43,44 +45,245 @@
 #define FILE_DCONF_DB    "dconf-db"
 #define FILE_DCONF_LOCK  "dconf-locks"
 
+/* File that can be modified by user. */
+#define FILE_USER_NSSWITCH "user-nsswitch.conf"
+
+/* Files stored in backup directory. */
+#define FILE_BACKUP_MANIFEST "manifest"
+#define FILE_BACKUP_OBJECTS  ".objects"
+
+/* Paths that authselect works with. They are prefixed with the root
+ * directory if it is set, see authselect_path(). */
+enum authselect_path_id {
+    /* Directories. */
+    AUTHSELECT_PATH_CONFIG_DIR,
+    AUTHSELECT_PATH_STATE_DIR,
+    AUTHSELECT_PATH_PAM_DIR,
+    AUTHSELECT_PATH_DCONF_DIR,
+    AUTHSELECT_PATH_DCONF_LOCKS_DIR,
+    AUTHSELECT_PATH_BACKUP_DIR,
+    AUTHSELECT_PATH_DEFAULT_PROFILES,
+    AUTHSELECT_PATH_VENDOR_PROFILES,
+    AUTHSELECT_PATH_CUSTOM_PROFILES,
+    AUTHSELECT_PATH_PROFILE_CACHE,
+    AUTHSELECT_PATH_BACKUP_OBJECTS,
+
+    /* Authselect configuration file. */
+    AUTHSELECT_PATH_CONFIG_FILE,
+
+    /* Generated system files. */
+    AUTHSELECT_PATH_SYSTEM,
+    AUTHSELECT_PATH_PASSWORD,
+    AUTHSELECT_PATH_FINGERPRINT,
+    AUTHSELECT_PATH_SMARTCARD,
+    AUTHSELECT_PATH_POSTLOGIN,
+    AUTHSELECT_PATH_NSSWITCH,
+    AUTHSELECT_PATH_DCONF_DB,
+    AUTHSELECT_PATH_DCONF_LOCK,
+    AUTHSELECT_PATH_USER_NSSWITCH,
+
+    /* Copies of generated system files. */
+    AUTHSELECT_PATH_COPY_SYSTEM,
+    AUTHSELECT_PATH_COPY_PASSWORD,
+    AUTHSELECT_PATH_COPY_FINGERPRINT,
+    AUTHSELECT_PATH_COPY_SMARTCARD,
+    AUTHSELECT_PATH_COPY_POSTLOGIN,
+    AUTHSELECT_PATH_COPY_NSSWITCH,
+    AUTHSELECT_PATH_COPY_DCONF_DB,
+    AUTHSELECT_PATH_COPY_DCONF_LOCK,
+    AUTHSELECT_PATH_MANIFEST,
+
+    /* Symbolic links to generated system files. */
+    AUTHSELECT_PATH_SYMLINK_SYSTEM,
+    AUTHSELECT_PATH_SYMLINK_PASSWORD,
+    AUTHSELECT_PATH_SYMLINK_FINGERPRINT,
+    AUTHSELECT_PATH_SYMLINK_SMARTCARD,
+    AUTHSELECT_PATH_SYMLINK_POSTLOGIN,
+    AUTHSELECT_PATH_SYMLINK_NSSWITCH,
+    AUTHSELECT_PATH_SYMLINK_DCONF_DB,
+    AUTHSELECT_PATH_SYMLINK_DCONF_LOCK,
+
+    /* Index of all available profiles. */
+    AUTHSELECT_PATH_PROFILE_INDEX,
+
+    AUTHSELECT_PATH_SENTINEL
+};
+
+/**
+ * Root directory that is prefixed to all paths and the prefixed paths.
+ */
+struct authselect_root;
+
+/**
+ * Create root directory prefix. Symbolic links in the paths are resolved
+ * within the root directory as if chroot was used, so an absolute link in
+ * the root directory does not lead to files of this system. The last
+ * component of a file path is not followed.
+ *
+ * @param dir       Path to the root directory. It must be an existing
+ *                  directory.
+ * @param _root     Root directory prefix. It is set to NULL if @dir is
+ *                  the system root directory.
+ *
+ * @return EOK on success, other errno code on error.
+ */
+errno_t
+authselect_root_create(const char *dir,
+                       struct authselect_root **_root);
+
+/**
+ * Free root directory prefix.
+ *
+ * @param root      Root directory prefix.
+ */
+void
+authselect_root_free(struct authselect_root *root);
+
+/**
+ * Set root directory prefix that is used when the calling thread does not
+ * have a context with its own root directory. Previous root is freed.
+ *
+ * @param root      Root directory prefix or NULL to not use any.
+ */
+void
+authselect_root_set_global(struct authselect_root *root);
+
+/**
+ * Return root directory of the calling thread.
+ *
+ * @return Path to the root directory or NULL if it is not set.
+ */
+const char *
+authselect_root_dir(void);
+
+/**
+ * Return path prefixed with the root directory of the calling thread.
+ *
+ * @param id        Path identifier.
+ *
+ * @return Path to the file on this system.
+ */
+const char *
+authselect_path(enum authselect_path_id id);
+
+/**
+ * Return path as it is seen from within the root directory. It is used
+ * as a destination of symbolic links and in generated content.
+ *
+ * @param id        Path identifier.
+ *
+ * @return Path to the file without the root directory prefix.
+ */
+const char *
+authselect_path_in_root(enum authselect_path_id id);
+
+/**
+ * Strip the root directory of the calling thread from @path.
+ *
+ * @param path      Path to a file on this system.
+ *
+ * @return Path to the file as it is seen from within the root directory.
+ */
+const char *
+authselect_path_strip_root(const char *path);
+
+/**
+ * Resolve symbolic link at @path within the root directory. Absolute
+ * destinations of the link and of any link on the way are resolved
+ * within the root directory so the link does not lead outside of it.
+ *
+ * @param path      Path to a file on this system.
+ * @param _resolved Path to the final destination of the link or copy of
+ *                  @path if it is not a symbolic link.
+ *
+ * @return EOK on success, other errno code on error.
+ */
+errno_t
+authselect_path_follow(const char *path,
+                       char **_resolved);
+
+/* Authselect configuration file. */
+#define PATH_CONFIG_FILE authselect_path(AUTHSELECT_PATH_CONFIG_FILE)
+
+/* Directories that authselect works with. */
+#define DIR_CONFIG       authselect_path(AUTHSELECT_PATH_CONFIG_DIR)
+#define DIR_STATE        authselect_path(AUTHSELECT_PATH_STATE_DIR)
+#define DIR_PAM          authselect_path(AUTHSELECT_PATH_PAM_DIR)
+#define DIR_DCONF        authselect_path(AUTHSELECT_PATH_DCONF_DIR)
+#define DIR_DCONF_LOCKS  authselect_path(AUTHSELECT_PATH_DCONF_LOCKS_DIR)
+#define DIR_BACKUP       authselect_path(AUTHSELECT_PATH_BACKUP_DIR)
+#define DIR_BACKUP_OBJECTS authselect_path(AUTHSELECT_PATH_BACKUP_OBJECTS)
+
 /* Paths to generated system files. */
-#define PATH_SYSTEM      AUTHSELECT_CONFIG_DIR "/" FILE_SYSTEM
-#define PATH_PASSWORD    AUTHSELECT_CONFIG_DIR "/" FILE_PASSWORD
-#define PATH_FINGERPRINT AUTHSELECT_CONFIG_DIR "/" FILE_FINGERPRINT
-#define PATH_SMARTCARD   AUTHSELECT_CONFIG_DIR "/" FILE_SMARTCARD
-#define PATH_POSTLOGIN   AUTHSELECT_CONFIG_DIR "/" FILE_POSTLOGIN
-#define PATH_NSSWITCH    AUTHSELECT_CONFIG_DIR "/" FILE_NSSWITCH
-#define PATH_DCONF_DB    AUTHSELECT_CONFIG_DIR "/" FILE_DCONF_DB
-#define PATH_DCONF_LOCK  AUTHSELECT_CONFIG_DIR "/" FILE_DCONF_LOCK
+#define PATH_SYSTEM      authselect_path(AUTHSELECT_PATH_SYSTEM)
+#define PATH_PASSWORD    authselect_path(AUTHSELECT_PATH_PASSWORD)
+#define PATH_FINGERPRINT authselect_path(AUTHSELECT_PATH_FINGERPRINT)
+#define PATH_SMARTCARD   authselect_path(AUTHSELECT_PATH_SMARTCARD)
+#define PATH_POSTLOGIN   authselect_path(AUTHSELECT_PATH_POSTLOGIN)
+#define PATH_NSSWITCH    authselect_path(AUTHSELECT_PATH_NSSWITCH)
+#define PATH_DCONF_DB    authselect_path(AUTHSELECT_PATH_DCONF_DB)
+#define PATH_DCONF_LOCK  authselect_path(AUTHSELECT_PATH_DCONF_LOCK)
+
+/* Destinations of symbolic links to generated system files. */
+#define LINK_SYSTEM      authselect_path_in_root(AUTHSELECT_PATH_SYSTEM)
+#define LINK_PASSWORD    authselect_path_in_root(AUTHSELECT_PATH_PASSWORD)
+#define LINK_FINGERPRINT authselect_path_in_root(AUTHSELECT_PATH_FINGERPRINT)
+#define LINK_SMARTCARD   authselect_path_in_root(AUTHSELECT_PATH_SMARTCARD)
+#define LINK_POSTLOGIN   authselect_path_in_root(AUTHSELECT_PATH_POSTLOGIN)
+#define LINK_NSSWITCH    authselect_path_in_root(AUTHSELECT_PATH_NSSWITCH)
+#define LINK_DCONF_DB    authselect_path_in_root(AUTHSELECT_PATH_DCONF_DB)
+#define LINK_DCONF_LOCK  authselect_path_in_root(AUTHSELECT_PATH_DCONF_LOCK)
 
 /* Path to files that can be modified by user. */
-#define PATH_USER_NSSWITCH  AUTHSELECT_CONFIG_DIR "/user-nsswitch.conf"
+#define PATH_USER_NSSWITCH authselect_path(AUTHSELECT_PATH_USER_NSSWITCH)
 
 /* Paths to copy generated system files. Used to check changes
  * in configuration. */
-#define PATH_COPY_SYSTEM      AUTHSELECT_STATE_DIR "/" FILE_SYSTEM
-#define PATH_COPY_PASSWORD    AUTHSELECT_STATE_DIR "/" FILE_PASSWORD
-#define PATH_COPY_FINGERPRINT AUTHSELECT_STATE_DIR "/" FILE_FINGERPRINT
-#define PATH_COPY_SMARTCARD   AUTHSELECT_STATE_DIR "/" FILE_SMARTCARD
-#define PATH_COPY_POSTLOGIN   AUTHSELECT_STATE_DIR "/" FILE_POSTLOGIN
-#define PATH_COPY_NSSWITCH    AUTHSELECT_STATE_DIR "/" FILE_NSSWITCH
-#define PATH_COPY_DCONF_DB    AUTHSELECT_STATE_DIR "/" FILE_DCONF_DB
-#define PATH_COPY_DCONF_LOCK  AUTHSELECT_STATE_DIR "/" FILE_DCONF_LOCK
+#define PATH_COPY_SYSTEM      authselect_path(AUTHSELECT_PATH_COPY_SYSTEM)
+#define PATH_COPY_PASSWORD    authselect_path(AUTHSELECT_PATH_COPY_PASSWORD)
+#define PATH_COPY_FINGERPRINT authselect_path(AUTHSELECT_PATH_COPY_FINGERPRINT)
+#define PATH_COPY_SMARTCARD   authselect_path(AUTHSELECT_PATH_COPY_SMARTCARD)
+#define PATH_COPY_POSTLOGIN   authselect_path(AUTHSELECT_PATH_COPY_POSTLOGIN)
+#define PATH_COPY_NSSWITCH    authselect_path(AUTHSELECT_PATH_COPY_NSSWITCH)
+#define PATH_COPY_DCONF_DB    authselect_path(AUTHSELECT_PATH_COPY_DCONF_DB)
+#define PATH_COPY_DCONF_LOCK  authselect_path(AUTHSELECT_PATH_COPY_DCONF_LOCK)
+
+/* Stat signatures and digests of written generated files and their copies.
+ * Used to check changes in configuration quickly. */
+#define PATH_MANIFEST authselect_path(AUTHSELECT_PATH_MANIFEST)
 
 /* Names of symbolic links that points to generated files. */
-#define PATH_SYMLINK_SYSTEM      AUTHSELECT_PAM_DIR "/" FILE_SYSTEM
-#define PATH_SYMLINK_PASSWORD    AUTHSELECT_PAM_DIR "/" FILE_PASSWORD
-#define PATH_SYMLINK_FINGERPRINT AUTHSELECT_PAM_DIR "/" FILE_FINGERPRINT
-#define PATH_SYMLINK_SMARTCARD   AUTHSELECT_PAM_DIR "/" FILE_SMARTCARD
-#define PATH_SYMLINK_POSTLOGIN   AUTHSELECT_PAM_DIR "/" FILE_POSTLOGIN
-#define PATH_SYMLINK_NSSWITCH    AUTHSELECT_NSSWITCH_CONF
-#define PATH_SYMLINK_DCONF_DB    AUTHSELECT_DCONF_DIR  "/" AUTHSELECT_DCONF_FILE
-#define PATH_SYMLINK_DCONF_LOCK  AUTHSELECT_DCONF_DIR  "/locks/" AUTHSELECT_DCONF_FILE
+#define PATH_SYMLINK_SYSTEM                                                   \
+    authselect_path(AUTHSELECT_PATH_SYMLINK_SYSTEM)
+#define PATH_SYMLINK_PASSWORD                                                 \
+    authselect_path(AUTHSELECT_PATH_SYMLINK_PASSWORD)
+#define PATH_SYMLINK_FINGERPRINT                                              \
+    authselect_path(AUTHSELECT_PATH_SYMLINK_FINGERPRINT)
+#define PATH_SYMLINK_SMARTCARD                                                \
+    authselect_path(AUTHSELECT_PATH_SYMLINK_SMARTCARD)
+#define PATH_SYMLINK_POSTLOGIN                                                \
+    authselect_path(AUTHSELECT_PATH_SYMLINK_POSTLOGIN)
+#define PATH_SYMLINK_NSSWITCH                                                 \
+    authselect_path(AUTHSELECT_PATH_SYMLINK_NSSWITCH)
+#define PATH_SYMLINK_DCONF_DB                                                 \
+    authselect_path(AUTHSELECT_PATH_SYMLINK_DCONF_DB)
+#define PATH_SYMLINK_DCONF_LOCK                                               \
+    authselect_path(AUTHSELECT_PATH_SYMLINK_DCONF_LOCK)
 
 /* Path to profile directories. */
-#define DIR_DEFAULT_PROFILES AUTHSELECT_PROFILE_DIR
-#define DIR_VENDOR_PROFILES  AUTHSELECT_VENDOR_DIR
-#define DIR_CUSTOM_PROFILES  AUTHSELECT_CUSTOM_DIR
+#define DIR_DEFAULT_PROFILES authselect_path(AUTHSELECT_PATH_DEFAULT_PROFILES)
+#define DIR_VENDOR_PROFILES  authselect_path(AUTHSELECT_PATH_VENDOR_PROFILES)
+#define DIR_CUSTOM_PROFILES  authselect_path(AUTHSELECT_PATH_CUSTOM_PROFILES)
+
+/* Compiled profiles are cached here if this directory exists. */
+#define DIR_PROFILE_CACHE    authselect_path(AUTHSELECT_PATH_PROFILE_CACHE)
+
+/* Index of all available profiles, stored together with compiled profiles. */
+#define PATH_PROFILE_INDEX   authselect_path(AUTHSELECT_PATH_PROFILE_INDEX)
+
+/* Socket where authselectd serves queries. It always belongs to this system
+ * and it is not prefixed with the root directory. */
+#define PATH_DAEMON_SOCKET   AUTHSELECT_RUN_DIR "/authselectd.socket"
 
 /* Structure to hold path and content of generated system files.
  * @see GENERATED_FILES, GENERATED_FILES_PATHS */
@@ -143,14 +346,14 @@ struct authselect_symlink {
 };
 
 #define SYMLINK_FILES                                                   \
-    {PATH_SYMLINK_SYSTEM,      PATH_SYSTEM,      false},                \
-    {PATH_SYMLINK_PASSWORD,    PATH_PASSWORD,    false},                \
-    {PATH_SYMLINK_FINGERPRINT, PATH_FINGERPRINT, false},                \
-    {PATH_SYMLINK_SMARTCARD,   PATH_SMARTCARD,   false},                \
-    {PATH_SYMLINK_POSTLOGIN,   PATH_POSTLOGIN,   false},                \
-    {PATH_SYMLINK_NSSWITCH,    PATH_NSSWITCH,    false},                \
-    {PATH_SYMLINK_DCONF_DB,    PATH_DCONF_DB,    true},                 \
-    {PATH_SYMLINK_DCONF_LOCK,  PATH_DCONF_LOCK,  true},                 \
+    {PATH_SYMLINK_SYSTEM,      LINK_SYSTEM,      false},                \
+    {PATH_SYMLINK_PASSWORD,    LINK_PASSWORD,    false},                \
+    {PATH_SYMLINK_FINGERPRINT, LINK_FINGERPRINT, false},                \
+    {PATH_SYMLINK_SMARTCARD,   LINK_SMARTCARD,   false},                \
+    {PATH_SYMLINK_POSTLOGIN,   LINK_POSTLOGIN,   false},                \
+    {PATH_SYMLINK_NSSWITCH,    LINK_NSSWITCH,    false},                \
+    {PATH_SYMLINK_DCONF_DB,    LINK_DCONF_DB,    true},                 \
+    {PATH_SYMLINK_DCONF_LOCK,  LINK_DCONF_LOCK,  true},                 \
     {NULL, NULL, false}                                                 \
 
 /**
@@ -18,40 +18,296 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <fcntl.h>
 #include <errno.h>
+#include <limits.h>
+#include <pthread.h>
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 #include "common/common.h"
 #include "lib/constants.h"
+#include "lib/ctx/ctx.h"
 #include "lib/files/files.h"
 #include "lib/profiles/profiles.h"
+#include "lib/util/command.h"
 #include "lib/util/util.h"
 
+/**
+ * State of dconf database update that runs in background. Each context has
+ * its own, calls without context use the global one.
+ */
+struct authselect_profile_dconf {
+    pthread_mutex_t lock;
+    bool running;
+    pthread_t thread;
+
+    /* Context that owns this state, the thread runs within it. */
+    struct authselect_ctx *ctx;
+
+    /* Result of the running update. */
+    errno_t result;
+
+    /* First error that was not yet returned by wait. */
+    errno_t error;
+};
+
+static struct authselect_profile_dconf authselect_profile_dconf_global = {
+    PTHREAD_MUTEX_INITIALIZER, false, 0, NULL, EOK, EOK
+};
+
+/* Background updates of calls without context. */
+static bool authselect_profile_dconf_async = false;
+
+/* The database is updated by one thread at a time, even if multiple
+ * contexts activate profiles. */
+static pthread_mutex_t authselect_profile_dconf_run_lock
+    = PTHREAD_MUTEX_INITIALIZER;
+
+static errno_t
+authselect_profile_dconf_run(void)
+{
+    const char *argv[] = {AUTHSELECT_DCONF_BIN, "update", NULL};
+    char *output = NULL;
+    int status;
+    errno_t ret;
+
+    INFO("Updating dconf database");
+
+    pthread_mutex_lock(&authselect_profile_dconf_run_lock);
+    ret = command_run(argv, AUTHSELECT_DCONF_TIMEOUT, &status, &output);
+    pthread_mutex_unlock(&authselect_profile_dconf_run_lock);
+    if (ret != EOK) {
+        return ret;
+    }
+
+    if (status != 0) {
+        ERROR("%s update failed [%d]: %s", AUTHSELECT_DCONF_BIN, status,
+              output == NULL ? "" : output);
+        ret = EIO;
+        goto done;
+    }
+
+    ret = EOK;
+
+done:
+    free(output);
+
+    return ret;
+}
+
+static void *
+authselect_profile_dconf_thread(void *data)
+{
+    struct authselect_profile_dconf *dconf = data;
+    struct authselect_ctx *prev;
+
+    prev = authselect_ctx_enter(dconf->ctx);
+    dconf->result = authselect_profile_dconf_run();
+    authselect_ctx_leave(prev);
+
+    return NULL;
+}
+
+void
+authselect_profile_dconf_set_async(bool async)
+{
+    authselect_profile_dconf_async = async;
+}
+
+/**
+ * Return state of the current context, it is created if @create is true.
+ */
+static struct authselect_profile_dconf *
+authselect_profile_dconf_get(bool create)
+{
+    struct authselect_ctx *ctx = authselect_ctx_current();
+    struct authselect_profile_dconf *dconf;
+
+    if (ctx == NULL) {
+        return &authselect_profile_dconf_global;
+    }
+
+    if (ctx->dconf != NULL || !create) {
+        return ctx->dconf;
+    }
+
+    dconf = malloc_zero(struct authselect_profile_dconf);
+    if (dconf == NULL) {
+        return NULL;
+    }
+
+    pthread_mutex_init(&dconf->lock, NULL);
+    dconf->ctx = ctx;
+    ctx->dconf = dconf;
+
+    return dconf;
+}
+
+static bool
+authselect_profile_dconf_is_async(void)
+{
+    struct authselect_ctx *ctx = authselect_ctx_current();
+
+    if (ctx != NULL && ctx->has_dconf_async) {
+        return ctx->dconf_async;
+    }
+
+    return authselect_profile_dconf_async;
+}
+
+/* Must be called with the lock held. The first error is kept until it is
+ * returned by authselect_profile_dconf_wait(). */
+static void
+authselect_profile_dconf_join(struct authselect_profile_dconf *dconf)
+{
+    if (!dconf->running) {
+        return;
+    }
+
+    pthread_join(dconf->thread, NULL);
+    dconf->running = false;
+
+    if (dconf->error == EOK) {
+        dconf->error = dconf->result;
+    }
+}
+
+errno_t
+authselect_profile_dconf_wait(void)
+{
+    struct authselect_profile_dconf *dconf;
+    errno_t ret;
+
+    dconf = authselect_profile_dconf_get(false);
+    if (dconf == NULL) {
+        return EOK;
+    }
+
+    pthread_mutex_lock(&dconf->lock);
+    authselect_profile_dconf_join(dconf);
+    ret = dconf->error;
+    dconf->error = EOK;
+    pthread_mutex_unlock(&dconf->lock);
+
+    return ret;
+}
+
+void
+authselect_profile_dconf_free(struct authselect_profile_dconf *dconf)
+{
+    if (dconf == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&dconf->lock);
+    authselect_profile_dconf_join(dconf);
+    pthread_mutex_unlock(&dconf->lock);
+
+    if (dconf->error != EOK) {
+        WARN("Result of dconf database update was not obtained [%d]: %s",
+             dconf->error, strerror(dconf->error));
+    }
+
+    pthread_mutex_destroy(&dconf->lock);
+    free(dconf);
+}
+
 errno_t
 authselect_profile_dconf_update()
 {
+    struct authselect_profile_dconf *dconf;
     errno_t ret;
-    int sysret;
+
+    /* The dconf binary always updates the database of this system. */
+    if (authselect_root_dir() != NULL) {
+        INFO("Root directory is set, run '%s update' within it to update "
+             "dconf database", AUTHSELECT_DCONF_BIN);
+        return EOK;
+    }
 
     ret = file_check_access(AUTHSELECT_DCONF_BIN, X_OK);
     if (ret != EOK) {
         return ret;
     }
 
-    sysret = system(AUTHSELECT_DCONF_BIN " update &> /dev/null");
-    if (sysret != 0) {
-        ERROR("%s update failed: %d", AUTHSELECT_DCONF_BIN, sysret);
-        return EIO;
+    if (!authselect_profile_dconf_is_async()) {
+        return authselect_profile_dconf_run();
+    }
+
+    dconf = authselect_profile_dconf_get(true);
+    if (dconf == NULL) {
+        return ENOMEM;
+    }
+
+    /* Only one update of each context runs at a time. The thread uses the
+     * context so its messages go to the same debug function. */
+    pthread_mutex_lock(&dconf->lock);
+    authselect_profile_dconf_join(dconf);
+
+    ret = pthread_create(&dconf->thread, NULL,
+                         authselect_profile_dconf_thread, dconf);
+    if (ret == 0) {
+        dconf->running = true;
+    }
+
+    pthread_mutex_unlock(&dconf->lock);
+
+    if (ret != 0) {
+        WARN("Unable to update dconf database in background [%d]: %s",
+             ret, strerror(ret));
+        return authselect_profile_dconf_run();
     }
 
     return EOK;
 }
 
+static bool
+authselect_profile_dconf_changed(struct authselect_dirs *dirs,
+                                 char **changed)
+{
+    char target[PATH_MAX];
+    ssize_t len;
+    size_t i;
+    int dirfd;
+
+    if (string_array_has_value(changed, PATH_DCONF_DB)
+            || string_array_has_value(changed, PATH_DCONF_LOCK)) {
+        return true;
+    }
+
+    /* The database needs to be updated also if the files are being linked
+     * for the first time. */
+    const char *links[][2] = {
+        {PATH_SYMLINK_DCONF_DB, LINK_DCONF_DB},
+        {PATH_SYMLINK_DCONF_LOCK, LINK_DCONF_LOCK},
+    };
+
+    for (i = 0; i < sizeof(links) / sizeof(links[0]); i++) {
+        dirfd = authselect_dirs_fd(dirs, links[i][0]);
+        len = readlinkat(dirfd, file_at(dirfd, links[i][0]), target,
+                         sizeof(target) - 1);
+        if (len == -1) {
+            return true;
+        }
+
+        target[len] = '\0';
+        if (strcmp(target, links[i][1]) != 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 errno_t
 authselect_profile_activate(struct authselect_profile *profile,
                             const char **features)
 {
+    struct authselect_dirs *dirs = NULL;
+    char **changed = NULL;
+    bool dconf_changed;
     errno_t ret;
 
     /* Check that all directories are writable. */
@@ -60,23 +316,37 @@ authselect_profile_activate(struct authselect_profile *profile,
         return EACCES;
     }
 
-    ret = authselect_system_write(features, profile->files);
+    ret = authselect_dirs_open(&dirs);
+    if (ret != EOK) {
+        return ret;
+    }
+
+    ret = authselect_system_write(dirs, features, profile->templates,
+                                  &changed);
     if (ret != EOK) {
         ERROR("Unable to write generated system files [%d]: %s",
               ret, strerror(ret));
-        return ret;
+        goto done;
     }
 
-    ret = authselect_config_write(profile->id, features);
+    dconf_changed = authselect_profile_dconf_changed(dirs, changed);
+
+    ret = authselect_config_write(dirs, profile->id, features);
     if (ret != EOK) {
         ERROR("Unable to write configuration [%d]: %s", ret, strerror(ret));
-        return ret;
+        goto done;
     }
 
-    ret = authselect_symlinks_write();
+    ret = authselect_symlinks_write(dirs);
     if (ret != EOK) {
         ERROR("Unable to create symbolic links [%d]: %s", ret, strerror(ret));
-        return ret;
+        goto done;
+    }
+
+    if (!dconf_changed) {
+        INFO("Dconf configuration is not changed, skipping dconf update");
+        ret = EOK;
+        goto done;
     }
 
     ret = authselect_profile_dconf_update();
@@ -84,8 +354,14 @@ authselect_profile_activate(struct authselect_profile *profile,
         INFO("Dconf is not installed on your system");
     } else if (ret != EOK) {
         ERROR("Unable to update dconf database [%d]: %s", ret, strerror(ret));
-        return ret;
+        goto done;
     }
 
-    return EOK;
+    ret = EOK;
+
+done:
+    authselect_dirs_close(dirs);
+    string_array_free(changed);
+
+    return ret;
 }
@@ -0,0 +1,416 @@
+/*
+    Authors:
+        Pavel Březina <pbrezina@redhat.com>
+
+    Copyright (C) 2018 Red Hat
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "common/common.h"
+#include "lib/constants.h"
+#include "lib/profiles/profiles.h"
+#include "lib/files/files.h"
+#include "lib/util/util.h"
+
+/* Bump this if the serialized format changes. */
+#define CACHE_MAGIC   "authselect-profile-cache"
+#define CACHE_FORMAT  1
+
+errno_t
+authselect_profile_signature_file(int dirfd,
+                                  const char *name,
+                                  time_t now,
+                                  struct pack *signature)
+{
+    struct stat st;
+    errno_t ret;
+
+    ret = fstatat(dirfd, name, &st, 0);
+    if (ret != 0) {
+        ret = errno;
+        if (ret != ENOENT) {
+            return ret;
+        }
+
+        /* Missing file is part of the signature as well. */
+        memset(&st, 0, sizeof(struct stat));
+    }
+
+    /* Files modified within the last second may still be modified again
+     * without changing their time stamps so they are not cached yet. */
+    if (st.st_mtim.tv_sec >= now - 1 || st.st_ctim.tv_sec >= now - 1) {
+        return EAGAIN;
+    }
+
+    pack_uint64(signature, st.st_dev);
+    pack_uint64(signature, st.st_ino);
+    pack_uint64(signature, st.st_size);
+    pack_uint64(signature, st.st_mtim.tv_sec);
+    pack_uint64(signature, st.st_mtim.tv_nsec);
+    pack_uint64(signature, st.st_ctim.tv_sec);
+    pack_uint64(signature, st.st_ctim.tv_nsec);
+
+    return EOK;
+}
+
+errno_t
+authselect_profile_signature(int dirfd,
+                             time_t now,
+                             struct pack *signature)
+{
+    errno_t ret;
+    int i;
+
+    const char *names[] = {
+        ".",
+        FILE_README,
+        FILE_REQUIREMENT,
+        FILE_SYSTEM,
+        FILE_PASSWORD,
+        FILE_SMARTCARD,
+        FILE_FINGERPRINT,
+        FILE_POSTLOGIN,
+        FILE_NSSWITCH,
+        FILE_DCONF_DB,
+        FILE_DCONF_LOCK,
+        NULL
+    };
+
+    for (i = 0; names[i] != NULL; i++) {
+        ret = authselect_profile_signature_file(dirfd, names[i], now,
+                                                signature);
+        if (ret != EOK) {
+            return ret;
+        }
+    }
+
+    return signature->error;
+}
+
+static errno_t
+authselect_profile_cache_signature(const char *location,
+                                   int dirfd,
+                                   struct pack *signature)
+{
+    pack_string(signature, CACHE_MAGIC);
+    pack_uint64(signature, CACHE_FORMAT);
+    pack_string(signature, PACKAGE_VERSION);
+    pack_string(signature, location);
+
+    return authselect_profile_signature(dirfd, time(NULL), signature);
+}
+
+static char *
+authselect_profile_cache_path(const char *location)
+{
+    char hash[SHA256_HEX_SIZE];
+
+    sha256_hex(location, strlen(location), hash);
+
+    return format("%s/%s", DIR_PROFILE_CACHE, hash);
+}
+
+static errno_t
+authselect_profile_cache_unpack(struct textfile_view *view,
+                                struct unpack *unpack,
+                                struct authselect_profile *profile)
+{
+    struct authselect_templates *templates = NULL;
+    struct authselect_files *files;
+    const char *name;
+    const char *description;
+    const char *requirements;
+    errno_t ret;
+
+    files = malloc_zero(struct authselect_files);
+    if (files == NULL) {
+        textfile_unmap(view);
+        return ENOMEM;
+    }
+
+    files->views = malloc_zero_array(struct textfile_view *, 2);
+    if (files->views == NULL) {
+        free(files);
+        textfile_unmap(view);
+        return ENOMEM;
+    }
+
+    /* Templates are used directly from the cache file content. */
+    files->views[0] = view;
+
+    name = unpack_string(unpack);
+    description = unpack_string(unpack);
+    requirements = unpack_string(unpack);
+    files->systemauth = (char *)unpack_string(unpack);
+    files->passwordauth = (char *)unpack_string(unpack);
+    files->smartcardauth = (char *)unpack_string(unpack);
+    files->fingerprintauth = (char *)unpack_string(unpack);
+    files->postlogin = (char *)unpack_string(unpack);
+    files->nsswitch = (char *)unpack_string(unpack);
+    files->dconfdb = (char *)unpack_string(unpack);
+    files->dconflock = (char *)unpack_string(unpack);
+    if (unpack->error != EOK || name == NULL || description == NULL) {
+        ret = EINVAL;
+        goto done;
+    }
+
+    ret = authselect_system_unpack_templates(files, unpack, &templates);
+    if (ret != EOK) {
+        goto done;
+    }
+
+    if (unpack->left != 0) {
+        ret = EINVAL;
+        goto done;
+    }
+
+    profile->name = strdup(name);
+    profile->description = strdup(description);
+    if (profile->name == NULL || profile->description == NULL) {
+        ret = ENOMEM;
+        goto done;
+    }
+
+    if (requirements != NULL) {
+        profile->requirements = strdup(requirements);
+        if (profile->requirements == NULL) {
+            ret = ENOMEM;
+            goto done;
+        }
+    }
+
+    profile->files = files;
+    profile->templates = templates;
+
+    ret = EOK;
+
+done:
+    if (ret != EOK) {
+        free(profile->name);
+        free(profile->description);
+        free(profile->requirements);
+        profile->name = NULL;
+        profile->description = NULL;
+        profile->requirements = NULL;
+        authselect_system_templates_free(templates);
+        authselect_files_free(files);
+    }
+
+    return ret;
+}
+
+errno_t
+authselect_profile_cache_load(const char *location,
+                              int dirfd,
+                              struct authselect_profile *profile,
+                              struct pack *signature)
+{
+    struct textfile_view *view;
+    struct unpack unpack;
+    char *path;
+    errno_t ret;
+
+    if (access(DIR_PROFILE_CACHE, F_OK) != 0) {
+        return ENOENT;
+    }
+
+    ret = authselect_profile_cache_signature(location, dirfd, signature);
+    if (ret != EOK) {
+        INFO("Profile [%s] can not be cached [%d]: %s",
+             location, ret, strerror(ret));
+        pack_free(signature);
+        return ret == ENOMEM ? ENOMEM : ENOENT;
+    }
+
+    path = authselect_profile_cache_path(location);
+    if (path == NULL) {
+        return ENOMEM;
+    }
+
+    /* Unpacked templates point into the content, which must not change
+     * while the profile is used. */
+    ret = textfile_load(path, AUTHSELECT_CACHE_SIZE_LIMIT, &view);
+    if (ret != EOK) {
+        INFO("Compiled profile [%s] is not cached", location);
+        ret = ret == ENOMEM ? ENOMEM : ENOENT;
+        goto done;
+    }
+
+    if (view->length < signature->length
+            || memcmp(view->data, signature->data, signature->length) != 0) {
+        INFO("Cached profile [%s] is out of date", location);
+        textfile_unmap(view);
+        ret = ENOENT;
+        goto done;
+    }
+
+    unpack.data = view->data + signature->length;
+    unpack.left = view->length - signature->length;
+    unpack.error = EOK;
+
+    ret = authselect_profile_cache_unpack(view, &unpack, profile);
+    if (ret != EOK) {
+        WARN("Unable to load cached profile [%s] from [%s] [%d]: %s",
+             location, path, ret, strerror(ret));
+        ret = ret == ENOMEM ? ENOMEM : ENOENT;
+        goto done;
+    }
+
+    INFO("Profile [%s] was loaded from cache", location);
+
+    ret = EOK;
+
+done:
+    free(path);
+
+    return ret;
+}
+
+errno_t
+authselect_profile_cache_write(const char *path,
+                               struct pack *pack)
+{
+    char *tmpfile;
+    ssize_t bytes;
+    size_t written;
+    errno_t ret;
+    int fd = -1;
+
+    ret = file_mktmp_for(path, 0077, &tmpfile);
+    if (ret != EOK) {
+        return ret;
+    }
+
+    fd = open(tmpfile, O_WRONLY | O_TRUNC);
+    if (fd == -1) {
+        ret = errno;
+        goto done;
+    }
+
+    for (written = 0; written < pack->length; written += bytes) {
+        bytes = write(fd, pack->data + written, pack->length - written);
+        if (bytes == -1) {
+            if (errno == EINTR) {
+                bytes = 0;
+                continue;
+            }
+
+            ret = errno;
+            goto done;
+        }
+    }
+
+    ret = fchmod(fd, AUTHSELECT_FILE_MODE);
+    if (ret != 0) {
+        ret = errno;
+        goto done;
+    }
+
+    ret = close(fd);
+    fd = -1;
+    if (ret != 0) {
+        ret = errno;
+        goto done;
+    }
+
+    ret = rename(tmpfile, path);
+    if (ret != 0) {
+        ret = errno;
+        goto done;
+    }
+
+    ret = EOK;
+
+done:
+    if (fd != -1) {
+        close(fd);
+    }
+
+    if (ret != EOK) {
+        unlink(tmpfile);
+    }
+
+    free(tmpfile);
+
+    return ret;
+}
+
+void
+authselect_profile_cache_store(const char *location,
+                               const struct authselect_profile *profile,
+                               struct pack *signature)
+{
+    char *path = NULL;
+    errno_t ret;
+
+    /* The profile can not be cached. */
+    if (signature->data == NULL) {
+        return;
+    }
+
+    pack_string(signature, profile->name);
+    pack_string(signature, profile->description);
+    pack_string(signature, profile->requirements);
+    pack_string(signature, profile->files->systemauth);
+    pack_string(signature, profile->files->passwordauth);
+    pack_string(signature, profile->files->smartcardauth);
+    pack_string(signature, profile->files->fingerprintauth);
+    pack_string(signature, profile->files->postlogin);
+    pack_string(signature, profile->files->nsswitch);
+    pack_string(signature, profile->files->dconfdb);
+    pack_string(signature, profile->files->dconflock);
+    authselect_system_pack_templates(profile->templates, signature);
+    if (signature->error != EOK) {
+        ret = signature->error;
+        goto done;
+    }
+
+    if (signature->length > (size_t)AUTHSELECT_CACHE_SIZE_LIMIT * 1024) {
+        ret = ERANGE;
+        goto done;
+    }
+
+    path = authselect_profile_cache_path(location);
+    if (path == NULL) {
+        ret = ENOMEM;
+        goto done;
+    }
+
+    ret = authselect_profile_cache_write(path, signature);
+    if (ret != EOK) {
+        goto done;
+    }
+
+    INFO("Compiled profile [%s] was stored in [%s]", location, path);
+
+    ret = EOK;
+
+done:
+    if (ret != EOK) {
+        WARN("Unable to cache profile [%s] [%d]: %s",
+             location, ret, strerror(ret));
+    }
+
+    free(path);
+}
@@ -0,0 +1,740 @@
+/*
+    Authors:
+        Pavel Březina <pbrezina@redhat.com>
+
+    Copyright (C) 2018 Red Hat
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "authselect.h"
+#include "common/common.h"
+#include "lib/constants.h"
+#include "lib/profiles/profiles.h"
+#include "lib/util/util.h"
+
+/* Bump this if the serialized format changes. */
+#define INDEX_MAGIC   "authselect-profile-index"
+#define INDEX_FORMAT  1
+
+/**
+ * Profile index entry. Strings point into the serialized index.
+ */
+struct authselect_profile_index_entry {
+    const char *id;
+    const char *location;
+    const char *name;
+    const char *description;
+    const char *requirements;
+    uint64_t type;
+    const char **features;
+
+    /* Digest of the profile content. */
+    const char *digest;
+
+    /* Signature of the profile files, empty if the profile was modified
+     * too recently and it must be read again next time. */
+    const void *signature;
+    size_t signature_length;
+};
+
+/**
+ * Signature of profile directories. It changes when a profile is added
+ * or removed.
+ */
+static errno_t
+authselect_profile_index_dirs(time_t now, struct pack *signature)
+{
+    errno_t ret;
+    int i;
+
+    const char *dirs[] = {
+        DIR_DEFAULT_PROFILES,
+        DIR_VENDOR_PROFILES,
+        DIR_CUSTOM_PROFILES,
+        NULL
+    };
+
+    for (i = 0; dirs[i] != NULL; i++) {
+        pack_string(signature, dirs[i]);
+        ret = authselect_profile_signature_file(AT_FDCWD, dirs[i], now,
+                                                signature);
+        if (ret != EOK) {
+            return ret;
+        }
+    }
+
+    return signature->error;
+}
+
+static enum authselect_profile_type
+authselect_profile_index_type(const char *location)
+{
+    size_t len;
+    int i;
+
+    struct {
+        const char *dir;
+        enum authselect_profile_type type;
+    } types[] = {
+        {DIR_CUSTOM_PROFILES, AUTHSELECT_PROFILE_CUSTOM},
+        {DIR_VENDOR_PROFILES, AUTHSELECT_PROFILE_VENDOR},
+        {DIR_DEFAULT_PROFILES, AUTHSELECT_PROFILE_DEFAULT},
+        {NULL, AUTHSELECT_PROFILE_ANY}
+    };
+
+    for (i = 0; types[i].dir != NULL; i++) {
+        len = strlen(types[i].dir);
+        if (strncmp(location, types[i].dir, len) == 0
+                && location[len] == '/') {
+            return types[i].type;
+        }
+    }
+
+    return AUTHSELECT_PROFILE_ANY;
+}
+
+static void
+authselect_profile_index_pack_entry(const struct authselect_profile_index_entry *entry,
+                                    struct pack *pack)
+{
+    size_t count;
+    size_t i;
+
+    for (count = 0; entry->features[count] != NULL; count++) {
+        /* Just count the features. */
+    }
+
+    pack_uint64(pack, 1);
+    pack_string(pack, entry->id);
+    pack_string(pack, entry->location);
+    pack_string(pack, entry->name);
+    pack_string(pack, entry->description);
+    pack_string(pack, entry->requirements);
+    pack_uint64(pack, entry->type);
+
+    pack_uint64(pack, count);
+    for (i = 0; i < count; i++) {
+        pack_string(pack, entry->features[i]);
+    }
+
+    pack_string(pack, entry->digest);
+    pack_blob(pack, entry->signature, entry->signature_length);
+}
+
+static errno_t
+authselect_profile_index_unpack_entry(struct unpack *unpack,
+                                      struct authselect_profile_index_entry *entry)
+{
+    uint64_t count;
+    uint64_t i;
+
+    memset(entry, 0, sizeof(struct authselect_profile_index_entry));
+
+    entry->id = unpack_string(unpack);
+    entry->location = unpack_string(unpack);
+    entry->name = unpack_string(unpack);
+    entry->description = unpack_string(unpack);
+    entry->requirements = unpack_string(unpack);
+    entry->type = unpack_uint64_max(unpack, AUTHSELECT_PROFILE_ANY);
+
+    /* Each feature takes at least its length. */
+    count = unpack_uint64_max(unpack, unpack->left / sizeof(uint64_t));
+    if (unpack->error != EOK) {
+        return EINVAL;
+    }
+
+    entry->features = malloc_zero_array(const char *, count + 1);
+    if (entry->features == NULL) {
+        return ENOMEM;
+    }
+
+    for (i = 0; i < count; i++) {
+        entry->features[i] = unpack_string(unpack);
+        if (entry->features[i] == NULL) {
+            goto fail;
+        }
+    }
+
+    entry->digest = unpack_string(unpack);
+    entry->signature = unpack_blob(unpack, &entry->signature_length);
+    if (unpack->error != EOK || entry->id == NULL || entry->location == NULL
+            || entry->name == NULL || entry->description == NULL
+            || entry->digest == NULL) {
+        goto fail;
+    }
+
+    return EOK;
+
+fail:
+    free(entry->features);
+    entry->features = NULL;
+    return EINVAL;
+}
+
+/**
+ * Find @id in the list of index entries.
+ *
+ * @return EOK if the entry was found, ENOENT if it is not indexed, EINVAL
+ *         if the index is malformed, other errno code on error.
+ */
+static errno_t
+authselect_profile_index_find(struct unpack unpack,
+                              const char *id,
+                              struct authselect_profile_index_entry *entry)
+{
+    errno_t ret;
+
+    while (unpack_uint64_max(&unpack, 1) == 1) {
+        ret = authselect_profile_index_unpack_entry(&unpack, entry);
+        if (ret != EOK) {
+            return ret;
+        }
+
+        if (strcmp(entry->id, id) == 0) {
+            return EOK;
+        }
+
+        free(entry->features);
+        entry->features = NULL;
+    }
+
+    if (unpack.error != EOK) {
+        return EINVAL;
+    }
+
+    return ENOENT;
+}
+
+static bool
+authselect_profile_index_is_valid(const struct authselect_profile_index_entry *entry,
+                                  time_t now)
+{
+    struct pack signature = {0};
+    errno_t ret;
+    bool valid;
+    int dirfd;
+
+    if (entry->signature_length == 0) {
+        return false;
+    }
+
+    dirfd = open(entry->location, O_DIRECTORY | O_RDONLY);
+    if (dirfd == -1) {
+        return false;
+    }
+
+    ret = authselect_profile_signature(dirfd, now, &signature);
+    close(dirfd);
+
+    valid = ret == EOK
+            && signature.length == entry->signature_length
+            && memcmp(signature.data, entry->signature,
+                      signature.length) == 0;
+
+    pack_free(&signature);
+
+    return valid;
+}
+
+/**
+ * Vendor profiles take precedence over default profiles with the same name.
+ * Check that such vendor profile was not added after the entry was indexed.
+ */
+static bool
+authselect_profile_index_is_shadowed(const struct authselect_profile_index_entry *entry)
+{
+    char *path;
+    bool shadowed;
+
+    if (entry->type != AUTHSELECT_PROFILE_DEFAULT) {
+        return false;
+    }
+
+    path = format("%s/%s", DIR_VENDOR_PROFILES, entry->id);
+    if (path == NULL) {
+        return true;
+    }
+
+    shadowed = access(path, F_OK) == 0;
+    free(path);
+
+    return shadowed;
+}
+
+static errno_t
+authselect_profile_index_digest(const struct authselect_profile *profile,
+                                char digest[SHA256_HEX_SIZE])
+{
+    struct pack content = {0};
+
+    pack_string(&content, profile->description);
+    pack_string(&content, profile->requirements);
+    pack_string(&content, profile->files->systemauth);
+    pack_string(&content, profile->files->passwordauth);
+    pack_string(&content, profile->files->smartcardauth);
+    pack_string(&content, profile->files->fingerprintauth);
+    pack_string(&content, profile->files->postlogin);
+    pack_string(&content, profile->files->nsswitch);
+    pack_string(&content, profile->files->dconfdb);
+    pack_string(&content, profile->files->dconflock);
+    if (content.error != EOK) {
+        pack_free(&content);
+        return content.error;
+    }
+
+    sha256_hex(content.data, content.length, digest);
+    pack_free(&content);
+
+    return EOK;
+}
+
+/**
+ * Read the profile and add it to the index. Profiles that can not be read
+ * are not indexed so the error is reported when they are used.
+ */
+static errno_t
+authselect_profile_index_add(const char *id,
+                             time_t now,
+                             struct pack *index)
+{
+    struct authselect_profile_index_entry entry = {0};
+    struct authselect_profile *profile;
+    struct pack signature = {0};
+    char digest[SHA256_HEX_SIZE];
+    char **features = NULL;
+    errno_t ret;
+    int dirfd;
+
+    ret = authselect_profile_read(id, AUTHSELECT_PROFILE_ANY, &profile);
+    if (ret != EOK) {
+        WARN("Profile [%s] can not be indexed [%d]: %s",
+             id, ret, strerror(ret));
+        return ret == ENOMEM ? ENOMEM : EOK;
+    }
+
+    features = authselect_profile_features(profile);
+    if (features == NULL) {
+        ret = ENOMEM;
+        goto done;
+    }
+
+    ret = authselect_profile_index_digest(profile, digest);
+    if (ret != EOK) {
+        goto done;
+    }
+
+    /* The profile is indexed without signature if it can not be obtained
+     * so it is read again when it is looked up. */
+    dirfd = open(profile->path, O_DIRECTORY | O_RDONLY);
+    if (dirfd != -1) {
+        ret = authselect_profile_signature(dirfd, now, &signature);
+        close(dirfd);
+        if (ret != EOK) {
+            INFO("Profile [%s] can not be indexed yet [%d]: %s",
+                 id, ret, strerror(ret));
+            pack_free(&signature);
+        }
+    }
+
+    entry.id = profile->id;
+    entry.location = profile->path;
+    entry.name = profile->name;
+    entry.description = profile->description;
+    entry.requirements = profile->requirements;
+    entry.type = authselect_profile_index_type(profile->path);
+    entry.features = (const char **)features;
+    entry.digest = digest;
+    entry.signature = signature.data == NULL ? "" : signature.data;
+    entry.signature_length = signature.length;
+
+    authselect_profile_index_pack_entry(&entry, index);
+
+    ret = index->error;
+
+done:
+    pack_free(&signature);
+    string_array_free(features);
+    authselect_profile_free(profile);
+
+    return ret;
+}
+
+/**
+ * Build new index. Entries from the @old index whose profiles were not
+ * changed are reused.
+ */
+static errno_t
+authselect_profile_index_build(const struct unpack *old,
+                               time_t now,
+                               struct pack *index)
+{
+    struct authselect_profile_index_entry entry;
+    char **profiles;
+    errno_t ret;
+    int i;
+
+    ret = authselect_profile_list(&profiles);
+    if (ret != EOK) {
+        return ret;
+    }
+
+    for (i = 0; profiles[i] != NULL; i++) {
+        if (old != NULL) {
+            ret = authselect_profile_index_find(*old, profiles[i], &entry);
+            if (ret == EOK) {
+                if (authselect_profile_index_is_valid(&entry, now)
+                        && !authselect_profile_index_is_shadowed(&entry)) {
+                    authselect_profile_index_pack_entry(&entry, index);
+                    free(entry.features);
+                    continue;
+                }
+
+                free(entry.features);
+            } else if (ret == ENOMEM) {
+                goto done;
+            }
+        }
+
+        INFO("Indexing profile [%s]", profiles[i]);
+
+        ret = authselect_profile_index_add(profiles[i], now, index);
+        if (ret != EOK) {
+            goto done;
+        }
+    }
+
+    pack_uint64(index, 0);
+
+    ret = index->error;
+
+done:
+    string_array_free(profiles);
+
+    return ret;
+}
+
+/**
+ * Check index header and move @unpack to the first entry.
+ *
+ * @return EOK if the index is up to date, EAGAIN if the index can be used
+ *         but some profiles were added or removed, EINVAL if it can not
+ *         be used at all.
+ */
+static errno_t
+authselect_profile_index_header(struct unpack *unpack,
+                                const struct pack *dirs)
+{
+    const void *signature;
+    size_t length;
+
+    if (!unpack_string_equal(unpack, INDEX_MAGIC)
+            || unpack_uint64(unpack) != INDEX_FORMAT
+            || !unpack_string_equal(unpack, PACKAGE_VERSION)) {
+        return EINVAL;
+    }
+
+    signature = unpack_blob(unpack, &length);
+    if (unpack->error != EOK) {
+        return EINVAL;
+    }
+
+    if (dirs->data == NULL || length != dirs->length
+            || memcmp(signature, dirs->data, length) != 0) {
+        return EAGAIN;
+    }
+
+    return EOK;
+}
+
+static errno_t
+authselect_profile_index_profile(const struct authselect_profile_index_entry *entry,
+                                 struct authselect_profile **_profile)
+{
+    struct authselect_profile *profile;
+    errno_t ret;
+
+    profile = malloc_zero(struct authselect_profile);
+    if (profile == NULL) {
+        return ENOMEM;
+    }
+
+    profile->id = strdup(entry->id);
+    profile->path = strdup(entry->location);
+    profile->name = strdup(entry->name);
+    profile->description = strdup(entry->description);
+    profile->features = string_array_copy((char **)entry->features, false);
+    if (profile->id == NULL || profile->path == NULL || profile->name == NULL
+            || profile->description == NULL || profile->features == NULL) {
+        ret = ENOMEM;
+        goto done;
+    }
+
+    if (entry->requirements != NULL) {
+        profile->requirements = strdup(entry->requirements);
+        if (profile->requirements == NULL) {
+            ret = ENOMEM;
+            goto done;
+        }
+    }
+
+    *_profile = profile;
+
+    ret = EOK;
+
+done:
+    if (ret != EOK) {
+        authselect_profile_free(profile);
+    }
+
+    return ret;
+}
+
+static void
+authselect_profile_index_store(struct pack *index)
+{
+    errno_t ret;
+
+    if (index->length > (size_t)AUTHSELECT_CACHE_SIZE_LIMIT * 1024) {
+        ret = ERANGE;
+        goto done;
+    }
+
+    ret = authselect_profile_cache_write(PATH_PROFILE_INDEX, index);
+    if (ret != EOK) {
+        goto done;
+    }
+
+    INFO("Profile index was stored in [%s]", PATH_PROFILE_INDEX);
+
+    ret = EOK;
+
+done:
+    if (ret != EOK) {
+        WARN("Unable to store profile index [%d]: %s", ret, strerror(ret));
+    }
+}
+
+/**
+ * Index that was built when profile directories were modified too recently
+ * to be stored. It is kept in memory so the following calls, e.g. for each
+ * profile of a listing, do not build it again.
+ */
+static struct {
+    pthread_mutex_t lock;
+
+    /* Profile directories of the root the index was built for. */
+    char *dirs;
+
+    struct pack index;
+    size_t header;
+} authselect_profile_index_memory = {PTHREAD_MUTEX_INITIALIZER, NULL,
+                                     {NULL, 0, 0, EOK}, 0};
+
+/* Must be called with the lock held. */
+static void
+authselect_profile_index_memory_drop(void)
+{
+    free(authselect_profile_index_memory.dirs);
+    pack_free(&authselect_profile_index_memory.index);
+
+    authselect_profile_index_memory.dirs = NULL;
+    authselect_profile_index_memory.header = 0;
+}
+
+/**
+ * Find profile in index entries. If @validate is true, the entry is used
+ * only if the profile was not changed since it was indexed, otherwise the
+ * profile is read directly.
+ */
+static errno_t
+authselect_profile_index_lookup(const struct pack *index,
+                                size_t header,
+                                const char *profile_id,
+                                bool validate,
+                                time_t now,
+                                struct authselect_profile **_profile)
+{
+    struct authselect_profile_index_entry entry = {0};
+    struct unpack unpack;
+    errno_t ret;
+
+    unpack.data = index->data + header;
+    unpack.left = index->length - header;
+    unpack.error = EOK;
+
+    ret = authselect_profile_index_find(unpack, profile_id, &entry);
+    if (ret == EOK && validate
+            && (!authselect_profile_index_is_valid(&entry, now)
+                || authselect_profile_index_is_shadowed(&entry))) {
+        ret = ENOENT;
+    }
+
+    if (ret == ENOENT) {
+        /* The profile does not exist or it can not be indexed. */
+        ret = authselect_profile_read(profile_id, AUTHSELECT_PROFILE_ANY,
+                                      _profile);
+        goto done;
+    } else if (ret != EOK) {
+        goto done;
+    }
+
+    ret = authselect_profile_index_profile(&entry, _profile);
+
+done:
+    free(entry.features);
+
+    return ret;
+}
+
+errno_t
+authselect_profile_index_read(const char *profile_id,
+                              struct authselect_profile **_profile)
+{
+    struct authselect_profile_index_entry entry = {0};
+    struct textfile_view *view = NULL;
+    struct unpack *old = NULL;
+    struct pack index = {0};
+    struct pack dirs = {0};
+    struct unpack unpack;
+    char *dirnames = NULL;
+    bool locked = false;
+    size_t header;
+    errno_t ret;
+    time_t now;
+
+    if (access(DIR_PROFILE_CACHE, F_OK) != 0) {
+        return authselect_profile_read(profile_id, AUTHSELECT_PROFILE_ANY,
+                                       _profile);
+    }
+
+    now = time(NULL);
+
+    /* Profile directories modified too recently are indexed but the index
+     * is not stored. */
+    ret = authselect_profile_index_dirs(now, &dirs);
+    if (ret != EOK) {
+        INFO("Profile index can not be stored [%d]: %s", ret, strerror(ret));
+        pack_free(&dirs);
+        if (ret == ENOMEM) {
+            return ENOMEM;
+        }
+    }
+
+    dirnames = format("%s:%s:%s", DIR_DEFAULT_PROFILES, DIR_VENDOR_PROFILES,
+                      DIR_CUSTOM_PROFILES);
+    if (dirnames == NULL) {
+        ret = ENOMEM;
+        goto done;
+    }
+
+    pthread_mutex_lock(&authselect_profile_index_memory.lock);
+    locked = true;
+
+    if (dirs.data != NULL) {
+        /* The stored index can be trusted again. */
+        authselect_profile_index_memory_drop();
+    } else if (authselect_profile_index_memory.dirs != NULL
+            && strcmp(authselect_profile_index_memory.dirs, dirnames) == 0) {
+        INFO("Using profile index from memory");
+        ret = authselect_profile_index_lookup(
+                  &authselect_profile_index_memory.index,
+                  authselect_profile_index_memory.header,
+                  profile_id, true, now, _profile);
+        goto done;
+    }
+
+    ret = textfile_map(PATH_PROFILE_INDEX, AUTHSELECT_CACHE_SIZE_LIMIT, &view);
+    if (ret == EOK) {
+        unpack.data = view->data;
+        unpack.left = view->length;
+        unpack.error = EOK;
+
+        ret = authselect_profile_index_header(&unpack, &dirs);
+        if (ret == EOK) {
+            ret = authselect_profile_index_find(unpack, profile_id, &entry);
+            if (ret == ENOENT) {
+                /* The profile does not exist or it can not be indexed. */
+                ret = authselect_profile_read(profile_id,
+                                              AUTHSELECT_PROFILE_ANY,
+                                              _profile);
+                goto done;
+            } else if (ret == EOK
+                    && authselect_profile_index_is_valid(&entry, now)) {
+                INFO("Profile [%s] was loaded from index", profile_id);
+                ret = authselect_profile_index_profile(&entry, _profile);
+                goto done;
+            } else if (ret == ENOMEM) {
+                goto done;
+            }
+
+            free(entry.features);
+            entry.features = NULL;
+        }
+
+        if (ret != EINVAL) {
+            old = &unpack;
+        }
+    } else if (ret == ENOMEM) {
+        goto done;
+    }
+
+    INFO("Profile index is out of date, rebuilding it");
+
+    pack_string(&index, INDEX_MAGIC);
+    pack_uint64(&index, INDEX_FORMAT);
+    pack_string(&index, PACKAGE_VERSION);
+    pack_blob(&index, dirs.data == NULL ? "" : dirs.data, dirs.length);
+    header = index.length;
+
+    ret = authselect_profile_index_build(old, now, &index);
+    if (ret != EOK) {
+        ERROR("Unable to build profile index [%d]: %s", ret, strerror(ret));
+        goto done;
+    }
+
+    ret = authselect_profile_index_lookup(&index, header, profile_id, false,
+                                          now, _profile);
+
+    if (dirs.data != NULL) {
+        authselect_profile_index_store(&index);
+    } else {
+        authselect_profile_index_memory.dirs = dirnames;
+        authselect_profile_index_memory.index = index;
+        authselect_profile_index_memory.header = header;
+        dirnames = NULL;
+        index.data = NULL;
+    }
+
+done:
+    if (locked) {
+        pthread_mutex_unlock(&authselect_profile_index_memory.lock);
+    }
+
+    free(entry.features);
+    free(dirnames);
+    pack_free(&index);
+    pack_free(&dirs);
+    textfile_unmap(view);
+
+    return ret;
+}
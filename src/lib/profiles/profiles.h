@@ -21,11 +21,14 @@
 #ifndef _PROFILES_H_
 #define _PROFILES_H_
 
+#include <time.h>
 #include <stdbool.h>
 
 #include "common/errno_t.h"
 #include "lib/files/files.h"
 
+struct pack;
+
 /**
  * Profile information.
  */
@@ -52,8 +55,36 @@ struct authselect_profile {
      * System file templates.
      */
     struct authselect_files *files;
+
+    /**
+     * Compiled system file templates.
+     */
+    struct authselect_templates *templates;
+
+    /**
+     * Features provided by the profile if it was loaded from the profile
+     * index and templates are not available.
+     */
+    char **features;
+
+    /**
+     * Number of additional owners of this structure. It is freed when the
+     * last owner calls authselect_profile_free().
+     */
+    unsigned int refs;
 };
 
+/**
+ * Take additional reference to the profile so it can be shared. The profile
+ * must not be modified afterwards.
+ *
+ * @param profile       Profile.
+ *
+ * @return The same profile.
+ */
+struct authselect_profile *
+authselect_profile_ref(struct authselect_profile *profile);
+
 /**
  * Activate given profile.
  *
@@ -94,6 +125,109 @@ authselect_profile_read(const char *profile_id,
                         enum authselect_profile_type type,
                         struct authselect_profile **_profile);
 
+/**
+ * Load compiled profile from the cache if caching is enabled and the profile
+ * files were not changed since the profile was cached.
+ *
+ * Caching is enabled if DIR_PROFILE_CACHE exists.
+ *
+ * @param location      Profile directory.
+ * @param dirfd         File descriptor of the opened profile directory.
+ * @param profile       Profile whose name, description, requirements, files
+ *                      and templates are set.
+ * @param signature     Output buffer where signature of the profile files is
+ *                      stored. It is later used to cache the profile with
+ *                      authselect_profile_cache_store().
+ *
+ * @return EOK if the profile was loaded, ENOENT if it is not cached, other
+ *         errno code on error.
+ */
+errno_t
+authselect_profile_cache_load(const char *location,
+                              int dirfd,
+                              struct authselect_profile *profile,
+                              struct pack *signature);
+
+/**
+ * Store compiled profile in the cache. Errors are not fatal and they
+ * are only logged.
+ *
+ * @param location      Profile directory.
+ * @param profile       Compiled profile.
+ * @param signature     Signature of the profile files obtained from
+ *                      authselect_profile_cache_load() before the profile
+ *                      was read. The serialized profile is appended to it.
+ */
+void
+authselect_profile_cache_store(const char *location,
+                               const struct authselect_profile *profile,
+                               struct pack *signature);
+
+/**
+ * Store content of a cache file atomically.
+ *
+ * @param path          Path to the cache file.
+ * @param pack          Content to store.
+ *
+ * @return EOK on success, other errno code on error.
+ */
+errno_t
+authselect_profile_cache_write(const char *path,
+                               struct pack *pack);
+
+/**
+ * Append time stamps and identity of a file to the @signature so it can be
+ * later checked whether the file was changed without reading it.
+ *
+ * @param dirfd         File descriptor of the parent directory or AT_FDCWD.
+ * @param name          File name.
+ * @param now           Current time.
+ * @param signature     Output buffer.
+ *
+ * @return EOK on success, EAGAIN if the file was modified too recently
+ *         to be trusted, other errno code on error.
+ */
+errno_t
+authselect_profile_signature_file(int dirfd,
+                                  const char *name,
+                                  time_t now,
+                                  struct pack *signature);
+
+/**
+ * Append signature of all profile files to the @signature.
+ *
+ * @see authselect_profile_signature_file
+ *
+ * @param dirfd         File descriptor of the opened profile directory.
+ * @param now           Current time.
+ * @param signature     Output buffer.
+ *
+ * @return EOK on success, EAGAIN if some file was modified too recently
+ *         to be trusted, other errno code on error.
+ */
+errno_t
+authselect_profile_signature(int dirfd,
+                             time_t now,
+                             struct pack *signature);
+
+/**
+ * Read profile name, description, requirements and features from the
+ * profile index if it is enabled and up to date. The index is rebuilt if
+ * some profile was changed, otherwise the profile is read directly.
+ *
+ * The profile index is enabled if DIR_PROFILE_CACHE exists. Templates are
+ * not loaded, features are available in profile->features instead.
+ *
+ * @param profile_id    Profile ID to search for.
+ * @param _profile      Profile information.
+ *
+ * @return EOK on success, ENOENT if the profile was not found, other errno
+ *         code on error.
+ */
+errno_t
+authselect_profile_index_read(const char *profile_id,
+                              struct authselect_profile **_profile);
+
 /**
  * Create custom profile id from a directory name.
  *
@@ -123,9 +257,43 @@ authselect_profile_is_custom(const char *profile_id);
 /**
  * Tell dconf to read updated files.
  *
- * @return EOK on success, other errno code on error.
+ * If background updates are enabled, the update is only started and its
+ * result can be obtained with authselect_profile_dconf_wait().
+ *
+ * @return EOK on success, ENOENT if dconf is not installed, other errno
+ *         code on error.
  */
 errno_t
 authselect_profile_dconf_update(void);
 
+/**
+ * Enable or disable dconf database updates in background for calls made
+ * without context or with context that does not set it.
+ *
+ * @param async         True to run updates in background.
+ */
+void
+authselect_profile_dconf_set_async(bool async);
+
+/**
+ * Wait until dconf database update that was started in background by the
+ * current context, or without context, finishes.
+ *
+ * @return EOK if no update failed since the last call, otherwise the error
+ *         of the first update that failed.
+ */
+errno_t
+authselect_profile_dconf_wait(void);
+
+struct authselect_profile_dconf;
+
+/**
+ * Wait until dconf database update of a context finishes and free its
+ * state.
+ *
+ * @param dconf         State of dconf database updates, may be NULL.
+ */
+void
+authselect_profile_dconf_free(struct authselect_profile_dconf *dconf);
+
 #endif /* _PROFILES_H_ */
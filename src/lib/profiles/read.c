@@ -30,35 +30,42 @@
 #include "lib/files/files.h"
 #include "lib/util/util.h"
 
-static const char **
+/**
+ * Fill @locations with NULL-terminated list of directories where the
+ * profile is looked up. It must have space for three items.
+ */
+static bool
 authselect_profile_locations(const char *id,
-                             enum authselect_profile_type type)
+                             enum authselect_profile_type type,
+                             const char **locations)
 {
-    static const char *type_default[] = {DIR_DEFAULT_PROFILES, NULL};
-    static const char *type_vendor[] = {DIR_VENDOR_PROFILES, NULL};
-    static const char *type_custom[] = {DIR_CUSTOM_PROFILES, NULL};
-    static const char *type_any[] = {
-        DIR_VENDOR_PROFILES,
-        DIR_DEFAULT_PROFILES,
-        NULL
-    };
-
     switch (type) {
     case AUTHSELECT_PROFILE_DEFAULT:
-        return type_default;
+        locations[0] = DIR_DEFAULT_PROFILES;
+        locations[1] = NULL;
+        return true;
     case AUTHSELECT_PROFILE_VENDOR:
-        return type_vendor;
+        locations[0] = DIR_VENDOR_PROFILES;
+        locations[1] = NULL;
+        return true;
     case AUTHSELECT_PROFILE_CUSTOM:
-        return type_custom;
+        locations[0] = DIR_CUSTOM_PROFILES;
+        locations[1] = NULL;
+        return true;
     case AUTHSELECT_PROFILE_ANY:
         if (authselect_profile_is_custom(id)) {
-            return type_custom;
+            locations[0] = DIR_CUSTOM_PROFILES;
+            locations[1] = NULL;
+            return true;
         }
 
-        return type_any;
+        locations[0] = DIR_VENDOR_PROFILES;
+        locations[1] = DIR_DEFAULT_PROFILES;
+        locations[2] = NULL;
+        return true;
     }
 
-    return NULL;
+    return false;
 }
 
 static errno_t
@@ -96,7 +103,7 @@ authselect_profile_open(const char *id,
                         char **_location,
                         int *_dirfd)
 {
-    const char **locations;
+    const char *locations[3];
     const char *name;
     char *location;
     errno_t ret;
@@ -105,15 +112,21 @@ authselect_profile_open(const char *id,
 
     INFO("Looking up profile [%s]", id);
 
-    locations = authselect_profile_locations(id, type);
-    if (locations == NULL) {
-        ERROR("Locations array is NULL");
+    if (!authselect_profile_locations(id, type, locations)) {
+        ERROR("Unknown profile type [%d]", type);
         return EINVAL;
     }
 
     name = authselect_profile_parse_custom(id);
     name = name == NULL ? id : name;
 
+    /* The name is used as a directory name, do not let it escape the
+     * profile directories. */
+    if (name[0] == '\0' || name[0] == '.' || strchr(name, '/') != NULL) {
+        ERROR("Invalid profile identifier [%s]", id);
+        return EINVAL;
+    }
+
     for (i = 0; locations[i] != NULL; i++) {
         location = format("%s/%s", locations[i], name);
         if (location == NULL) {
@@ -271,6 +284,7 @@ authselect_profile_read(const char *profile_id,
                         struct authselect_profile **_profile)
 {
     struct authselect_profile *profile = NULL;
+    struct pack signature = {0};
     char *location;
     int dirfd;
     errno_t ret;
@@ -288,6 +302,14 @@ authselect_profile_read(const char *profile_id,
 
     profile->path = location;
 
+    ret = authselect_profile_cache_load(location, dirfd, profile, &signature);
+    if (ret == EOK) {
+        *_profile = profile;
+        goto done;
+    } else if (ret != ENOENT) {
+        goto done;
+    }
+
     ret = authselect_profile_read_readme(location, dirfd, &profile->name,
                                          &profile->description);
     if (ret != EOK) {
@@ -305,11 +327,20 @@ authselect_profile_read(const char *profile_id,
         goto done;
     }
 
+    ret = authselect_system_compile_templates(profile->files,
+                                              &profile->templates);
+    if (ret != EOK) {
+        goto done;
+    }
+
+    authselect_profile_cache_store(location, profile, &signature);
+
     *_profile = profile;
 
     ret = EOK;
 
 done:
+    pack_free(&signature);
     close(dirfd);
 
     if (ret != EOK) {
@@ -0,0 +1,247 @@
+/*
+    Authors:
+        Pavel Březina <pbrezina@redhat.com>
+
+    Copyright (C) 2018 Red Hat
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <signal.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "common/common.h"
+#include "lib/util/command.h"
+
+extern char **environ;
+
+static long
+command_remaining_ms(const struct timespec *deadline)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (deadline->tv_sec - now.tv_sec) * 1000
+           + (deadline->tv_nsec - now.tv_nsec) / 1000000;
+}
+
+static errno_t
+command_spawn(const char *const argv[],
+              int errfd,
+              pid_t *_pid)
+{
+    posix_spawn_file_actions_t actions;
+    errno_t ret;
+
+    ret = posix_spawn_file_actions_init(&actions);
+    if (ret != 0) {
+        return ret;
+    }
+
+    ret = posix_spawn_file_actions_addopen(&actions, STDIN_FILENO,
+                                           "/dev/null", O_RDONLY, 0);
+    if (ret != 0) {
+        goto done;
+    }
+
+    ret = posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO,
+                                           "/dev/null", O_WRONLY, 0);
+    if (ret != 0) {
+        goto done;
+    }
+
+    ret = posix_spawn_file_actions_adddup2(&actions, errfd, STDERR_FILENO);
+    if (ret != 0) {
+        goto done;
+    }
+
+    ret = posix_spawn(_pid, argv[0], &actions, NULL, (char *const *)argv,
+                      environ);
+
+done:
+    posix_spawn_file_actions_destroy(&actions);
+
+    return ret;
+}
+
+/* Read error output until the command closes it or the time is up. */
+static errno_t
+command_read_output(int fd,
+                    const struct timespec *deadline,
+                    char *output,
+                    size_t *_length)
+{
+    char buffer[1024];
+    struct pollfd pfd;
+    size_t length = 0;
+    ssize_t bytes;
+    long timeout;
+    size_t chunk;
+    int pret;
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+
+    while (true) {
+        timeout = command_remaining_ms(deadline);
+        if (timeout <= 0) {
+            *_length = length;
+            return ETIMEDOUT;
+        }
+
+        pret = poll(&pfd, 1, timeout);
+        if (pret == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return errno;
+        } else if (pret == 0) {
+            continue;
+        }
+
+        bytes = read(fd, buffer, sizeof(buffer));
+        if (bytes == -1) {
+            if (errno == EINTR || errno == EAGAIN) {
+                continue;
+            }
+
+            return errno;
+        } else if (bytes == 0) {
+            break;
+        }
+
+        /* Keep the beginning of the output, the rest is discarded. */
+        chunk = COMMAND_OUTPUT_LIMIT - length;
+        chunk = (size_t)bytes < chunk ? (size_t)bytes : chunk;
+        memcpy(output + length, buffer, chunk);
+        length += chunk;
+    }
+
+    *_length = length;
+
+    return EOK;
+}
+
+static errno_t
+command_wait(pid_t pid,
+             const struct timespec *deadline,
+             int *_status)
+{
+    struct timespec interval = {0, 10 * 1000 * 1000};
+    pid_t wret;
+    int status;
+
+    while (true) {
+        wret = waitpid(pid, &status, WNOHANG);
+        if (wret == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return errno;
+        } else if (wret == pid) {
+            break;
+        }
+
+        if (command_remaining_ms(deadline) <= 0) {
+            return ETIMEDOUT;
+        }
+
+        nanosleep(&interval, NULL);
+    }
+
+    *_status = status;
+
+    return EOK;
+}
+
+errno_t
+command_run(const char *const argv[],
+            unsigned int timeout,
+            int *_exit_status,
+            char **_error_output)
+{
+    char output[COMMAND_OUTPUT_LIMIT + 1];
+    struct timespec deadline;
+    size_t length = 0;
+    int pipefd[2];
+    errno_t ret;
+    int status;
+    pid_t pid;
+
+    ret = pipe2(pipefd, O_CLOEXEC);
+    if (ret != 0) {
+        return errno;
+    }
+
+    ret = command_spawn(argv, pipefd[1], &pid);
+    close(pipefd[1]);
+    if (ret != EOK) {
+        close(pipefd[0]);
+        ERROR("Unable to execute [%s] [%d]: %s", argv[0], ret, strerror(ret));
+        return ret;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout;
+
+    ret = command_read_output(pipefd[0], &deadline, output, &length);
+    close(pipefd[0]);
+    if (ret == EOK) {
+        ret = command_wait(pid, &deadline, &status);
+    }
+
+    if (ret != EOK) {
+        /* Make sure that the command does not outlive us. */
+        kill(pid, SIGKILL);
+        while (waitpid(pid, &status, 0) == -1 && errno == EINTR);
+
+        if (ret == ETIMEDOUT) {
+            ERROR("Command [%s] did not finish in %u seconds",
+                  argv[0], timeout);
+        }
+
+        return ret;
+    }
+
+    if (WIFEXITED(status)) {
+        *_exit_status = WEXITSTATUS(status);
+    } else if (WIFSIGNALED(status)) {
+        *_exit_status = 128 + WTERMSIG(status);
+    } else {
+        *_exit_status = 128;
+    }
+
+    if (_error_output != NULL) {
+        output[length] = '\0';
+        *_error_output = strdup(output);
+        if (*_error_output == NULL) {
+            return ENOMEM;
+        }
+    }
+
+    return EOK;
+}
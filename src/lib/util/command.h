@@ -0,0 +1,52 @@
+/*
+    Authors:
+        Pavel Březina <pbrezina@redhat.com>
+
+    Copyright (C) 2018 Red Hat
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _COMMAND_H_
+#define _COMMAND_H_
+
+#include "common/errno_t.h"
+
+/* Maximum number of bytes of the command error output that is kept. */
+#define COMMAND_OUTPUT_LIMIT 4096
+
+/**
+ * Execute command directly without a shell and wait until it finishes.
+ *
+ * Standard input and output of the command are redirected to /dev/null.
+ * Standard error output is captured so it can be used for diagnostics.
+ *
+ * @param argv            NULL-terminated list of arguments, the first one
+ *                        is an absolute path to the executable.
+ * @param timeout         Number of seconds to wait for the command to finish.
+ *                        The command is killed if it does not finish in time.
+ * @param _exit_status    Exit status of the command. If the command was
+ *                        terminated by a signal, it is 128 + signal number.
+ * @param _error_output   Captured error output, may be NULL.
+ *
+ * @return EOK if the command finished, ETIMEDOUT if it was killed, other
+ *         errno code if it could not be executed.
+ */
+errno_t
+command_run(const char *const argv[],
+            unsigned int timeout,
+            int *_exit_status,
+            char **_error_output);
+
+#endif /* _COMMAND_H_ */
@@ -35,7 +35,7 @@
 #include "lib/util/string_array.h"
 
 static int
-compare_timespec(struct timespec *a, struct timespec *b)
+compare_timespec(const struct timespec *a, const struct timespec *b)
 {
     if (a->tv_sec == b->tv_sec) {
         if (a->tv_nsec < b->tv_nsec) {
@@ -61,44 +61,13 @@ compare_timespec(struct timespec *a, struct timespec *b)
 }
 
 static int
-sort_by_ctime(const void *a, const void *b, void *arg)
+dir_item_compare_ctime(const void *a, const void *b)
 {
-    const char *name_a = *(const char **)a;
-    const char *name_b = *(const char **)b;
-    int dirfd = *(int *)arg;
-    const char *base_a;
-    const char *base_b;
-    struct stat stat_a;
-    struct stat stat_b;
-    errno_t ret;
-
-    base_a = file_get_basename(name_a);
-    if (base_a == NULL) {
-        ERROR("Unable to get basename of [%s]", name_a);
-        return 0;
-    }
-
-    base_b = file_get_basename(name_b);
-    if (base_b == NULL) {
-        ERROR("Unable to get basename of [%s]", name_b);
-        return 0;
-    }
-
-    ret = fstatat(dirfd, base_a, &stat_a, 0);
-    if (ret != 0) {
-        ret = errno;
-        ERROR("Unable to stat [%s] [%d]: %s", name_a, ret, strerror(ret));
-        return 0;
-    }
-
-    ret = fstatat(dirfd, base_b, &stat_b, 0);
-    if (ret != 0) {
-        ret = errno;
-        ERROR("Unable to stat [%s] [%d]: %s", name_b, ret, strerror(ret));
-        return 0;
-    }
+    const struct dir_item *item_a = a;
+    const struct dir_item *item_b = b;
 
-    return compare_timespec(&stat_a.st_ctim, &stat_b.st_ctim);
+    return compare_timespec(&item_a->statbuf.st_ctim,
+                            &item_b->statbuf.st_ctim);
 }
 
 static bool
@@ -181,6 +150,58 @@ dir_open(const char *path,
     return EOK;
 }
 
+/**
+ * Sort @items by their creation time. Each item is stat'ed only once.
+ */
+static errno_t
+dir_sort_by_ctime(int dirfd,
+                  char **items)
+{
+    struct dir_item *sorted;
+    const char *base;
+    size_t count;
+    errno_t ret;
+    size_t i;
+
+    count = string_array_count(items);
+    sorted = malloc_zero_array(struct dir_item, count);
+    if (sorted == NULL) {
+        return ENOMEM;
+    }
+
+    for (i = 0; i < count; i++) {
+        /* Names are only borrowed from @items. */
+        sorted[i].name = items[i];
+
+        base = file_get_basename(items[i]);
+        if (base == NULL) {
+            ERROR("Unable to get basename of [%s]", items[i]);
+            ret = EINVAL;
+            goto done;
+        }
+
+        ret = fstatat(dirfd, base, &sorted[i].statbuf, 0);
+        if (ret != 0) {
+            ret = errno;
+            ERROR("Unable to stat [%s] [%d]: %s", items[i], ret, strerror(ret));
+            goto done;
+        }
+    }
+
+    qsort(sorted, count, sizeof(struct dir_item), dir_item_compare_ctime);
+
+    for (i = 0; i < count; i++) {
+        items[i] = sorted[i].name;
+    }
+
+    ret = EOK;
+
+done:
+    free(sorted);
+
+    return ret;
+}
+
 errno_t
 dir_list(const char *path,
          uint32_t flags,
@@ -242,8 +263,10 @@ dir_list(const char *path,
     }
 
     if (flags & DIR_LIST_SORT_BY_CTIME) {
-        qsort_r(items, string_array_count(items), sizeof(char *),
-                sort_by_ctime, &dirfd);
+        ret = dir_sort_by_ctime(dirfd, items);
+        if (ret != EOK) {
+            goto done;
+        }
     }
 
     if (_dirfd != NULL) {
@@ -266,9 +289,7 @@ dir_list(const char *path,
     ret = EOK;
 
 done:
-    if (ret == EOK && _dirfd != NULL)  {
-        closedir(dirstream);
-    }
+    closedir(dirstream);
 
     if (ret != EOK) {
         string_array_free(items);
@@ -278,61 +299,213 @@ done:
 }
 
 errno_t
-dir_remove(const char *path)
+dir_list_stat(const char *path,
+              uint32_t flags,
+              struct dir_item **_items,
+              size_t *_count,
+              int *_dirfd)
 {
-    char **subdirs = NULL;
-    char **files = NULL;
-    int dirfd = -1;
+    struct dir_item *items = NULL;
+    struct dir_item *tmp;
+    struct dirent *entry;
+    struct stat statbuf;
+    size_t capacity = 0;
+    size_t count = 0;
+    DIR *dirstream;
+    int dirfd;
+    int dupfd;
     errno_t ret;
-    int i;
 
-    ret = dir_list(path, DIR_LIST_DIRS | DIR_LIST_FULL_PATH, &subdirs, NULL);
-    if (ret == ENOENT) {
-        ret = EOK;
-        goto done;
-    } else if (ret != EOK) {
-        goto done;
+    ret = dir_open(path, &dirstream, &dirfd);
+    if (ret != EOK) {
+        return ret;
     }
 
-    ret = dir_list(path, DIR_LIST_FILES, &files, &dirfd);
-    if (ret == ENOENT) {
-        ret = EOK;
-        goto done;
-    } else if (ret != EOK) {
-        goto done;
-    }
+    errno = 0;
+    while ((entry = readdir(dirstream)) != NULL) {
+        if (is_dot_dir(entry->d_name)) {
+            continue;
+        }
 
-    for (i = 0; subdirs[i] != NULL; i++) {
-        ret = dir_remove(subdirs[i]);
-        if (ret != EOK) {
+        ret = fstatat(dirfd, entry->d_name, &statbuf, 0);
+        if (ret != 0) {
+            ret = errno;
+            if (ret == ENOENT) {
+                /* Removed meanwhile. */
+                continue;
+            }
+
+            ERROR("Unable to stat [%s/%s] [%d]: %s",
+                  path, entry->d_name, ret, strerror(ret));
+            goto done;
+        }
+
+        if (S_ISDIR(statbuf.st_mode)) {
+            if (!(flags & DIR_LIST_DIRS)) {
+                continue;
+            }
+        } else {
+            if (!(flags & DIR_LIST_FILES)) {
+                continue;
+            }
+        }
+
+        if (count == capacity) {
+            capacity = capacity == 0 ? 16 : capacity * 2;
+            tmp = realloc(items, sizeof(struct dir_item) * capacity);
+            if (tmp == NULL) {
+                ret = ENOMEM;
+                goto done;
+            }
+
+            items = tmp;
+        }
+
+        if (flags & DIR_LIST_FULL_PATH) {
+            items[count].name = format("%s/%s", path, entry->d_name);
+        } else {
+            items[count].name = strdup(entry->d_name);
+        }
+
+        if (items[count].name == NULL) {
+            ret = ENOMEM;
             goto done;
         }
+
+        items[count].statbuf = statbuf;
+        count++;
     }
 
-    for (i = 0; files[i] != NULL; i++) {
-        INFO("Removing file [%s/%s]", path, files[i]);
-        ret = unlinkat(dirfd, files[i], 0);
-        if (ret != 0) {
+    if (flags & DIR_LIST_SORT_BY_CTIME && count > 0) {
+        qsort(items, count, sizeof(struct dir_item), dir_item_compare_ctime);
+    }
+
+    if (_dirfd != NULL) {
+        dupfd = dup(dirfd);
+        if (dupfd == -1) {
             ret = errno;
             goto done;
         }
+
+        *_dirfd = dupfd;
     }
 
-    INFO("Removing directory [%s]", path);
-    ret = rmdir(path);
-    if (ret != 0) {
+    *_items = items;
+    *_count = count;
+
+    ret = EOK;
+
+done:
+    closedir(dirstream);
+
+    if (ret != EOK) {
+        dir_items_free(items, count);
+    }
+
+    return ret;
+}
+
+void
+dir_items_free(struct dir_item *items,
+               size_t count)
+{
+    size_t i;
+
+    if (items == NULL) {
+        return;
+    }
+
+    for (i = 0; i < count; i++) {
+        free(items[i].name);
+    }
+
+    free(items);
+}
+
+errno_t
+dir_remove_at(int dirfd,
+              const char *name)
+{
+    struct dirent *entry;
+    struct stat statbuf;
+    DIR *dirstream;
+    bool is_dir;
+    errno_t ret;
+    int fd;
+
+    fd = openat(dirfd, name,
+                O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd == -1) {
+        return errno;
+    }
+
+    dirstream = fdopendir(fd);
+    if (dirstream == NULL) {
+        ret = errno;
+        close(fd);
+        return ret;
+    }
+
+    errno = 0;
+    while ((entry = readdir(dirstream)) != NULL) {
+        if (is_dot_dir(entry->d_name)) {
+            continue;
+        }
+
+#ifdef _DIRENT_HAVE_D_TYPE
+        is_dir = entry->d_type == DT_DIR;
+        if (entry->d_type == DT_UNKNOWN) {
+#endif
+            /* Symbolic links are removed, not followed. */
+            ret = fstatat(fd, entry->d_name, &statbuf, AT_SYMLINK_NOFOLLOW);
+            if (ret != 0) {
+                ret = errno;
+                goto done;
+            }
+
+            is_dir = S_ISDIR(statbuf.st_mode);
+#ifdef _DIRENT_HAVE_D_TYPE
+        }
+#endif
+
+        if (is_dir) {
+            ret = dir_remove_at(fd, entry->d_name);
+        } else {
+            INFO("Removing file [%s/%s]", name, entry->d_name);
+            ret = unlinkat(fd, entry->d_name, 0);
+            ret = ret == 0 ? EOK : errno;
+        }
+
+        if (ret != EOK) {
+            goto done;
+        }
+
+        errno = 0;
+    }
+
+    if (errno != 0) {
         ret = errno;
         goto done;
     }
 
-    ret = EOK;
+    INFO("Removing directory [%s]", name);
+    ret = unlinkat(dirfd, name, AT_REMOVEDIR);
+    ret = ret == 0 ? EOK : errno;
 
 done:
-    string_array_free(subdirs);
-    string_array_free(files);
+    closedir(dirstream);
+
+    return ret;
+}
 
-    if (dirfd != -1) {
-        close(dirfd);
+errno_t
+dir_remove(const char *path)
+{
+    errno_t ret;
+
+    ret = dir_remove_at(AT_FDCWD, path);
+    if (ret == ENOENT) {
+        return EOK;
     }
 
     return ret;
@@ -21,6 +21,10 @@
 #ifndef _DIR_H_
 #define _DIR_H_
 
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
 #include "common/errno_t.h"
 
 /* List files. */
@@ -53,6 +57,59 @@ dir_list(const char *path,
          char ***_items,
          int *_dirfd);
 
+/**
+ * Directory item together with its status.
+ */
+struct dir_item {
+    char *name;
+    struct stat statbuf;
+};
+
+/**
+ * List items in a directory together with their status. Each item is
+ * stat'ed only once, also when the listing is sorted.
+ *
+ * @param path   Directory to list.
+ * @param flags  See DIR_LIST_* macros.
+ * @param _items Array of directory items.
+ * @param _count Number of items in @_items.
+ * @param _dirfd If not NULL an open file descriptor of this directory is
+ *               stored here.
+ *
+ * @return EOK on success, ENOENT if the directory was not found, other
+ * errno code on failure.
+ */
+errno_t
+dir_list_stat(const char *path,
+              uint32_t flags,
+              struct dir_item **_items,
+              size_t *_count,
+              int *_dirfd);
+
+/**
+ * Free array returned by dir_list_stat().
+ *
+ * @param items  Directory items.
+ * @param count  Number of items.
+ */
+void
+dir_items_free(struct dir_item *items,
+               size_t count);
+
+/**
+ * Recursively remove (non-empty) directory @name relatively to @dirfd.
+ * Symbolic links are removed, not followed.
+ *
+ * @param dirfd Descriptor of the parent directory or AT_FDCWD.
+ * @param name  Directory name.
+ *
+ * @return EOK on success, ENOENT if the directory does not exist, other
+ * errno code on failure.
+ */
+errno_t
+dir_remove_at(int dirfd,
+              const char *name);
+
 /**
  * Recursively remove (non-empty) directory.
  *
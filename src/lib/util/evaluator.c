@@ -24,8 +24,10 @@
 #include <string.h>
 #include <ctype.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "evaluator.h"
+#include "lib/util/feature_set.h"
 #include "lib/util/string_array.h"
 #include "common/common.h"
 
@@ -46,6 +48,47 @@ enum e_operator {
     E_OPERATOR_NOT
 };
 
+enum e_opcode {
+    E_OPCODE_PUSH,      /* push value of feature operand */
+    E_OPCODE_FALSE,     /* push false */
+    E_OPCODE_NOT,       /* negate value on top of the stack */
+    E_OPCODE_AND,       /* pop two values and push their conjunction */
+    E_OPCODE_OR,        /* pop two values and push their disjunction */
+};
+
+struct e_instruction {
+    enum e_opcode opcode;
+    unsigned int operand;
+};
+
+struct evaluator_program {
+    /* Expression text, it is used as a key in the cache. */
+    char *expression;
+
+    /* Broken expressions are compiled as well so they are parsed only
+     * once, the error is returned each time they are evaluated. */
+    errno_t error;
+
+    /* Instructions in postfix order. */
+    struct e_instruction *code;
+    unsigned int length;
+    unsigned int stack_size;
+
+    /* Distinct feature names referenced by E_OPCODE_PUSH. */
+    char **operands;
+    unsigned int num_operands;
+
+    /* References held by the cache and by callers of evaluator_compile(). */
+    unsigned int refs;
+
+    /* Next program in the same cache bucket. */
+    struct evaluator_program *next;
+
+    /* Neighbours in the cache ordered from the most recently used. */
+    struct evaluator_program *lru_prev;
+    struct evaluator_program *lru_next;
+};
+
 struct evaluator {
     const char *expression;
     const char *cursor;
@@ -53,6 +96,14 @@ struct evaluator {
     size_t tokensize;
     int depth;
     enum e_state state;
+
+    /* Number of feature names read so far. */
+    unsigned int operand;
+
+    /* Program that is being compiled. */
+    struct evaluator_program *program;
+    unsigned int capacity;
+    unsigned int stack;
 };
 
 struct e_map {
@@ -67,10 +118,19 @@ static struct e_map operators[] = {
     {NULL, E_OPERATOR_INVALID}
 };
 
-static errno_t evaluator_state_machine(struct evaluator *self,
-                                       int depth,
-                                       const char **features,
-                                       bool *_result);
+#define EVALUATOR_CACHE_SIZE 256
+
+/* Maximum number of cached programs, the least recently used program is
+ * dropped when a new one is compiled. */
+#define EVALUATOR_CACHE_MAX 1024
+
+static struct evaluator_program *evaluator_cache[EVALUATOR_CACHE_SIZE];
+static struct evaluator_program *evaluator_lru_head;
+static struct evaluator_program *evaluator_lru_tail;
+static unsigned int evaluator_cache_count;
+static pthread_mutex_t evaluator_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static errno_t evaluator_state_machine(struct evaluator *self, int depth);
 
 /*
  * This function reads new item/token from expression.
@@ -102,6 +162,7 @@ static errno_t evaluator_next_token(struct evaluator *self)
         if (p != NULL) {
             strncpy(self->token, self->cursor, p - self->cursor + 1);
             self->cursor = ++p;
+            self->operand++;
             return EOK;
         }
         self->cursor = &self->expression[self->tokensize - 1];
@@ -171,24 +232,151 @@ static enum e_state evaluator_token_to_state(const char *token)
     return E_STATE_INVALID;
 }
 
-static errno_t evaluator_get_feature(const char *token,
-                                     const char **features,
-                                     bool *_result)
+/*
+ * Append instruction to the compiled program and keep track of the stack
+ * size that is needed to run it.
+ */
+static errno_t evaluator_emit(struct evaluator *self,
+                              enum e_opcode opcode,
+                              unsigned int operand)
 {
-    char *feature_name;
+    struct evaluator_program *program = self->program;
+    struct e_instruction *code;
+
+    if (program->length == self->capacity) {
+        code = realloc_array(program->code, struct e_instruction,
+                             self->capacity * 2);
+        if (code == NULL) {
+            return ENOMEM;
+        }
 
-    *_result = false;
-    if (features == NULL || token == NULL) {
-        return EINVAL;
+        program->code = code;
+        self->capacity *= 2;
+    }
+
+    program->code[program->length].opcode = opcode;
+    program->code[program->length].operand = operand;
+    program->length++;
+
+    switch (opcode) {
+    case E_OPCODE_PUSH:
+    case E_OPCODE_FALSE:
+        self->stack++;
+        if (self->stack > program->stack_size) {
+            program->stack_size = self->stack;
+        }
+        break;
+    case E_OPCODE_AND:
+    case E_OPCODE_OR:
+        self->stack--;
+        break;
+    case E_OPCODE_NOT:
+        break;
     }
 
-    feature_name = format("%.*s", strlen(token) - 2, &token[1]);
-    if (feature_name == NULL) {
+    return EOK;
+}
+
+/*
+ * Emit instruction that pushes value of feature from self->token.
+ */
+static errno_t evaluator_emit_feature(struct evaluator *self)
+{
+    struct evaluator_program *program = self->program;
+    const char *name = &self->token[1];
+    size_t len = strlen(self->token) - 2;
+    unsigned int i;
+
+    for (i = 0; i < program->num_operands; i++) {
+        if (strncmp(program->operands[i], name, len) == 0
+                && program->operands[i][len] == '\0') {
+            return evaluator_emit(self, E_OPCODE_PUSH, i);
+        }
+    }
+
+    /* There can not be more feature names than quotation marks. */
+    if (program->operands == NULL) {
+        program->operands = malloc_zero_array(char *,
+                                              self->tokensize / 2 + 1);
+        if (program->operands == NULL) {
+            return ENOMEM;
+        }
+    }
+
+    program->operands[i] = strndup(name, len);
+    if (program->operands[i] == NULL) {
         return ENOMEM;
     }
 
-    *_result = string_array_has_value((char **)features, feature_name);
-    free(feature_name);
+    program->num_operands++;
+
+    return evaluator_emit(self, E_OPCODE_PUSH, i);
+}
+
+/*
+ * Emit instructions that combine the result of current expression with
+ * an operand. The operand is either a feature name from self->token or
+ * a subexpression that is compiled recursively.
+ */
+static errno_t evaluator_combine(struct evaluator *self,
+                                 int depth,
+                                 bool *has_result,
+                                 bool *negation,
+                                 enum e_operator *operator,
+                                 bool subexpression)
+{
+    errno_t ret;
+
+    switch(*operator) {
+    case E_OPERATOR_AND:
+    case E_OPERATOR_OR:
+        /* Result of an empty expression is false. */
+        if (!*has_result) {
+            ret = evaluator_emit(self, E_OPCODE_FALSE, 0);
+            if (ret != EOK) {
+                return ret;
+            }
+        }
+        break;
+    case E_OPERATOR_INVALID: /* no operator yet */
+        break;
+    default:
+        return EINVAL;
+    }
+
+    if (subexpression) {
+        ret = evaluator_state_machine(self, depth + 1);
+    } else {
+        ret = evaluator_emit_feature(self);
+    }
+    if (ret != EOK) {
+        return ret;
+    }
+
+    if (*negation) {
+        ret = evaluator_emit(self, E_OPCODE_NOT, 0);
+        if (ret != EOK) {
+            return ret;
+        }
+    }
+
+    switch(*operator) {
+    case E_OPERATOR_AND:
+        ret = evaluator_emit(self, E_OPCODE_AND, 0);
+        break;
+    case E_OPERATOR_OR:
+        ret = evaluator_emit(self, E_OPCODE_OR, 0);
+        break;
+    default:
+        ret = EOK;
+        break;
+    }
+    if (ret != EOK) {
+        return ret;
+    }
+
+    *has_result = true;
+    *negation = false;
 
     return EOK;
 }
@@ -198,45 +386,27 @@ static errno_t evaluator_get_feature(const char *token,
  */
 static errno_t evaluator_handle_begin_state(struct evaluator *self,
                                             int depth,
-                                            const char **features,
                                             enum e_state nextstate,
-                                            bool *result,
+                                            bool *has_result,
                                             bool *negation,
                                             enum e_operator *operator)
 {
-
-    bool sub_result;
     errno_t ret;
 
     switch (nextstate) {
     case E_STATE_STRING:
-        return evaluator_get_feature(self->token, features, result);
-    case E_STATE_UNARY_NOT:
-        *negation = !*negation;
-        return EOK;
-    case E_STATE_SUBEXPRESSION:
-        ret = evaluator_state_machine(self, depth + 1, features,
-                                      &sub_result);
+        ret = evaluator_emit_feature(self);
         if (ret != EOK) {
             return ret;
         }
-        switch(*operator) {
-        case E_OPERATOR_AND:
-            *result = *result && (*negation ? !sub_result : sub_result);
-            *negation = false;
-            break;
-        case E_OPERATOR_OR:
-            *result = *result || (*negation ? !sub_result : sub_result);
-            *negation = false;
-            break;
-        case E_OPERATOR_INVALID: /* no operator yet */
-            *result = (*negation ? !sub_result : sub_result);
-            *negation = false;
-            break;
-        default:
-            return EINVAL;
-        }
+        *has_result = true;
+        return EOK;
+    case E_STATE_UNARY_NOT:
+        *negation = !*negation;
         return EOK;
+    case E_STATE_SUBEXPRESSION:
+        return evaluator_combine(self, depth, has_result, negation,
+                                 operator, true);
     default:
         return EINVAL;
     }
@@ -247,75 +417,21 @@ static errno_t evaluator_handle_begin_state(struct evaluator *self,
  */
 static errno_t evaluator_handle_operator_state(struct evaluator *self,
                                                int depth,
-                                               const char **features,
                                                enum e_state nextstate,
-                                               bool *result,
+                                               bool *has_result,
                                                bool *negation,
                                                enum e_operator *operator)
 {
-    bool sub_result;
-    errno_t ret;
-
     switch (nextstate) {
     case E_STATE_STRING:
-        switch(*operator) {
-        case E_OPERATOR_AND:
-            ret = evaluator_get_feature(self->token, features, &sub_result);
-            if (ret != EOK) {
-                return ret;
-            }
-
-            *result = *result && (*negation ? !sub_result : sub_result);
-            *negation = false;
-            break;
-        case E_OPERATOR_OR:
-            ret = evaluator_get_feature(self->token, features, &sub_result);
-            if (ret != EOK) {
-                return ret;
-            }
-
-            *result = *result || (*negation ? !sub_result : sub_result);
-            *negation = false;
-            break;
-        case E_OPERATOR_INVALID: /* no operator yet */
-            ret = evaluator_get_feature(self->token, features, &sub_result);
-            if (ret != EOK) {
-                return ret;
-            }
-
-            *result = *negation ? !sub_result : sub_result;
-            *negation = false;
-            break;
-        default:
-            return EINVAL;
-        }
-        return EOK;
+        return evaluator_combine(self, depth, has_result, negation,
+                                 operator, false);
     case E_STATE_UNARY_NOT:
         *negation = !*negation;
         return EOK;
     case E_STATE_SUBEXPRESSION:
-        ret = evaluator_state_machine(self, depth + 1, features, &sub_result);
-        if (ret != EOK) {
-            return ret;
-        }
-
-        switch(*operator) {
-        case E_OPERATOR_AND:
-            *result = *result && (*negation ? !sub_result : sub_result);
-            *negation = false;
-            break;
-        case E_OPERATOR_OR:
-            *result = *result || (*negation ? !sub_result : sub_result);
-            *negation = false;
-            break;
-        case E_OPERATOR_INVALID: /* no operator yet */
-            *result = (*negation ? !sub_result : sub_result);
-            *negation = false;
-            break;
-        default:
-            return EINVAL;
-        }
-        return EOK;
+        return evaluator_combine(self, depth, has_result, negation,
+                                 operator, true);
     case E_STATE_END:
         if (depth == 0) {
             return EINVAL; /* too many ) */
@@ -331,10 +447,7 @@ static errno_t evaluator_handle_operator_state(struct evaluator *self,
  */
 static errno_t evaluator_handle_expression_state(struct evaluator *self,
                                                  int depth,
-                                                 const char **features,
                                                  enum e_state nextstate,
-                                                 bool *result,
-                                                 bool *negation,
                                                  enum e_operator *operator)
 {
     switch (nextstate) {
@@ -351,18 +464,31 @@ static errno_t evaluator_handle_expression_state(struct evaluator *self,
     }
 }
 
-static errno_t evaluator_state_machine(struct evaluator *self,
-                                       int depth,
-                                       const char **features,
-                                       bool *_result)
+/*
+ * Make sure that the expression leaves its result on the stack.
+ */
+static errno_t evaluator_finish(struct evaluator *self, bool has_result)
 {
-    if (self == NULL || _result == NULL) {
+    if (has_result) {
+        return EOK;
+    }
+
+    return evaluator_emit(self, E_OPCODE_FALSE, 0);
+}
+
+/*
+ * Compile (sub)expression into postfix code that leaves exactly one
+ * value on the stack.
+ */
+static errno_t evaluator_state_machine(struct evaluator *self, int depth)
+{
+    if (self == NULL) {
         return EINVAL;
     }
 
     enum e_state state = E_STATE_BEGIN;
     enum e_state nextstate;
-    bool result = false;
+    bool has_result = false;
     bool negation = false;
     enum e_operator operator = E_OPERATOR_INVALID;
     errno_t ret;
@@ -377,33 +503,31 @@ static errno_t evaluator_state_machine(struct evaluator *self,
             nextstate = evaluator_token_to_state(self->token);
             switch(state) {
             case E_STATE_BEGIN:
-                ret = evaluator_handle_begin_state(self, depth, features,
-                                                   nextstate, &result,
-                                                   &negation, &operator);
+                ret = evaluator_handle_begin_state(self, depth, nextstate,
+                                                   &has_result, &negation,
+                                                   &operator);
                 if (ret != EOK) {
                     return ret;
                 }
                 break;
             case E_STATE_UNARY_NOT:
             case E_STATE_OPERATOR:
-                ret = evaluator_handle_operator_state(self, depth, features,
-                                                      nextstate, &result,
-                                                      &negation, &operator);
+                ret = evaluator_handle_operator_state(self, depth, nextstate,
+                                                      &has_result, &negation,
+                                                      &operator);
                 if (ret != EOK) {
                     return ret;
                 }
                 break;
             case E_STATE_SUBEXPRESSION:
             case E_STATE_STRING:
-                ret = evaluator_handle_expression_state(self, depth, features,
-                                                        nextstate, &result,
-                                                        &negation, &operator);
+                ret = evaluator_handle_expression_state(self, depth,
+                                                        nextstate, &operator);
                 if (ret != EOK) {
                     return ret;
                 }
                 if (nextstate == E_STATE_END) {
-                    *_result = result;
-                    return ret;
+                    return evaluator_finish(self, has_result);
                 }
                 break;
             case E_STATE_END:
@@ -429,9 +553,7 @@ static errno_t evaluator_state_machine(struct evaluator *self,
         return EINVAL; /* expression can't end in this state */
     }
 
-    *_result = result;
-
-    return EOK;
+    return evaluator_finish(self, has_result);
 }
 
 /*
@@ -460,46 +582,441 @@ static errno_t evaluator_set_expression(struct evaluator *self,
     return EOK;
 }
 
+static void evaluator_program_free(struct evaluator_program *program)
+{
+    unsigned int i;
+
+    if (program == NULL) {
+        return;
+    }
+
+    for (i = 0; i < program->num_operands; i++) {
+        free(program->operands[i]);
+    }
+
+    free(program->operands);
+    free(program->code);
+    free(program->expression);
+    free(program);
+}
+
 /*
- * Evaluate expression with set of features
- * Result is stored in _result variable.
- * Returns EOK or an error on failure.
+ * Compile expression into a new program.
+ * Returns EOK or ENOMEM. Syntax errors are stored in the program.
  */
-static errno_t evaluator_evaluate(struct evaluator *self,
-                                  const char **features,
-                                  bool *_result)
+static errno_t evaluator_program_create(const char *expression,
+                                        struct evaluator_program **_program)
 {
-    if (self == NULL || features == NULL || _result == NULL) {
-        return EINVAL;
+    struct evaluator_program *program;
+    struct evaluator evaluator = {0};
+    errno_t ret;
+
+    program = malloc_zero(struct evaluator_program);
+    if (program == NULL) {
+        return ENOMEM;
     }
 
-    self->cursor = self->expression;
-    return evaluator_state_machine(self, 0, features, _result);
+    program->expression = strdup(expression);
+    if (program->expression == NULL) {
+        ret = ENOMEM;
+        goto done;
+    }
+
+    evaluator.capacity = 8;
+    program->code = malloc_zero_array(struct e_instruction,
+                                      evaluator.capacity);
+    if (program->code == NULL) {
+        ret = ENOMEM;
+        goto done;
+    }
+
+    ret = evaluator_set_expression(&evaluator, expression);
+    if (ret != EOK) {
+        goto done;
+    }
+
+    evaluator.program = program;
+    ret = evaluator_state_machine(&evaluator, 0);
+    if (ret == ENOMEM) {
+        goto done;
+    }
+
+    program->error = ret;
+    if (ret != EOK) {
+        program->length = 0;
+    }
+
+    *_program = program;
+
+    ret = EOK;
+
+done:
+    if (ret != EOK) {
+        evaluator_program_free(program);
+    }
+
+    free(evaluator.token);
+    return ret;
 }
 
+static unsigned int evaluator_hash(const char *expression)
+{
+    unsigned int hash = 2166136261u;
+    const char *c;
 
-errno_t evaluate(const char *expression, const char *features[], bool *_result)
+    for (c = expression; *c != '\0'; c++) {
+        hash ^= (unsigned char)*c;
+        hash *= 16777619u;
+    }
+
+    return hash % EVALUATOR_CACHE_SIZE;
+}
+
+static void evaluator_program_unref(struct evaluator_program *program)
+{
+    program->refs--;
+    if (program->refs == 0) {
+        evaluator_program_free(program);
+    }
+}
+
+static void evaluator_lru_unlink(struct evaluator_program *program)
+{
+    if (program->lru_prev != NULL) {
+        program->lru_prev->lru_next = program->lru_next;
+    } else {
+        evaluator_lru_head = program->lru_next;
+    }
+
+    if (program->lru_next != NULL) {
+        program->lru_next->lru_prev = program->lru_prev;
+    } else {
+        evaluator_lru_tail = program->lru_prev;
+    }
+
+    program->lru_prev = NULL;
+    program->lru_next = NULL;
+}
+
+static void evaluator_lru_push(struct evaluator_program *program)
+{
+    program->lru_next = evaluator_lru_head;
+    if (evaluator_lru_head != NULL) {
+        evaluator_lru_head->lru_prev = program;
+    } else {
+        evaluator_lru_tail = program;
+    }
+
+    evaluator_lru_head = program;
+}
+
+/*
+ * Drop program from the cache, it is freed once it is not used.
+ */
+static void evaluator_cache_remove(struct evaluator_program *program)
+{
+    struct evaluator_program **link;
+
+    link = &evaluator_cache[evaluator_hash(program->expression)];
+    while (*link != program) {
+        link = &(*link)->next;
+    }
+
+    *link = program->next;
+    evaluator_lru_unlink(program);
+    evaluator_cache_count--;
+    evaluator_program_unref(program);
+}
+
+errno_t evaluator_compile(const char *expression,
+                          const struct evaluator_program **_program)
 {
-    struct evaluator *evaluator;
+    struct evaluator_program *program;
+    unsigned int hash;
     errno_t ret;
 
-    evaluator = malloc_zero(struct evaluator);
-    if (evaluator == NULL) {
-        return ENOMEM;
+    if (expression == NULL || _program == NULL) {
+        return EINVAL;
+    }
+
+    hash = evaluator_hash(expression);
+
+    pthread_mutex_lock(&evaluator_cache_lock);
+
+    for (program = evaluator_cache[hash];
+         program != NULL;
+         program = program->next) {
+        if (strcmp(program->expression, expression) == 0) {
+            evaluator_lru_unlink(program);
+            evaluator_lru_push(program);
+            ret = EOK;
+            goto done;
+        }
     }
 
-    ret = evaluator_set_expression(evaluator, expression);
+    ret = evaluator_program_create(expression, &program);
     if (ret != EOK) {
         goto done;
     }
 
-    ret = evaluator_evaluate(evaluator, features, _result);
+    if (evaluator_cache_count == EVALUATOR_CACHE_MAX) {
+        evaluator_cache_remove(evaluator_lru_tail);
+    }
+
+    program->refs = 1;
+    program->next = evaluator_cache[hash];
+    evaluator_cache[hash] = program;
+    evaluator_lru_push(program);
+    evaluator_cache_count++;
+
+done:
+    if (ret == EOK) {
+        program->refs++;
+        *_program = program;
+    }
+
+    pthread_mutex_unlock(&evaluator_cache_lock);
+
+    return ret;
+}
+
+void evaluator_program_release(const struct evaluator_program *program)
+{
+    if (program == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&evaluator_cache_lock);
+    evaluator_program_unref((struct evaluator_program *)program);
+    pthread_mutex_unlock(&evaluator_cache_lock);
+}
+
+void evaluator_cache_clear(void)
+{
+    pthread_mutex_lock(&evaluator_cache_lock);
+
+    while (evaluator_lru_head != NULL) {
+        evaluator_cache_remove(evaluator_lru_head);
+    }
+
+    pthread_mutex_unlock(&evaluator_cache_lock);
+}
+
+const char *evaluator_program_expression(const struct evaluator_program *program)
+{
+    return program->expression;
+}
+
+/*
+ * Run compiled program. Features are looked up in @set by @ids if @set
+ * is not NULL, otherwise their names are searched in @features.
+ */
+static errno_t evaluator_program_run(const struct evaluator_program *program,
+                                     const unsigned int *ids,
+                                     const struct feature_set *set,
+                                     const char **features,
+                                     bool *_result)
+{
+    const struct e_instruction *instruction;
+    bool stack[program->stack_size + 1];
+    unsigned int top = 0;
+    unsigned int i;
+
+    if (program->error != EOK) {
+        return program->error;
+    }
+
+    for (i = 0; i < program->length; i++) {
+        instruction = &program->code[i];
+        switch (instruction->opcode) {
+        case E_OPCODE_PUSH:
+            if (set != NULL) {
+                stack[top++] = feature_set_has(set, ids[instruction->operand]);
+            } else {
+                stack[top++] = string_array_has_value(
+                    (char **)features, program->operands[instruction->operand]
+                );
+            }
+            break;
+        case E_OPCODE_FALSE:
+            stack[top++] = false;
+            break;
+        case E_OPCODE_NOT:
+            stack[top - 1] = !stack[top - 1];
+            break;
+        case E_OPCODE_AND:
+            top--;
+            stack[top - 1] = stack[top - 1] && stack[top];
+            break;
+        case E_OPCODE_OR:
+            top--;
+            stack[top - 1] = stack[top - 1] || stack[top];
+            break;
+        }
+    }
+
+    *_result = stack[0];
+
+    return EOK;
+}
+
+errno_t evaluate_program(const struct evaluator_program *program,
+                         const unsigned int *ids,
+                         const struct feature_set *set,
+                         bool *_result)
+{
+    if (program == NULL || set == NULL || _result == NULL) {
+        return EINVAL;
+    }
+
+    return evaluator_program_run(program, ids, set, NULL, _result);
+}
+
+errno_t evaluate_program_partial(const struct evaluator_program *program,
+                                 const unsigned int *ids,
+                                 const struct feature_set *known,
+                                 const struct feature_set *set,
+                                 enum evaluator_result *_result,
+                                 unsigned int *_unknown)
+{
+    const struct e_instruction *instruction;
+    enum evaluator_result stack[program->stack_size + 1];
+    unsigned int unknown[program->stack_size + 1];
+    enum evaluator_result a, b;
+    unsigned int top = 0;
+    unsigned int id;
+    unsigned int i;
+
+    if (program->error != EOK) {
+        return program->error;
+    }
+
+    /* Three-valued logic, unknown value is absorbed by false in
+     * conjunction and by true in disjunction. Each unknown value on the
+     * stack remembers a feature it was computed from, so the reported
+     * feature is one that the final value still depends on. */
+    for (i = 0; i < program->length; i++) {
+        instruction = &program->code[i];
+        switch (instruction->opcode) {
+        case E_OPCODE_PUSH:
+            id = ids[instruction->operand];
+            if (feature_set_has(known, id)) {
+                stack[top++] = feature_set_has(set, id) ? EVALUATOR_TRUE
+                                                        : EVALUATOR_FALSE;
+                break;
+            }
+
+            unknown[top] = id;
+            stack[top++] = EVALUATOR_UNKNOWN;
+            break;
+        case E_OPCODE_FALSE:
+            stack[top++] = EVALUATOR_FALSE;
+            break;
+        case E_OPCODE_NOT:
+            a = stack[top - 1];
+            if (a != EVALUATOR_UNKNOWN) {
+                stack[top - 1] = a == EVALUATOR_TRUE ? EVALUATOR_FALSE
+                                                     : EVALUATOR_TRUE;
+            }
+            break;
+        case E_OPCODE_AND:
+            b = stack[--top];
+            a = stack[top - 1];
+            if (a == EVALUATOR_FALSE || b == EVALUATOR_FALSE) {
+                stack[top - 1] = EVALUATOR_FALSE;
+            } else if (a == EVALUATOR_TRUE && b == EVALUATOR_TRUE) {
+                stack[top - 1] = EVALUATOR_TRUE;
+            } else {
+                stack[top - 1] = EVALUATOR_UNKNOWN;
+                if (a != EVALUATOR_UNKNOWN) {
+                    unknown[top - 1] = unknown[top];
+                }
+            }
+            break;
+        case E_OPCODE_OR:
+            b = stack[--top];
+            a = stack[top - 1];
+            if (a == EVALUATOR_TRUE || b == EVALUATOR_TRUE) {
+                stack[top - 1] = EVALUATOR_TRUE;
+            } else if (a == EVALUATOR_FALSE && b == EVALUATOR_FALSE) {
+                stack[top - 1] = EVALUATOR_FALSE;
+            } else {
+                stack[top - 1] = EVALUATOR_UNKNOWN;
+                if (a != EVALUATOR_UNKNOWN) {
+                    unknown[top - 1] = unknown[top];
+                }
+            }
+            break;
+        }
+    }
 
- done:
-    if (evaluator->token != NULL) {
-        free(evaluator->token);
+    *_result = stack[0];
+    if (stack[0] == EVALUATOR_UNKNOWN) {
+        *_unknown = unknown[0];
     }
 
-    free(evaluator);
+    return EOK;
+}
+
+errno_t evaluator_list_features(const struct evaluator_program *program,
+                                char ***_features)
+{
+    unsigned int i;
+
+    for (i = 0; i < program->num_operands; i++) {
+        *_features = string_array_add_value(*_features, program->operands[i],
+                                            true);
+        if (*_features == NULL) {
+            return ENOMEM;
+        }
+    }
+
+    return EOK;
+}
+
+errno_t evaluator_bind(const struct evaluator_program *program,
+                       struct feature_table *table,
+                       unsigned int **_ids)
+{
+    unsigned int *ids;
+    unsigned int i;
+    errno_t ret;
+
+    ids = malloc_zero_array(unsigned int, program->num_operands + 1);
+    if (ids == NULL) {
+        return ENOMEM;
+    }
+
+    for (i = 0; i < program->num_operands; i++) {
+        ret = feature_table_intern(table, program->operands[i],
+                                   strlen(program->operands[i]), &ids[i]);
+        if (ret != EOK) {
+            free(ids);
+            return ret;
+        }
+    }
+
+    *_ids = ids;
+
+    return EOK;
+}
+
+errno_t evaluate(const char *expression, const char *features[], bool *_result)
+{
+    const struct evaluator_program *program;
+    errno_t ret;
+
+    if (features == NULL || _result == NULL) {
+        return EINVAL;
+    }
+
+    ret = evaluator_compile(expression, &program);
+    if (ret != EOK) {
+        return ret;
+    }
+
+    ret = evaluator_program_run(program, NULL, NULL, features, _result);
+    evaluator_program_release(program);
+
     return ret;
 }
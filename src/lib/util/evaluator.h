@@ -24,24 +24,140 @@
 #include <stdbool.h>
 
 #include "common/errno_t.h"
+#include "lib/util/feature_set.h"
 
 /**
  * Evaluate expression.
  *
- * Returns EOK or an error on failure.
+ * @param expression Expression to evaluate.
+ * @param features   NULL-terminated array that lists enabled features.
+ * @param _result    Output parameter where the result of the evaluation
+ *                   is stored.
  *
- * Evaluation result is stored in _result variable.
+ * @return EOK on success, other errno code on failure.
+ */
+errno_t evaluate(const char *expression, const char **features, bool *_result);
+
+/**
+ * Compiled expression.
  */
+struct evaluator_program;
+
 /**
- * Evaluate expression.
+ * Compile expression into a postfix program. Compiled programs are kept in
+ * a bounded cache and shared between all callers, so frequently used
+ * expressions are compiled only once. Syntax errors are not reported here
+ * but each time the program is evaluated.
  *
- * @param expression Expression to evaluate.
- * @param features   NULL-terminated array that lists enabled features.
+ * @param expression Expression to compile.
+ * @param _program   New reference to the compiled program, it must be
+ *                   released with evaluator_program_release().
+ *
+ * @return EOK on success, other errno code on failure.
+ */
+errno_t evaluator_compile(const char *expression,
+                          const struct evaluator_program **_program);
+
+/**
+ * Release reference to a program obtained from evaluator_compile().
+ *
+ * @param program    Compiled program, may be NULL.
+ */
+void evaluator_program_release(const struct evaluator_program *program);
+
+/**
+ * Drop all programs from the cache. Programs that are still referenced
+ * are freed when they are released.
+ */
+void evaluator_cache_clear(void);
+
+/**
+ * Return expression that was compiled into the @program.
+ *
+ * @param program    Compiled program.
+ *
+ * @return Expression text.
+ */
+const char *evaluator_program_expression(const struct evaluator_program *program);
+
+/**
+ * Add names of features referenced by a compiled expression to the end of
+ * NULL-terminated string array, each name is added only once.
+ *
+ * @param program    Compiled program.
+ * @param _features  NULL-terminated string array. It is freed and set to
+ *                   NULL if memory can not be allocated.
+ *
+ * @return EOK on success, other errno code on failure.
+ */
+errno_t evaluator_list_features(const struct evaluator_program *program,
+                                char ***_features);
+
+/**
+ * Add features referenced by a compiled expression into a feature table.
+ *
+ * @param program    Compiled program.
+ * @param table      Feature table.
+ * @param _ids       Ids of features referenced by the program. Use it
+ *                   with evaluate_program().
+ *
+ * @return EOK on success, other errno code on failure.
+ */
+errno_t evaluator_bind(const struct evaluator_program *program,
+                       struct feature_table *table,
+                       unsigned int **_ids);
+
+/**
+ * Evaluate compiled expression against a set of enabled features. This
+ * does not allocate any memory.
+ *
+ * @param program    Compiled program.
+ * @param ids        Feature ids obtained from evaluator_bind().
+ * @param set        Set of enabled features.
  * @param _result    Output parameter where the result of the evaluation
  *                   is stored.
  *
  * @return EOK on success, other errno code on failure.
  */
-errno_t evaluate(const char *expression, const char **features, bool *_result);
+errno_t evaluate_program(const struct evaluator_program *program,
+                         const unsigned int *ids,
+                         const struct feature_set *set,
+                         bool *_result);
+
+/**
+ * Result of evaluation with partially known features.
+ */
+enum evaluator_result {
+    EVALUATOR_FALSE,
+    EVALUATOR_TRUE,
+    EVALUATOR_UNKNOWN
+};
+
+/**
+ * Evaluate compiled expression when values of only some features are
+ * known. Three-valued logic is used: the result is known if the known
+ * features decide it, e.g. "x and false" is false even if "x" is not known.
+ * Otherwise it is unknown, even though it may in rare cases be the same
+ * for all values of the unknown features, e.g. "x and not x".
+ *
+ * @param program    Compiled program.
+ * @param ids        Feature ids obtained from evaluator_bind().
+ * @param known      Set of features whose value is known.
+ * @param set        Set of enabled features, only known features are used.
+ * @param _result    Output parameter where the result of the evaluation
+ *                   is stored.
+ * @param _unknown   Id of an unknown feature that the unknown result was
+ *                   computed from, operands that did not affect the result
+ *                   are never reported. It is set only if the result is
+ *                   EVALUATOR_UNKNOWN.
+ *
+ * @return EOK on success, other errno code on failure.
+ */
+errno_t evaluate_program_partial(const struct evaluator_program *program,
+                                 const unsigned int *ids,
+                                 const struct feature_set *known,
+                                 const struct feature_set *set,
+                                 enum evaluator_result *_result,
+                                 unsigned int *_unknown);
 
 #endif /* __EVALUATOR_H */
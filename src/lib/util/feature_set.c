@@ -0,0 +1,174 @@
+/*
+    Authors:
+        Pavel Březina <pbrezina@redhat.com>
+
+    Copyright (C) 2018 Red Hat
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "common/common.h"
+#include "lib/util/feature_set.h"
+
+struct feature_table {
+    char **names;
+    unsigned int count;
+    unsigned int capacity;
+};
+
+struct feature_table *
+feature_table_create(void)
+{
+    return malloc_zero(struct feature_table);
+}
+
+void
+feature_table_free(struct feature_table *table)
+{
+    unsigned int i;
+
+    if (table == NULL) {
+        return;
+    }
+
+    for (i = 0; i < table->count; i++) {
+        free(table->names[i]);
+    }
+
+    free(table->names);
+    free(table);
+}
+
+static bool
+feature_table_find(const struct feature_table *table,
+                   const char *name,
+                   size_t len,
+                   unsigned int *_id)
+{
+    unsigned int i;
+
+    for (i = 0; i < table->count; i++) {
+        if (strncmp(table->names[i], name, len) == 0
+                && table->names[i][len] == '\0') {
+            *_id = i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+errno_t
+feature_table_intern(struct feature_table *table,
+                     const char *name,
+                     size_t len,
+                     unsigned int *_id)
+{
+    unsigned int capacity;
+    char **names;
+    char *copy;
+
+    if (feature_table_find(table, name, len, _id)) {
+        return EOK;
+    }
+
+    if (table->count == table->capacity) {
+        capacity = table->capacity == 0 ? 16 : table->capacity * 2;
+        names = realloc_array(table->names, char *, capacity);
+        if (names == NULL) {
+            return ENOMEM;
+        }
+
+        table->names = names;
+        table->capacity = capacity;
+    }
+
+    copy = strndup(name, len);
+    if (copy == NULL) {
+        return ENOMEM;
+    }
+
+    table->names[table->count] = copy;
+    *_id = table->count;
+    table->count++;
+
+    return EOK;
+}
+
+bool
+feature_table_lookup(const struct feature_table *table,
+                     const char *name,
+                     unsigned int *_id)
+{
+    return feature_table_find(table, name, strlen(name), _id);
+}
+
+const char *
+feature_table_name(const struct feature_table *table,
+                   unsigned int id)
+{
+    return id < table->count ? table->names[id] : NULL;
+}
+
+unsigned int
+feature_table_count(const struct feature_table *table)
+{
+    return table->count;
+}
+
+errno_t
+feature_set_init(struct feature_set *set,
+                 const struct feature_table *table,
+                 const char **features)
+{
+    unsigned int id;
+    int i;
+
+    /* Always allocate at least one word so the set can be copied to
+     * a variable length array. */
+    set->words = table->count / FEATURE_SET_WORD_BITS + 1;
+    set->bits = malloc_zero_array(uint64_t, set->words);
+    if (set->bits == NULL) {
+        return ENOMEM;
+    }
+
+    if (features == NULL) {
+        return EOK;
+    }
+
+    for (i = 0; features[i] != NULL; i++) {
+        if (feature_table_lookup(table, features[i], &id)) {
+            feature_set_add(set, id);
+        }
+    }
+
+    return EOK;
+}
+
+void
+feature_set_destroy(struct feature_set *set)
+{
+    if (set == NULL) {
+        return;
+    }
+
+    free(set->bits);
+    set->bits = NULL;
+    set->words = 0;
+}
@@ -0,0 +1,153 @@
+/*
+    Authors:
+        Pavel Březina <pbrezina@redhat.com>
+
+    Copyright (C) 2018 Red Hat
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _FEATURE_SET_H_
+#define _FEATURE_SET_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "common/errno_t.h"
+
+/**
+ * Symbol table that assigns small integer ids to feature names.
+ */
+struct feature_table;
+
+/**
+ * Set of enabled features represented as a bitset indexed by feature ids.
+ */
+struct feature_set {
+    unsigned int words;
+    uint64_t *bits;
+};
+
+#define FEATURE_SET_WORD_BITS 64
+
+/**
+ * Create new empty feature table.
+ *
+ * @return Feature table or NULL if the allocation fails.
+ */
+struct feature_table *
+feature_table_create(void);
+
+/**
+ * Free feature table.
+ *
+ * @param table Feature table.
+ */
+void
+feature_table_free(struct feature_table *table);
+
+/**
+ * Return id of the feature, the feature is added to the table if it is
+ * not yet present.
+ *
+ * @param table Feature table.
+ * @param name  Feature name.
+ * @param len   Length of the feature name.
+ * @param _id   Feature id.
+ *
+ * @return EOK on success, other errno code on error.
+ */
+errno_t
+feature_table_intern(struct feature_table *table,
+                     const char *name,
+                     size_t len,
+                     unsigned int *_id);
+
+/**
+ * Find id of the feature.
+ *
+ * @param table Feature table.
+ * @param name  Feature name.
+ * @param _id   Feature id.
+ *
+ * @return True if the feature was found, false otherwise.
+ */
+bool
+feature_table_lookup(const struct feature_table *table,
+                     const char *name,
+                     unsigned int *_id);
+
+/**
+ * @return Name of the feature @id.
+ */
+const char *
+feature_table_name(const struct feature_table *table,
+                   unsigned int id);
+
+/**
+ * @return Number of features in the table.
+ */
+unsigned int
+feature_table_count(const struct feature_table *table);
+
+/**
+ * Initialize set of enabled features that is large enough to hold all
+ * features from @table. Features that are not present in @table
+ * are ignored.
+ *
+ * @param set      Feature set to initialize.
+ * @param table    Feature table.
+ * @param features NULL-terminated array of enabled features, may be NULL.
+ *
+ * @return EOK on success, other errno code on error.
+ */
+errno_t
+feature_set_init(struct feature_set *set,
+                 const struct feature_table *table,
+                 const char **features);
+
+/**
+ * Free bitset allocated by feature_set_init().
+ *
+ * @param set Feature set.
+ */
+void
+feature_set_destroy(struct feature_set *set);
+
+/**
+ * @return True if feature @id is enabled, false otherwise.
+ */
+static inline bool
+feature_set_has(const struct feature_set *set, unsigned int id)
+{
+    if (id / FEATURE_SET_WORD_BITS >= set->words) {
+        return false;
+    }
+
+    return set->bits[id / FEATURE_SET_WORD_BITS]
+           & ((uint64_t)1 << (id % FEATURE_SET_WORD_BITS));
+}
+
+/**
+ * Enable feature @id. The set must be large enough to hold the feature.
+ */
+static inline void
+feature_set_add(struct feature_set *set, unsigned int id)
+{
+    set->bits[id / FEATURE_SET_WORD_BITS] |=
+        (uint64_t)1 << (id % FEATURE_SET_WORD_BITS);
+}
+
+#endif /* _FEATURE_SET_H_ */
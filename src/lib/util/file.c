@@ -18,19 +18,32 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include "config.h"
+
 #include <fcntl.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <libgen.h>
 #include <limits.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <stdbool.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <linux/fs.h>
+#include <time.h>
 
 #include "common/common.h"
 #include "lib/util/file.h"
 
+#define FILE_MKTMP_ATTEMPTS 100
+
+/* Buffer size used when the data can not be copied within the kernel. */
+#define FILE_COPY_BUFFER_SIZE 4096
+
 static bool
 file_check_type(struct stat *statbuf,
                 const char *name,
@@ -105,7 +118,8 @@ file_check_mode(struct stat *statbuf,
 }
 
 static errno_t
-file_check_attributes(const char *filepath,
+file_check_attributes(int dirfd,
+                      const char *filepath,
                       uid_t uid,
                       gid_t gid,
                       mode_t mode,
@@ -114,7 +128,8 @@ file_check_attributes(const char *filepath,
     struct stat statbuf;
     errno_t ret;
 
-    ret = lstat(filepath, &statbuf);
+    ret = fstatat(dirfd, file_at(dirfd, filepath), &statbuf,
+                  AT_SYMLINK_NOFOLLOW);
     if (ret == -1) {
         ret = errno;
         if (ret == ENOENT) {
@@ -139,26 +154,47 @@ file_is_regular(const char *filepath,
            mode_t access_mode,
            bool *_result)
 {
-    return file_check_attributes(filepath, uid, gid, S_IFREG | access_mode,
-                                 _result);
+    return file_is_regular_at(AT_FDCWD, filepath, uid, gid, access_mode,
+                              _result);
+}
+
+errno_t
+file_is_regular_at(int dirfd,
+                   const char *filepath,
+                   uid_t uid,
+                   gid_t gid,
+                   mode_t access_mode,
+                   bool *_result)
+{
+    return file_check_attributes(dirfd, filepath, uid, gid,
+                                 S_IFREG | access_mode, _result);
 }
 
 errno_t
 file_links_to(const char *linkpath,
               const char *destpath,
               bool *_result)
+{
+    return file_links_to_at(AT_FDCWD, linkpath, destpath, _result);
+}
+
+errno_t
+file_links_to_at(int dirfd,
+                 const char *linkpath,
+                 const char *destpath,
+                 bool *_result)
 {
     char linkbuf[PATH_MAX + 1];
     ssize_t len;
     errno_t ret;
 
-    ret = file_check_attributes(linkpath, (uid_t)-1, (gid_t)-1,
+    ret = file_check_attributes(dirfd, linkpath, (uid_t)-1, (gid_t)-1,
                                 S_IFLNK | ACCESSPERMS, _result);
     if (ret != EOK || *_result == false) {
         return ret;
     }
 
-    len = readlink(linkpath, linkbuf, PATH_MAX + 1);
+    len = readlinkat(dirfd, file_at(dirfd, linkpath), linkbuf, PATH_MAX + 1);
     if (len == -1) {
         ret = errno;
         ERROR("Unable to read link destination [%s] [%d]: %s",
@@ -180,13 +216,23 @@ errno_t
 file_does_not_link_to(const char *linkpath,
                       const char *destpath,
                       bool *_result)
+{
+    return file_does_not_link_to_at(AT_FDCWD, linkpath, destpath, _result);
+}
+
+errno_t
+file_does_not_link_to_at(int dirfd,
+                         const char *linkpath,
+                         const char *destpath,
+                         bool *_result)
 {
     char linkbuf[PATH_MAX + 1];
     struct stat statbuf;
     ssize_t len;
     errno_t ret;
 
-    ret = lstat(linkpath, &statbuf);
+    ret = fstatat(dirfd, file_at(dirfd, linkpath), &statbuf,
+                  AT_SYMLINK_NOFOLLOW);
     if (ret == -1) {
         ret = errno;
 
@@ -204,7 +250,7 @@ file_does_not_link_to(const char *linkpath,
         return EOK;
     }
 
-    len = readlink(linkpath, linkbuf, PATH_MAX + 1);
+    len = readlinkat(dirfd, file_at(dirfd, linkpath), linkbuf, PATH_MAX + 1);
     if (len == -1) {
         ret = errno;
         ERROR("Unable to read link destination [%s] [%d]: %s",
@@ -240,6 +286,28 @@ file_exists(const char *path)
     return file_check_access(path, F_OK);
 }
 
+errno_t
+file_exists_at(int dirfd, const char *path)
+{
+    errno = 0;
+    if (faccessat(dirfd, file_at(dirfd, path), F_OK, 0) == 0) {
+        return EOK;
+    }
+
+    /* ENOENT is returned if a file is missing. */
+    return errno;
+}
+
+const char *
+file_at(int dirfd, const char *filepath)
+{
+    if (dirfd == AT_FDCWD) {
+        return filepath;
+    }
+
+    return file_get_basename(filepath);
+}
+
 const char *
 file_get_basename(const char *filepath)
 {
@@ -344,13 +412,12 @@ file_make_path(const char *path, mode_t mode)
 errno_t
 file_mktmp_for(const char *path, mode_t mode, char **_tmpfile)
 {
-    mode_t oldmask;
     char *tmpfile;
     errno_t ret;
     int fd;
 
-    oldmask = umask(mode);
-
+    /* mkstemp() always creates the file with 0600 so there is no need to
+     * change umask, which is shared by all threads. */
     tmpfile = format("%s.XXXXXX", path);
     if (tmpfile == NULL) {
         ret = ENOMEM;
@@ -378,8 +445,6 @@ done:
         free(tmpfile);
     }
 
-    umask(oldmask);
-
     return ret;
 }
 
@@ -445,6 +510,99 @@ done:
     return ret;
 }
 
+/**
+ * Tell if the kernel refused to copy the data with given method, so we can
+ * try another one.
+ */
+static bool
+file_copy_unsupported(errno_t ret)
+{
+    switch (ret) {
+    case ENOSYS:
+    case EXDEV:
+    case EINVAL:
+    case EOPNOTSUPP:
+#if EOPNOTSUPP != ENOTSUP
+    case ENOTSUP:
+#endif
+        return true;
+    default:
+        return false;
+    }
+}
+
+/**
+ * Copy content of @fdin to @fdout. Both descriptors are read and written at
+ * their current offset. The data is copied within the kernel if possible.
+ */
+static errno_t
+file_copy_fd(int fdin,
+             int fdout)
+{
+    char buf[FILE_COPY_BUFFER_SIZE];
+    ssize_t bytes_written;
+    ssize_t bytes_read;
+    ssize_t bytes;
+    errno_t ret;
+
+#ifdef FICLONE
+    /* Share the data blocks if the file system supports reflinks. */
+    ret = ioctl(fdout, FICLONE, fdin);
+    if (ret == 0) {
+        return EOK;
+    }
+#endif
+
+#ifdef HAVE_COPY_FILE_RANGE
+    do {
+        bytes = copy_file_range(fdin, NULL, fdout, NULL, SSIZE_MAX, 0);
+    } while (bytes > 0 || (bytes == -1 && errno == EINTR));
+
+    if (bytes == 0) {
+        return EOK;
+    }
+
+    ret = errno;
+    if (!file_copy_unsupported(ret)) {
+        return ret;
+    }
+#endif
+
+    /* Data that was already copied is skipped since the offsets moved. */
+    do {
+        bytes = sendfile(fdout, fdin, NULL, SSIZE_MAX);
+    } while (bytes > 0 || (bytes == -1 && errno == EINTR));
+
+    if (bytes == 0) {
+        return EOK;
+    }
+
+    ret = errno;
+    if (!file_copy_unsupported(ret)) {
+        return ret;
+    }
+
+    while (true) {
+        bytes_read = read(fdin, buf, sizeof(buf));
+        if (bytes_read == -1 && errno == EINTR) {
+            continue;
+        } else if (bytes_read == -1) {
+            return errno;
+        } else if (bytes_read == 0) {
+            return EOK;
+        }
+
+        for (bytes = 0; bytes < bytes_read; bytes += bytes_written) {
+            bytes_written = write(fdout, buf + bytes, bytes_read - bytes);
+            if (bytes_written == -1 && errno == EINTR) {
+                bytes_written = 0;
+            } else if (bytes_written == -1) {
+                return errno;
+            }
+        }
+    }
+}
+
 errno_t
 file_copy(const char *source,
           const char *destdir,
@@ -452,13 +610,9 @@ file_copy(const char *source,
           mode_t dir_mode)
 {
     struct stat statbuf;
-    FILE *fsource = NULL;
-    FILE *fdest = NULL;
-    size_t bytes_written;
-    size_t bytes_read;
-    mode_t oldmask;
     char *destpath;
-    char buf[32];
+    int fdsource = -1;
+    int fddest = -1;
     errno_t ret;
 
     ret = file_make_path(destdir, dir_mode);
@@ -471,74 +625,154 @@ file_copy(const char *source,
         return ENOMEM;
     }
 
-    /* Temporary umask before we change the owner and permissions. */
-    oldmask = umask(0600);
-
-    fsource = fopen(source, "r");
-    if (fsource == NULL) {
+    fdsource = open(source, O_RDONLY | O_CLOEXEC);
+    if (fdsource == -1) {
         ret = errno;
         goto done;
     }
 
-    ret = fstat(fileno(fsource), &statbuf);
+    ret = fstat(fdsource, &statbuf);
     if (ret == -1) {
         ret = errno;
         goto done;
     }
 
-    fdest = fopen(destpath, "w");
-    if (fdest == NULL) {
+    /* Accessible only to the owner before we change the owner and
+     * permissions. */
+    fddest = open(destpath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fddest == -1) {
         ret = errno;
         goto done;
     }
 
-    do {
-        bytes_read = fread(buf, sizeof(char), sizeof(buf), fsource);
-        if (bytes_read != sizeof(buf)) {
-            if (ferror(fsource) != 0) {
-                ret = EIO;
-                goto done;
-            }
-            /* eof not error */
-        }
-
-        bytes_written = fwrite(buf, sizeof(char), bytes_read, fdest);
-        if (bytes_written != bytes_read) {
-            if (ferror(fdest) != 0) {
-                ret = EIO;
-                goto done;
-            }
-        }
-    } while (!feof(fsource));
+    ret = file_copy_fd(fdsource, fddest);
+    if (ret != EOK) {
+        ERROR("Unable to copy [%s] to [%s] [%d]: %s",
+              source, destpath, ret, strerror(ret));
+        goto done;
+    }
 
     /* Restore original owner and mode.  Errors here are not fatal, since we
      * have the original content already stored and owned by root. */
-    ret = chmod(destpath, statbuf.st_mode);
+    ret = fchmod(fddest, statbuf.st_mode);
     if (ret != 0) {
         ret = errno;
         WARN("Unable to chmod file [%s] [%d]: %s",
              destpath, ret, strerror(ret));
     }
 
-    ret = chown(destpath, statbuf.st_uid, statbuf.st_gid);
+    ret = fchown(fddest, statbuf.st_uid, statbuf.st_gid);
     if (ret != 0) {
         ret = errno;
         WARN("Unable to chown file [%s] [%d]: %s",
              destpath, ret, strerror(ret));
     }
 
+    ret = close(fddest);
+    fddest = -1;
+    if (ret != 0) {
+        ret = errno;
+        goto done;
+    }
+
     ret = EOK;
 
 done:
     free(destpath);
-    umask(oldmask);
-    if (fsource != NULL) {
-        fclose(fsource);
+    if (fdsource != -1) {
+        close(fdsource);
+    }
+
+    if (fddest != -1) {
+        close(fddest);
+    }
+
+    return ret;
+}
+
+errno_t
+file_mktmp_fd(int dirfd,
+              const char *path,
+              mode_t mode,
+              char **_tmpfile,
+              int *_fd)
+{
+    static const char letters[] = "abcdefghijklmnopqrstuvwxyz"
+                                  "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+    /* Per thread, so concurrent callers do not race on it. */
+    static __thread uint64_t value;
+    struct timespec ts;
+    char *tmpfile;
+    char *suffix;
+    uint64_t v;
+    errno_t ret;
+    int attempt;
+    int fd;
+    int i;
+
+    tmpfile = format("%s.XXXXXX", path);
+    if (tmpfile == NULL) {
+        return ENOMEM;
+    }
+
+    suffix = tmpfile + strlen(tmpfile) - 6;
+
+    /* Same approach as mkstemp(), there is no variant of it that accepts
+     * a directory descriptor. */
+    ret = EEXIST;
+    for (attempt = 0; attempt < FILE_MKTMP_ATTEMPTS; attempt++) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        value += ((uint64_t)ts.tv_nsec << 16) ^ ts.tv_sec ^ getpid();
+        value = value * 6364136223846793005ULL + 1442695040888963407ULL;
+
+        for (i = 0, v = value >> 16; i < 6; i++, v /= sizeof(letters) - 1) {
+            suffix[i] = letters[v % (sizeof(letters) - 1)];
+        }
+
+        fd = openat(dirfd, file_at(dirfd, tmpfile),
+                    O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC,
+                    mode);
+        if (fd != -1) {
+            ret = EOK;
+            break;
+        }
+
+        ret = errno;
+        if (ret != EEXIST) {
+            break;
+        }
+    }
+
+    if (ret != EOK) {
+        free(tmpfile);
+        return ret;
+    }
+
+    *_tmpfile = tmpfile;
+    *_fd = fd;
+
+    return EOK;
+}
+
+errno_t
+file_exchange(int dirfd, const char *path1, const char *path2)
+{
+#if defined(HAVE_RENAMEAT2) && defined(RENAME_EXCHANGE)
+    errno_t ret;
+
+    ret = renameat2(dirfd, file_at(dirfd, path1), dirfd, file_at(dirfd, path2),
+                    RENAME_EXCHANGE);
+    if (ret == 0) {
+        return EOK;
     }
 
-    if (fdest != NULL) {
-        fclose(fdest);
+    ret = errno;
+    if (ret == EINVAL || ret == ENOSYS) {
+        return ENOTSUP;
     }
 
     return ret;
+#else
+    return ENOTSUP;
+#endif
 }
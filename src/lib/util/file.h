@@ -51,6 +51,20 @@ file_is_regular(const char *filepath,
                 mode_t access_mode,
                 bool *_result);
 
+/**
+ * Same as file_is_regular() but @filepath is accessed relatively
+ * to @dirfd.
+ *
+ * @see file_at()
+ */
+errno_t
+file_is_regular_at(int dirfd,
+                   const char *filepath,
+                   uid_t uid,
+                   gid_t gid,
+                   mode_t access_mode,
+                   bool *_result);
+
 /**
  * Check that @linkpath is a link to @destpath.
  *
@@ -69,6 +83,17 @@ file_links_to(const char *linkpath,
               const char *destpath,
               bool *_result);
 
+/**
+ * Same as file_links_to() but @linkpath is accessed relatively to @dirfd.
+ *
+ * @see file_at()
+ */
+errno_t
+file_links_to_at(int dirfd,
+                 const char *linkpath,
+                 const char *destpath,
+                 bool *_result);
+
 /**
  * Check that @linkpath is not a link or it does not link to @destpath.
  *
@@ -87,6 +112,18 @@ file_does_not_link_to(const char *linkpath,
                       const char *destpath,
                       bool *_result);
 
+/**
+ * Same as file_does_not_link_to() but @linkpath is accessed relatively
+ * to @dirfd.
+ *
+ * @see file_at()
+ */
+errno_t
+file_does_not_link_to_at(int dirfd,
+                         const char *linkpath,
+                         const char *destpath,
+                         bool *_result);
+
 /**
  * Check file access mode.
  *
@@ -110,6 +147,30 @@ file_check_access(const char *path, int mode);
 errno_t
 file_exists(const char *path);
 
+/**
+ * Same as file_exists() but @path is accessed relatively to @dirfd.
+ *
+ * @see file_at()
+ */
+errno_t
+file_exists_at(int dirfd, const char *path);
+
+/**
+ * Return name that can be used to access @filepath relatively to @dirfd.
+ *
+ * Functions with _at suffix take path to the file together with descriptor
+ * of its parent directory. The path is used as it is when @dirfd is
+ * AT_FDCWD, otherwise only its basename is looked up in @dirfd. The whole
+ * path is still used in messages.
+ *
+ * @param dirfd          Descriptor of @filepath parent directory or AT_FDCWD.
+ * @param filepath       Path to the file.
+ *
+ * @return Name of the file relative to @dirfd.
+ */
+const char *
+file_at(int dirfd, const char *filepath);
+
 /**
  * Return file basename from path.
  *
@@ -152,6 +213,25 @@ file_make_path(const char *path, mode_t mode);
 errno_t
 file_mktmp_for(const char *path, mode_t mode, char **_tmpfile);
 
+/**
+ * Create and open temporary file @path.XXXXXX relatively to @dirfd so it
+ * can be first written and then safely renamed to @path.
+ *
+ * @param dirfd          Descriptor of @path parent directory or AT_FDCWD.
+ * @param path           Path to the file.
+ * @param mode           Mode to create the file with.
+ * @param _tmpfile       Path to created temporary file.
+ * @param _fd            Descriptor of the file opened for writing.
+ *
+ * @return EOK on success, other errno code on error.
+ */
+errno_t
+file_mktmp_fd(int dirfd,
+              const char *path,
+              mode_t mode,
+              char **_tmpfile,
+              int *_fd);
+
 /**
  * Make copy of a file @source and store it in temporary file
  * @destdir/@destname.XXXXXX keeping its owner and permissions.
@@ -173,6 +253,9 @@ file_mktmp_copy(const char *source,
  * Copy file to destination. Directory is created if it does not exist.
  * The original owner and permissions of the source file are kept.
  *
+ * The data is cloned if the file system supports reflinks, otherwise it is
+ * copied within the kernel if possible.
+ *
  * @param source       Source file name.
  * @param destdir      Destination directory.
  * @param destname     Destination file name.
@@ -186,4 +269,17 @@ file_copy(const char *source,
           const char *destname,
           mode_t dir_mode);
 
+/**
+ * Atomically exchange two existing files in the same directory.
+ *
+ * @param dirfd        Descriptor of the parent directory or AT_FDCWD.
+ * @param path1        Path to the first file.
+ * @param path2        Path to the second file.
+ *
+ * @return EOK on success, ENOTSUP if the exchange is not supported by
+ *         the system or file system, other errno code on error.
+ */
+errno_t
+file_exchange(int dirfd, const char *path1, const char *path2);
+
 #endif /* _FILE_H_ */
@@ -0,0 +1,200 @@
+/*
+    Authors:
+        Pavel Březina <pbrezina@redhat.com>
+
+    Copyright (C) 2018 Red Hat
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "common/common.h"
+#include "lib/util/pack.h"
+
+/* Strings are stored with their length which is followed by the string
+ * itself including its NULL terminator so they can be used directly from
+ * the serialized data. NULL string has the maximum length. */
+#define PACK_NULL_STRING UINT64_MAX
+
+static void
+pack_append(struct pack *pack, const void *data, size_t length)
+{
+    size_t capacity;
+    char *buffer;
+
+    if (pack->error != EOK) {
+        return;
+    }
+
+    if (pack->capacity - pack->length < length) {
+        capacity = pack->capacity == 0 ? 4096 : pack->capacity;
+        while (capacity - pack->length < length) {
+            capacity *= 2;
+        }
+
+        buffer = realloc_array(pack->data, char, capacity);
+        if (buffer == NULL) {
+            pack->error = ENOMEM;
+            return;
+        }
+
+        pack->data = buffer;
+        pack->capacity = capacity;
+    }
+
+    memcpy(pack->data + pack->length, data, length);
+    pack->length += length;
+}
+
+void
+pack_uint64(struct pack *pack, uint64_t value)
+{
+    pack_append(pack, &value, sizeof(uint64_t));
+}
+
+void
+pack_string(struct pack *pack, const char *str)
+{
+    size_t length;
+
+    if (str == NULL) {
+        pack_uint64(pack, PACK_NULL_STRING);
+        return;
+    }
+
+    length = strlen(str);
+    pack_uint64(pack, length);
+    pack_append(pack, str, length + 1);
+}
+
+void
+pack_blob(struct pack *pack, const void *data, size_t length)
+{
+    pack_uint64(pack, length);
+    pack_append(pack, data, length);
+}
+
+void
+pack_free(struct pack *pack)
+{
+    free(pack->data);
+    memset(pack, 0, sizeof(struct pack));
+}
+
+static const char *
+unpack_data(struct unpack *unpack, size_t length)
+{
+    const char *data;
+
+    if (unpack->error != EOK) {
+        return NULL;
+    }
+
+    if (unpack->left < length) {
+        unpack->error = EINVAL;
+        return NULL;
+    }
+
+    data = unpack->data;
+    unpack->data += length;
+    unpack->left -= length;
+
+    return data;
+}
+
+uint64_t
+unpack_uint64(struct unpack *unpack)
+{
+    const char *data;
+    uint64_t value;
+
+    data = unpack_data(unpack, sizeof(uint64_t));
+    if (data == NULL) {
+        return 0;
+    }
+
+    memcpy(&value, data, sizeof(uint64_t));
+
+    return value;
+}
+
+uint64_t
+unpack_uint64_max(struct unpack *unpack, uint64_t max)
+{
+    uint64_t value;
+
+    value = unpack_uint64(unpack);
+    if (value > max) {
+        unpack->error = EINVAL;
+        return 0;
+    }
+
+    return value;
+}
+
+const char *
+unpack_string(struct unpack *unpack)
+{
+    const char *str;
+    uint64_t length;
+
+    length = unpack_uint64(unpack);
+    if (unpack->error != EOK || length == PACK_NULL_STRING) {
+        return NULL;
+    }
+
+    if (length >= unpack->left) {
+        unpack->error = EINVAL;
+        return NULL;
+    }
+
+    str = unpack_data(unpack, length + 1);
+    if (str == NULL || str[length] != '\0') {
+        unpack->error = EINVAL;
+        return NULL;
+    }
+
+    return str;
+}
+
+const void *
+unpack_blob(struct unpack *unpack, size_t *_length)
+{
+    uint64_t length;
+
+    length = unpack_uint64_max(unpack, unpack->left);
+    if (unpack->error != EOK) {
+        *_length = 0;
+        return NULL;
+    }
+
+    *_length = length;
+
+    return unpack_data(unpack, length);
+}
+
+bool
+unpack_string_equal(struct unpack *unpack, const char *expected)
+{
+    const char *str;
+
+    str = unpack_string(unpack);
+    if (str == NULL || expected == NULL) {
+        return str == expected && unpack->error == EOK;
+    }
+
+    return strcmp(str, expected) == 0;
+}
@@ -0,0 +1,145 @@
+/*
+    Authors:
+        Pavel Březina <pbrezina@redhat.com>
+
+    Copyright (C) 2018 Red Hat
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _PACK_H_
+#define _PACK_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "common/errno_t.h"
+
+/**
+ * Buffer to serialize data into.
+ *
+ * All pack functions do nothing once an error has occurred, the error is
+ * remembered and can be checked after all data is packed.
+ */
+struct pack {
+    char *data;
+    size_t length;
+    size_t capacity;
+    errno_t error;
+};
+
+/**
+ * Serialized data that are being read.
+ *
+ * All unpack functions return zero or NULL once an error has occurred,
+ * the error is remembered and can be checked after all data is unpacked.
+ */
+struct unpack {
+    const char *data;
+    size_t left;
+    errno_t error;
+};
+
+/**
+ * Append unsigned integer to the buffer.
+ *
+ * @param pack    Serialization buffer.
+ * @param value   Value to append.
+ */
+void
+pack_uint64(struct pack *pack, uint64_t value);
+
+/**
+ * Append string to the buffer.
+ *
+ * @param pack    Serialization buffer.
+ * @param str     NULL-terminated string or NULL.
+ */
+void
+pack_string(struct pack *pack, const char *str);
+
+/**
+ * Append binary data together with their length to the buffer.
+ *
+ * @param pack    Serialization buffer.
+ * @param data    Data to append.
+ * @param length  Length of the data.
+ */
+void
+pack_blob(struct pack *pack, const void *data, size_t length);
+
+/**
+ * Free data of the serialization buffer.
+ *
+ * @param pack    Serialization buffer.
+ */
+void
+pack_free(struct pack *pack);
+
+/**
+ * Read unsigned integer.
+ *
+ * @param unpack  Serialized data.
+ *
+ * @return Read value.
+ */
+uint64_t
+unpack_uint64(struct unpack *unpack);
+
+/**
+ * Read unsigned integer that must not be larger than @max.
+ *
+ * @param unpack  Serialized data.
+ * @param max     Maximum allowed value.
+ *
+ * @return Read value.
+ */
+uint64_t
+unpack_uint64_max(struct unpack *unpack, uint64_t max);
+
+/**
+ * Read string.
+ *
+ * @param unpack  Serialized data.
+ *
+ * @return NULL-terminated string that points into the serialized data.
+ *         NULL is returned if NULL was packed or on error.
+ */
+const char *
+unpack_string(struct unpack *unpack);
+
+/**
+ * Read binary data stored with pack_blob().
+ *
+ * @param unpack   Serialized data.
+ * @param _length  Length of the data.
+ *
+ * @return Data that point into the serialized data or NULL on error.
+ */
+const void *
+unpack_blob(struct unpack *unpack, size_t *_length);
+
+/**
+ * Read string and check that it is equal to @expected.
+ *
+ * @param unpack    Serialized data.
+ * @param expected  Expected value.
+ *
+ * @return True if the strings are equal, false otherwise.
+ */
+bool
+unpack_string_equal(struct unpack *unpack, const char *expected);
+
+#endif /* _PACK_H_ */
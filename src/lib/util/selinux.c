@@ -18,6 +18,7 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <fcntl.h>
 #include <errno.h>
 #include <stdio.h>
 #include <string.h>
@@ -32,22 +33,152 @@
 #include "lib/util/selinux.h"
 #include "lib/util/string_array.h"
 
+/**
+ * Default security context found for a path during labeling session.
+ */
+struct selinux_label {
+    char *path;
+    char *context;
+    struct selinux_label *next;
+};
+
+/**
+ * Labeling session of a thread. The file contexts database is loaded when
+ * the first default context is looked up and it is kept together with the
+ * results until the session ends.
+ */
+struct selinux_labels {
+    unsigned int depth;
+    struct selabel_handle *handle;
+    struct selinux_label *labels;
+};
+
+static selinux_lookup_path_fn selinux_lookup_path = NULL;
+
+static __thread struct selinux_labels selinux_session = {0, NULL, NULL};
+
+void
+selinux_set_lookup_path_fn(selinux_lookup_path_fn fn)
+{
+    __atomic_store_n(&selinux_lookup_path, fn, __ATOMIC_RELEASE);
+}
+
+void
+selinux_labels_begin(void)
+{
+    selinux_session.depth++;
+}
+
+void
+selinux_labels_end(void)
+{
+    struct selinux_label *label;
+    struct selinux_label *next;
+
+    if (selinux_session.depth == 0 || --selinux_session.depth > 0) {
+        return;
+    }
+
+    for (label = selinux_session.labels; label != NULL; label = next) {
+        next = label->next;
+        free(label->path);
+        free(label->context);
+        free(label);
+    }
+
+    if (selinux_session.handle != NULL) {
+        selabel_close(selinux_session.handle);
+    }
+
+    selinux_session.handle = NULL;
+    selinux_session.labels = NULL;
+}
+
+static errno_t
+selinux_labels_find(const char *path,
+                    char **_context)
+{
+    struct selinux_label *label;
+
+    for (label = selinux_session.labels; label != NULL; label = label->next) {
+        if (strcmp(label->path, path) != 0) {
+            continue;
+        }
+
+        if (label->context == NULL) {
+            *_context = NULL;
+            return EOK;
+        }
+
+        *_context = strdup(label->context);
+        return *_context == NULL ? ENOMEM : EOK;
+    }
+
+    return ENOENT;
+}
+
+static void
+selinux_labels_add(const char *path,
+                   const char *context)
+{
+    struct selinux_label *label;
+
+    /* The result is just not remembered if there is not enough memory. */
+    label = malloc_zero(struct selinux_label);
+    if (label == NULL) {
+        return;
+    }
+
+    label->path = strdup(path);
+    label->context = context == NULL ? NULL : strdup(context);
+    if (label->path == NULL || (context != NULL && label->context == NULL)) {
+        free(label->path);
+        free(label->context);
+        free(label);
+        return;
+    }
+
+    label->next = selinux_session.labels;
+    selinux_session.labels = label;
+}
+
 static errno_t
 selinux_get_default_context(const char *path,
                             char **_context)
 {
+    selinux_lookup_path_fn lookup_path;
     struct selabel_handle *handle;
+    const char *key;
     char *context;
     int ret;
 
-    handle = selabel_open(SELABEL_CTX_FILE, NULL, 0);
+    lookup_path = __atomic_load_n(&selinux_lookup_path, __ATOMIC_ACQUIRE);
+    key = lookup_path == NULL ? path : lookup_path(path);
+
+    if (selinux_session.depth > 0) {
+        ret = selinux_labels_find(key, &context);
+        if (ret == EOK) {
+            INFO("Found cached default selinux context for [%s]: %s",
+                 path, context == NULL ? "NULL" : context);
+            *_context = context;
+            return EOK;
+        } else if (ret != ENOENT) {
+            return ret;
+        }
+    }
+
+    handle = selinux_session.handle;
     if (handle == NULL) {
-        ret = errno;
-        ERROR("Unable to create selabel context [%d]: %s", ret, strerror(ret));
-        return ret;
+        handle = selabel_open(SELABEL_CTX_FILE, NULL, 0);
+        if (handle == NULL) {
+            ret = errno;
+            ERROR("Unable to create selabel context [%d]: %s",
+                  ret, strerror(ret));
+            return ret;
+        }
     }
 
-    ret = selabel_lookup(handle, &context, path, 0);
+    ret = selabel_lookup(handle, &context, key, 0);
     if (ret < 0 && errno == ENOENT) {
         context = NULL;
     } else if (ret != 0) {
@@ -59,12 +190,21 @@ selinux_get_default_context(const char *path,
     INFO("Found default selinux context for [%s]: %s",
          path, context == NULL ? "NULL" : context);
 
+    if (selinux_session.depth > 0) {
+        selinux_labels_add(key, context);
+    }
+
     *_context = context;
 
     ret = EOK;
 
 done:
-    selabel_close(handle);
+    if (selinux_session.depth > 0) {
+        /* Keep the database loaded for the rest of the session. */
+        selinux_session.handle = handle;
+    } else {
+        selabel_close(handle);
+    }
 
     return ret;
 }
@@ -95,6 +235,107 @@ selinux_get_context(const char *path,
     return EOK;
 }
 
+static errno_t
+selinux_get_context_at(int dirfd,
+                       const char *path,
+                       char **_context)
+{
+    char *context;
+    int ret;
+    int fd;
+
+    fd = openat(dirfd, file_at(dirfd, path),
+                O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd == -1 && errno == ENOENT) {
+        return selinux_get_default_context(path, _context);
+    } else if (fd == -1) {
+        ret = errno;
+        ERROR("Unable to open [%s] [%d]: %s", path, ret, strerror(ret));
+        return ret;
+    }
+
+    ret = fgetfilecon(fd, &context);
+    close(fd);
+    if (ret < 0) {
+        ret = errno;
+        ERROR("Unable to obtain selinux context for [%s] [%d]: %s",
+              path, ret, strerror(ret));
+
+        return ret;
+    }
+
+    INFO("Found selinux context for [%s]: %s",
+         path, context == NULL ? _("not set") : context);
+
+    *_context = context;
+
+    return EOK;
+}
+
+errno_t
+selinux_mkstemp_fd(int dirfd,
+                   const char *filepath,
+                   mode_t mode,
+                   char **_tmpfile,
+                   int *_fd)
+{
+    char *original_context = NULL;
+    char *default_context = NULL;
+    errno_t ret;
+    int seret;
+
+    if (is_selinux_enabled() != 1) {
+        return file_mktmp_fd(dirfd, filepath, mode, _tmpfile, _fd);
+    }
+
+    seret = getfscreatecon(&original_context);
+    if (seret != 0) {
+        ERROR("Unable to get current fscreate selinux context!");
+        return EIO;
+    }
+
+    ret = selinux_get_context_at(dirfd, filepath, &default_context);
+    if (ret != EOK) {
+        ERROR("Unable to get default selinux context for [%s] [%d]: %s!",
+              filepath, ret, strerror(ret));
+        goto done;
+    }
+
+    /* Set desired fs create context. */
+    seret = setfscreatecon(default_context);
+    if (seret != 0) {
+        ERROR("Unable to set fscreate selinux context!");
+        ret = EIO;
+        goto done;
+    }
+
+    ret = file_mktmp_fd(dirfd, filepath, mode, _tmpfile, _fd);
+
+    /* Restore original fs create context. */
+    seret = setfscreatecon(original_context);
+    if (seret != 0) {
+        ERROR("Unable to restore fscreate selinux context!");
+        if (ret == EOK) {
+            close(*_fd);
+            unlinkat(dirfd, file_at(dirfd, *_tmpfile), 0);
+            free(*_tmpfile);
+        }
+        ret = EIO;
+        goto done;
+    }
+
+done:
+    if (original_context != NULL) {
+        freecon(original_context);
+    }
+
+    if (default_context != NULL) {
+        freecon(default_context);
+    }
+
+    return ret;
+}
+
 errno_t
 selinux_mkstemp_for(const char *filepath,
                     mode_t mode,
@@ -326,6 +567,24 @@ parse_destination_path(const char *destination,
     return EOK;
 }
 
+static errno_t
+selinux_rename_tmpfile(const char *tmpfile,
+                       const char *destination)
+{
+    errno_t ret;
+
+    INFO("Renaming [%s] to [%s]", tmpfile, destination);
+    ret = rename(tmpfile, destination);
+    if (ret != 0) {
+        ret = errno;
+        ERROR("Unable to rename [%s] to [%s] [%d]: %s",
+              tmpfile, destination, ret, strerror(ret));
+        return ret;
+    }
+
+    return EOK;
+}
+
 errno_t
 selinux_copy_files_safely(struct selinux_safe_copy *table,
                           mode_t dir_mode)
@@ -385,12 +644,8 @@ selinux_copy_files_safely(struct selinux_safe_copy *table,
      * even recover from it.
      */
     for (i = 0; table[i].source != NULL; i++) {
-        INFO("Renaming [%s] to [%s]", tmpfiles[i], table[i].destination);
-        ret = rename(tmpfiles[i], table[i].destination);
-        if (ret != 0) {
-            ret = errno;
-            ERROR("Unable to rename [%s] to [%s] [%d]: %s",
-                  tmpfiles[i], table[i].destination, ret, strerror(ret));
+        ret = selinux_rename_tmpfile(tmpfiles[i], table[i].destination);
+        if (ret != EOK) {
             goto done;
         }
     }
@@ -412,3 +667,167 @@ done:
 
     return ret;
 }
+
+/**
+ * Create and open temporary file for @filepath with security context
+ * @context or with default security context of @filepath if it is NULL.
+ */
+static errno_t
+selinux_mkstemp_context(const char *filepath,
+                        const char *context,
+                        mode_t mode,
+                        char **_tmpfile,
+                        int *_fd)
+{
+    char *original_context = NULL;
+    errno_t ret;
+    int seret;
+
+    if (context == NULL) {
+        return selinux_mkstemp_fd(AT_FDCWD, filepath, mode, _tmpfile, _fd);
+    }
+
+    if (is_selinux_enabled() != 1) {
+        return file_mktmp_fd(AT_FDCWD, filepath, mode, _tmpfile, _fd);
+    }
+
+    seret = getfscreatecon(&original_context);
+    if (seret != 0) {
+        ERROR("Unable to get current fscreate selinux context!");
+        return EIO;
+    }
+
+    /* Set desired fs create context. */
+    seret = setfscreatecon(context);
+    if (seret != 0) {
+        ERROR("Unable to set fscreate selinux context!");
+        ret = EIO;
+        goto done;
+    }
+
+    ret = file_mktmp_fd(AT_FDCWD, filepath, mode, _tmpfile, _fd);
+
+    /* Restore original fs create context. */
+    seret = setfscreatecon(original_context);
+    if (seret != 0) {
+        ERROR("Unable to restore fscreate selinux context!");
+        if (ret == EOK) {
+            close(*_fd);
+            unlink(*_tmpfile);
+            free(*_tmpfile);
+            *_tmpfile = NULL;
+        }
+        ret = EIO;
+        goto done;
+    }
+
+done:
+    if (original_context != NULL) {
+        freecon(original_context);
+    }
+
+    return ret;
+}
+
+errno_t
+selinux_write_files_safely(struct selinux_safe_write *table,
+                           mode_t dir_mode,
+                           selinux_write_fn write_fn,
+                           void *pvt)
+{
+    char **tmpfiles = NULL;
+    char *dir;
+    errno_t ret;
+    int fd = -1;
+    size_t i;
+
+    for (i = 0; table[i].destination != NULL; i++) {
+        /* Just counting. */
+    }
+
+    tmpfiles = string_array_create(i);
+    if (tmpfiles == NULL) {
+        ret = ENOMEM;
+        goto done;
+    }
+
+    /* First, write content into temporary files, so we can safely fail
+     * on error without overwriting destination files. */
+    for (i = 0; table[i].destination != NULL; i++) {
+        dir = file_get_parent_directory(table[i].destination);
+        if (dir == NULL) {
+            ret = ENOMEM;
+            goto done;
+        }
+
+        ret = file_make_path(dir, dir_mode);
+        free(dir);
+        if (ret != EOK) {
+            goto done;
+        }
+
+        INFO("Writing temporary file for [%s]", table[i].destination);
+        ret = selinux_mkstemp_context(table[i].destination, table[i].context,
+                                      0600, &tmpfiles[i], &fd);
+        if (ret != EOK) {
+            goto done;
+        }
+
+        ret = write_fn(i, fd, pvt);
+        if (ret != EOK) {
+            goto done;
+        }
+
+        ret = fchown(fd, table[i].uid, table[i].gid);
+        if (ret != 0) {
+            ret = errno;
+            ERROR("Unable to change owner of [%s] [%d]: %s",
+                  tmpfiles[i], ret, strerror(ret));
+            goto done;
+        }
+
+        ret = fchmod(fd, table[i].mode);
+        if (ret != 0) {
+            ret = errno;
+            ERROR("Unable to change mode of [%s] [%d]: %s",
+                  tmpfiles[i], ret, strerror(ret));
+            goto done;
+        }
+
+        ret = close(fd);
+        fd = -1;
+        if (ret != 0) {
+            ret = errno;
+            ERROR("Unable to write [%s] [%d]: %s",
+                  tmpfiles[i], ret, strerror(ret));
+            goto done;
+        }
+    }
+
+    /* Now rename the files, see selinux_copy_files_safely(). */
+    for (i = 0; table[i].destination != NULL; i++) {
+        ret = selinux_rename_tmpfile(tmpfiles[i], table[i].destination);
+        if (ret != EOK) {
+            goto done;
+        }
+    }
+
+    ret = EOK;
+
+done:
+    if (fd != -1) {
+        close(fd);
+    }
+
+    if (ret != EOK && tmpfiles != NULL) {
+        for (i = 0; table[i].destination != NULL; i++) {
+            if (tmpfiles[i] != NULL) {
+                unlink(tmpfiles[i]);
+            }
+        }
+    }
+
+    string_array_free(tmpfiles);
+
+    return ret;
+}
@@ -21,8 +21,57 @@
 #ifndef _UTIL_SELINUX_H_
 #define _UTIL_SELINUX_H_
 
+#include <sys/types.h>
+
 #include "common/errno_t.h"
 
+/**
+ * Function that returns path that is used to look up default security
+ * context of @path.
+ */
+typedef const char *(*selinux_lookup_path_fn)(const char *path);
+
+/**
+ * Set function that translates paths before their default security context
+ * is looked up. It is used when files are written to a different root
+ * directory so they get the context they would have in the system root.
+ *
+ * @param fn       Translation function or NULL to use paths as they are.
+ */
+void
+selinux_set_lookup_path_fn(selinux_lookup_path_fn fn);
+
+/**
+ * Begin labeling session of the calling thread. Until selinux_labels_end()
+ * is called, the file contexts database is loaded only once and default
+ * security contexts are remembered by path, instead of loading the
+ * database again for every file that is created.
+ *
+ * Sessions may be nested, only the outermost one releases the database.
+ */
+void
+selinux_labels_begin(void);
+
+/**
+ * End labeling session of the calling thread started with
+ * selinux_labels_begin().
+ */
+void
+selinux_labels_end(void);
+
+/**
+ * Get security context of @path. If the file does not exist, its default
+ * security context is returned.
+ *
+ * @param path     File path.
+ * @param _context Security context, it must be freed with freecon().
+ *
+ * @return EOK on success, other errno code on failure.
+ */
+errno_t
+selinux_get_context(const char *path,
+                    char **_context);
+
 /**
  * Create temporary file created on @filepath.XXXXXX with security context
  * set to default security context of @filepath.
@@ -38,6 +87,25 @@ selinux_mkstemp_for(const char *filepath,
                     mode_t mode,
                     char **_tmpfile);
 
+/**
+ * Create and open temporary file @filepath.XXXXXX relatively to @dirfd
+ * with security context set to default security context of @filepath.
+ *
+ * @param dirfd    Descriptor of @filepath parent directory or AT_FDCWD.
+ * @param filepath File for which a temporary file should be created.
+ * @param mode     Temporary file mode.
+ * @param _tmpfile Created temporary file.
+ * @param _fd      Descriptor of the file opened for writing.
+ *
+ * @return EOK on success, other errno code on failure.
+ */
+errno_t
+selinux_mkstemp_fd(int dirfd,
+                   const char *filepath,
+                   mode_t mode,
+                   char **_tmpfile,
+                   int *_fd);
+
 /**
  * Copy file to destination. Directory is created if it does not exist.
  * The original owner, permissions and selinux context of the source
@@ -100,4 +168,41 @@ errno_t
 selinux_copy_files_safely(struct selinux_safe_copy *table,
                           mode_t dir_mode);
 
+struct selinux_safe_write {
+    /* Destination file name. */
+    const char *destination;
+
+    /* Security context or NULL to use default context of destination. */
+    const char *context;
+
+    /* Owner and permissions of the file. */
+    mode_t mode;
+    uid_t uid;
+    gid_t gid;
+};
+
+/**
+ * Function that writes content of file @index of the table passed to
+ * selinux_write_files_safely() into @fd.
+ */
+typedef errno_t (*selinux_write_fn)(size_t index, int fd, void *pvt);
+
+/**
+ * Write multiple files safely. Same as selinux_copy_files_safely() but the
+ * content is written into the temporary files by @write_fn, in the order
+ * of the table, instead of being copied from a source file.
+ *
+ * @param table        File definitions, terminated by NULL destination.
+ * @param dir_mode     Access mode of destination directory if it is created.
+ * @param write_fn     Function that writes content of the files.
+ * @param pvt          Private data passed to @write_fn.
+ *
+ * @return EOK on success, other errno code on error.
+ */
+errno_t
+selinux_write_files_safely(struct selinux_safe_write *table,
+                           mode_t dir_mode,
+                           selinux_write_fn write_fn,
+                           void *pvt);
+
 #endif /* _UTIL_SELINUX_H_ */
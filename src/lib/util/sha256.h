@@ -0,0 +1,78 @@
+/*
+    Authors:
+        Pavel Březina <pbrezina@redhat.com>
+
+    Copyright (C) 2018 Red Hat
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _SHA256_H_
+#define _SHA256_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_DIGEST_SIZE 32
+#define SHA256_HEX_SIZE (SHA256_DIGEST_SIZE * 2 + 1)
+
+/**
+ * SHA-256 hashing context.
+ */
+struct sha256_ctx {
+    uint32_t state[8];
+    uint64_t length;
+    uint8_t block[64];
+    size_t used;
+};
+
+/**
+ * Initialize hashing context.
+ *
+ * @param ctx    Hashing context.
+ */
+void
+sha256_init(struct sha256_ctx *ctx);
+
+/**
+ * Add data to the hash.
+ *
+ * @param ctx    Hashing context.
+ * @param data   Data to hash.
+ * @param len    Length of @data.
+ */
+void
+sha256_update(struct sha256_ctx *ctx, const void *data, size_t len);
+
+/**
+ * Finish hashing and store the digest in @digest.
+ *
+ * @param ctx    Hashing context.
+ * @param digest Output digest.
+ */
+void
+sha256_final(struct sha256_ctx *ctx, uint8_t digest[SHA256_DIGEST_SIZE]);
+
+/**
+ * Compute SHA-256 digest of @data and store it in @hex as NULL-terminated
+ * string of hexadecimal characters.
+ *
+ * @param data   Data to hash.
+ * @param len    Length of @data.
+ * @param hex    Output hexadecimal digest.
+ */
+void
+sha256_hex(const void *data, size_t len, char hex[SHA256_HEX_SIZE]);
+
+#endif /* _SHA256_H_ */
@@ -19,6 +19,7 @@
 */
 
 #include <time.h>
+#include <ctype.h>
 #include <regex.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -27,11 +28,13 @@
 
 #include "common/common.h"
 #include "lib/util/template.h"
+#include "lib/util/file.h"
 #include "lib/util/textfile.h"
 #include "lib/util/selinux.h"
 #include "lib/util/string.h"
 #include "lib/util/string_array.h"
 #include "lib/util/evaluator.h"
+#include "lib/util/pack.h"
 
 #define RE_MATCHES   12
 #define RE_VALUE     "([^{}|]{0,})"
@@ -42,6 +45,9 @@
 #define OP_RE_IF     "(if) " RE_EXPRESSION ":" RE_VALUE "(\\|" RE_VALUE "){0,1}"
 #define OP_RE        "\\{(" OP_RE_LINE "|" OP_RE_IF "|" OP_RE_IMPLY ")\\}"
 
+#define PREAMBLE_GENERATED "# Generated by authselect on "
+#define PREAMBLE_WARNING   "\n# Do not modify this file manually.\n\n"
+
 enum template_operator {
     OP_CONTINUE,
     OP_STOP,
@@ -53,6 +59,62 @@ enum template_operator {
     OP_SENTINEL
 };
 
+struct template_node {
+    /* Position of the operator within the template source. */
+    size_t start;
+    size_t end;
+
+    enum template_operator op;
+    char *expression;
+    const struct evaluator_program *program;
+    char *if_true;
+    char *if_false;
+    char *value;
+
+    /* Ids of features used in the expression and id of implied feature. */
+    unsigned int *ids;
+    unsigned int value_id;
+};
+
+enum template_action {
+    ACTION_REMOVE_LINE,
+    ACTION_REMOVE_REMAINDER,
+    ACTION_REMOVE_OPERATOR,
+    ACTION_REPLACE
+};
+
+/* Generated content. Each line is trimmed from the right once it is
+ * finished. */
+struct template_output {
+    char *data;
+    size_t length;
+
+    /* Start of the current line. */
+    size_t line;
+
+    /* Where removal of the current line starts. It is either the start of
+     * the line or the end of the last operator that was processed on it. */
+    size_t mark;
+};
+
+/* Template is compiled into a list of operator nodes. Text between two
+ * operators is copied to the output as it is. */
+struct template {
+    /* Template source, it is not owned by the compiled template. */
+    const char *source;
+    size_t length;
+
+    struct template_node *nodes;
+    size_t count;
+
+    /* Features referenced by operator expressions. */
+    char **features;
+
+    /* Table that assigns ids to all features used in the template. */
+    struct feature_table *table;
+    bool owns_table;
+};
+
 void
 template_debug_print_matches(const char *str,
                              regmatch_t *matches,
@@ -209,81 +271,6 @@ template_match_get_values(const char *match_string,
     return EOK;
 }
 
-static errno_t
-template_match_replace(char ***features,
-                       char *match_string,
-                       regmatch_t *match,
-                       enum template_operator op,
-                       const char *expression,
-                       const char *if_true,
-                       const char *if_false,
-                       const char *value)
-{
-    const char *replacement;
-    bool enabled;
-    int ret;
-
-    ret = evaluate(expression, (const char **)*features, &enabled);
-    if (ret != EOK) {
-        return ret;
-    }
-
-    switch (op) {
-    case OP_CONTINUE:
-        if (enabled) {
-            string_remove_line(match_string, match->rm_so);
-            break;
-        }
-
-        string_remove_remainder(match_string, match->rm_so);
-        break;
-    case OP_STOP:
-        if (!enabled) {
-            string_remove_line(match_string, match->rm_so);
-            break;
-        }
-
-        string_remove_remainder(match_string, match->rm_so);
-        break;
-    case OP_INCLUDE:
-        if (enabled) {
-            string_remove_range(match_string, match->rm_so, match->rm_eo);
-            break;
-        }
-
-        string_remove_line(match_string, match->rm_so);
-        break;
-    case OP_EXCLUDE:
-        if (!enabled) {
-            string_remove_range(match_string, match->rm_so, match->rm_eo);
-            break;
-        }
-
-        string_remove_line(match_string, match->rm_so);
-        break;
-    case OP_IMPLY:
-        if (enabled) {
-            *features = string_array_add_value(*features, value, true);
-            if (*features == NULL) {
-                return ENOMEM;
-            }
-        }
-
-        string_remove_line(match_string, match->rm_so);
-        break;
-    case OP_IF:
-        replacement = enabled ? if_true : if_false;
-        string_replace_position(match_string, match->rm_so, match->rm_eo,
-                                replacement);
-        break;
-    case OP_SENTINEL:
-        ERROR("Invalid operator!");
-        return EINVAL;
-    }
-
-    return EOK;
-}
-
 /**
  * Supported operators:
  *
@@ -363,10 +350,10 @@ template_process_matches(const char *match_string,
                          char **_value)
 {
     enum template_operator op;
-    char *if_false;
-    char *if_true;
+    char *if_false = NULL;
+    char *if_true = NULL;
     char *expression;
-    char *value;
+    char *value = NULL;
     errno_t ret;
 
     template_debug_print_matches(match_string, m, RE_MATCHES);
@@ -419,38 +406,225 @@ template_process_matches(const char *match_string,
     return EOK;
 }
 
+static void
+template_output_trim_line(struct template_output *output)
+{
+    size_t end;
+
+    if (output->length == output->line) {
+        return;
+    }
+
+    /* Trim the line the same way as string_trim_right() does. */
+    end = output->length - 1;
+    while (end > output->line && isspace(output->data[end])) {
+        end--;
+    }
+
+    output->length = end + 1;
+}
+
+static void
+template_output_append(struct template_output *output,
+                       const char *str,
+                       size_t len)
+{
+    const char *end = str + len;
+    const char *newline;
+    size_t chunk;
+
+    while (str < end) {
+        newline = memchr(str, '\n', end - str);
+        chunk = (newline == NULL ? end : newline) - str;
+
+        memcpy(output->data + output->length, str, chunk);
+        output->length += chunk;
+
+        if (newline == NULL) {
+            break;
+        }
+
+        template_output_trim_line(output);
+        output->data[output->length] = '\n';
+        output->length++;
+        output->line = output->length;
+        output->mark = output->length;
+
+        str = newline + 1;
+    }
+}
+
+static enum template_action
+template_node_action(const struct template_node *node,
+                     bool enabled)
+{
+    switch (node->op) {
+    case OP_CONTINUE:
+        return enabled ? ACTION_REMOVE_LINE : ACTION_REMOVE_REMAINDER;
+    case OP_STOP:
+        return enabled ? ACTION_REMOVE_REMAINDER : ACTION_REMOVE_LINE;
+    case OP_INCLUDE:
+        return enabled ? ACTION_REMOVE_OPERATOR : ACTION_REMOVE_LINE;
+    case OP_EXCLUDE:
+        return enabled ? ACTION_REMOVE_LINE : ACTION_REMOVE_OPERATOR;
+    case OP_IMPLY:
+        return ACTION_REMOVE_LINE;
+    case OP_IF:
+        return ACTION_REPLACE;
+    case OP_SENTINEL:
+        break;
+    }
+
+    return ACTION_REMOVE_OPERATOR;
+}
+
 static errno_t
-template_process_operators(const char **features,
-                           char *content)
+template_add_node(struct template *template,
+                  size_t *capacity,
+                  size_t start,
+                  size_t end,
+                  enum template_operator op,
+                  char *expression,
+                  char *if_true,
+                  char *if_false,
+                  char *value)
 {
+    struct template_node *nodes;
+    struct template_node *node;
+    errno_t ret;
 
-    regex_t regex;
-    char *match_string;
-    size_t orig_len;
+    if (template->count == *capacity) {
+        nodes = realloc_array(template->nodes, struct template_node,
+                              *capacity * 2);
+        if (nodes == NULL) {
+            return ENOMEM;
+        }
+
+        template->nodes = nodes;
+        *capacity *= 2;
+    }
+
+    node = &template->nodes[template->count];
+    memset(node, 0, sizeof(struct template_node));
+
+    ret = evaluator_compile(expression, &node->program);
+    if (ret != EOK) {
+        return ret;
+    }
+
+    ret = evaluator_bind(node->program, template->table, &node->ids);
+    if (ret != EOK) {
+        evaluator_program_release(node->program);
+        return ret;
+    }
+
+    if (value != NULL) {
+        ret = feature_table_intern(template->table, value, strlen(value),
+                                   &node->value_id);
+        if (ret != EOK) {
+            evaluator_program_release(node->program);
+            free(node->ids);
+            return ret;
+        }
+    }
+
+    node->start = start;
+    node->end = end;
+    node->op = op;
+    node->expression = expression;
+    node->if_true = if_true;
+    node->if_false = if_false;
+    node->value = value;
+
+    template->count++;
+
+    return EOK;
+}
+
+static errno_t
+template_init(struct feature_table *table,
+              size_t *_capacity,
+              struct template **_template)
+{
+    struct template *template;
+    size_t capacity;
+
+    template = malloc_zero(struct template);
+    if (template == NULL) {
+        return ENOMEM;
+    }
+
+    capacity = 10;
+    template->nodes = malloc_zero_array(struct template_node, capacity);
+    if (template->nodes == NULL) {
+        free(template);
+        return ENOMEM;
+    }
+
+    template->features = string_array_create(10);
+    if (template->features == NULL) {
+        template_free(template);
+        return ENOMEM;
+    }
+
+    if (table == NULL) {
+        table = feature_table_create();
+        if (table == NULL) {
+            template_free(template);
+            return ENOMEM;
+        }
+
+        template->owns_table = true;
+    }
+
+    template->table = table;
+
+    *_capacity = capacity;
+    *_template = template;
+
+    return EOK;
+}
+
+errno_t
+template_compile(const char *source,
+                 struct feature_table *table,
+                 struct template **_template)
+{
+    struct template_node *node;
+    struct template *template;
     regmatch_t m[RE_MATCHES];
+    const char *match_string;
     enum template_operator op;
     char *if_false = NULL;
     char *if_true = NULL;
     char *expression = NULL;
     char *value = NULL;
-    char **features_copy;
+    size_t capacity;
+    regex_t regex;
     errno_t ret;
     int reret;
 
-    features_copy = string_array_copy((char**)features, true);
-    if (features_copy == NULL) {
-        return ENOMEM;
+    ret = template_init(table, &capacity, &template);
+    if (ret != EOK) {
+        return ret;
+    }
+
+    if (source == NULL) {
+        *_template = template;
+        return EOK;
     }
 
-    orig_len = strlen(content);
+    template->source = source;
+    template->length = strlen(source);
 
     reret = regcomp(&regex, OP_RE, REG_EXTENDED | REG_NEWLINE);
     if (reret != REG_NOERROR) {
         ERROR("Unable to compile regular expression: regex error %d", reret);
+        template_free(template);
         return EFAULT;
     }
 
-    match_string = content;
+    match_string = source;
     while ((reret = regexec(&regex, match_string, RE_MATCHES, m, 0)) == REG_NOERROR) {
         ret = template_process_matches(match_string, m, &op, &expression,
                                        &if_true, &if_false, &value);
@@ -459,251 +633,584 @@ template_process_operators(const char **features,
             goto done;
         }
 
-        ret = template_match_replace(&features_copy, match_string, &m[0], op,
-                                     expression, if_true, if_false, value);
-
-        if (expression != NULL) {
+        ret = template_add_node(template, &capacity,
+                                match_string - source + m[0].rm_so,
+                                match_string - source + m[0].rm_eo,
+                                op, expression, if_true, if_false, value);
+        if (ret != EOK) {
             free(expression);
-        }
-
-        if (if_true != NULL) {
             free(if_true);
-        }
-
-        if (if_false != NULL) {
             free(if_false);
-        }
-
-        if (value != NULL) {
             free(value);
+            goto done;
         }
 
+        node = &template->nodes[template->count - 1];
+        ret = evaluator_list_features(node->program, &template->features);
         if (ret != EOK) {
-            ERROR("Unable to process operator [%d]: %s", ret, strerror(ret));
             goto done;
         }
 
-        /* Since the whole line could have been removed, we have to find first
-         * non-zero position. */
         match_string += m[0].rm_eo;
-        while (*match_string == '\0' && match_string - content < orig_len) {
-            match_string++;
-        }
     }
 
-    string_replace_shake(content, orig_len);
-
     if (reret != REG_NOMATCH) {
         ERROR("Unable to search string: regex error %d", reret);
         ret = EFAULT;
         goto done;
     }
 
+    *_template = template;
+
     ret = EOK;
 
 done:
-    string_array_free(features_copy);
     regfree(&regex);
+
+    if (ret != EOK) {
+        template_free(template);
+    }
+
     return ret;
 }
 
-char *
-template_generate(const char *template,
-                  const char **features)
+void
+template_free(struct template *template)
 {
-    char **lines;
-    char *output;
-    errno_t ret;
+    size_t i;
 
     if (template == NULL) {
-        return strdup("");
+        return;
     }
 
-    output = strdup(template);
-    if (output == NULL) {
-        return NULL;
+    for (i = 0; i < template->count; i++) {
+        free(template->nodes[i].expression);
+        free(template->nodes[i].if_true);
+        free(template->nodes[i].if_false);
+        free(template->nodes[i].value);
+        free(template->nodes[i].ids);
+        evaluator_program_release(template->nodes[i].program);
     }
 
-    ret = template_process_operators(features, output);
-    if (ret != EOK) {
-        ERROR("Unable to generate template [%d]: %s", ret, strerror(ret));
-        free(output);
-        return NULL;
+    if (template->owns_table) {
+        feature_table_free(template->table);
     }
 
-    /* Trim lines */
-    lines = string_explode(output, '\n', STRING_EXPLODE_TRIM_RIGHT);
-    free(output);
-    if (lines == NULL) {
-        return NULL;
+    string_array_free(template->features);
+    free(template->nodes);
+    free(template);
+}
+
+void
+template_pack(const struct template *template,
+              struct pack *pack)
+{
+    const struct template_node *node;
+    size_t i;
+
+    pack_uint64(pack, template->count);
+    for (i = 0; i < template->count; i++) {
+        node = &template->nodes[i];
+
+        pack_uint64(pack, node->start);
+        pack_uint64(pack, node->end);
+        pack_uint64(pack, node->op);
+        pack_string(pack, node->expression);
+        pack_string(pack, node->if_true);
+        pack_string(pack, node->if_false);
+        pack_string(pack, node->value);
     }
 
-    output = string_implode((const char **)lines, '\n');
-    string_array_free(lines);
+    pack_uint64(pack, string_array_count(template->features));
+    for (i = 0; template->features[i] != NULL; i++) {
+        pack_string(pack, template->features[i]);
+    }
+}
 
-    return output;
+static errno_t
+template_unpack_string(struct unpack *unpack,
+                       char **_str)
+{
+    const char *str;
+
+    str = unpack_string(unpack);
+    if (str == NULL) {
+        *_str = NULL;
+        return unpack->error;
+    }
+
+    *_str = strdup(str);
+    if (*_str == NULL) {
+        return ENOMEM;
+    }
+
+    return EOK;
 }
 
-static char *
-template_generate_preamble(time_t timestamp)
+static errno_t
+template_unpack_node(struct template *template,
+                     size_t *capacity,
+                     size_t *pos,
+                     struct unpack *unpack)
 {
-    const char *timestr;
-    char *preamble;
-    char *trimmed;
+    enum template_operator op;
+    char *expression = NULL;
+    char *if_true = NULL;
+    char *if_false = NULL;
+    char *value = NULL;
+    size_t start;
+    size_t end;
+    errno_t ret;
 
-    timestr = ctime(&timestamp);
-    if (timestr == NULL) {
-        ERROR("Unable to get current time!");
-        return NULL;
+    start = unpack_uint64_max(unpack, template->length);
+    end = unpack_uint64_max(unpack, template->length);
+    op = unpack_uint64_max(unpack, OP_SENTINEL - 1);
+    if (unpack->error != EOK) {
+        return unpack->error;
     }
 
-    trimmed = string_trim_noempty(timestr);
-    if (trimmed == NULL) {
-        return NULL;
+    /* Nodes must follow each other in the template source. */
+    if (start < *pos || start >= end) {
+        return EINVAL;
     }
 
-    preamble = format("# Generated by authselect on %s\n"
-                      "# Do not modify this file manually.\n\n",
-                      trimmed);
-    free(trimmed);
-    if (preamble == NULL) {
-        ERROR("Unable to create message!");
-        return NULL;
+    ret = template_unpack_string(unpack, &expression);
+    if (ret == EOK && expression == NULL) {
+        ret = EINVAL;
     }
 
-    return preamble;
+    if (ret == EOK) {
+        ret = template_unpack_string(unpack, &if_true);
+    }
+
+    if (ret == EOK) {
+        ret = template_unpack_string(unpack, &if_false);
+    }
+
+    if (ret == EOK) {
+        ret = template_unpack_string(unpack, &value);
+    }
+
+    if (ret == EOK) {
+        ret = template_add_node(template, capacity, start, end, op,
+                                expression, if_true, if_false, value);
+    }
+
+    if (ret != EOK) {
+        free(expression);
+        free(if_true);
+        free(if_false);
+        free(value);
+        return ret;
+    }
+
+    *pos = end;
+
+    return EOK;
 }
 
 errno_t
-template_list_features_from_expression(const char *expression, char ***features)
+template_unpack(const char *source,
+                struct feature_table *table,
+                struct unpack *unpack,
+                struct template **_template)
 {
-    regmatch_t m[RE_MATCHES];
-    const char *match_string;
-    regex_t regex;
+    struct template *template;
+    const char *feature;
+    size_t capacity;
+    size_t count;
+    size_t pos;
     errno_t ret;
-    int reret;
+    size_t i;
 
-    reret = regcomp(&regex, "[^\"]{0,}" RE_FEATURE, REG_EXTENDED | REG_NEWLINE);
-    if (reret != REG_NOERROR) {
-        ERROR("Unable to compile regular expression: regex error %d", reret);
-        return EFAULT;
+    ret = template_init(table, &capacity, &template);
+    if (ret != EOK) {
+        return ret;
     }
 
-    match_string = expression;
-    while ((reret = regexec(&regex, match_string, RE_MATCHES, m, 0)) == REG_NOERROR) {
-        if (reret != EOK) {
-            ERROR("Unable to find new match: regex error %d", reret);
-            ret = EFAULT;
+    template->source = source;
+    template->length = source == NULL ? 0 : strlen(source);
+
+    /* Each operator takes at least one character of the source. */
+    count = unpack_uint64_max(unpack, template->length);
+    for (i = 0, pos = 0; i < count; i++) {
+        ret = template_unpack_node(template, &capacity, &pos, unpack);
+        if (ret != EOK) {
+            goto done;
+        }
+    }
+
+    count = unpack_uint64_max(unpack, template->length);
+    for (i = 0; i < count; i++) {
+        feature = unpack_string(unpack);
+        if (feature == NULL) {
+            ret = unpack->error == EOK ? EINVAL : unpack->error;
             goto done;
         }
-        *features = string_array_add_value_safe(*features,
-                                                &match_string[m[1].rm_so],
-                                                m[1].rm_eo - m[1].rm_so,
-                                                true);
-        if (*features == NULL) {
+
+        template->features = string_array_add_value(template->features,
+                                                    feature, true);
+        if (template->features == NULL) {
             ret = ENOMEM;
             goto done;
         }
-        match_string += m[0].rm_eo;
     }
 
+    if (unpack->error != EOK) {
+        ret = unpack->error;
+        goto done;
+    }
+
+    *_template = template;
+
     ret = EOK;
 
 done:
-    regfree(&regex);
+    if (ret != EOK) {
+        template_free(template);
+    }
+
     return ret;
 }
 
-char **
-template_list_features(const char *template)
+const char **
+template_get_features(const struct template *template)
 {
-    regmatch_t m[RE_MATCHES];
-    const char *match_string;
-    char **features;
-    char *expression;
-    regex_t regex;
+    return (const char **)template->features;
+}
+
+char *
+template_render_set(const struct template *template,
+                    const struct feature_set *enabled_features)
+{
+    struct template_output output = {0};
+    const struct template_node *node;
+    const char *replacement;
+    const char *newline;
+    bool enabled;
+    size_t pos;
     errno_t ret;
-    int reret;
+    size_t i;
 
-    features = string_array_create(10);
-    if (features == NULL) {
-        return NULL;
-    }
+    /* Implied features are local to the template so we work on a copy. */
+    uint64_t bits[enabled_features->words];
+    struct feature_set features = {enabled_features->words, bits};
 
-    if (template == NULL) {
-        return features;
+    if (template->source == NULL) {
+        return strdup("");
     }
 
-    reret = regcomp(&regex, OP_RE, REG_EXTENDED | REG_NEWLINE);
-    if (reret != REG_NOERROR) {
-        ERROR("Unable to compile regular expression: regex error %d", reret);
-        ret = EFAULT;
+    memcpy(bits, enabled_features->bits, sizeof(bits));
+
+    /* Operators are always replaced by a part of themselves at most, so the
+     * output can never be longer than the template. */
+    output.data = malloc_zero_array(char, template->length + 1);
+    if (output.data == NULL) {
+        ret = ENOMEM;
         goto done;
     }
 
-    match_string = template;
-    while ((reret = regexec(&regex, match_string, RE_MATCHES, m, 0)) == REG_NOERROR) {
-        ret = template_process_matches(match_string, m, NULL, &expression,
-                                       NULL, NULL, NULL);
+    pos = 0;
+    for (i = 0; i < template->count; i++) {
+        node = &template->nodes[i];
+
+        /* This operator was already removed by one of the previous ones. */
+        if (node->start < pos) {
+            continue;
+        }
+
+        template_output_append(&output, template->source + pos,
+                               node->start - pos);
+        pos = node->end;
+
+        ret = evaluate_program(node->program, node->ids, &features,
+                               &enabled);
         if (ret != EOK) {
-            ERROR("Unable to process match [%d]: %s", ret, strerror(ret));
+            ERROR("Unable to process operator [%d]: %s", ret, strerror(ret));
             goto done;
         }
 
-        if (expression) {
-            ret = template_list_features_from_expression(expression, &features);
-            free(expression);
+        if (node->op == OP_IMPLY && enabled) {
+            feature_set_add(&features, node->value_id);
+        }
+
+        switch (template_node_action(node, enabled)) {
+        case ACTION_REMOVE_LINE:
+            /* Remove the line up to the previous operator and skip
+             * the rest of it, including the new line character. */
+            output.length = output.mark;
+            newline = memchr(template->source + pos, '\n',
+                             template->length - pos);
+            pos = newline == NULL ? template->length
+                                  : newline - template->source + 1;
+            break;
+        case ACTION_REMOVE_REMAINDER:
+            pos = template->length;
+            break;
+        case ACTION_REMOVE_OPERATOR:
+            break;
+        case ACTION_REPLACE:
+            replacement = enabled ? node->if_true : node->if_false;
+            template_output_append(&output, replacement, strlen(replacement));
+            break;
+        }
+
+        output.mark = output.length;
+    }
+
+    template_output_append(&output, template->source + pos,
+                           template->length - pos);
+    template_output_trim_line(&output);
+    output.data[output.length] = '\0';
+
+    ret = EOK;
+
+done:
+    if (ret != EOK) {
+        ERROR("Unable to generate template [%d]: %s", ret, strerror(ret));
+        free(output.data);
+        return NULL;
+    }
+
+    return output.data;
+}
+
+char *
+template_render(const struct template *template,
+                const char **features)
+{
+    struct feature_set set;
+    char *output;
+    errno_t ret;
+
+    ret = feature_set_init(&set, template->table, features);
+    if (ret != EOK) {
+        return NULL;
+    }
+
+    output = template_render_set(template, &set);
+    feature_set_destroy(&set);
+
+    return output;
+}
+
+struct template_walk {
+    const struct template *template;
+    template_walk_fn fn;
+    void *pvt;
+};
+
+/*
+ * Process operators starting with @index the same way as
+ * template_render_set() does. If a result of an operator depends on a
+ * feature whose value is not yet known, the walk continues with both
+ * values of this feature.
+ */
+static errno_t
+template_walk_nodes(struct template_walk *walk,
+                    size_t index,
+                    size_t pos,
+                    const struct feature_set *known_features,
+                    const struct feature_set *enabled_features,
+                    const struct feature_set *user_features)
+{
+    const struct template *template = walk->template;
+    const struct template_node *node;
+    enum evaluator_result result;
+    const char *newline;
+    unsigned int unknown;
+    errno_t ret;
+    size_t i;
+
+    uint64_t known_bits[known_features->words];
+    uint64_t enabled_bits[known_features->words];
+    uint64_t user_bits[known_features->words];
+    struct feature_set known = {known_features->words, known_bits};
+    struct feature_set enabled = {known_features->words, enabled_bits};
+    struct feature_set user = {known_features->words, user_bits};
+
+    memcpy(known_bits, known_features->bits, sizeof(known_bits));
+    memcpy(enabled_bits, enabled_features->bits, sizeof(enabled_bits));
+    memcpy(user_bits, user_features->bits, sizeof(user_bits));
+
+    for (i = index; i < template->count; i++) {
+        node = &template->nodes[i];
+
+        if (node->start < pos) {
+            continue;
+        }
+
+        ret = evaluate_program_partial(node->program, node->ids, &known,
+                                       &enabled, &result, &unknown);
+        if (ret != EOK) {
+            ERROR("Unable to process operator [%d]: %s", ret, strerror(ret));
+            return ret;
+        }
+
+        if (result == EVALUATOR_UNKNOWN) {
+            feature_set_add(&known, unknown);
+            ret = template_walk_nodes(walk, i, pos, &known, &enabled, &user);
             if (ret != EOK) {
-                goto done;
+                return ret;
             }
+
+            feature_set_add(&enabled, unknown);
+            feature_set_add(&user, unknown);
+            return template_walk_nodes(walk, i, pos, &known, &enabled, &user);
         }
 
-        match_string += m[0].rm_eo;
+        pos = node->end;
+
+        if (node->op == OP_IMPLY && result == EVALUATOR_TRUE) {
+            feature_set_add(&known, node->value_id);
+            feature_set_add(&enabled, node->value_id);
+        }
+
+        switch (template_node_action(node, result == EVALUATOR_TRUE)) {
+        case ACTION_REMOVE_LINE:
+            newline = memchr(template->source + pos, '\n',
+                             template->length - pos);
+            pos = newline == NULL ? template->length
+                                  : newline - template->source + 1;
+            break;
+        case ACTION_REMOVE_REMAINDER:
+            pos = template->length;
+            break;
+        case ACTION_REMOVE_OPERATOR:
+        case ACTION_REPLACE:
+            break;
+        }
     }
 
-    if (reret != REG_NOMATCH) {
-        ERROR("Unable to search string: regex error %d", reret);
-        ret = EFAULT;
-        goto done;
+    return walk->fn(template, &user, walk->pvt);
+}
+
+errno_t
+template_walk(const struct template *template,
+              template_walk_fn fn,
+              void *pvt)
+{
+    struct template_walk walk = {template, fn, pvt};
+    struct feature_set empty;
+    errno_t ret;
+
+    ret = feature_set_init(&empty, template->table, NULL);
+    if (ret != EOK) {
+        return ret;
     }
 
-    ret = EOK;
+    ret = template_walk_nodes(&walk, 0, 0, &empty, &empty, &empty);
+    feature_set_destroy(&empty);
 
-done:
+    return ret;
+}
+
+struct feature_table *
+template_get_feature_table(const struct template *template)
+{
+    return template->table;
+}
+
+char *
+template_generate(const char *template,
+                  const char **features)
+{
+    struct template *compiled;
+    char *output;
+    errno_t ret;
+
+    ret = template_compile(template, NULL, &compiled);
     if (ret != EOK) {
-        string_array_free(features);
+        ERROR("Unable to compile template [%d]: %s", ret, strerror(ret));
         return NULL;
     }
 
-    regfree(&regex);
+    output = template_render(compiled, features);
+    template_free(compiled);
+
+    return output;
+}
+
+static char *
+template_generate_preamble(time_t timestamp)
+{
+    char timebuf[26];
+    const char *timestr;
+    char *preamble;
+    char *trimmed;
+
+    timestr = ctime_r(&timestamp, timebuf);
+    if (timestr == NULL) {
+        ERROR("Unable to get current time!");
+        return NULL;
+    }
+
+    trimmed = string_trim_noempty(timestr);
+    if (trimmed == NULL) {
+        return NULL;
+    }
+
+    preamble = format(PREAMBLE_GENERATED "%s" PREAMBLE_WARNING, trimmed);
+    free(trimmed);
+    if (preamble == NULL) {
+        ERROR("Unable to create message!");
+        return NULL;
+    }
+
+    return preamble;
+}
+
+char **
+template_list_features(const char *template)
+{
+    struct template *compiled;
+    char **features;
+    errno_t ret;
+
+    ret = template_compile(template, NULL, &compiled);
+    if (ret != EOK) {
+        ERROR("Unable to compile template [%d]: %s", ret, strerror(ret));
+        return NULL;
+    }
+
+    features = string_array_copy(compiled->features, false);
+    template_free(compiled);
+
     return features;
 }
 
+static char *
+template_generate_output(const char *content,
+                         time_t timestamp)
+{
+    char *preamble;
+    char *output;
+
+    preamble = template_generate_preamble(timestamp);
+    if (preamble == NULL || content == NULL) {
+        return preamble;
+    }
+
+    output = format("%s%s", preamble, content);
+    free(preamble);
+
+    return output;
+}
+
 errno_t
 template_write(const char *filepath,
                const char *content,
                mode_t mode,
                time_t timestamp)
 {
-    char *preamble;
     char *output;
     errno_t ret;
 
-    preamble = template_generate_preamble(timestamp);
-    if (preamble == NULL) {
+    output = template_generate_output(content, timestamp);
+    if (output == NULL) {
         return ENOMEM;
     }
 
-    if (content == NULL) {
-        output = preamble;
-    } else {
-        output = format("%s%s", preamble, content);
-        free(preamble);
-        if (output == NULL) {
-            return ENOMEM;
-        }
-    }
-
     ret = textfile_write(filepath, output, mode);
     free(output);
 
@@ -738,6 +1245,73 @@ template_write_temporary(const char *filepath,
     return EOK;
 }
 
+errno_t
+template_write_temporary_at(int dirfd,
+                            const char *filepath,
+                            const char *content,
+                            mode_t mode,
+                            time_t timestamp,
+                            char **_tmpfile,
+                            int *_fd)
+{
+    char *output;
+    char *tmpfile;
+    errno_t ret;
+    int fd;
+
+    output = template_generate_output(content, timestamp);
+    if (output == NULL) {
+        return ENOMEM;
+    }
+
+    ret = selinux_mkstemp_fd(dirfd, filepath, S_IRUSR | S_IWUSR, &tmpfile, &fd);
+    if (ret != EOK) {
+        ERROR("Unable to create temporary file for [%s] [%d]: %s",
+              filepath, ret, strerror(ret));
+        goto done;
+    }
+
+    ret = textfile_write_fd(fd, tmpfile, output, mode);
+    if (ret != EOK) {
+        close(fd);
+        unlinkat(dirfd, file_at(dirfd, tmpfile), 0);
+        free(tmpfile);
+        goto done;
+    }
+
+    *_tmpfile = tmpfile;
+    *_fd = fd;
+
+    ret = EOK;
+
+done:
+    free(output);
+
+    return ret;
+}
+
+bool
+template_is_written_content(const char *file_content,
+                            const char *content)
+{
+    const char *end;
+
+    /* Skip the preamble that contains the time when the file was written. */
+    if (strncmp(file_content, PREAMBLE_GENERATED,
+                sizeof(PREAMBLE_GENERATED) - 1) != 0) {
+        return false;
+    }
+
+    end = strstr(file_content, PREAMBLE_WARNING);
+    if (end == NULL) {
+        return false;
+    }
+
+    end += sizeof(PREAMBLE_WARNING) - 1;
+
+    return strcmp(end, content == NULL ? "" : content) == 0;
+}
+
 bool
 template_validate_written_content(const char *file_content,
                                   const char *expected)
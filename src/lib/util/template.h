@@ -24,6 +24,157 @@
 #include <sys/stat.h>
 
 #include "common/errno_t.h"
+#include "lib/util/feature_set.h"
+
+/**
+ * Compiled template.
+ */
+struct template;
+
+struct pack;
+struct unpack;
+
+/**
+ * Compile template into a list of operators that can be used repeatedly
+ * to generate output or to list features without parsing the template
+ * again.
+ *
+ * The compiled template references @source which must not be modified
+ * or freed as long as the compiled template is in use.
+ *
+ * Features used in the template are added to @table. If @table is NULL,
+ * the template creates its own table.
+ *
+ * @param source      Template, may be NULL.
+ * @param table       Feature table shared with other templates, may be NULL.
+ * @param _template   Compiled template.
+ *
+ * @return EOK on success, other errno code on error.
+ */
+errno_t
+template_compile(const char *source,
+                 struct feature_table *table,
+                 struct template **_template);
+
+/**
+ * Free compiled template.
+ *
+ * @param template    Compiled template.
+ */
+void
+template_free(struct template *template);
+
+/**
+ * Generate output from a compiled template.
+ *
+ * @param template    Compiled template.
+ * @param features    Features to enable.
+ *
+ * @return Generated content or NULL on error.
+ */
+char *
+template_render(const struct template *template,
+                const char **features);
+
+/**
+ * Generate output from a compiled template.
+ *
+ * @param template    Compiled template.
+ * @param features    Set of enabled features created from the template
+ *                    feature table.
+ *
+ * @return Generated content or NULL on error.
+ */
+char *
+template_render_set(const struct template *template,
+                    const struct feature_set *features);
+
+/**
+ * Function called by template_walk().
+ *
+ * @param template    Compiled template.
+ * @param features    Set of enabled features.
+ * @param pvt         Private data passed to template_walk().
+ *
+ * @return EOK to continue, other errno code to stop the walk.
+ */
+typedef errno_t
+(*template_walk_fn)(const struct template *template,
+                    const struct feature_set *features,
+                    void *pvt);
+
+/**
+ * Find all distinct ways in which the template can be processed and call
+ * @fn for each of them with a set of enabled features that leads to it.
+ *
+ * Only features whose value really decides about the result of an operator
+ * are enabled or disabled during the walk, therefore the number of
+ * calls depends on the number of possible outputs rather than on the
+ * number of features. Different sets of features may still produce the
+ * same output.
+ *
+ * @param template    Compiled template.
+ * @param fn          Function to call.
+ * @param pvt         Private data passed to @fn.
+ *
+ * @return EOK on success, other errno code on error.
+ */
+errno_t
+template_walk(const struct template *template,
+              template_walk_fn fn,
+              void *pvt);
+
+/**
+ * Serialize compiled template so it can be loaded later without parsing
+ * the template source again.
+ *
+ * @param template    Compiled template.
+ * @param pack        Serialization buffer.
+ */
+void
+template_pack(const struct template *template,
+              struct pack *pack);
+
+/**
+ * Load compiled template serialized with template_pack().
+ *
+ * The compiled template references @source which must be the same source
+ * that the serialized template was compiled from and it must not be
+ * modified or freed as long as the compiled template is in use.
+ *
+ * @param source      Template, may be NULL.
+ * @param table       Feature table shared with other templates, may be NULL.
+ * @param unpack      Serialized data.
+ * @param _template   Compiled template.
+ *
+ * @return EOK on success, EINVAL if the data are malformed, other errno
+ *         code on error.
+ */
+errno_t
+template_unpack(const char *source,
+                struct feature_table *table,
+                struct unpack *unpack,
+                struct template **_template);
+
+/**
+ * Return feature table used by the compiled @template.
+ *
+ * @param template    Compiled template.
+ *
+ * @return Feature table.
+ */
+struct feature_table *
+template_get_feature_table(const struct template *template);
+
+/**
+ * Return features available within the compiled @template.
+ *
+ * @param template    Compiled template.
+ *
+ * @return List of features in NULL-terminated array owned by the template.
+ */
+const char **
+template_get_features(const struct template *template);
 
 /**
  * Generate output from a template.
@@ -88,6 +239,45 @@ template_write_temporary(const char *filepath,
                          time_t timestamp,
                          char **_tmpfile);
 
+/**
+ * Write generated file preamble together with its content to a temporary file
+ * created relatively to @dirfd. The temporary file name is returned in
+ * @_tmpfile and it is left open for further operations in @_fd.
+ * The file mode is set to @mode.
+ *
+ * @param dirfd        Descriptor of @filepath parent directory or AT_FDCWD.
+ * @param filepath     Path to the file.
+ * @param content      Content to write.
+ * @param mode         Mode to create the file with.
+ * @param timestamp    Time when the content was generated that
+ *                     will be written to preambule.
+ * @param _tmpfile     Name of created temporary file.
+ * @param _fd          Descriptor of created temporary file.
+ *
+ * @return EOK on success, other errno code on error.
+ */
+errno_t
+template_write_temporary_at(int dirfd,
+                            const char *filepath,
+                            const char *content,
+                            mode_t mode,
+                            time_t timestamp,
+                            char **_tmpfile,
+                            int *_fd);
+
+/**
+ * Check that @file_content was written by template_write() with @content.
+ *
+ * @param file_content  Content of the written file.
+ * @param content       Content that is expected to be written, may be NULL.
+ *
+ * @return True if the file contains exactly @content after the preamble,
+ *         false otherwise.
+ */
+bool
+template_is_written_content(const char *file_content,
+                            const char *content);
+
 /**
  * Validate previously generated and written file content.
  *
@@ -19,10 +19,12 @@
 */
 
 #include <fcntl.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 
 #include "common/common.h"
@@ -30,78 +32,266 @@
 #include "lib/util/textfile.h"
 
 static errno_t
-textfile_read_content(FILE *file,
-                      const char *filename,
-                      unsigned int limit_KiB,
-                      char **_content)
+textfile_view_map(int fd,
+                  size_t length,
+                  struct textfile_view *view)
 {
-    size_t read_bytes;
-    char *buffer;
-    long filelen;
+    size_t pagesize;
+    size_t maplen;
+    void *map;
     errno_t ret;
 
-    ret = fseek(file, 0, SEEK_END);
-    if (ret != 0) {
+    /* Reserve one more zeroed page after the file content so the content
+     * is always NULL-terminated even if its length is a multiple of the
+     * page size. The file is then mapped over the beginning of it. */
+    pagesize = sysconf(_SC_PAGESIZE);
+    maplen = (length / pagesize + 2) * pagesize;
+
+    map = mmap(NULL, maplen, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+        return errno;
+    }
+
+    if (mmap(map, length, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0)
+            == MAP_FAILED) {
         ret = errno;
+        munmap(map, maplen);
+        return ret;
+    }
+
+    view->data = map;
+    view->length = length;
+    view->map = map;
+    view->maplen = maplen;
+
+    return EOK;
+}
+
+static errno_t
+textfile_view_read(int fd,
+                   const char *filename,
+                   unsigned int limit_KiB,
+                   size_t size_hint,
+                   struct textfile_view *view)
+{
+    size_t limit = (size_t)limit_KiB * 1024;
+    size_t capacity = 0;
+    size_t length = 0;
+    char *buffer = NULL;
+    char *tmp;
+    ssize_t bytes;
+
+    /* Special files do not tell us their size and regular files may change
+     * while they are read, so read them until EOF. One extra byte is
+     * reserved so EOF of a file with the expected size is found without
+     * growing the buffer. */
+    do {
+        if (length == capacity) {
+            if (capacity > limit) {
+                ERROR("File [%s] is bigger than %uKiB!", filename, limit_KiB);
+                free(buffer);
+                return ERANGE;
+            }
+
+            capacity += capacity == 0 && size_hint > 0 ? size_hint + 1 : 4096;
+            tmp = realloc_array(buffer, char, capacity + 1);
+            if (tmp == NULL) {
+                free(buffer);
+                return ENOMEM;
+            }
+            buffer = tmp;
+        }
+
+        bytes = read(fd, buffer + length, capacity - length);
+        if (bytes == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            free(buffer);
+            return errno;
+        }
+
+        length += bytes;
+    } while (bytes != 0);
+
+    if (length > limit) {
+        ERROR("File [%s] is bigger than %uKiB!", filename, limit_KiB);
+        free(buffer);
+        return ERANGE;
+    }
+
+    buffer[length] = '\0';
+
+    view->data = buffer;
+    view->length = length;
+    view->map = NULL;
+    view->maplen = 0;
+
+    return EOK;
+}
+
+/**
+ * Create view of file opened at @fd. If @copy is false, regular files are
+ * memory mapped, otherwise they are read into a buffer that does not
+ * depend on the file anymore.
+ */
+static errno_t
+textfile_map_fd(int fd,
+                const char *filename,
+                unsigned int limit_KiB,
+                bool copy,
+                struct textfile_view **_view)
+{
+    struct textfile_view *view;
+    struct stat statbuf;
+    errno_t ret;
+
+    view = malloc_zero(struct textfile_view);
+    if (view == NULL) {
+        ret = ENOMEM;
         goto done;
     }
 
-    filelen = ftell(file);
-    if (filelen == -1) {
+    ret = fstat(fd, &statbuf);
+    if (ret != 0) {
         ret = errno;
         goto done;
     }
 
-    if (filelen > limit_KiB * 1024) {
+    if (S_ISREG(statbuf.st_mode)
+            && statbuf.st_size > (off_t)limit_KiB * 1024) {
         ERROR("File [%s] is bigger than %uKiB!", filename, limit_KiB);
         ret = ERANGE;
         goto done;
     }
 
-    rewind(file);
-
-    buffer = malloc_zero_array(char, filelen + 1);
-    if (buffer == NULL) {
-        ret = ENOMEM;
-        goto done;
+    if (S_ISREG(statbuf.st_mode) && statbuf.st_size > 0 && !copy) {
+        ret = textfile_view_map(fd, statbuf.st_size, view);
+    } else if (S_ISREG(statbuf.st_mode)) {
+        ret = textfile_view_read(fd, filename, limit_KiB, statbuf.st_size,
+                                 view);
+    } else {
+        ret = textfile_view_read(fd, filename, limit_KiB, 0, view);
     }
 
-    read_bytes = fread(buffer, sizeof(char), filelen, file);
-    if (read_bytes != filelen) {
-        free(buffer);
-        ret = EIO;
+    if (ret != EOK) {
         goto done;
     }
 
-    *_content = buffer;
+    *_view = view;
 
     ret = EOK;
 
 done:
-    /* File descriptor is closed when file is closed. */
-    fclose(file);
+    /* The mapping stays valid after the file is closed. */
+    close(fd);
 
     if (ret != EOK) {
         ERROR("Unable to read file [%s] [%d]: %s",
               filename, ret, strerror(ret));
+        free(view);
     }
 
     return ret;
 }
 
+static errno_t
+textfile_open_view(int dirfd,
+                   const char *filepath,
+                   unsigned int limit_KiB,
+                   bool copy,
+                   struct textfile_view **_view)
+{
+    int fd;
+
+    fd = openat(dirfd, filepath, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return errno;
+    }
+
+    return textfile_map_fd(fd, filepath, limit_KiB, copy, _view);
+}
+
+errno_t
+textfile_map(const char *filepath,
+             unsigned int limit_KiB,
+             struct textfile_view **_view)
+{
+    return textfile_open_view(AT_FDCWD, filepath, limit_KiB, false, _view);
+}
+
+errno_t
+textfile_map_dirfd(int dirfd,
+                   const char *dirpath,
+                   const char *filename,
+                   unsigned int limit_KiB,
+                   struct textfile_view **_view)
+{
+    return textfile_open_view(dirfd, filename, limit_KiB, false, _view);
+}
+
+errno_t
+textfile_load(const char *filepath,
+              unsigned int limit_KiB,
+              struct textfile_view **_view)
+{
+    return textfile_open_view(AT_FDCWD, filepath, limit_KiB, true, _view);
+}
+
+errno_t
+textfile_load_dirfd(int dirfd,
+                    const char *dirpath,
+                    const char *filename,
+                    unsigned int limit_KiB,
+                    struct textfile_view **_view)
+{
+    return textfile_open_view(dirfd, filename, limit_KiB, true, _view);
+}
+
+void
+textfile_unmap(struct textfile_view *view)
+{
+    if (view == NULL) {
+        return;
+    }
+
+    if (view->map != NULL) {
+        munmap(view->map, view->maplen);
+    } else {
+        free((char *)view->data);
+    }
+
+    free(view);
+}
+
+/**
+ * Take ownership of the buffer of a view created by textfile_load().
+ */
+static errno_t
+textfile_view_steal(struct textfile_view *view,
+                    char **_content)
+{
+    *_content = (char *)view->data;
+    free(view);
+
+    return EOK;
+}
+
 errno_t
 textfile_read(const char *filepath,
               unsigned int limit_KiB,
               char **_content)
 {
-    FILE *file;
+    struct textfile_view *view;
+    errno_t ret;
 
-    file = fopen(filepath, "r");
-    if (file == NULL) {
-        return errno;
+    ret = textfile_load(filepath, limit_KiB, &view);
+    if (ret != EOK) {
+        return ret;
     }
 
-    return textfile_read_content(file, filepath, limit_KiB, _content);
+    return textfile_view_steal(view, _content);
 }
 
 errno_t
@@ -111,23 +301,15 @@ textfile_read_dirfd(int dirfd,
                     unsigned int limit_KiB,
                     char **_content)
 {
+    struct textfile_view *view;
     errno_t ret;
-    FILE *file;
-    int fd;
 
-    fd = openat(dirfd, filename, O_RDONLY);
-    if (fd == -1) {
-        return errno;
-    }
-
-    file = fdopen(fd, "r");
-    if (file == NULL) {
-        ret = errno;
-        close(fd);
+    ret = textfile_load_dirfd(dirfd, dirpath, filename, limit_KiB, &view);
+    if (ret != EOK) {
         return ret;
     }
 
-    return textfile_read_content(file, filename, limit_KiB, _content);
+    return textfile_view_steal(view, _content);
 }
 
 errno_t
@@ -135,11 +317,11 @@ textfile_write(const char *filepath,
                const char *content,
                mode_t mode)
 {
-    FILE *file;
-    mode_t oldmask;
+    FILE *file = NULL;
     size_t written;
     size_t len;
     errno_t ret;
+    int fd;
 
     if (filepath == NULL || filepath[0] == '\0') {
         return EINVAL;
@@ -150,11 +332,20 @@ textfile_write(const char *filepath,
         content = "";
     }
 
-    oldmask = umask(mode);
+    /* Create the file accessible only to the owner before it gets its final
+     * mode. We do not touch umask since it is shared by all threads. */
+    fd = open(filepath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd == -1) {
+        ret = errno;
+        ERROR("Unable to open file [%s] [%d]: %s",
+              filepath, ret, strerror(ret));
+        goto done;
+    }
 
-    file = fopen(filepath, "w");
+    file = fdopen(fd, "w");
     if (file == NULL) {
         ret = errno;
+        close(fd);
         ERROR("Unable to open file [%s] [%d]: %s",
               filepath, ret, strerror(ret));
         goto done;
@@ -180,7 +371,6 @@ textfile_write(const char *filepath,
     ret = EOK;
 
 done:
-    umask(oldmask);
     if (file != NULL) {
         fclose(file);
     }
@@ -191,3 +381,45 @@ done:
 
     return ret;
 }
+
+errno_t
+textfile_write_fd(int fd,
+                  const char *filepath,
+                  const char *content,
+                  mode_t mode)
+{
+    ssize_t written;
+    size_t len;
+    errno_t ret;
+
+    /* Create an empty file if no content is given. */
+    if (content == NULL) {
+        content = "";
+    }
+
+    len = strlen(content);
+    while (len > 0) {
+        written = write(fd, content, len);
+        if (written == -1 && errno == EINTR) {
+            continue;
+        } else if (written == -1) {
+            ret = errno;
+            ERROR("Unable to write data [%s] [%d]: %s",
+                  filepath, ret, strerror(ret));
+            return ret;
+        }
+
+        content += written;
+        len -= written;
+    }
+
+    ret = fchmod(fd, mode);
+    if (ret != 0) {
+        ret = errno;
+        ERROR("Unable to chmod file [%s] [%d]: %s",
+              filepath, ret, strerror(ret));
+        return ret;
+    }
+
+    return EOK;
+}
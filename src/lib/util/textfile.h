@@ -25,6 +25,121 @@
 
 #include "common/errno_t.h"
 
+/**
+ * Read-only view of a file content.
+ */
+struct textfile_view {
+    /* NULL-terminated file content. */
+    const char *data;
+    size_t length;
+
+    /* Mapped memory or NULL if the content was read into a buffer. */
+    void *map;
+    size_t maplen;
+};
+
+/**
+ * Map file contents to memory.
+ *
+ * Regular files are memory mapped so their content is not copied, other
+ * files are read into a buffer. If the file is larger then @limit_KiB
+ * an error is returned.
+ *
+ * The mapping reflects changes of the file and accessing it fails if the
+ * file is truncated, therefore the view should be released before the
+ * function that created it returns. Use textfile_load() for content that
+ * is kept for longer.
+ *
+ * @param filepath     Path to the file.
+ * @param limit_KiB    File size limit in KiB.
+ *
+ * @param _view        Output variable where the file view is stored.
+ *
+ * @return On success, file view is stored in @_view and EOK is returned.
+ *         If the file is larger then @limit_KiB ERANGE is returned. Other
+ *         errno code is returned on other error.
+ */
+errno_t
+textfile_map(const char *filepath,
+             unsigned int limit_KiB,
+             struct textfile_view **_view);
+
+/**
+ * Map contents of a file in directory opened at @dirfd descriptor
+ * to memory.
+ *
+ * @see textfile_map
+ *
+ * @param dirfd        File descriptor of an opened directory.
+ * @param dirpath      Path to the directory.
+ * @param filename     Name of the file.
+ * @param limit_KiB    File size limit in KiB.
+ *
+ * @param _view        Output variable where the file view is stored.
+ *
+ * @return On success, file view is stored in @_view and EOK is returned.
+ *         If the file is larger then @limit_KiB ERANGE is returned. Other
+ *         errno code is returned on other error.
+ */
+errno_t
+textfile_map_dirfd(int dirfd,
+                   const char *dirpath,
+                   const char *filename,
+                   unsigned int limit_KiB,
+                   struct textfile_view **_view);
+
+/**
+ * Read file contents into a view that does not depend on the file.
+ *
+ * Same as textfile_map() but the content is always read into a buffer,
+ * so it does not change when the file is modified or removed.
+ *
+ * @param filepath     Path to the file.
+ * @param limit_KiB    File size limit in KiB.
+ *
+ * @param _view        Output variable where the file view is stored.
+ *
+ * @return On success, file view is stored in @_view and EOK is returned.
+ *         If the file is larger then @limit_KiB ERANGE is returned. Other
+ *         errno code is returned on other error.
+ */
+errno_t
+textfile_load(const char *filepath,
+              unsigned int limit_KiB,
+              struct textfile_view **_view);
+
+/**
+ * Read contents of a file in directory opened at @dirfd descriptor into
+ * a view that does not depend on the file.
+ *
+ * @see textfile_load
+ *
+ * @param dirfd        File descriptor of an opened directory.
+ * @param dirpath      Path to the directory.
+ * @param filename     Name of the file.
+ * @param limit_KiB    File size limit in KiB.
+ *
+ * @param _view        Output variable where the file view is stored.
+ *
+ * @return On success, file view is stored in @_view and EOK is returned.
+ *         If the file is larger then @limit_KiB ERANGE is returned. Other
+ *         errno code is returned on other error.
+ */
+errno_t
+textfile_load_dirfd(int dirfd,
+                    const char *dirpath,
+                    const char *filename,
+                    unsigned int limit_KiB,
+                    struct textfile_view **_view);
+
+/**
+ * Release file view obtained from textfile_map() or textfile_load().
+ *
+ * @param view         File view.
+ */
+void
+textfile_unmap(struct textfile_view *view);
+
 /**
  * Read file contents.
  *
@@ -83,4 +198,20 @@ textfile_write(const char *filepath,
                const char *content,
                mode_t mode);
 
+/**
+ * Write file contents to an opened file and set its mode to @mode.
+ *
+ * @param fd           File descriptor opened for writing.
+ * @param filepath     Path to the file, used in messages.
+ * @param content      Content to write.
+ * @param mode         File mode.
+ *
+ * @return EOK on success, other errno code on error.
+ */
+errno_t
+textfile_write_fd(int fd,
+                  const char *filepath,
+                  const char *content,
+                  mode_t mode);
+
 #endif /* _TEXTFILE_H_ */
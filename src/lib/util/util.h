@@ -29,8 +29,11 @@
 
 #include "common/common.h"
 #include "lib/util/dir.h"
+#include "lib/util/feature_set.h"
 #include "lib/util/file.h"
+#include "lib/util/pack.h"
 #include "lib/util/selinux.h"
+#include "lib/util/sha256.h"
 #include "lib/util/string.h"
 #include "lib/util/string_array.h"
 #include "lib/util/template.h"
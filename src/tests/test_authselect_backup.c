@@ -0,0 +1,324 @@
+/*
+    Authors:
+        Pavel Březina <pbrezina@redhat.com>
+
+    Copyright (C) 2018 Red Hat
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "tests/test_common.h"
+#include "common/common.h"
+#include "authselect.h"
+
+#define TEST_BACKUPS 4
+
+struct test_backup {
+    char root[32];
+    char *backups;
+};
+
+static void
+test_write(struct test_backup *test,
+           const char *dir,
+           const char *name,
+           const char *content)
+{
+    char *path;
+    char *cmd;
+    FILE *file;
+
+    cmd = format("mkdir -p %s%s", test->root, dir);
+    assert_non_null(cmd);
+    assert_int_equal(system(cmd), 0);
+    free(cmd);
+
+    path = format("%s%s/%s", test->root, dir, name);
+    assert_non_null(path);
+    file = fopen(path, "w");
+    assert_non_null(file);
+    assert_true(fputs(content, file) >= 0);
+    assert_int_equal(fclose(file), 0);
+    free(path);
+}
+
+static void
+test_assert_removed(char **removed, const char **expected)
+{
+    int i;
+
+    for (i = 0; expected[i] != NULL; i++) {
+        assert_non_null(removed[i]);
+        assert_string_equal(removed[i], expected[i]);
+    }
+
+    assert_null(removed[i]);
+    authselect_array_free(removed);
+}
+
+static void
+test_assert_gc(unsigned int keep_last,
+               unsigned int keep_daily,
+               unsigned int keep_weekly,
+               unsigned long long max_bytes,
+               const char **expected)
+{
+    char **removed;
+
+    assert_int_equal(authselect_backup_gc(keep_last, keep_daily, keep_weekly,
+                                          max_bytes, true, &removed), 0);
+    test_assert_removed(removed, expected);
+}
+
+static size_t
+test_count_backups(void)
+{
+    char **list;
+    size_t count;
+
+    list = authselect_backup_list();
+    assert_non_null(list);
+    for (count = 0; list[count] != NULL; count++) {
+        /* Just counting. */
+    }
+    authselect_array_free(list);
+
+    return count;
+}
+
+struct test_usage {
+    ino_t inodes[256];
+    size_t count;
+    unsigned long long total;
+};
+
+static void
+test_usage_add(struct test_usage *usage, const char *path)
+{
+    struct stat statbuf;
+    size_t i;
+
+    assert_int_equal(lstat(path, &statbuf), 0);
+
+    for (i = 0; i < usage->count; i++) {
+        if (usage->inodes[i] == statbuf.st_ino) {
+            return;
+        }
+    }
+
+    assert_true(usage->count < sizeof(usage->inodes) / sizeof(ino_t));
+    usage->inodes[usage->count++] = statbuf.st_ino;
+    usage->total += (unsigned long long)statbuf.st_blocks * 512;
+}
+
+static void
+test_usage_scan(struct test_usage *usage, const char *dir, bool recurse)
+{
+    struct dirent *entry;
+    DIR *dirp;
+    char *path;
+
+    dirp = opendir(dir);
+    assert_non_null(dirp);
+
+    while ((entry = readdir(dirp)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0
+                || strcmp(entry->d_name, "..") == 0
+                || strcmp(entry->d_name, ".objects") == 0) {
+            continue;
+        }
+
+        path = format("%s/%s", dir, entry->d_name);
+        assert_non_null(path);
+        test_usage_add(usage, path);
+        if (recurse && entry->d_type == DT_DIR) {
+            test_usage_scan(usage, path, false);
+        }
+        free(path);
+    }
+
+    closedir(dirp);
+}
+
+/* Disk space used by backups, files shared by backups are counted once. */
+static unsigned long long
+test_usage(struct test_backup *test)
+{
+    struct test_usage usage = {{0}, 0, 0};
+
+    test_usage_scan(&usage, test->backups, true);
+
+    return usage.total;
+}
+
+static int
+test_setup(void **state)
+{
+    const char *features[] = {NULL};
+    struct test_backup *test;
+    char name[16];
+    char *path;
+    int i;
+
+    test = malloc(sizeof(struct test_backup));
+    assert_non_null(test);
+
+    strcpy(test->root, "/tmp/authselect-test-XXXXXX");
+    assert_non_null(mkdtemp(test->root));
+
+    test->backups = format("%s%s", test->root, AUTHSELECT_BACKUP_DIR);
+    assert_non_null(test->backups);
+
+    test_write(test, AUTHSELECT_PROFILE_DIR "/test", "README",
+               "Test profile\n");
+    test_write(test, AUTHSELECT_PROFILE_DIR "/test", "system-auth",
+               "auth required pam_env.so\n");
+    test_write(test, AUTHSELECT_PROFILE_DIR "/test", "nsswitch.conf",
+               "passwd: files\n");
+    test_write(test, AUTHSELECT_CUSTOM_DIR, ".keep", "");
+    test_write(test, AUTHSELECT_PAM_DIR, ".keep", "");
+    test_write(test, AUTHSELECT_DCONF_DIR "/locks", ".keep", "");
+    test_write(test, AUTHSELECT_STATE_DIR, ".keep", "");
+
+    assert_int_equal(authselect_set_root(test->root), 0);
+    assert_int_equal(authselect_activate("test", features, true), 0);
+
+    /* Backups are ordered by their creation time. */
+    for (i = 0; i < TEST_BACKUPS; i++) {
+        snprintf(name, sizeof(name), "b%d", i);
+        assert_int_equal(authselect_backup(name, &path), 0);
+        free(path);
+        usleep(20000);
+    }
+
+    *state = test;
+
+    return 0;
+}
+
+static int
+test_teardown(void **state)
+{
+    struct test_backup *test = *state;
+    char *cmd;
+
+    authselect_set_root(NULL);
+
+    cmd = format("rm -rf %s", test->root);
+    assert_non_null(cmd);
+    assert_int_equal(system(cmd), 0);
+    free(cmd);
+
+    free(test->backups);
+    free(test);
+
+    return 0;
+}
+
+void test_backup_gc_keep_all(void **state)
+{
+    const char *none[] = {NULL};
+
+    test_assert_gc(0, 0, 0, 0, none);
+    test_assert_gc(TEST_BACKUPS, 0, 0, 0, none);
+    test_assert_gc(TEST_BACKUPS + 1, 0, 0, 0, none);
+}
+
+void test_backup_gc_keep_last(void **state)
+{
+    const char *expected[] = {"b0", "b1", NULL};
+    char **removed;
+
+    /* Dry run does not remove anything. */
+    test_assert_gc(2, 0, 0, 0, expected);
+    assert_int_equal(test_count_backups(), TEST_BACKUPS);
+
+    assert_int_equal(authselect_backup_gc(2, 0, 0, 0, false, &removed), 0);
+    test_assert_removed(removed, expected);
+    assert_int_equal(test_count_backups(), 2);
+    assert_int_equal(authselect_backup_restore("b2"), 0);
+}
+
+void test_backup_gc_keep_periods(void **state)
+{
+    const char *expected[] = {"b0", "b1", "b2", NULL};
+    const char *last[] = {"b0", NULL};
+
+    /* All backups were created today. */
+    test_assert_gc(0, 1, 0, 0, expected);
+    test_assert_gc(0, 7, 0, 0, expected);
+    test_assert_gc(0, 0, 1, 0, expected);
+    test_assert_gc(1, 1, 1, 0, expected);
+
+    /* Rules are combined. */
+    test_assert_gc(3, 1, 0, 0, last);
+}
+
+void test_backup_gc_max_bytes(void **state)
+{
+    struct test_backup *test = *state;
+    const char *expected[] = {"b0", "b1", "b2", NULL};
+    const char *none[] = {NULL};
+    unsigned long long usage;
+
+    /* Files shared between backups are counted once. */
+    usage = test_usage(test);
+    test_assert_gc(0, 0, 0, usage, none);
+
+    /* The newest backup is never removed. */
+    test_assert_gc(0, 0, 0, 1, expected);
+
+    /* Size limit applies to backups kept by other rules. */
+    test_assert_gc(3, 0, 0, 1, expected);
+}
+
+void test_backup_gc_archives(void **state)
+{
+    struct test_backup *test = *state;
+    const char *expected[] = {"b0", "b1", "b2", "b3", NULL};
+    char *path;
+
+    /* Unknown files are not backups. */
+    test_write(test, AUTHSELECT_BACKUP_DIR, "stray", "stray\n");
+    assert_int_equal(authselect_backup_archive("archive", &path), 0);
+    free(path);
+
+    test_assert_gc(1, 0, 0, 0, expected);
+}
+
+int main(int argc, const char *argv[])
+{
+
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(test_backup_gc_keep_all,
+                                        test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_backup_gc_keep_last,
+                                        test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_backup_gc_keep_periods,
+                                        test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_backup_gc_max_bytes,
+                                        test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_backup_gc_archives,
+                                        test_setup, test_teardown),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
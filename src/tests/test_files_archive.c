@@ -0,0 +1,313 @@
+/*
+    Authors:
+        Pavel Březina <pbrezina@redhat.com>
+
+    Copyright (C) 2018 Red Hat
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "tests/test_common.h"
+#include "common/common.h"
+#include "lib/util/util.h"
+#include "lib/files/files.h"
+
+/* Large enough to span many buffers of the compressed stream. */
+#define TEST_LARGE_SIZE (256 * 1024)
+
+struct test_archive {
+    char dir[32];
+    char *small;
+    char *large;
+    char *archive;
+};
+
+static char *
+test_path(struct test_archive *test, const char *name)
+{
+    char *path;
+
+    path = format("%s/%s", test->dir, name);
+    assert_non_null(path);
+
+    return path;
+}
+
+static void
+test_write(const char *path, const char *data, size_t size, mode_t mode)
+{
+    FILE *file;
+
+    file = fopen(path, "w");
+    assert_non_null(file);
+    assert_int_equal(fwrite(data, 1, size, file), size);
+    assert_int_equal(fclose(file), 0);
+    assert_int_equal(chmod(path, mode), 0);
+}
+
+static char *
+test_read(const char *path, size_t *_size)
+{
+    struct stat statbuf;
+    FILE *file;
+    char *data;
+
+    assert_int_equal(stat(path, &statbuf), 0);
+    data = malloc(statbuf.st_size + 1);
+    assert_non_null(data);
+
+    file = fopen(path, "r");
+    assert_non_null(file);
+    assert_int_equal(fread(data, 1, statbuf.st_size, file), statbuf.st_size);
+    assert_int_equal(fclose(file), 0);
+    data[statbuf.st_size] = '\0';
+
+    *_size = statbuf.st_size;
+
+    return data;
+}
+
+static void
+test_corrupt(const char *path, long offset)
+{
+    FILE *file;
+    int c;
+
+    file = fopen(path, "r+");
+    assert_non_null(file);
+    assert_int_equal(fseek(file, offset, SEEK_END), 0);
+    c = fgetc(file);
+    assert_int_not_equal(c, EOF);
+    assert_int_equal(fseek(file, offset, SEEK_END), 0);
+    assert_int_equal(fputc(c ^ 0xff, file), c ^ 0xff);
+    assert_int_equal(fclose(file), 0);
+}
+
+static int
+test_setup(void **state)
+{
+    struct test_archive *test;
+    struct authselect_archive *archive;
+    unsigned int seed = 1;
+    char *data;
+    size_t i;
+
+    test = malloc_zero(struct test_archive);
+    assert_non_null(test);
+
+    strcpy(test->dir, "/tmp/authselect-test-XXXXXX");
+    assert_non_null(mkdtemp(test->dir));
+
+    test->small = test_path(test, "small");
+    test->large = test_path(test, "large");
+    test->archive = test_path(test, "archive");
+
+    test_write(test->small, "small file\n", strlen("small file\n"), 0640);
+
+    /* Random content does not compress, so the trailer of the stream is
+     * far from the manifest. */
+    data = malloc(TEST_LARGE_SIZE);
+    assert_non_null(data);
+    for (i = 0; i < TEST_LARGE_SIZE; i++) {
+        data[i] = rand_r(&seed);
+    }
+    test_write(test->large, data, TEST_LARGE_SIZE, 0600);
+    free(data);
+
+    assert_int_equal(authselect_archive_new(&archive), EOK);
+    assert_int_equal(authselect_archive_add(archive, test->small, "small"),
+                     EOK);
+    assert_int_equal(authselect_archive_add(archive, test->large, "large"),
+                     EOK);
+    assert_int_equal(authselect_archive_write(archive, test->archive), EOK);
+    authselect_archive_free(archive);
+
+    *state = test;
+
+    return 0;
+}
+
+static int
+test_teardown(void **state)
+{
+    struct test_archive *test = *state;
+    char *cmd;
+
+    cmd = format("rm -rf %s", test->dir);
+    assert_non_null(cmd);
+    assert_int_equal(system(cmd), 0);
+    free(cmd);
+
+    free(test->small);
+    free(test->large);
+    free(test->archive);
+    free(test);
+
+    return 0;
+}
+
+static errno_t
+test_extract(struct test_archive *test, char *small, char *large)
+{
+    struct authselect_archive *archive;
+    struct selinux_safe_copy table[] = {
+        {"large", large},
+        {"small", small},
+        {NULL, NULL}
+    };
+    errno_t ret;
+
+    /* Extract only the first archived file. */
+    if (large == NULL) {
+        table[0] = table[1];
+        table[1] = table[2];
+    }
+
+    ret = authselect_archive_open(test->archive, &archive);
+    if (ret != EOK) {
+        return ret;
+    }
+
+    ret = authselect_archive_extract(archive, table, 0755);
+    authselect_archive_free(archive);
+
+    return ret;
+}
+
+void test_archive_round_trip(void **state)
+{
+    struct test_archive *test = *state;
+    struct authselect_archive *archive;
+    struct stat statbuf;
+    size_t size1;
+    size_t size2;
+    char *small;
+    char *large;
+    char *data1;
+    char *data2;
+
+    small = test_path(test, "out/small");
+    large = test_path(test, "out/large");
+
+    assert_int_equal(authselect_archive_open(test->archive, &archive), EOK);
+    assert_true(authselect_archive_contains(archive, "small"));
+    assert_true(authselect_archive_contains(archive, "large"));
+    assert_false(authselect_archive_contains(archive, "missing"));
+    authselect_archive_free(archive);
+
+    assert_int_equal(test_extract(test, small, large), EOK);
+
+    data1 = test_read(test->small, &size1);
+    data2 = test_read(small, &size2);
+    assert_int_equal(size1, size2);
+    assert_memory_equal(data1, data2, size1);
+    free(data1);
+    free(data2);
+
+    data1 = test_read(test->large, &size1);
+    data2 = test_read(large, &size2);
+    assert_int_equal(size1, size2);
+    assert_memory_equal(data1, data2, size1);
+    free(data1);
+    free(data2);
+
+    assert_int_equal(stat(small, &statbuf), 0);
+    assert_int_equal(statbuf.st_mode & ALLPERMS, 0640);
+    assert_int_equal(stat(large, &statbuf), 0);
+    assert_int_equal(statbuf.st_mode & ALLPERMS, 0600);
+
+    free(small);
+    free(large);
+}
+
+void test_archive_not_archive(void **state)
+{
+    struct test_archive *test = *state;
+    struct authselect_archive *archive;
+
+    assert_int_equal(authselect_archive_open(test->small, &archive), EINVAL);
+}
+
+void test_archive_truncated(void **state)
+{
+    struct test_archive *test = *state;
+    struct stat statbuf;
+    char *small;
+    char *large;
+
+    small = test_path(test, "truncated/small");
+    large = test_path(test, "truncated/large");
+
+    assert_int_equal(stat(test->archive, &statbuf), 0);
+    assert_int_equal(truncate(test->archive, statbuf.st_size / 2), 0);
+
+    assert_int_not_equal(test_extract(test, small, large), EOK);
+    assert_int_equal(access(small, F_OK), -1);
+    assert_int_equal(access(large, F_OK), -1);
+
+    free(small);
+    free(large);
+}
+
+void test_archive_corrupt_checksum(void **state)
+{
+    struct test_archive *test = *state;
+    char *small;
+    size_t size;
+    char *data;
+    char *dir;
+
+    dir = test_path(test, "corrupt");
+    small = test_path(test, "corrupt/small");
+
+    /* Existing files must be kept if the archive is corrupted. */
+    assert_int_equal(mkdir(dir, 0755), 0);
+    test_write(small, "old\n", strlen("old\n"), 0644);
+
+    /* The gzip trailer ends with crc32 and size of the content. It must be
+     * verified even if the last archived file is not extracted. */
+    test_corrupt(test->archive, -8);
+
+    assert_int_equal(test_extract(test, small, NULL), EIO);
+
+    data = test_read(small, &size);
+    assert_string_equal(data, "old\n");
+    free(data);
+
+    free(small);
+    free(dir);
+}
+
+int main(int argc, const char *argv[])
+{
+
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(test_archive_round_trip,
+                                        test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_archive_not_archive,
+                                        test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_archive_truncated,
+                                        test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_archive_corrupt_checksum,
+                                        test_setup, test_teardown),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,205 @@
+/*
+    Authors:
+        Pavel Březina <pbrezina@redhat.com>
+
+    Copyright (C) 2018 Red Hat
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "tests/test_common.h"
+#include "common/common.h"
+#include "lib/paths.h"
+#include "lib/util/util.h"
+#include "lib/files/files.h"
+
+struct test_manifest {
+    char dir[32];
+    char *file;
+    char *copy;
+};
+
+/* Paths are resolved against the global root directory. */
+struct authselect_ctx *
+authselect_ctx_current(void)
+{
+    return NULL;
+}
+
+static void
+test_write(const char *path, const char *content)
+{
+    struct timespec times[2] = {{1, 0}, {1, 0}};
+
+    assert_int_equal(textfile_write(path, content, 0644), EOK);
+
+    /* Make sure the stat signature changes even within the timestamp
+     * granularity of the file system. */
+    assert_int_equal(utimensat(AT_FDCWD, path, times, 0), 0);
+}
+
+static int
+test_setup(void **state)
+{
+    struct authselect_generated generated[2] = {{NULL}};
+    struct test_manifest *test;
+    struct authselect_root *root;
+
+    test = malloc_zero(struct test_manifest);
+    assert_non_null(test);
+
+    strcpy(test->dir, "/tmp/authselect-test-XXXXXX");
+    assert_non_null(mkdtemp(test->dir));
+
+    assert_int_equal(authselect_root_create(test->dir, &root), EOK);
+    authselect_root_set_global(root);
+    assert_int_equal(file_make_path(DIR_STATE, 0755), EOK);
+
+    test->file = format("%s/file", test->dir);
+    test->copy = format("%s/copy", test->dir);
+    assert_non_null(test->file);
+    assert_non_null(test->copy);
+
+    assert_int_equal(textfile_write(test->file, "content\n", 0644), EOK);
+    assert_int_equal(textfile_write(test->copy, "content\n", 0644), EOK);
+
+    generated[0].path = test->file;
+    generated[0].copy_path = test->copy;
+    assert_int_equal(authselect_manifest_write(generated), EOK);
+
+    *state = test;
+
+    return 0;
+}
+
+static int
+test_teardown(void **state)
+{
+    struct test_manifest *test = *state;
+    char *cmd;
+
+    authselect_root_set_global(NULL);
+
+    cmd = format("rm -rf %s", test->dir);
+    assert_non_null(cmd);
+    assert_int_equal(system(cmd), 0);
+    free(cmd);
+
+    free(test->file);
+    free(test->copy);
+    free(test);
+
+    return 0;
+}
+
+static enum authselect_manifest_result
+test_check(struct test_manifest *test)
+{
+    struct authselect_manifest *manifest;
+    enum authselect_manifest_result result;
+
+    assert_int_equal(authselect_manifest_read(&manifest), EOK);
+    result = authselect_manifest_check(manifest, test->file, test->copy);
+    authselect_manifest_free(manifest);
+
+    return result;
+}
+
+void test_manifest_valid(void **state)
+{
+    struct test_manifest *test = *state;
+    struct timespec times[2] = {{1, 0}, {1, 0}};
+
+    assert_int_equal(test_check(test), AUTHSELECT_MANIFEST_VALID);
+
+    /* Touched file is hashed and found unchanged. */
+    assert_int_equal(utimensat(AT_FDCWD, test->file, times, 0), 0);
+    assert_int_equal(test_check(test), AUTHSELECT_MANIFEST_VALID);
+}
+
+void test_manifest_modified(void **state)
+{
+    struct test_manifest *test = *state;
+
+    /* Same size, different content. */
+    test_write(test->file, "CONTENT\n");
+    assert_int_equal(test_check(test), AUTHSELECT_MANIFEST_MODIFIED);
+
+    test_write(test->file, "content\nappended\n");
+    assert_int_equal(test_check(test), AUTHSELECT_MANIFEST_MODIFIED);
+
+    test_write(test->file, "content\n");
+    assert_int_equal(test_check(test), AUTHSELECT_MANIFEST_VALID);
+}
+
+void test_manifest_unknown(void **state)
+{
+    struct test_manifest *test = *state;
+    struct authselect_manifest *manifest;
+
+    assert_int_equal(authselect_manifest_read(&manifest), EOK);
+    assert_int_equal(authselect_manifest_check(NULL, test->file, test->copy),
+                     AUTHSELECT_MANIFEST_UNKNOWN);
+    assert_int_equal(authselect_manifest_check(manifest, "/nonexistent",
+                                               test->copy),
+                     AUTHSELECT_MANIFEST_UNKNOWN);
+    authselect_manifest_free(manifest);
+
+    /* The copy is not the one that was written with the file. */
+    test_write(test->copy, "content\n");
+    assert_int_equal(test_check(test), AUTHSELECT_MANIFEST_UNKNOWN);
+
+    assert_int_equal(unlink(test->file), 0);
+    assert_int_equal(test_check(test), AUTHSELECT_MANIFEST_UNKNOWN);
+}
+
+void test_manifest_invalid(void **state)
+{
+    struct authselect_manifest *manifest;
+
+    assert_int_equal(textfile_write(PATH_MANIFEST, "garbage\n", 0644), EOK);
+    assert_int_equal(authselect_manifest_read(&manifest), EINVAL);
+
+    /* The path is missing. */
+    assert_int_equal(textfile_write(PATH_MANIFEST,
+                                    "0123 1 2 3 4.5 6.7\n", 0644), EOK);
+    assert_int_equal(authselect_manifest_read(&manifest), EINVAL);
+
+    authselect_manifest_delete();
+    assert_int_equal(authselect_manifest_read(&manifest), ENOENT);
+}
+
+int main(int argc, const char *argv[])
+{
+
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(test_manifest_valid,
+                                        test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_manifest_modified,
+                                        test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_manifest_unknown,
+                                        test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_manifest_invalid,
+                                        test_setup, test_teardown),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
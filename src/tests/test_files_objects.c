@@ -0,0 +1,315 @@
+/*
+    Authors:
+        Pavel Březina <pbrezina@redhat.com>
+
+    Copyright (C) 2018 Red Hat
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "tests/test_common.h"
+#include "common/common.h"
+#include "lib/constants.h"
+#include "lib/paths.h"
+#include "lib/util/util.h"
+#include "lib/files/files.h"
+
+struct test_objects {
+    char dir[32];
+    char *backups;
+};
+
+/* Paths are resolved against the global root directory. */
+struct authselect_ctx *
+authselect_ctx_current(void)
+{
+    return NULL;
+}
+
+static char *
+test_path(struct test_objects *test, const char *name)
+{
+    char *path;
+
+    path = format("%s/%s", test->dir, name);
+    assert_non_null(path);
+
+    return path;
+}
+
+static void
+test_write(struct test_objects *test,
+           const char *name,
+           const char *content,
+           mode_t mode)
+{
+    char *path;
+
+    path = test_path(test, name);
+    assert_int_equal(textfile_write(path, content, mode), EOK);
+    assert_int_equal(chmod(path, mode), 0);
+    free(path);
+}
+
+static void
+test_copy(struct test_objects *test,
+          const char *source,
+          const char *backup,
+          char digest[SHA256_HEX_SIZE])
+{
+    char *destdir;
+    char *path;
+
+    path = test_path(test, source);
+    destdir = format("%s/%s", test->backups, backup);
+    assert_non_null(destdir);
+
+    assert_int_equal(authselect_objects_copy(path, destdir, "file", digest),
+                     EOK);
+
+    free(destdir);
+    free(path);
+}
+
+static void
+test_stat(struct test_objects *test, const char *backup, struct stat *statbuf)
+{
+    char *path;
+
+    path = format("%s/%s/file", test->backups, backup);
+    assert_non_null(path);
+    assert_int_equal(stat(path, statbuf), 0);
+    free(path);
+}
+
+static char *
+test_read(struct test_objects *test, const char *backup)
+{
+    char *content;
+    char *path;
+
+    path = format("%s/%s/file", test->backups, backup);
+    assert_non_null(path);
+    assert_int_equal(textfile_read(path, AUTHSELECT_FILE_SIZE_LIMIT,
+                                   &content), EOK);
+    free(path);
+
+    return content;
+}
+
+static size_t
+test_count_objects(void)
+{
+    struct dirent *entry;
+    size_t count = 0;
+    DIR *dirp;
+
+    dirp = opendir(DIR_BACKUP_OBJECTS);
+    assert_non_null(dirp);
+
+    while ((entry = readdir(dirp)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0
+                || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+
+        /* Only objects may be left in the store. */
+        assert_int_equal(strlen(entry->d_name), SHA256_HEX_SIZE - 1);
+        count++;
+    }
+
+    closedir(dirp);
+
+    return count;
+}
+
+static int
+test_setup(void **state)
+{
+    struct test_objects *test;
+    struct authselect_root *root;
+
+    test = malloc_zero(struct test_objects);
+    assert_non_null(test);
+
+    strcpy(test->dir, "/tmp/authselect-test-XXXXXX");
+    assert_non_null(mkdtemp(test->dir));
+
+    assert_int_equal(authselect_root_create(test->dir, &root), EOK);
+    authselect_root_set_global(root);
+
+    test->backups = strdup(DIR_BACKUP);
+    assert_non_null(test->backups);
+
+    test_write(test, "one", "content\n", 0644);
+    test_write(test, "two", "content\n", 0644);
+    test_write(test, "mode", "content\n", 0600);
+    test_write(test, "other", "other content\n", 0644);
+
+    *state = test;
+
+    return 0;
+}
+
+static int
+test_teardown(void **state)
+{
+    struct test_objects *test = *state;
+    char *cmd;
+
+    authselect_root_set_global(NULL);
+
+    cmd = format("rm -rf %s", test->dir);
+    assert_non_null(cmd);
+    assert_int_equal(system(cmd), 0);
+    free(cmd);
+
+    free(test->backups);
+    free(test);
+
+    return 0;
+}
+
+void test_objects_dedupe(void **state)
+{
+    struct test_objects *test = *state;
+    char digest1[SHA256_HEX_SIZE];
+    char digest2[SHA256_HEX_SIZE];
+    char digest3[SHA256_HEX_SIZE];
+    char digest4[SHA256_HEX_SIZE];
+    struct stat statbuf1;
+    struct stat statbuf2;
+    char *content;
+
+    test_copy(test, "one", "b1", digest1);
+    test_copy(test, "two", "b2", digest2);
+    test_copy(test, "mode", "b3", digest3);
+    test_copy(test, "other", "b4", digest4);
+
+    /* Same content and attributes are stored once. */
+    assert_string_equal(digest1, digest2);
+    test_stat(test, "b1", &statbuf1);
+    test_stat(test, "b2", &statbuf2);
+    assert_int_equal(statbuf1.st_ino, statbuf2.st_ino);
+    assert_int_equal(statbuf1.st_nlink, 3);
+    assert_int_equal(statbuf1.st_mode & ALLPERMS, 0644);
+
+    content = test_read(test, "b2");
+    assert_string_equal(content, "content\n");
+    free(content);
+
+    /* Different mode or content is a different object. */
+    assert_string_not_equal(digest1, digest3);
+    assert_string_not_equal(digest1, digest4);
+    test_stat(test, "b3", &statbuf2);
+    assert_int_not_equal(statbuf1.st_ino, statbuf2.st_ino);
+    assert_int_equal(statbuf2.st_mode & ALLPERMS, 0600);
+
+    assert_int_equal(test_count_objects(), 3);
+}
+
+void test_objects_overwrite(void **state)
+{
+    struct test_objects *test = *state;
+    char digest[SHA256_HEX_SIZE];
+    char *content;
+
+    test_copy(test, "one", "b1", digest);
+    test_copy(test, "one", "b2", digest);
+
+    /* Shared object must not be written through the overwritten backup. */
+    test_copy(test, "other", "b1", digest);
+
+    content = test_read(test, "b1");
+    assert_string_equal(content, "other content\n");
+    free(content);
+
+    content = test_read(test, "b2");
+    assert_string_equal(content, "content\n");
+    free(content);
+}
+
+void test_objects_prune(void **state)
+{
+    struct test_objects *test = *state;
+    char digest[SHA256_HEX_SIZE];
+    char *path;
+
+    test_copy(test, "one", "b1", digest);
+    test_copy(test, "two", "b2", digest);
+    test_copy(test, "other", "b2", digest);
+    assert_int_equal(test_count_objects(), 2);
+
+    /* The first object is still used by b1. */
+    authselect_objects_prune();
+    assert_int_equal(test_count_objects(), 2);
+
+    path = format("%s/b1", test->backups);
+    assert_non_null(path);
+    assert_int_equal(dir_remove(path), EOK);
+    free(path);
+
+    authselect_objects_prune();
+    assert_int_equal(test_count_objects(), 1);
+
+    path = format("%s/%s", DIR_BACKUP_OBJECTS, digest);
+    assert_non_null(path);
+    assert_int_equal(access(path, F_OK), 0);
+    free(path);
+}
+
+void test_objects_missing_source(void **state)
+{
+    struct test_objects *test = *state;
+    char digest[SHA256_HEX_SIZE];
+    char *destdir;
+    char *path;
+
+    test_copy(test, "one", "b1", digest);
+
+    path = test_path(test, "missing");
+    destdir = format("%s/b2", test->backups);
+    assert_non_null(destdir);
+
+    assert_int_equal(authselect_objects_copy(path, destdir, "file", digest),
+                     ENOENT);
+    assert_int_equal(test_count_objects(), 1);
+
+    free(destdir);
+    free(path);
+}
+
+int main(int argc, const char *argv[])
+{
+
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(test_objects_dedupe,
+                                        test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_objects_overwrite,
+                                        test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_objects_prune,
+                                        test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_objects_missing_source,
+                                        test_setup, test_teardown),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
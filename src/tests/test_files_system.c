@@ -0,0 +1,406 @@
+/*
+    Authors:
+        Pavel Březina <pbrezina@redhat.com>
+
+    Copyright (C) 2018 Red Hat
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "tests/test_common.h"
+#include "common/common.h"
+#include "authselect.h"
+
+#define TEMPLATE_SYSTEM \
+    "auth required pam_env.so\n" \
+    "auth required pam_test.so {include if \"with-test\"}\n"
+
+#define TEMPLATE_PASSWORD \
+    "password required pam_unix.so {if \"with-test\":use_test}\n"
+
+struct test_system {
+    char root[32];
+};
+
+/* Name of the file whose commit fails and number of renames to that name
+ * that succeed first. */
+static const char *test_fail_name;
+static int test_fail_skip;
+
+/* Number of files that were exchanged atomically. */
+static int test_exchanged;
+
+/* Simulate failure when the file is put in place, all renames within the
+ * library end up here. */
+static bool
+test_rename_fails(const char *newpath)
+{
+    const char *name;
+
+    if (test_fail_name == NULL) {
+        return false;
+    }
+
+    name = strrchr(newpath, '/');
+    name = name == NULL ? newpath : name + 1;
+    if (strcmp(name, test_fail_name) != 0) {
+        return false;
+    }
+
+    if (test_fail_skip > 0) {
+        test_fail_skip--;
+        return false;
+    }
+
+    test_fail_name = NULL;
+
+    return true;
+}
+
+int
+renameat2(int olddirfd, const char *oldpath,
+          int newdirfd, const char *newpath,
+          unsigned int flags)
+{
+    if (test_rename_fails(newpath)) {
+        errno = EIO;
+        return -1;
+    }
+
+    if (flags & RENAME_EXCHANGE) {
+        test_exchanged++;
+    }
+
+    return syscall(SYS_renameat2, olddirfd, oldpath, newdirfd, newpath, flags);
+}
+
+int
+renameat(int olddirfd, const char *oldpath,
+         int newdirfd, const char *newpath)
+{
+    return renameat2(olddirfd, oldpath, newdirfd, newpath, 0);
+}
+
+int
+rename(const char *oldpath, const char *newpath)
+{
+    return renameat2(AT_FDCWD, oldpath, AT_FDCWD, newpath, 0);
+}
+
+static char *
+test_path(struct test_system *test, const char *dir, const char *name)
+{
+    char *path;
+
+    path = format("%s%s/%s", test->root, dir, name);
+    assert_non_null(path);
+
+    return path;
+}
+
+static void
+test_write(struct test_system *test,
+           const char *dir,
+           const char *name,
+           const char *content)
+{
+    char *path;
+    char *cmd;
+    FILE *file;
+
+    cmd = format("mkdir -p %s%s", test->root, dir);
+    assert_non_null(cmd);
+    assert_int_equal(system(cmd), 0);
+    free(cmd);
+
+    path = test_path(test, dir, name);
+    file = fopen(path, "w");
+    assert_non_null(file);
+    assert_true(fputs(content, file) >= 0);
+    assert_int_equal(fclose(file), 0);
+    free(path);
+}
+
+static char *
+test_read(struct test_system *test, const char *dir, const char *name)
+{
+    char buf[1024];
+    char *path;
+    size_t len;
+    FILE *file;
+
+    path = test_path(test, dir, name);
+    file = fopen(path, "r");
+    assert_non_null(file);
+    len = fread(buf, 1, sizeof(buf) - 1, file);
+    assert_int_equal(fclose(file), 0);
+    free(path);
+
+    buf[len] = '\0';
+
+    return strdup(buf);
+}
+
+static void
+test_assert_files(struct test_system *test, const char *feature)
+{
+    const char *dirs[] = {AUTHSELECT_CONFIG_DIR, AUTHSELECT_STATE_DIR, NULL};
+    const char *expected;
+    char *content;
+    int i;
+
+    for (i = 0; dirs[i] != NULL; i++) {
+        expected = feature != NULL ? "auth required pam_env.so\n"
+                                     "auth required pam_test.so\n"
+                                   : "auth required pam_env.so\n";
+        content = test_read(test, dirs[i], "system-auth");
+        assert_non_null(strstr(content, expected));
+        free(content);
+
+        expected = feature != NULL ? "pam_unix.so use_test\n"
+                                   : "pam_unix.so\n";
+        content = test_read(test, dirs[i], "password-auth");
+        assert_non_null(strstr(content, expected));
+        free(content);
+    }
+}
+
+static void
+test_assert_no_temporary_files(struct test_system *test, const char *dir)
+{
+    const char *names[] = {"system-auth", "password-auth", NULL};
+    struct dirent *entry;
+    DIR *dirp;
+    char *path;
+    size_t len;
+    int i;
+
+    path = format("%s%s", test->root, dir);
+    assert_non_null(path);
+    dirp = opendir(path);
+    assert_non_null(dirp);
+    free(path);
+
+    /* Temporary files are named after the file with a suffix. */
+    while ((entry = readdir(dirp)) != NULL) {
+        for (i = 0; names[i] != NULL; i++) {
+            len = strlen(names[i]);
+            assert_false(strncmp(entry->d_name, names[i], len) == 0
+                         && entry->d_name[len] == '.');
+        }
+    }
+
+    closedir(dirp);
+}
+
+static int
+test_setup(void **state)
+{
+    const char *features[] = {NULL};
+    struct test_system *test;
+    const char *files[] = {
+        "fingerprint-auth", "smartcard-auth", "postlogin", NULL
+    };
+    int i;
+
+    test = malloc(sizeof(struct test_system));
+    assert_non_null(test);
+
+    strcpy(test->root, "/tmp/authselect-test-XXXXXX");
+    assert_non_null(mkdtemp(test->root));
+
+    test_write(test, AUTHSELECT_PROFILE_DIR "/test", "README",
+               "Test profile\n");
+    test_write(test, AUTHSELECT_PROFILE_DIR "/test", "system-auth",
+               TEMPLATE_SYSTEM);
+    test_write(test, AUTHSELECT_PROFILE_DIR "/test", "password-auth",
+               TEMPLATE_PASSWORD);
+    test_write(test, AUTHSELECT_PROFILE_DIR "/test", "nsswitch.conf",
+               "passwd: files\n");
+    for (i = 0; files[i] != NULL; i++) {
+        test_write(test, AUTHSELECT_PROFILE_DIR "/test", files[i],
+                   "auth required pam_env.so\n");
+    }
+
+    test_write(test, AUTHSELECT_CUSTOM_DIR, ".keep", "");
+    test_write(test, AUTHSELECT_PAM_DIR, ".keep", "");
+    test_write(test, AUTHSELECT_DCONF_DIR "/locks", ".keep", "");
+    test_write(test, AUTHSELECT_STATE_DIR, ".keep", "");
+
+    assert_int_equal(authselect_set_root(test->root), 0);
+    assert_int_equal(authselect_activate("test", features, true), 0);
+    test_assert_files(test, NULL);
+
+    *state = test;
+
+    return 0;
+}
+
+static int
+test_teardown(void **state)
+{
+    struct test_system *test = *state;
+    char *cmd;
+
+    test_fail_name = NULL;
+    authselect_set_root(NULL);
+
+    cmd = format("rm -rf %s", test->root);
+    assert_non_null(cmd);
+    assert_int_equal(system(cmd), 0);
+    free(cmd);
+
+    free(test);
+
+    return 0;
+}
+
+void test_system_commit(void **state)
+{
+    struct test_system *test = *state;
+    const char *features[] = {"with-test", NULL};
+    bool valid;
+
+    test_exchanged = 0;
+    assert_int_equal(authselect_activate("test", features, false), 0);
+    test_assert_files(test, "with-test");
+
+    /* Existing files are replaced atomically. */
+    assert_true(test_exchanged > 0);
+    test_assert_no_temporary_files(test, AUTHSELECT_CONFIG_DIR);
+    test_assert_no_temporary_files(test, AUTHSELECT_STATE_DIR);
+
+    assert_int_equal(authselect_validate_configuration(&valid), 0);
+    assert_true(valid);
+}
+
+void test_system_rollback(void **state)
+{
+    struct test_system *test = *state;
+    const char *features[] = {"with-test", NULL};
+    bool valid;
+
+    /* Copies are committed first, so the copy of password-auth and
+     * system-auth itself are already in place when password-auth fails. */
+    test_fail_name = "password-auth";
+    test_fail_skip = 1;
+
+    assert_int_not_equal(authselect_activate("test", features, false), 0);
+    assert_null(test_fail_name);
+
+    test_assert_files(test, NULL);
+    test_assert_no_temporary_files(test, AUTHSELECT_CONFIG_DIR);
+    test_assert_no_temporary_files(test, AUTHSELECT_STATE_DIR);
+
+    assert_int_equal(authselect_validate_configuration(&valid), 0);
+    assert_true(valid);
+
+    /* The next activation is not affected. */
+    assert_int_equal(authselect_activate("test", features, false), 0);
+    test_assert_files(test, "with-test");
+}
+
+void test_system_root_symlinks(void **state)
+{
+    struct test_system *test = *state;
+    const char *features[] = {"with-test", NULL};
+    struct stat statbuf;
+    char *outside;
+    char *backup;
+    char *inside;
+    char *content;
+    char *cmd;
+    char *path;
+    bool valid;
+
+    /* Absolute links in the image point to a location that exists on this
+     * system as well, the backup directory does not exist in the image. */
+    outside = format("%s/outside", test->root);
+    assert_non_null(outside);
+    inside = format("%s%s", test->root, outside);
+    assert_non_null(inside);
+
+    cmd = format("rm -rf %s%s %s%s && mkdir -p %s/pam.d %s/pam.d %s/backups"
+                 " && ln -s %s/pam.d %s%s && ln -s %s/backups %s%s",
+                 test->root, AUTHSELECT_PAM_DIR,
+                 test->root, AUTHSELECT_BACKUP_DIR,
+                 inside, outside, outside,
+                 outside, test->root, AUTHSELECT_PAM_DIR,
+                 outside, test->root, AUTHSELECT_BACKUP_DIR);
+    assert_non_null(cmd);
+    assert_int_equal(system(cmd), 0);
+    free(cmd);
+
+    assert_int_equal(authselect_set_root(test->root), 0);
+    assert_int_equal(authselect_activate("test", features, true), 0);
+    assert_int_equal(authselect_validate_configuration(&valid), 0);
+    assert_true(valid);
+
+    path = format("%s/pam.d/system-auth", inside);
+    assert_non_null(path);
+    assert_int_equal(lstat(path, &statbuf), 0);
+    assert_true(S_ISLNK(statbuf.st_mode));
+    free(path);
+
+    path = format("%s/pam.d/system-auth", outside);
+    assert_non_null(path);
+    assert_int_equal(lstat(path, &statbuf), -1);
+    free(path);
+
+    /* Links are followed within the image as well. */
+    assert_int_equal(authselect_backup("image", &backup), 0);
+    path = format("%s/backups/image", inside);
+    assert_non_null(path);
+    assert_string_equal(backup, path);
+    free(path);
+
+    content = test_read(test, backup + strlen(test->root), "system-auth");
+    assert_non_null(strstr(content, "pam_test.so"));
+    free(content);
+    free(backup);
+
+    path = format("%s/backups/image", outside);
+    assert_non_null(path);
+    assert_int_equal(lstat(path, &statbuf), -1);
+    free(path);
+
+    free(outside);
+    free(inside);
+}
+
+int main(int argc, const char *argv[])
+{
+
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(test_system_commit,
+                                        test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_system_rollback,
+                                        test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_system_root_symlinks,
+                                        test_setup, test_teardown),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
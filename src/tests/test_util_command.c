@@ -0,0 +1,129 @@
+/*
+    Authors:
+        Pavel Březina <pbrezina@redhat.com>
+
+    Copyright (C) 2018 Red Hat
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#include "tests/test_common.h"
+#include "common/common.h"
+#include "lib/util/command.h"
+
+void test_command_run_status(void **state)
+{
+    const char *const cmd_true[] = {"/bin/true", NULL};
+    const char *const cmd_false[] = {"/bin/false", NULL};
+    int status;
+
+    assert_int_equal(command_run(cmd_true, 5, &status, NULL), EOK);
+    assert_int_equal(status, 0);
+
+    assert_int_equal(command_run(cmd_false, 5, &status, NULL), EOK);
+    assert_int_equal(status, 1);
+}
+
+void test_command_run_signal(void **state)
+{
+    const char *const cmd[] = {"/bin/sh", "-c", "kill -9 $$", NULL};
+    int status;
+
+    assert_int_equal(command_run(cmd, 5, &status, NULL), EOK);
+    assert_int_equal(status, 128 + 9);
+}
+
+void test_command_run_not_found(void **state)
+{
+    const char *const cmd[] = {"/nonexistent/command", NULL};
+    char *output = NULL;
+    int status;
+
+    assert_int_equal(command_run(cmd, 5, &status, &output), ENOENT);
+    free(output);
+}
+
+void test_command_run_error_output(void **state)
+{
+    const char *const cmd[] = {
+        "/bin/sh", "-c", "echo some error >&2; echo some output; exit 3", NULL
+    };
+    char *output;
+    int status;
+
+    assert_int_equal(command_run(cmd, 5, &status, &output), EOK);
+    assert_int_equal(status, 3);
+    assert_string_equal(output, "some error\n");
+    free(output);
+}
+
+void test_command_run_error_output_limit(void **state)
+{
+    const char *const cmd[] = {
+        "/bin/sh", "-c", "head -c 100000 /dev/zero | tr '\\0' x >&2", NULL
+    };
+    char *output;
+    int status;
+
+    /* The command must not block on a full pipe. */
+    assert_int_equal(command_run(cmd, 5, &status, &output), EOK);
+    assert_int_equal(status, 0);
+    assert_true(strlen(output) <= COMMAND_OUTPUT_LIMIT);
+    assert_true(strspn(output, "x") == strlen(output));
+    free(output);
+}
+
+void test_command_run_timeout(void **state)
+{
+    const char *const cmd_sleep[] = {"/bin/sleep", "10", NULL};
+    const char *const cmd_closed[] = {
+        "/bin/sh", "-c", "exec 2>&-; sleep 10", NULL
+    };
+    char *output = NULL;
+    time_t start;
+    int status;
+
+    start = time(NULL);
+    assert_int_equal(command_run(cmd_sleep, 1, &status, &output),
+                     ETIMEDOUT);
+    assert_true(time(NULL) - start < 5);
+    free(output);
+
+    /* The timeout applies also after the error output is closed. */
+    output = NULL;
+    start = time(NULL);
+    assert_int_equal(command_run(cmd_closed, 1, &status, &output),
+                     ETIMEDOUT);
+    assert_true(time(NULL) - start < 5);
+    free(output);
+}
+
+int main(int argc, const char *argv[])
+{
+
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_command_run_status),
+        cmocka_unit_test(test_command_run_signal),
+        cmocka_unit_test(test_command_run_not_found),
+        cmocka_unit_test(test_command_run_error_output),
+        cmocka_unit_test(test_command_run_error_output_limit),
+        cmocka_unit_test(test_command_run_timeout),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,276 @@
+/*
+    Authors:
+        Pavel Březina <pbrezina@redhat.com>
+
+    Copyright (C) 2018 Red Hat
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "tests/test_common.h"
+#include "common/common.h"
+#include "lib/util/dir.h"
+
+struct test_dir {
+    char dir[32];
+};
+
+static char *
+test_path(struct test_dir *test, const char *name)
+{
+    char *path;
+
+    path = format("%s/%s", test->dir, name);
+    assert_non_null(path);
+
+    return path;
+}
+
+static void
+test_create(struct test_dir *test, const char *name, const char *content)
+{
+    char *path;
+    FILE *file;
+
+    path = test_path(test, name);
+    if (content == NULL) {
+        assert_int_equal(mkdir(path, 0755), 0);
+    } else {
+        file = fopen(path, "w");
+        assert_non_null(file);
+        assert_true(fputs(content, file) >= 0);
+        assert_int_equal(fclose(file), 0);
+    }
+    free(path);
+
+    /* Make sure the items differ in creation time. */
+    usleep(20000);
+}
+
+static struct dir_item *
+test_find(struct dir_item *items, size_t count, const char *name)
+{
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        if (strcmp(items[i].name, name) == 0) {
+            return &items[i];
+        }
+    }
+
+    return NULL;
+}
+
+static int
+test_setup(void **state)
+{
+    struct test_dir *test;
+
+    test = malloc(sizeof(struct test_dir));
+    assert_non_null(test);
+
+    strcpy(test->dir, "/tmp/authselect-test-XXXXXX");
+    assert_non_null(mkdtemp(test->dir));
+
+    test_create(test, "c", "ccc");
+    test_create(test, "dir", NULL);
+    test_create(test, "a", "a");
+    test_create(test, "dir/nested", NULL);
+    test_create(test, "dir/nested/file", "file");
+    test_create(test, "b", "bb");
+
+    *state = test;
+
+    return 0;
+}
+
+static int
+test_teardown(void **state)
+{
+    struct test_dir *test = *state;
+    char *cmd;
+
+    cmd = format("rm -rf %s", test->dir);
+    assert_non_null(cmd);
+    assert_int_equal(system(cmd), 0);
+    free(cmd);
+
+    free(test);
+
+    return 0;
+}
+
+void test_dir_list_stat_files(void **state)
+{
+    struct test_dir *test = *state;
+    struct dir_item *items;
+    struct dir_item *item;
+    struct stat statbuf;
+    size_t count;
+    int dirfd;
+
+    assert_int_equal(dir_list_stat(test->dir, DIR_LIST_FILES, &items, &count,
+                                   &dirfd), EOK);
+    assert_int_equal(count, 3);
+
+    item = test_find(items, count, "a");
+    assert_non_null(item);
+    assert_true(S_ISREG(item->statbuf.st_mode));
+    assert_int_equal(item->statbuf.st_size, 1);
+
+    item = test_find(items, count, "c");
+    assert_non_null(item);
+    assert_int_equal(item->statbuf.st_size, 3);
+
+    assert_non_null(test_find(items, count, "b"));
+    assert_null(test_find(items, count, "dir"));
+
+    /* The descriptor refers to the listed directory. */
+    assert_int_equal(fstatat(dirfd, "b", &statbuf, 0), 0);
+    assert_int_equal(statbuf.st_size, 2);
+    close(dirfd);
+
+    dir_items_free(items, count);
+}
+
+void test_dir_list_stat_dirs(void **state)
+{
+    struct test_dir *test = *state;
+    struct dir_item *items;
+    char *expected;
+    size_t count;
+    char *path;
+
+    assert_int_equal(dir_list_stat(test->dir, DIR_LIST_DIRS, &items, &count,
+                                   NULL), EOK);
+    assert_int_equal(count, 1);
+    assert_string_equal(items[0].name, "dir");
+    assert_true(S_ISDIR(items[0].statbuf.st_mode));
+    dir_items_free(items, count);
+
+    path = test_path(test, "dir");
+    assert_int_equal(dir_list_stat(path, DIR_LIST_FILES | DIR_LIST_DIRS
+                                   | DIR_LIST_FULL_PATH, &items, &count,
+                                   NULL), EOK);
+    expected = test_path(test, "dir/nested");
+    assert_int_equal(count, 1);
+    assert_string_equal(items[0].name, expected);
+    dir_items_free(items, count);
+    free(expected);
+    free(path);
+}
+
+void test_dir_list_stat_sort_by_ctime(void **state)
+{
+    struct test_dir *test = *state;
+    /* Creating the nested directory changed the directory as well. */
+    const char *expected[] = {"c", "a", "dir", "b"};
+    struct dir_item *items;
+    size_t count;
+    size_t i;
+
+    assert_int_equal(dir_list_stat(test->dir, DIR_LIST_FILES | DIR_LIST_DIRS
+                                   | DIR_LIST_SORT_BY_CTIME, &items, &count,
+                                   NULL), EOK);
+    assert_int_equal(count, 4);
+    for (i = 0; i < count; i++) {
+        assert_string_equal(items[i].name, expected[i]);
+    }
+    dir_items_free(items, count);
+}
+
+void test_dir_list_stat_missing(void **state)
+{
+    struct test_dir *test = *state;
+    struct dir_item *items;
+    size_t count;
+    char *path;
+
+    path = test_path(test, "missing");
+    assert_int_equal(dir_list_stat(path, DIR_LIST_FILES, &items, &count, NULL),
+                     ENOENT);
+    free(path);
+}
+
+void test_dir_remove_at(void **state)
+{
+    struct test_dir *test = *state;
+    struct stat statbuf;
+    char *target;
+    char *link;
+    int dirfd;
+
+    /* Symbolic links are removed, not followed. */
+    target = test_path(test, "a");
+    link = test_path(test, "dir/nested/link");
+    assert_int_equal(symlink(target, link), 0);
+    free(link);
+    link = test_path(test, "dir/link");
+    assert_int_equal(symlink(test->dir, link), 0);
+    free(link);
+
+    dirfd = open(test->dir, O_RDONLY | O_DIRECTORY);
+    assert_int_not_equal(dirfd, -1);
+
+    assert_int_equal(dir_remove_at(dirfd, "dir"), EOK);
+    assert_int_equal(fstatat(dirfd, "dir", &statbuf, 0), -1);
+    assert_int_equal(errno, ENOENT);
+    assert_int_equal(stat(target, &statbuf), 0);
+    assert_int_equal(dir_remove_at(dirfd, "dir"), ENOENT);
+
+    /* Only directories are removed. */
+    assert_int_not_equal(dir_remove_at(dirfd, "b"), EOK);
+    assert_int_equal(fstatat(dirfd, "b", &statbuf, 0), 0);
+
+    close(dirfd);
+    free(target);
+}
+
+void test_dir_remove(void **state)
+{
+    struct test_dir *test = *state;
+    struct stat statbuf;
+
+    assert_int_equal(dir_remove(test->dir), EOK);
+    assert_int_equal(stat(test->dir, &statbuf), -1);
+    assert_int_equal(mkdir(test->dir, 0700), 0);
+}
+
+int main(int argc, const char *argv[])
+{
+
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(test_dir_list_stat_files,
+                                        test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_dir_list_stat_dirs,
+                                        test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_dir_list_stat_sort_by_ctime,
+                                        test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_dir_list_stat_missing,
+                                        test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_dir_remove_at,
+                                        test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_dir_remove,
+                                        test_setup, test_teardown),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -207,6 +207,204 @@ void test_evaluator_broken_expressions(void **state)
     assert_int_not_equal(ret, 0);
 }
 
+void test_evaluator_feature_set(void **state)
+{
+    const char *variables[] = {"w1", "w2", NULL};
+    const char *expression = "\"w1\" and not (\"w3\" or \"w1\")";
+    const struct evaluator_program *program;
+    const struct evaluator_program *cached;
+    struct feature_table *table;
+    struct feature_set set;
+    unsigned int *ids;
+    unsigned int id;
+    bool result;
+    errno_t ret;
+
+    table = feature_table_create();
+    assert_non_null(table);
+
+    ret = evaluator_compile(expression, &program);
+    assert_int_equal(ret, 0);
+    assert_string_equal(evaluator_program_expression(program), expression);
+
+    ret = evaluator_compile(expression, &cached);
+    assert_int_equal(ret, 0);
+    assert_ptr_equal(program, cached);
+
+    ret = evaluator_bind(program, table, &ids);
+    assert_int_equal(ret, 0);
+    assert_int_equal(feature_table_count(table), 2);
+    assert_true(feature_table_lookup(table, "w1", &id));
+    assert_int_equal(ids[0], id);
+    assert_true(feature_table_lookup(table, "w3", &id));
+    assert_int_equal(ids[1], id);
+
+    ret = feature_set_init(&set, table, variables);
+    assert_int_equal(ret, 0);
+
+    ret = evaluate_program(program, ids, &set, &result);
+    assert_int_equal(ret, 0);
+    assert_false(result);
+
+    feature_set_destroy(&set);
+    evaluator_program_release(program);
+    evaluator_program_release(cached);
+    free(ids);
+
+    ret = evaluator_compile("\"w1\" and not \"w3\"", &program);
+    assert_int_equal(ret, 0);
+
+    ret = evaluator_bind(program, table, &ids);
+    assert_int_equal(ret, 0);
+    assert_int_equal(feature_table_count(table), 2);
+
+    ret = feature_set_init(&set, table, NULL);
+    assert_int_equal(ret, 0);
+
+    ret = evaluate_program(program, ids, &set, &result);
+    assert_int_equal(ret, 0);
+    assert_false(result);
+
+    feature_set_add(&set, ids[0]);
+    ret = evaluate_program(program, ids, &set, &result);
+    assert_int_equal(ret, 0);
+    assert_true(result);
+
+    feature_set_destroy(&set);
+    evaluator_program_release(program);
+    free(ids);
+
+    ret = evaluator_compile("\"w1\" and or \"w2\"", &program);
+    assert_int_equal(ret, 0);
+
+    ret = evaluate_program(program, NULL, &set, &result);
+    assert_int_not_equal(ret, 0);
+
+    evaluator_program_release(program);
+    feature_table_free(table);
+    evaluator_cache_clear();
+}
+
+void test_evaluator_partial(void **state)
+{
+    const struct {
+        const char *expression;
+        enum evaluator_result result;
+        const char *unknown;
+    } tests[] = {
+        {"\"t\" and not \"f\"", EVALUATOR_TRUE, NULL},
+        {"\"x\" and \"f\"", EVALUATOR_FALSE, NULL},
+        {"\"x\" or \"t\"", EVALUATOR_TRUE, NULL},
+        {"\"x\" and \"t\"", EVALUATOR_UNKNOWN, "x"},
+        {"not \"x\" or \"f\"", EVALUATOR_UNKNOWN, "x"},
+        /* Operands that did not affect the result are not reported. */
+        {"(\"x\" and \"f\") or \"y\"", EVALUATOR_UNKNOWN, "y"},
+        {"(\"x\" or \"t\") and \"y\"", EVALUATOR_UNKNOWN, "y"},
+        {"\"f\" or (\"t\" and not \"y\")", EVALUATOR_UNKNOWN, "y"},
+        {NULL, EVALUATOR_FALSE, NULL}
+    };
+    const char *known_features[] = {"t", "f", NULL};
+    const char *enabled_features[] = {"t", NULL};
+    const struct evaluator_program *program;
+    enum evaluator_result result;
+    struct feature_table *table;
+    struct feature_set known;
+    struct feature_set set;
+    unsigned int *ids;
+    unsigned int unknown;
+    unsigned int id;
+    errno_t ret;
+    int i;
+
+    table = feature_table_create();
+    assert_non_null(table);
+
+    for (i = 0; tests[i].expression != NULL; i++) {
+        ret = evaluator_compile(tests[i].expression, &program);
+        assert_int_equal(ret, 0);
+
+        ret = evaluator_bind(program, table, &ids);
+        assert_int_equal(ret, 0);
+
+        ret = feature_set_init(&known, table, known_features);
+        assert_int_equal(ret, 0);
+
+        ret = feature_set_init(&set, table, enabled_features);
+        assert_int_equal(ret, 0);
+
+        ret = evaluate_program_partial(program, ids, &known, &set,
+                                       &result, &unknown);
+        assert_int_equal(ret, 0);
+        assert_int_equal(result, tests[i].result);
+
+        if (tests[i].unknown != NULL) {
+            assert_true(feature_table_lookup(table, tests[i].unknown, &id));
+            assert_int_equal(unknown, id);
+        }
+
+        feature_set_destroy(&known);
+        feature_set_destroy(&set);
+        evaluator_program_release(program);
+        free(ids);
+    }
+
+    feature_table_free(table);
+    evaluator_cache_clear();
+}
+
+void test_evaluator_cache_eviction(void **state)
+{
+    const char *variables[] = {"w1", NULL};
+    const struct evaluator_program *program;
+    const struct evaluator_program *other;
+    struct feature_table *table;
+    struct feature_set set;
+    char expression[64];
+    unsigned int *ids;
+    bool result;
+    errno_t ret;
+    int i;
+
+    table = feature_table_create();
+    assert_non_null(table);
+
+    ret = evaluator_compile("\"w1\" or \"w2\"", &program);
+    assert_int_equal(ret, 0);
+
+    /* Fill the cache so the first program is dropped from it. */
+    for (i = 0; i < 2048; i++) {
+        snprintf(expression, sizeof(expression), "\"f%d\"", i);
+        ret = evaluator_compile(expression, &other);
+        assert_int_equal(ret, 0);
+        evaluator_program_release(other);
+    }
+
+    /* It is still valid while it is referenced. */
+    ret = evaluator_bind(program, table, &ids);
+    assert_int_equal(ret, 0);
+
+    ret = feature_set_init(&set, table, variables);
+    assert_int_equal(ret, 0);
+
+    ret = evaluate_program(program, ids, &set, &result);
+    assert_int_equal(ret, 0);
+    assert_true(result);
+
+    /* Compiling it again gives a new program. */
+    ret = evaluator_compile("\"w1\" or \"w2\"", &other);
+    assert_int_equal(ret, 0);
+    assert_ptr_not_equal(program, other);
+    assert_string_equal(evaluator_program_expression(other),
+                        evaluator_program_expression(program));
+
+    feature_set_destroy(&set);
+    evaluator_program_release(program);
+    evaluator_program_release(other);
+    feature_table_free(table);
+    free(ids);
+    evaluator_cache_clear();
+}
+
 int main(int argc, const char *argv[])
 {
 
@@ -220,6 +418,9 @@ int main(int argc, const char *argv[])
         cmocka_unit_test(test_evaluator_simple_expressions),
         cmocka_unit_test(test_evaluator_parentheses),
         cmocka_unit_test(test_evaluator_broken_expressions),
+        cmocka_unit_test(test_evaluator_feature_set),
+        cmocka_unit_test(test_evaluator_partial),
+        cmocka_unit_test(test_evaluator_cache_eviction),
     };
 
     return cmocka_run_group_tests(tests, NULL, NULL);
@@ -0,0 +1,78 @@
+/*
+    Authors:
+        Pavel Březina <pbrezina@redhat.com>
+
+    Copyright (C) 2018 Red Hat
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+
+#include "tests/test_common.h"
+#include "lib/util/sha256.h"
+
+void test_sha256_hex(void **state)
+{
+    char hex[SHA256_HEX_SIZE];
+
+    sha256_hex("", 0, hex);
+    assert_string_equal(hex, "e3b0c44298fc1c149afbf4c8996fb924"
+                             "27ae41e4649b934ca495991b7852b855");
+
+    sha256_hex("abc", 3, hex);
+    assert_string_equal(hex, "ba7816bf8f01cfea414140de5dae2223"
+                             "b00361a396177a9cb410ff61f20015ad");
+
+    sha256_hex("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 56,
+               hex);
+    assert_string_equal(hex, "248d6a61d20638b8e5c026930c3e6039"
+                             "a33ce45964ff2167f6ecedd419db06c1");
+}
+
+void test_sha256_update(void **state)
+{
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    uint8_t expected[SHA256_DIGEST_SIZE] = {
+        0xcd, 0xc7, 0x6e, 0x5c, 0x99, 0x14, 0xfb, 0x92,
+        0x81, 0xa1, 0xc7, 0xe2, 0x84, 0xd7, 0x3e, 0x67,
+        0xf1, 0x80, 0x9a, 0x48, 0xa4, 0x97, 0x20, 0x0e,
+        0x04, 0x6d, 0x39, 0xcc, 0xc7, 0x11, 0x2c, 0xd0
+    };
+    struct sha256_ctx ctx;
+    char block[1000];
+    int i;
+
+    /* One million of 'a' fed in uneven chunks. */
+    memset(block, 'a', sizeof(block));
+    sha256_init(&ctx);
+    for (i = 0; i < 1000; i++) {
+        sha256_update(&ctx, block, 999);
+    }
+    sha256_update(&ctx, block, 1000);
+    sha256_final(&ctx, digest);
+
+    assert_memory_equal(digest, expected, SHA256_DIGEST_SIZE);
+}
+
+int main(int argc, const char *argv[])
+{
+
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_sha256_hex),
+        cmocka_unit_test(test_sha256_update)
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -19,6 +19,7 @@
 */
 
 #include "tests/test_common.h"
+#include "lib/util/pack.h"
 #include "lib/util/string_array.h"
 #include "lib/util/template.h"
 
@@ -269,6 +270,217 @@ void test_template_imply_if(void **state)
     free(result);
 }
 
+void test_template_compiled(void **state)
+{
+    const char *features1[] = {
+        "feature1",
+        NULL
+    };
+    const char *features2[] = {
+        "feature2",
+        NULL
+    };
+
+    const char *template =
+        "line 01 {if \"feature1\":yes|no}\n"
+        "line 02 {include if \"feature2\"}\n"
+        "{imply \"feature3\" if \"feature2\"}\n"
+        "line 04 {exclude if \"feature3\"}\n"
+        "";
+    const char *expected1 =
+        "line 01 yes\n"
+        "line 04\n"
+        "";
+    const char *expected2 =
+        "line 01 no\n"
+        "line 02\n"
+        "";
+    struct template *compiled;
+    const char **flist;
+    char *result;
+    errno_t ret;
+
+    ret = template_compile(template, NULL, &compiled);
+    assert_int_equal(ret, EOK);
+
+    result = template_render(compiled, features1);
+    assert_string_equal(expected1, result);
+    free(result);
+
+    result = template_render(compiled, features2);
+    assert_string_equal(expected2, result);
+    free(result);
+
+    flist = template_get_features(compiled);
+    assert_int_equal(string_array_count((char **)flist), 3);
+    assert_string_equal(flist[0], "feature1");
+    assert_string_equal(flist[1], "feature2");
+    assert_string_equal(flist[2], "feature3");
+
+    template_free(compiled);
+}
+
+void test_template_pack(void **state)
+{
+    const char *features[] = {
+        "feature2",
+        "feature4",
+        NULL
+    };
+
+    const char *template =
+        "line 01 {if \"feature1\":yes|no}\n"
+        "line 02 {include if \"feature2\"}\n"
+        "{imply \"feature3\" if \"feature2\"}\n"
+        "line 04 {exclude if \"feature3\" or \"feature4\"}\n"
+        "";
+    struct template *compiled;
+    struct template *unpacked;
+    struct pack pack = {0};
+    struct unpack unpack;
+    const char **flist;
+    char *expected;
+    char *result;
+    errno_t ret;
+
+    ret = template_compile(template, NULL, &compiled);
+    assert_int_equal(ret, EOK);
+
+    template_pack(compiled, &pack);
+    assert_int_equal(pack.error, EOK);
+
+    unpack.data = pack.data;
+    unpack.left = pack.length;
+    unpack.error = EOK;
+    ret = template_unpack(template, NULL, &unpack, &unpacked);
+    assert_int_equal(ret, EOK);
+    assert_int_equal(unpack.left, 0);
+
+    expected = template_render(compiled, features);
+    result = template_render(unpacked, features);
+    assert_non_null(expected);
+    assert_non_null(result);
+    assert_string_equal(expected, result);
+    free(expected);
+    free(result);
+
+    flist = template_get_features(unpacked);
+    assert_int_equal(string_array_count((char **)flist), 4);
+    assert_string_equal(flist[0], "feature1");
+    assert_string_equal(flist[3], "feature4");
+
+    template_free(unpacked);
+
+    /* Truncated data must be refused. */
+    unpack.data = pack.data;
+    unpack.left = pack.length - 1;
+    unpack.error = EOK;
+    ret = template_unpack(template, NULL, &unpack, &unpacked);
+    assert_int_equal(ret, EINVAL);
+
+    template_free(compiled);
+    pack_free(&pack);
+}
+
+void test_template_is_written_content(void **state)
+{
+    const char *written =
+        "# Generated by authselect on Sat Oct 17 10:00:00 2026\n"
+        "# Do not modify this file manually.\n"
+        "\n"
+        "line 01\n"
+        "";
+
+    assert_true(template_is_written_content(written, "line 01\n"));
+    assert_false(template_is_written_content(written, "line 01"));
+    assert_false(template_is_written_content(written, "line 02\n"));
+    assert_false(template_is_written_content("line 01\n", "line 01\n"));
+    assert_true(template_is_written_content(
+        "# Generated by authselect on Sat Oct 17 10:00:00 2026\n"
+        "# Do not modify this file manually.\n\n", NULL));
+}
+
+static errno_t
+test_template_walk_collect(const struct template *template,
+                           const struct feature_set *features,
+                           void *pvt)
+{
+    char ***outputs = pvt;
+    char *result;
+
+    result = template_render_set(template, features);
+    assert_non_null(result);
+
+    *outputs = string_array_add_value(*outputs, result, true);
+    assert_non_null(*outputs);
+    free(result);
+
+    return EOK;
+}
+
+void test_template_walk(void **state)
+{
+    const char *template =
+        "{imply \"feature3\" if \"feature4\"}\n"
+        "line 01 {if \"feature1\" and \"feature5\":yes|no}\n"
+        "line 02 {include if \"feature2\" or \"feature3\"}\n"
+        "line 03 {continue if \"feature1\"}{exclude if \"feature6\"}\n"
+        "line 04 {exclude if \"feature3\"}\n"
+        "{stop if \"feature7\"}\n"
+        "line 06 {if not \"feature8\":on}\n"
+        "";
+    struct template *compiled;
+    const char **flist;
+    const char *enabled[10];
+    char **expected;
+    char **outputs;
+    char *result;
+    unsigned int mask;
+    int count;
+    errno_t ret;
+    int i, j;
+
+    ret = template_compile(template, NULL, &compiled);
+    assert_int_equal(ret, EOK);
+
+    flist = template_get_features(compiled);
+    count = string_array_count((char **)flist);
+    assert_int_equal(count, 8);
+
+    /* Render all combinations of features. */
+    expected = string_array_create(10);
+    assert_non_null(expected);
+    for (mask = 0; mask < (1u << count); mask++) {
+        for (i = 0, j = 0; i < count; i++) {
+            if (mask & (1u << i)) {
+                enabled[j++] = flist[i];
+            }
+        }
+        enabled[j] = NULL;
+
+        result = template_render(compiled, enabled);
+        assert_non_null(result);
+        expected = string_array_add_value(expected, result, true);
+        assert_non_null(expected);
+        free(result);
+    }
+
+    outputs = string_array_create(10);
+    assert_non_null(outputs);
+    ret = template_walk(compiled, test_template_walk_collect, &outputs);
+    assert_int_equal(ret, EOK);
+
+    assert_int_equal(string_array_count(outputs),
+                     string_array_count(expected));
+    for (i = 0; expected[i] != NULL; i++) {
+        assert_true(string_array_has_value(outputs, expected[i]));
+    }
+
+    string_array_free(expected);
+    string_array_free(outputs);
+    template_free(compiled);
+}
+
 int main(int argc, const char *argv[])
 {
 
@@ -281,6 +493,10 @@ int main(int argc, const char *argv[])
         cmocka_unit_test(test_template_continue_if),
         cmocka_unit_test(test_template_list_features),
         cmocka_unit_test(test_template_imply_if),
+        cmocka_unit_test(test_template_compiled),
+        cmocka_unit_test(test_template_pack),
+        cmocka_unit_test(test_template_is_written_content),
+        cmocka_unit_test(test_template_walk),
     };
 
     return cmocka_run_group_tests(tests, NULL, NULL);